@@ -0,0 +1,134 @@
+#include <Settings.h>
+
+#if SUBPROGRAM_EXECUTE == ALLOCATION_TEST
+
+#include <sdr/IRSDR.h>
+#include <sdr/ThreadPool.h>
+#include <sc/HTSL.h>
+
+#include <atomic>
+#include <cstdlib>
+#include <iostream>
+#include <new>
+
+// Regression test for the preallocated workspaces of IRSDR, sc::HTSL and RecurrentSparseCoder2D. Counts every operator new,
+// and fails if a step after warm-up allocates. Exits with 1 on the first failure
+std::atomic<long> numAllocations(0);
+
+void* operator new(size_t size) {
+	numAllocations++;
+
+	void* p = std::malloc(size == 0 ? 1 : size);
+
+	if (p == nullptr)
+		throw std::bad_alloc();
+
+	return p;
+}
+
+void operator delete(void* p) noexcept {
+	std::free(p);
+}
+
+void operator delete(void* p, size_t) noexcept {
+	std::free(p);
+}
+
+const int warmupSteps = 5;
+const int countedSteps = 10;
+
+bool check(long allocations, const char* name) {
+	if (allocations != 0)
+		std::cerr << "FAILED: " << name << " allocated " << allocations << " times in " << countedSteps << " warmed-up steps" << std::endl;
+
+	return allocations == 0;
+}
+
+bool testIRSDR(sdr::IRSDR::Storage storage, sdr::IRSDR::Solver solver, const char* name) {
+	std::mt19937 generator(1234);
+
+	sdr::IRSDR irsdr;
+
+	irsdr.createRandom(32, 32, 16, 16, 4, 2, -0.01f, 0.01f, generator, storage);
+	irsdr.setSolver(solver);
+
+	std::uniform_real_distribution<float> inputDist(0.0f, 1.0f);
+
+	std::vector<float> input(irsdr.getNumVisible());
+
+	long allocationsBefore = 0;
+
+	for (int step = 0; step < warmupSteps + countedSteps; step++) {
+		if (step == warmupSteps)
+			allocationsBefore = numAllocations;
+
+		for (size_t vi = 0; vi < input.size(); vi++)
+			input[vi] = inputDist(generator);
+
+		irsdr.setVisibleStates(input.data(), input.size());
+
+		irsdr.activate(30, 0.1f, 0.05f, 0.0f, 0.0f, generator);
+		irsdr.learn(0.01f, 0.01f, 0.01f, 0.05f, 0.0f);
+		irsdr.stepEnd();
+	}
+
+	return check(numAllocations - allocationsBefore, name);
+}
+
+bool testHTSL(int numThreads, bool incremental, const char* name) {
+	std::mt19937 generator(1234);
+
+	std::vector<sc::HTSL::LayerDesc> layerDescs(3);
+
+	layerDescs[0]._width = 32;
+	layerDescs[0]._height = 32;
+	layerDescs[1]._width = 24;
+	layerDescs[1]._height = 24;
+	layerDescs[2]._width = 16;
+	layerDescs[2]._height = 16;
+
+	sc::HTSL htsl;
+
+	htsl.createRandom(48, 48, layerDescs, generator);
+
+	if (numThreads > 0)
+		htsl.setThreadPool(std::make_shared<sdr::ThreadPool>(numThreads));
+
+	htsl.setIncremental(incremental);
+
+	std::vector<float> input(48 * 48);
+
+	long allocationsBefore = 0;
+
+	for (int step = 0; step < warmupSteps + countedSteps; step++) {
+		if (step == warmupSteps)
+			allocationsBefore = numAllocations;
+
+		for (size_t i = 0; i < input.size(); i++)
+			input[i] = (i * 7 + step * 3) % 11 < 3 ? 1.0f : 0.0f;
+
+		htsl.setInputs(input.data(), input.size());
+
+		htsl.update();
+		htsl.learn();
+		htsl.stepEnd();
+	}
+
+	return check(numAllocations - allocationsBefore, name);
+}
+
+int main() {
+	if (!testIRSDR(sdr::IRSDR::_nodes, sdr::IRSDR::_dense, "IRSDR _nodes _dense")
+		|| !testIRSDR(sdr::IRSDR::_nodes, sdr::IRSDR::_activeSet, "IRSDR _nodes _activeSet")
+		|| !testIRSDR(sdr::IRSDR::_implicit, sdr::IRSDR::_dense, "IRSDR _implicit _dense")
+		|| !testHTSL(0, false, "sc::HTSL")
+		|| !testHTSL(0, true, "sc::HTSL incremental")
+		|| !testHTSL(2, false, "sc::HTSL with a thread pool"))
+		return 1;
+
+	std::cout << "Allocation test passed" << std::endl;
+
+	return 0;
+}
+
+#endif
\ No newline at end of file
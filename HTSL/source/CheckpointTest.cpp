@@ -0,0 +1,471 @@
+#include <Settings.h>
+
+#if SUBPROGRAM_EXECUTE == CHECKPOINT_TEST
+
+#include <sdr/Checkpoint.h>
+#include <sdr/RSDR.h>
+#include <sdr/IRSDR.h>
+#include <sdr/PredictiveRSDR.h>
+#include <sdr/IPredictiveRSDR.h>
+#include <sdr/PRSDRRL.h>
+#include <sdr/QPRSDR.h>
+#include <sc/RecurrentSparseCoder2D.h>
+#include <sc/HTSL.h>
+#include <deep/FERL.h>
+
+#include <fstream>
+#include <iostream>
+#include <sstream>
+
+#ifdef _WIN32
+#include <direct.h>
+#else
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+// Regression test for the binary checkpoints. Every network is saved and loaded into a new object, and both are stepped and compared bit for bit through their checkpoints.
+// Then a truncated file and a file of another type are loaded into the live copy, which must fail, leave the copy unchanged and let it keep stepping. Exits with 1 on the first failure
+const int steps = 4;
+
+const char* const fileName = "CheckpointTest.bin";
+const char* const truncatedFileName = "CheckpointTestTruncated.bin";
+const char* const rsdrFileName = "CheckpointTestRSDR.bin";
+const char* const irsdrFileName = "CheckpointTestIRSDR.bin";
+
+bool check(bool condition, const std::string &name, const char* message) {
+	if (!condition)
+		std::cerr << "FAILED: " << name << ": " << message << std::endl;
+
+	return condition;
+}
+
+// Everything a network checkpoints, for comparing two of them
+template<class T>
+std::string getCheckpoint(const T &object) {
+	std::ostringstream os(std::ios::binary);
+
+	sdr::CheckpointWriter writer(os);
+
+	object.save(writer);
+
+	return os.str();
+}
+
+// Writes the first half of fileName to truncatedFileName
+bool truncateFile() {
+	std::ifstream is(fileName, std::ios::binary);
+
+	std::string contents((std::istreambuf_iterator<char>(is)), std::istreambuf_iterator<char>());
+
+	std::ofstream os(truncatedFileName, std::ios::binary);
+
+	os.write(contents.data(), contents.size() / 2);
+
+	return os.good() && contents.size() > 1;
+}
+
+// Saves original and loads it into copy
+template<class T>
+bool testLoad(const T &original, T &copy, const std::string &name) {
+	return check(original.save(fileName), name, "save failed")
+		&& check(copy.load(fileName), name, "load failed")
+		&& check(getCheckpoint(copy) == getCheckpoint(original), name, "the loaded copy differs from the original");
+}
+
+// step(object, s) runs step s of a network. wrongFileName holds a checkpoint of another type
+template<class T, class Step>
+bool testRoundTrip(T &original, Step step, const char* wrongFileName, const std::string &name) {
+	T copy;
+
+	// The truncated file holds the state before stepping, so a load that partly overwrites the copy shows
+	if (!testLoad(original, copy, name) || !check(truncateFile(), name, "writing the truncated file failed"))
+		return false;
+
+	for (int s = 0; s < steps; s++) {
+		step(original, s);
+		step(copy, s);
+
+		if (!check(getCheckpoint(copy) == getCheckpoint(original), name, "the loaded copy steps differently from the original"))
+			return false;
+	}
+
+	const char* badFileNames[] = { truncatedFileName, wrongFileName };
+	const char* badFileMessages[] = { "loading a truncated file", "loading a file of another type" };
+
+	for (int f = 0; f < 2; f++) {
+		std::string message = badFileMessages[f];
+
+		if (!check(!copy.load(badFileNames[f]), name, (message + " succeeded").c_str())
+			|| !check(getCheckpoint(copy) == getCheckpoint(original), name, (message + " changed the network").c_str()))
+			return false;
+
+		step(original, steps + f);
+		step(copy, steps + f);
+
+		if (!check(getCheckpoint(copy) == getCheckpoint(original), name, (message + " broke stepping").c_str()))
+			return false;
+	}
+
+	return true;
+}
+
+// Input of step s
+float getInput(int index, int s) {
+	return (index * 7 + s * 3) % 11 < 3 ? 1.0f : 0.0f;
+}
+
+bool testRSDR(sdr::RSDR::Storage storage, bool eventDrivenInhibition, const std::string &name) {
+	std::mt19937 generator(1234);
+
+	sdr::RSDR rsdr;
+
+	rsdr.createRandom(24, 24, 16, 16, 4, 2, 2, -0.01f, 0.01f, 0.01f, 0.05f, 0.1f, generator, storage);
+	rsdr.setEventDrivenInhibition(eventDrivenInhibition);
+
+	// The thread pool is not stored, a load keeps it
+	sdr::RSDR pooled;
+
+	std::shared_ptr<sdr::ThreadPool> threadPool = std::make_shared<sdr::ThreadPool>(2);
+
+	pooled.setThreadPool(threadPool);
+
+	if (!check(rsdr.save(fileName) && pooled.load(fileName) && pooled.getThreadPool() == threadPool, name, "load did not keep the thread pool"))
+		return false;
+
+	return testRoundTrip(rsdr, [](sdr::RSDR &r, int s) {
+		for (int vi = 0; vi < r.getNumVisible(); vi++)
+			r.setVisibleState(vi, getInput(vi, s));
+
+		r.activate(17, 5, 0.1f);
+		r.learn(0.02f, 0.02f, 0.2f, 0.12f, 0.02f);
+		r.stepEnd();
+	}, irsdrFileName, name);
+}
+
+bool testIRSDR(sdr::IRSDR::Storage storage, const std::string &name) {
+	std::mt19937 generator(1234);
+
+	sdr::IRSDR irsdr;
+
+	irsdr.createRandom(24, 24, 16, 16, 4, 2, -0.01f, 0.01f, generator, storage);
+
+	return testRoundTrip(irsdr, [](sdr::IRSDR &r, int s) {
+		std::mt19937 generator(s);
+
+		for (int vi = 0; vi < r.getNumVisible(); vi++)
+			r.setVisibleState(vi, getInput(vi, s));
+
+		r.activate(30, 0.1f, 0.05f, 0.0f, 0.01f, generator);
+		r.learn(0.01f, 0.01f, 0.01f, 0.05f, 0.0f);
+		r.stepEnd();
+	}, rsdrFileName, name);
+}
+
+bool testPredictiveRSDR(sdr::RSDR::Storage storage, const std::string &name) {
+	std::mt19937 generator(1234);
+
+	std::vector<sdr::PredictiveRSDR::LayerDesc> layerDescs(2);
+
+	layerDescs[0]._width = 12;
+	layerDescs[0]._height = 12;
+	layerDescs[1]._width = 8;
+	layerDescs[1]._height = 8;
+
+	sdr::PredictiveRSDR prsdr;
+
+	prsdr.createRandom(16, 16, layerDescs, -0.01f, 0.01f, 0.01f, 0.05f, 0.1f, generator, storage);
+
+	return testRoundTrip(prsdr, [](sdr::PredictiveRSDR &p, int s) {
+		for (int i = 0; i < 16 * 16; i++)
+			p.setInput(i, getInput(i, s));
+
+		p.simStep();
+	}, rsdrFileName, name);
+}
+
+bool testIPredictiveRSDR() {
+	std::mt19937 generator(1234);
+
+	std::vector<sdr::IPredictiveRSDR::LayerDesc> layerDescs(2);
+
+	layerDescs[0]._width = 12;
+	layerDescs[0]._height = 12;
+	layerDescs[1]._width = 8;
+	layerDescs[1]._height = 8;
+
+	sdr::IPredictiveRSDR iprsdr;
+
+	iprsdr.createRandom(16, 16, 4, layerDescs, -0.01f, 0.01f, 0.0f, generator);
+
+	return testRoundTrip(iprsdr, [](sdr::IPredictiveRSDR &p, int s) {
+		std::mt19937 generator(s);
+
+		for (int i = 0; i < 16 * 16; i++)
+			p.setInput(i, getInput(i, s));
+
+		p.simStep(generator);
+	}, rsdrFileName, "IPredictiveRSDR");
+}
+
+// PRSDRRL::createRandom does not build its sdr layers, so it cannot step. Only the round trip, with the unbuilt layers, and a failed load are checked
+bool testPRSDRRL() {
+	std::mt19937 generator(1234);
+
+	std::vector<sdr::PRSDRRL::LayerDesc> layerDescs(2);
+
+	layerDescs[0]._width = 12;
+	layerDescs[0]._height = 12;
+	layerDescs[1]._width = 8;
+	layerDescs[1]._height = 8;
+
+	std::vector<sdr::PRSDRRL::InputType> inputTypes(16 * 16, sdr::PRSDRRL::_state);
+
+	inputTypes[0] = sdr::PRSDRRL::_q;
+	inputTypes[1] = sdr::PRSDRRL::_action;
+
+	sdr::PRSDRRL prsdrrl;
+
+	prsdrrl.createRandom(16, 16, 4, inputTypes, layerDescs, -0.01f, 0.01f, 0.1f, generator);
+
+	sdr::PRSDRRL copy;
+
+	return testLoad(prsdrrl, copy, "PRSDRRL")
+		&& check(!copy.load(rsdrFileName) && getCheckpoint(copy) == getCheckpoint(prsdrrl), "PRSDRRL", "loading a file of another type changed the network");
+}
+
+bool testQPRSDR() {
+	std::mt19937 generator(1234);
+
+	std::vector<sdr::PredictiveRSDR::LayerDesc> layerDescs(2);
+
+	layerDescs[0]._width = 12;
+	layerDescs[0]._height = 12;
+	layerDescs[1]._width = 8;
+	layerDescs[1]._height = 8;
+
+	std::vector<int> actionIndices;
+
+	actionIndices.push_back(0);
+	actionIndices.push_back(1);
+
+	sdr::QPRSDR qprsdr;
+
+	qprsdr.createRandom(16, 16, actionIndices, layerDescs, -0.01f, 0.01f, 0.01f, 0.05f, 0.1f, generator);
+
+	return testRoundTrip(qprsdr, [](sdr::QPRSDR &q, int s) {
+		std::mt19937 generator(s);
+
+		for (int i = 2; i < 16 * 16; i++)
+			q.setState(i, getInput(i, s));
+
+		q.simStep(s % 2 == 0 ? 1.0f : 0.0f, generator);
+	}, rsdrFileName, "QPRSDR");
+}
+
+bool testRecurrentSparseCoder2D() {
+	std::mt19937 generator(1234);
+
+	sc::RecurrentSparseCoder2D rsc;
+
+	rsc.createRandom(24, 24, 16, 16, 4, 3, 3, generator);
+
+	return testRoundTrip(rsc, [](sc::RecurrentSparseCoder2D &r, int s) {
+		for (int vi = 0; vi < r.getNumVisible(); vi++)
+			r.setVisibleInput(vi, getInput(vi, s));
+
+		r.activate();
+		r.reconstruct();
+		r.learn(0.01f, 0.01f, 0.05f, 0.01f, 0.01f, 0.01f, 0.1f, 0.01f);
+		r.stepEnd();
+	}, rsdrFileName, "RecurrentSparseCoder2D");
+}
+
+bool testHTSL() {
+	std::mt19937 generator(1234);
+
+	std::vector<sc::HTSL::LayerDesc> layerDescs(2);
+
+	layerDescs[0]._width = 16;
+	layerDescs[0]._height = 16;
+	layerDescs[1]._width = 12;
+	layerDescs[1]._height = 12;
+
+	sc::HTSL htsl;
+
+	htsl.createRandom(24, 24, layerDescs, generator);
+
+	return testRoundTrip(htsl, [](sc::HTSL &h, int s) {
+		for (int i = 0; i < 24 * 24; i++)
+			h.setInput(i, getInput(i, s));
+
+		h.update();
+		h.learn();
+		h.stepEnd();
+	}, rsdrFileName, "sc::HTSL");
+}
+
+// FERL's binary format is a checkpoint of a stream, and a failed load must leave the FERL with its replay samples unchanged too
+std::string getBinary(const deep::FERL &ferl) {
+	std::ostringstream os(std::ios::binary);
+
+	ferl.saveToFile(os, true, deep::FERL::_binary);
+
+	return os.str();
+}
+
+bool testFERL() {
+	std::mt19937 generator(1234);
+
+	deep::FERL ferl;
+
+	ferl.createRandom(8, 2, 32, 0.1f, generator);
+
+	std::vector<float> state(8);
+	std::vector<float> action;
+
+	for (int s = 0; s < 20; s++) {
+		for (int i = 0; i < 8; i++)
+			state[i] = getInput(i, s);
+
+		ferl.step(state, action, s % 2 == 0 ? 1.0f : 0.0f, 0.5f, 0.99f, 0.98f, 0.1f, 1, 1, 0.05f, 0.01f, 0.05f, 10, 0, 0.001f, generator);
+	}
+
+	std::string binary = getBinary(ferl);
+
+	deep::FERL copy;
+
+	std::istringstream is(binary, std::ios::binary);
+
+	if (!check(copy.loadFromFile(is, true, deep::FERL::_binary), "FERL", "load failed")
+		|| !check(getBinary(copy) == binary && !copy.getSamples().empty(), "FERL", "the loaded copy differs from the original"))
+		return false;
+
+	std::istringstream truncated(binary.substr(0, binary.size() / 2), std::ios::binary);
+
+	return check(!copy.loadFromFile(truncated, true, deep::FERL::_binary), "FERL", "loading a truncated stream succeeded")
+		&& check(getBinary(copy) == binary, "FERL", "loading a truncated stream changed the network");
+}
+
+// A save that cannot write must fail and keep the previous file. A directory in the way of the temporary file makes the write fail
+bool testFailedSave() {
+	std::mt19937 generator(1234);
+
+	sdr::RSDR previous;
+	sdr::RSDR next;
+
+	previous.createRandom(8, 8, 4, 4, 2, 1, 1, -0.01f, 0.01f, 0.01f, 0.05f, 0.1f, generator);
+	next.createRandom(8, 8, 6, 6, 2, 1, 1, -0.01f, 0.01f, 0.01f, 0.05f, 0.1f, generator);
+
+	if (!check(previous.save(fileName), "failed save", "save failed"))
+		return false;
+
+	std::string tempFileName = std::string(fileName) + ".tmp";
+
+#ifdef _WIN32
+	_mkdir(tempFileName.c_str());
+#else
+	mkdir(tempFileName.c_str(), 0700);
+#endif
+
+	bool saved = next.save(fileName);
+
+#ifdef _WIN32
+	_rmdir(tempFileName.c_str());
+#else
+	rmdir(tempFileName.c_str());
+#endif
+
+	sdr::RSDR loaded;
+
+	return check(!saved, "failed save", "saving over a directory succeeded")
+		&& check(loaded.load(fileName) && getCheckpoint(loaded) == getCheckpoint(previous), "failed save", "the previous file was not kept");
+}
+
+// Loading from memory that is not aligned, and rejecting bool bytes other than 0 and 1
+bool testMemory() {
+	std::mt19937 generator(1234);
+
+	sdr::RSDR rsdr;
+
+	rsdr.createRandom(8, 8, 4, 4, 2, 1, 1, -0.01f, 0.01f, 0.01f, 0.05f, 0.1f, generator);
+
+	std::string checkpoint = getCheckpoint(rsdr);
+
+	std::vector<char> buffer(checkpoint.size() + 1);
+
+	std::copy(checkpoint.begin(), checkpoint.end(), buffer.begin() + 1);
+
+	sdr::RSDR loaded;
+
+	{
+		sdr::CheckpointReader reader;
+
+		if (!check(reader.open(buffer.data() + 1, checkpoint.size()) && loaded.load(reader) && getCheckpoint(loaded) == checkpoint, "misaligned memory", "load failed or differs"))
+			return false;
+	}
+
+	// The byte of the event-driven inhibition flag is where the checkpoints with and without it differ
+	rsdr.setEventDrivenInhibition(true);
+
+	std::string eventDriven = getCheckpoint(rsdr);
+
+	size_t flag = 0;
+
+	while (flag < checkpoint.size() && checkpoint[flag] == eventDriven[flag])
+		flag++;
+
+	if (!check(flag < checkpoint.size() && eventDriven[flag] == 1, "bool byte", "flag not found"))
+		return false;
+
+	eventDriven[flag] = 2;
+
+	sdr::CheckpointReader reader;
+
+	return check(reader.open(eventDriven.data(), eventDriven.size()) && !loaded.load(reader), "bool byte", "a bool byte of 2 loaded");
+}
+
+int main() {
+	// Files of the wrong type for the other tests
+	std::mt19937 generator(1234);
+
+	sdr::RSDR rsdr;
+	sdr::IRSDR irsdr;
+
+	rsdr.createRandom(8, 8, 4, 4, 2, 1, 1, -0.01f, 0.01f, 0.01f, 0.05f, 0.1f, generator);
+	irsdr.createRandom(8, 8, 4, 4, 2, 1, -0.01f, 0.01f, generator);
+
+	if (!check(rsdr.save(rsdrFileName) && irsdr.save(irsdrFileName), "setup", "save failed"))
+		return 1;
+
+	const char* storageNames[] = { "_nodes", "_arrays", "_implicit" };
+
+	for (int s = 0; s < 3; s++)
+		for (int eventDriven = 0; eventDriven < 2; eventDriven++)
+			if (!testRSDR(static_cast<sdr::RSDR::Storage>(s), eventDriven != 0, std::string("RSDR ") + storageNames[s] + (eventDriven != 0 ? " event-driven" : "")))
+				return 1;
+
+	if (!testIRSDR(sdr::IRSDR::_nodes, "IRSDR _nodes")
+		|| !testIRSDR(sdr::IRSDR::_implicit, "IRSDR _implicit"))
+		return 1;
+
+	for (int s = 0; s < 3; s++)
+		if (!testPredictiveRSDR(static_cast<sdr::RSDR::Storage>(s), std::string("PredictiveRSDR ") + storageNames[s]))
+			return 1;
+
+	if (!testIPredictiveRSDR()
+		|| !testPRSDRRL()
+		|| !testQPRSDR()
+		|| !testRecurrentSparseCoder2D()
+		|| !testHTSL()
+		|| !testFERL()
+		|| !testFailedSave()
+		|| !testMemory())
+		return 1;
+
+	std::cout << "Checkpoint test passed" << std::endl;
+
+	return 0;
+}
+
+#endif
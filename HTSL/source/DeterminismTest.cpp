@@ -0,0 +1,730 @@
+#include <Settings.h>
+
+#if SUBPROGRAM_EXECUTE == DETERMINISM_TEST
+
+#include <sdr/Checkpoint.h>
+#include <sdr/IPredictiveRSDR.h>
+#include <sdr/IRSDR.h>
+#include <sdr/Kernels.h>
+#include <sdr/PredictiveRSDR.h>
+#include <sdr/RSDR.h>
+#include <sc/HTSL.h>
+
+#include <algorithm>
+#include <cmath>
+#include <iostream>
+#include <sstream>
+#include <thread>
+
+// Regression test for the thread pool paths. Networks stepped on pools of 1 to maxThreads threads, and with the other options that promise identical results,
+// must end bit for bit where the serial run ends, compared through their checkpoints (weights and states). Incremental activation only promises the full sums up to rounding,
+// so it is compared within tolerances. Exits with 1 on the first failure
+const int maxThreads = 4;
+const int steps = 8;
+
+// Largest difference of a prediction or activation from the full sums, and largest fraction of hidden states that may flip
+const float incrementalTolerance = 0.001f;
+const float incrementalStateTolerance = 0.01f;
+
+bool check(bool condition, const std::string &name, const char* message) {
+	if (!condition)
+		std::cerr << "FAILED: " << name << ": " << message << std::endl;
+
+	return condition;
+}
+
+template<class T>
+std::string getCheckpoint(const T &object) {
+	std::ostringstream os(std::ios::binary);
+
+	sdr::CheckpointWriter writer(os);
+
+	object.save(writer);
+
+	return os.str();
+}
+
+// Input of step s
+float getInput(int index, int s) {
+	return (index * 7 + s * 3) % 11 < 3 ? 1.0f : 0.0f;
+}
+
+// Checkpoint after stepping an RSDR with numThreads threads (0 for no pool), and its final hidden states.
+// Event-driven inhibition is switched off before saving, so the flag itself does not make the checkpoints differ
+std::string runRSDR(sdr::RSDR::Storage storage, int numThreads, bool eventDrivenInhibition, std::vector<float> &states) {
+	std::mt19937 generator(1234);
+
+	sdr::RSDR rsdr;
+
+	rsdr.createRandom(48, 48, 32, 32, 4, 2, 2, -0.01f, 0.01f, 0.01f, 0.05f, 0.1f, generator, storage);
+
+	if (numThreads > 0)
+		rsdr.setThreadPool(std::make_shared<sdr::ThreadPool>(numThreads));
+
+	rsdr.setEventDrivenInhibition(eventDrivenInhibition);
+
+	for (int s = 0; s < steps; s++) {
+		for (int vi = 0; vi < rsdr.getNumVisible(); vi++)
+			rsdr.setVisibleState(vi, getInput(vi, s));
+
+		rsdr.activate(17, 5, 0.1f);
+		rsdr.learn(0.02f, 0.02f, 0.2f, 0.12f, 0.02f);
+		rsdr.stepEnd();
+	}
+
+	states.resize(rsdr.getNumHidden());
+
+	rsdr.getHiddenStates(states.data());
+
+	rsdr.setEventDrivenInhibition(false);
+
+	return getCheckpoint(rsdr);
+}
+
+bool testRSDR() {
+	const char* storageNames[] = { "_nodes", "_arrays", "_implicit" };
+
+	std::vector<float> nodesStates;
+
+	for (int s = 0; s < 3; s++) {
+		sdr::RSDR::Storage storage = static_cast<sdr::RSDR::Storage>(s);
+
+		std::vector<float> states;
+
+		std::string serial = runRSDR(storage, 0, false, states);
+
+		// _arrays keeps the connection order of _nodes. _implicit sums each window row by row instead of column by column, so rounding may flip a few spikes
+		if (storage == sdr::RSDR::_nodes)
+			nodesStates = states;
+		else if (storage == sdr::RSDR::_arrays && !check(states == nodesStates, "RSDR _arrays", "states differ from _nodes storage"))
+			return false;
+
+		for (int numThreads = 0; numThreads <= maxThreads; numThreads++)
+			for (int eventDriven = 0; eventDriven < 2; eventDriven++) {
+				std::ostringstream name;
+
+				name << "RSDR " << storageNames[s] << ", " << numThreads << " threads" << (eventDriven != 0 ? ", event-driven" : "");
+
+				if (!check(runRSDR(storage, numThreads, eventDriven != 0, states) == serial, name.str(), "differs from the serial run"))
+					return false;
+			}
+	}
+
+	return true;
+}
+
+void createHTSL(sc::HTSL &htsl) {
+	std::mt19937 generator(1234);
+
+	std::vector<sc::HTSL::LayerDesc> layerDescs(3);
+
+	layerDescs[0]._width = 32;
+	layerDescs[0]._height = 32;
+	layerDescs[1]._width = 24;
+	layerDescs[1]._height = 24;
+	layerDescs[2]._width = 16;
+	layerDescs[2]._height = 16;
+
+	htsl.createRandom(48, 48, layerDescs, generator);
+}
+
+void stepHTSL(sc::HTSL &htsl, int s) {
+	for (int i = 0; i < 48 * 48; i++)
+		htsl.setInput(i, getInput(i, s));
+
+	htsl.update();
+	htsl.learn();
+	htsl.stepEnd();
+}
+
+// Fraction of hidden states that differ between two sparse coders of the same size
+float getStateDifference(const sc::RecurrentSparseCoder2D &rsc0, const sc::RecurrentSparseCoder2D &rsc1) {
+	int numDiffering = 0;
+
+	for (int hi = 0; hi < rsc0.getNumHidden(); hi++)
+		if (rsc0.getHiddenState(hi) != rsc1.getHiddenState(hi))
+			numDiffering++;
+
+	return static_cast<float>(numDiffering) / rsc0.getNumHidden();
+}
+
+// A 3-layer HTSL on pools of 1 to maxThreads threads against the serial run, after every step
+bool testHTSL() {
+	sc::HTSL serial;
+
+	createHTSL(serial);
+
+	std::vector<sc::HTSL> pooled(maxThreads);
+
+	for (int t = 0; t < maxThreads; t++) {
+		createHTSL(pooled[t]);
+
+		pooled[t].setThreadPool(std::make_shared<sdr::ThreadPool>(t + 1));
+	}
+
+	for (int s = 0; s < steps; s++) {
+		stepHTSL(serial, s);
+
+		std::string serialCheckpoint = getCheckpoint(serial);
+
+		for (int t = 0; t < maxThreads; t++) {
+			stepHTSL(pooled[t], s);
+
+			std::ostringstream name;
+
+			name << "HTSL, " << (t + 1) << " threads, step " << s;
+
+			if (!check(getCheckpoint(pooled[t]) == serialCheckpoint, name.str(), "differs from the serial run"))
+				return false;
+		}
+	}
+
+	return true;
+}
+
+// The HTSL with incremental activation, serial and on a pool, against full sums.
+// Most codes of an untrained HTSL flip every step, so this mostly covers the fallback to full sums
+bool testHTSLIncremental() {
+	for (int numThreads = 0; numThreads <= maxThreads; numThreads += maxThreads) {
+		sc::HTSL full;
+		sc::HTSL incremental;
+
+		createHTSL(full);
+		createHTSL(incremental);
+
+		incremental.setIncremental(true);
+
+		if (numThreads > 0)
+			incremental.setThreadPool(std::make_shared<sdr::ThreadPool>(numThreads));
+
+		for (int s = 0; s < steps; s++) {
+			stepHTSL(full, s);
+			stepHTSL(incremental, s);
+
+			std::ostringstream name;
+
+			name << "HTSL incremental, " << numThreads << " threads, step " << s;
+
+			float maxDifference = 0.0f;
+
+			for (int i = 0; i < 48 * 48; i++)
+				maxDifference = std::max(maxDifference, std::abs(incremental.getPrediction(i) - full.getPrediction(i)));
+
+			if (!check(maxDifference <= incrementalTolerance, name.str(), "predictions differ beyond the tolerance"))
+				return false;
+
+			for (size_t l = 0; l < full.getLayers().size(); l++)
+				if (!check(getStateDifference(full.getLayers()[l]._rsc, incremental.getLayers()[l]._rsc) <= incrementalStateTolerance, name.str(), "too many hidden states differ"))
+					return false;
+		}
+	}
+
+	return true;
+}
+
+// Static background with a 4x4 patch that moves one pixel per step, so few inputs change
+float getPatchInput(int x, int y, int s) {
+	int patchX = s % 44;
+
+	return x >= patchX && x < patchX + 4 && y >= 20 && y < 24 ? 1.0f : getInput(x + y * 48, 0);
+}
+
+// A sparse coder on the moving patch, where incremental activation scatters the changes instead of falling back to full sums
+bool testRSCIncremental() {
+	const int rscSteps = 200;
+
+	for (int numThreads = 0; numThreads <= maxThreads; numThreads += maxThreads) {
+		std::mt19937 generator(1234);
+
+		sc::RecurrentSparseCoder2D full;
+
+		full.createRandom(48, 48, 32, 32, 6, 6, 6, generator);
+
+		sc::RecurrentSparseCoder2D incremental = full;
+
+		incremental.setIncremental(true);
+
+		if (numThreads > 0)
+			incremental.setThreadPool(std::make_shared<sdr::ThreadPool>(numThreads));
+
+		for (int s = 0; s < rscSteps; s++) {
+			for (int y = 0; y < 48; y++)
+				for (int x = 0; x < 48; x++) {
+					full.setVisibleInput(x, y, getPatchInput(x, y, s));
+					incremental.setVisibleInput(x, y, getPatchInput(x, y, s));
+				}
+
+			full.activate();
+			incremental.activate();
+
+			full.learn(0.01f, 0.01f, 0.05f, 0.01f, 0.01f, 0.01f, 0.1f, 0.0f);
+			incremental.learn(0.01f, 0.01f, 0.05f, 0.01f, 0.01f, 0.01f, 0.1f, 0.0f);
+
+			std::ostringstream name;
+
+			name << "RecurrentSparseCoder2D incremental, " << numThreads << " threads, step " << s;
+
+			float maxDifference = 0.0f;
+
+			for (int hi = 0; hi < full.getNumHidden(); hi++)
+				maxDifference = std::max(maxDifference, std::abs(incremental.getHiddenActivation(hi) - full.getHiddenActivation(hi)));
+
+			if (!check(maxDifference <= incrementalTolerance, name.str(), "activations differ beyond the tolerance")
+				|| !check(getStateDifference(full, incremental) <= incrementalStateTolerance, name.str(), "too many hidden states differ"))
+				return false;
+
+			full.stepEnd();
+			incremental.stepEnd();
+		}
+	}
+
+	return true;
+}
+
+// Inhibition thresholds windowMaskedSum, so every instruction set must give the scalar sums. Windows of all row lengths up to 40, for the vector tails
+bool testMaskedSum() {
+	const int width = 64;
+
+	std::mt19937 generator(1234);
+
+	std::uniform_real_distribution<float> dist(0.0f, 1.0f);
+
+	std::vector<float> activations(width * width);
+	std::vector<float> weights(width * width);
+	std::vector<float> falloffs(width * width);
+
+	for (int i = 0; i < width * width; i++) {
+		activations[i] = dist(generator);
+		weights[i] = dist(generator);
+		falloffs[i] = dist(generator);
+	}
+
+	sdr::Kernels::InstructionSet supported = sdr::Kernels::getSupportedInstructionSet();
+
+	std::vector<float> scalarSums;
+
+	for (int set = sdr::Kernels::_scalar; set <= supported; set++) {
+		sdr::Kernels::setInstructionSet(static_cast<sdr::Kernels::InstructionSet>(set));
+
+		std::vector<float> sums;
+
+		for (int rowLength = 1; rowLength <= 40; rowLength++)
+			for (int offset = 0; offset < 4; offset++)
+				sums.push_back(sdr::Kernels::windowMaskedSum(&activations[offset * (width + 1)], width, &weights[offset], rowLength, &falloffs[offset * 3], width, 0.5f, rowLength, 7));
+
+		if (set == sdr::Kernels::_scalar)
+			scalarSums = sums;
+		else if (!check(sums == scalarSums, sdr::Kernels::getInstructionSetName(static_cast<sdr::Kernels::InstructionSet>(set)), "windowMaskedSum differs from the scalar sums"))
+			return false;
+	}
+
+	sdr::Kernels::setInstructionSet(supported);
+
+	return true;
+}
+
+// The _activeSet solver only skips nodes its bound proves _dense leaves at 0, so both must give the same states and learn the same weights
+bool testIRSDRSolvers(sdr::IRSDR::Storage storage, const char* name) {
+	const int solverSteps = 30;
+
+	std::mt19937 denseGenerator(1234);
+
+	sdr::IRSDR dense;
+
+	dense.createRandom(32, 32, 16, 16, 4, 2, -0.1f, 0.1f, denseGenerator, storage);
+
+	sdr::IRSDR activeSet = dense;
+
+	std::mt19937 activeSetGenerator = denseGenerator;
+
+	dense.setSolver(sdr::IRSDR::_dense);
+	activeSet.setSolver(sdr::IRSDR::_activeSet);
+
+	for (int s = 0; s < solverSteps; s++) {
+		for (int vi = 0; vi < dense.getNumVisible(); vi++) {
+			dense.setVisibleState(vi, getInput(vi, s));
+			activeSet.setVisibleState(vi, getInput(vi, s));
+		}
+
+		dense.activate(30, 0.1f, 0.05f, 0.0f, 0.01f, denseGenerator);
+		activeSet.activate(30, 0.1f, 0.05f, 0.0f, 0.01f, activeSetGenerator);
+
+		std::ostringstream stepName;
+
+		stepName << name << ", step " << s;
+
+		for (int hi = 0; hi < dense.getNumHidden(); hi++)
+			if (!check(activeSet.getHiddenState(hi) == dense.getHiddenState(hi), stepName.str(), "hidden states differ"))
+				return false;
+
+		dense.learn(0.05f, 0.05f, 0.05f, 0.1f, 0.0001f);
+		activeSet.learn(0.05f, 0.05f, 0.05f, 0.1f, 0.0001f);
+
+		dense.stepEnd();
+		activeSet.stepEnd();
+	}
+
+	return check(getCheckpoint(activeSet) == getCheckpoint(dense), name, "checkpoints differ");
+}
+
+// IPredictiveRSDR's sequential step as it was before the pipelined mode, stepping copies of a network's layers and prediction nodes
+struct ReferenceIPredictiveRSDR {
+	std::vector<sdr::IPredictiveRSDR::LayerDesc> _layerDescs;
+	std::vector<sdr::IPredictiveRSDR::Layer> _layers;
+	std::vector<sdr::IPredictiveRSDR::PredictionNode> _inputPredictionNodes;
+
+	float _learnInputFeedBack;
+
+	explicit ReferenceIPredictiveRSDR(const sdr::IPredictiveRSDR &source)
+		: _layerDescs(source.getLayerDescs()), _layers(source.getLayers()), _inputPredictionNodes(source.getInputPredictionNodes()), _learnInputFeedBack(source._learnInputFeedBack)
+	{}
+
+	void simStep(std::mt19937 &generator, bool learn) {
+		for (int l = 0; l < _layers.size(); l++) {
+			_layers[l]._sdr.activate(_layerDescs[l]._sdrIter, _layerDescs[l]._sdrStepSize, _layerDescs[l]._sdrLambda, _layerDescs[l]._sdrHiddenDecay, _layerDescs[l]._sdrNoise, generator, _layerDescs[l]._sdrTolerance, _layerDescs[l]._sdrConvergence);
+
+			if (l < _layers.size() - 1) {
+				for (int i = 0; i < _layers[l]._sdr.getNumHidden(); i++)
+					_layers[l + 1]._sdr.setVisibleState(i, _layers[l]._sdr.getHiddenState(i));
+			}
+		}
+
+		for (int l = _layers.size() - 1; l >= 0; l--) {
+			for (int pi = 0; pi < _layers[l]._predictionNodes.size(); pi++) {
+				sdr::IPredictiveRSDR::PredictionNode &p = _layers[l]._predictionNodes[pi];
+
+				if (learn) {
+					float predictionError = _layers[l]._sdr.getHiddenState(pi) - p._statePrev;
+
+					float surprise = predictionError * predictionError;
+
+					p._averageSurprise = (1.0f - _layerDescs[l]._averageSurpriseDecay) * p._averageSurprise + _layerDescs[l]._averageSurpriseDecay * surprise;
+
+					if (l < _layers.size() - 1) {
+						for (int ci = 0; ci < p._feedBackConnections.size(); ci++)
+							p._feedBackConnections[ci]._weight += _layerDescs[l]._learnFeedBack * predictionError * _layers[l + 1]._predictionNodes[p._feedBackConnections[ci]._index]._statePrev;
+					}
+
+					for (int ci = 0; ci < p._predictiveConnections.size(); ci++)
+						p._predictiveConnections[ci]._weight += _layerDescs[l]._learnPrediction * predictionError * _layers[l]._sdr.getHiddenStatePrev(p._predictiveConnections[ci]._index);
+				}
+
+				float activation = 0.0f;
+
+				if (l < _layers.size() - 1) {
+					for (int ci = 0; ci < p._feedBackConnections.size(); ci++)
+						activation += p._feedBackConnections[ci]._weight * _layers[l + 1]._predictionNodes[p._feedBackConnections[ci]._index]._state;
+				}
+
+				for (int ci = 0; ci < p._predictiveConnections.size(); ci++)
+					activation += p._predictiveConnections[ci]._weight * _layers[l]._sdr.getHiddenState(p._predictiveConnections[ci]._index);
+
+				p._state = p._activation = activation;
+			}
+		}
+
+		for (int pi = 0; pi < _inputPredictionNodes.size(); pi++) {
+			sdr::IPredictiveRSDR::PredictionNode &p = _inputPredictionNodes[pi];
+
+			if (learn) {
+				float predictionError = _layers.front()._sdr.getVisibleState(pi) - p._statePrev;
+
+				for (int ci = 0; ci < p._feedBackConnections.size(); ci++)
+					p._feedBackConnections[ci]._weight += _learnInputFeedBack * predictionError * _layers.front()._sdr.getHiddenStatePrev(p._feedBackConnections[ci]._index);
+			}
+
+			float activation = 0.0f;
+
+			for (int ci = 0; ci < p._feedBackConnections.size(); ci++)
+				activation += p._feedBackConnections[ci]._weight * _layers.front()._sdr.getHiddenState(p._feedBackConnections[ci]._index);
+
+			p._state = p._activation = activation;
+		}
+
+		for (int l = 0; l < _layers.size(); l++) {
+			if (learn)
+				_layers[l]._sdr.learn(_layerDescs[l]._learnFeedForward, _layerDescs[l]._learnRecurrent, _layerDescs[l]._sdrLearnBoost, _layerDescs[l]._sdrBoostSparsity, _layerDescs[l]._sdrWeightDecay);
+
+			_layers[l]._sdr.stepEnd();
+
+			for (int pi = 0; pi < _layers[l]._predictionNodes.size(); pi++) {
+				_layers[l]._predictionNodes[pi]._statePrev = _layers[l]._predictionNodes[pi]._state;
+				_layers[l]._predictionNodes[pi]._activationPrev = _layers[l]._predictionNodes[pi]._activation;
+			}
+		}
+
+		for (int pi = 0; pi < _inputPredictionNodes.size(); pi++) {
+			_inputPredictionNodes[pi]._statePrev = _inputPredictionNodes[pi]._state;
+			_inputPredictionNodes[pi]._activationPrev = _inputPredictionNodes[pi]._activation;
+		}
+	}
+};
+
+bool samePredictionNodes(const std::vector<sdr::IPredictiveRSDR::PredictionNode> &nodes, const std::vector<sdr::IPredictiveRSDR::PredictionNode> &referenceNodes) {
+	if (nodes.size() != referenceNodes.size())
+		return false;
+
+	for (size_t pi = 0; pi < nodes.size(); pi++) {
+		const sdr::IPredictiveRSDR::PredictionNode &p = nodes[pi];
+		const sdr::IPredictiveRSDR::PredictionNode &r = referenceNodes[pi];
+
+		if (p._state != r._state || p._statePrev != r._statePrev || p._averageSurprise != r._averageSurprise)
+			return false;
+
+		for (size_t ci = 0; ci < p._feedBackConnections.size(); ci++)
+			if (p._feedBackConnections[ci]._weight != r._feedBackConnections[ci]._weight)
+				return false;
+
+		for (size_t ci = 0; ci < p._predictiveConnections.size(); ci++)
+			if (p._predictiveConnections[ci]._weight != r._predictiveConnections[ci]._weight)
+				return false;
+	}
+
+	return true;
+}
+
+// Three layers, the middle one slower to pass its outputs on in pipelined mode
+void createIPredictiveRSDR(sdr::IPredictiveRSDR &iprsdr) {
+	std::mt19937 generator(1234);
+
+	std::vector<sdr::IPredictiveRSDR::LayerDesc> layerDescs(3);
+
+	for (int l = 0; l < layerDescs.size(); l++) {
+		layerDescs[l]._width = 16 - l * 4;
+		layerDescs[l]._height = 16 - l * 4;
+		layerDescs[l]._receptiveRadius = 4;
+		layerDescs[l]._recurrentRadius = 2;
+		layerDescs[l]._predictiveRadius = 2;
+		layerDescs[l]._feedBackRadius = 3;
+		layerDescs[l]._sdrIter = 20;
+		layerDescs[l]._pipelineDelay = l == 1 ? 3 : 1;
+	}
+
+	iprsdr.createRandom(24, 24, 4, layerDescs, -0.05f, 0.05f, 0.0f, generator);
+}
+
+void stepIPredictiveRSDR(sdr::IPredictiveRSDR &iprsdr, std::mt19937 &generator, int s) {
+	for (int i = 0; i < 24 * 24; i++)
+		iprsdr.setInput(i, getInput(i, s));
+
+	iprsdr.simStep(generator);
+}
+
+// The sequential mode must step exactly as before the pipelined mode was added
+bool testIPredictiveRSDRSequential() {
+	sdr::IPredictiveRSDR iprsdr;
+
+	createIPredictiveRSDR(iprsdr);
+
+	ReferenceIPredictiveRSDR reference(iprsdr);
+
+	std::mt19937 generator(4321);
+	std::mt19937 referenceGenerator(4321);
+
+	for (int s = 0; s < steps * 2; s++) {
+		stepIPredictiveRSDR(iprsdr, generator, s);
+
+		for (int i = 0; i < 24 * 24; i++)
+			reference._layers.front()._sdr.setVisibleState(i, getInput(i, s));
+
+		reference.simStep(referenceGenerator, true);
+
+		std::ostringstream name;
+
+		name << "IPredictiveRSDR sequential, step " << s;
+
+		if (!check(samePredictionNodes(iprsdr.getInputPredictionNodes(), reference._inputPredictionNodes), name.str(), "input predictions differ from the previous step code"))
+			return false;
+
+		for (int l = 0; l < reference._layers.size(); l++)
+			if (!check(getCheckpoint(iprsdr.getLayers()[l]._sdr) == getCheckpoint(reference._layers[l]._sdr)
+				&& samePredictionNodes(iprsdr.getLayers()[l]._predictionNodes, reference._layers[l]._predictionNodes), name.str(), "layers differ from the previous step code"))
+				return false;
+	}
+
+	return true;
+}
+
+// Pipelined runs on pools of 1 to maxThreads threads must match the run without a pool, and each layer must see the layer below exactly its delay late
+bool testIPredictiveRSDRPipelined() {
+	sdr::IPredictiveRSDR serial;
+
+	createIPredictiveRSDR(serial);
+
+	serial.setPipelined(true);
+
+	std::mt19937 generator(4321);
+
+	// Hidden states of the middle layer after every step, the input of the top layer _pipelineDelay steps later
+	std::vector<std::vector<float>> middleStates;
+
+	int middleDelay = serial.getLayerDescs()[1]._pipelineDelay;
+
+	for (int s = 0; s < steps * 2; s++) {
+		stepIPredictiveRSDR(serial, generator, s);
+
+		const sdr::IRSDR &middle = serial.getLayers()[1]._sdr;
+		const sdr::IRSDR &top = serial.getLayers()[2]._sdr;
+
+		middleStates.push_back(std::vector<float>(middle.getNumHidden()));
+
+		middle.getHiddenStates(middleStates.back().data());
+
+		// The delay line starts filled with the states the middle layer had before the first step, 0
+		for (int i = 0; i < top.getNumVisible(); i++)
+			if (!check(top.getVisibleState(i) == (s >= middleDelay ? middleStates[s - middleDelay][i] : 0.0f), "IPredictiveRSDR pipelined", "top layer input is not the middle layer's states from its delay ago"))
+				return false;
+	}
+
+	std::string serialCheckpoint = getCheckpoint(serial);
+
+	for (int numThreads = 1; numThreads <= maxThreads; numThreads++) {
+		sdr::IPredictiveRSDR pooled;
+
+		createIPredictiveRSDR(pooled);
+
+		pooled.setPipelined(true, std::make_shared<sdr::ThreadPool>(numThreads));
+
+		std::mt19937 pooledGenerator(4321);
+
+		for (int s = 0; s < steps * 2; s++)
+			stepIPredictiveRSDR(pooled, pooledGenerator, s);
+
+		std::ostringstream name;
+
+		name << "IPredictiveRSDR pipelined, " << numThreads << " threads";
+
+		if (!check(getCheckpoint(pooled) == serialCheckpoint, name.str(), "checkpoint differs from the run without a pool"))
+			return false;
+	}
+
+	return true;
+}
+
+// A network saved halfway and loaded into a new one must continue as if it had not stopped, data in flight included
+bool testIPredictiveRSDRContinuation(bool pipelined, const char* name) {
+	sdr::IPredictiveRSDR uninterrupted;
+
+	createIPredictiveRSDR(uninterrupted);
+
+	uninterrupted.setPipelined(pipelined);
+
+	std::mt19937 generator(4321);
+
+	for (int s = 0; s < steps; s++)
+		stepIPredictiveRSDR(uninterrupted, generator, s);
+
+	std::string checkpoint = getCheckpoint(uninterrupted);
+
+	sdr::IPredictiveRSDR loaded;
+
+	loaded.setPipelined(pipelined);
+
+	sdr::CheckpointReader reader;
+
+	if (!check(reader.open(checkpoint.data(), checkpoint.size()) && loaded.load(reader), name, "load failed"))
+		return false;
+
+	std::mt19937 loadedGenerator = generator;
+
+	for (int s = steps; s < steps * 2; s++) {
+		stepIPredictiveRSDR(uninterrupted, generator, s);
+		stepIPredictiveRSDR(loaded, loadedGenerator, s);
+	}
+
+	return check(getCheckpoint(loaded) == getCheckpoint(uninterrupted), name, "continuation differs from the uninterrupted run");
+}
+
+// A batch of streams must predict, stream for stream, what copies of the network stepped one at a time with simStep(false) predict
+bool testPredictiveRSDRBatch(sdr::RSDR::Storage storage, const char* name) {
+	const int numStreams = 5;
+
+	std::mt19937 generator(1234);
+
+	std::vector<sdr::PredictiveRSDR::LayerDesc> layerDescs(2);
+
+	layerDescs[0]._width = 12;
+	layerDescs[0]._height = 12;
+	layerDescs[1]._width = 8;
+	layerDescs[1]._height = 8;
+
+	sdr::PredictiveRSDR prsdr;
+
+	prsdr.createRandom(16, 16, layerDescs, -0.1f, 0.1f, 0.01f, 0.05f, 0.1f, generator, storage);
+
+	std::vector<sdr::PredictiveRSDR> copies(numStreams, prsdr);
+
+	sdr::PredictiveRSDR::Batch batch;
+
+	prsdr.createBatch(numStreams, batch);
+
+	for (int s = 0; s < steps; s++) {
+		// Each stream sees its own input sequence
+		for (int b = 0; b < numStreams; b++)
+			for (int i = 0; i < 16 * 16; i++) {
+				batch.setInput(b, i, getInput(i, s + b * 5));
+				copies[b].setInput(i, getInput(i, s + b * 5));
+			}
+
+		prsdr.simStep(batch);
+
+		for (int b = 0; b < numStreams; b++) {
+			copies[b].simStep(false);
+
+			std::ostringstream streamName;
+
+			streamName << name << ", step " << s << ", stream " << b;
+
+			for (int i = 0; i < 16 * 16; i++)
+				if (!check(batch.getPrediction(b, i) == copies[b].getPrediction(i), streamName.str(), "batched prediction differs from the copy's"))
+					return false;
+		}
+	}
+
+	return true;
+}
+
+// Two threads driving one pool, each run() must still run each of its own tasks exactly once
+bool testSharedPool() {
+	const int numTasks = 64;
+	const int numRuns = 200;
+
+	sdr::ThreadPool pool(maxThreads);
+
+	std::vector<int> counts[2];
+
+	auto drive = [&](int d) {
+		counts[d].assign(numTasks, 0);
+
+		for (int r = 0; r < numRuns; r++)
+			pool.run(numTasks, [&, d](int t) { counts[d][t]++; });
+	};
+
+	std::thread other(drive, 1);
+
+	drive(0);
+
+	other.join();
+
+	for (int d = 0; d < 2; d++)
+		if (!check(std::count(counts[d].begin(), counts[d].end(), numRuns) == numTasks, "ThreadPool shared by two threads", "tasks ran a wrong number of times"))
+			return false;
+
+	return true;
+}
+
+int main() {
+	if (!testRSDR() || !testHTSL() || !testHTSLIncremental() || !testRSCIncremental() || !testMaskedSum()
+		|| !testIRSDRSolvers(sdr::IRSDR::_nodes, "IRSDR solvers, _nodes") || !testIRSDRSolvers(sdr::IRSDR::_implicit, "IRSDR solvers, _implicit")
+		|| !testIPredictiveRSDRSequential() || !testIPredictiveRSDRPipelined()
+		|| !testIPredictiveRSDRContinuation(false, "IPredictiveRSDR sequential continuation") || !testIPredictiveRSDRContinuation(true, "IPredictiveRSDR pipelined continuation")
+		|| !testSharedPool()
+		|| !testPredictiveRSDRBatch(sdr::RSDR::_arrays, "PredictiveRSDR batch, _arrays") || !testPredictiveRSDRBatch(sdr::RSDR::_implicit, "PredictiveRSDR batch, _implicit"))
+		return 1;
+
+	std::cout << "Determinism test passed" << std::endl;
+
+	return 0;
+}
+
+#endif
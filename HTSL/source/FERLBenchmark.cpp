@@ -0,0 +1,84 @@
+#include <Settings.h>
+
+#if SUBPROGRAM_EXECUTE == FERL_BENCHMARK
+
+#include <deep/FERL.h>
+
+#include <chrono>
+#include <fstream>
+#include <sstream>
+#include <iostream>
+
+// Saves with the given format, loads into a fresh FERL, and reports times and file size. The loaded copy is saved again in binary to check it is exact
+void benchmarkFormat(const deep::FERL &ferl, deep::FERL::Format format, const std::string &fileName, const std::string &reference) {
+	std::ios::openmode mode = format == deep::FERL::_binary ? std::ios::binary : std::ios::openmode();
+
+	std::chrono::high_resolution_clock::time_point start = std::chrono::high_resolution_clock::now();
+
+	{
+		std::ofstream os(fileName, std::ios::out | mode);
+
+		ferl.saveToFile(os, true, format);
+	}
+
+	std::chrono::high_resolution_clock::time_point saveEnd = std::chrono::high_resolution_clock::now();
+
+	deep::FERL loaded;
+
+	{
+		std::ifstream is(fileName, std::ios::in | mode);
+
+		loaded.loadFromFile(is, true, format);
+	}
+
+	std::chrono::high_resolution_clock::time_point loadEnd = std::chrono::high_resolution_clock::now();
+
+	std::ifstream size(fileName, std::ios::binary | std::ios::ate);
+
+	std::ostringstream check(std::ios::binary);
+
+	loaded.saveToFile(check, true, deep::FERL::_binary);
+
+	std::cout << (format == deep::FERL::_binary ? "binary" : "text") << ": save " << std::chrono::duration<float, std::milli>(saveEnd - start).count() << " ms, load "
+		<< std::chrono::duration<float, std::milli>(loadEnd - saveEnd).count() << " ms, " << size.tellg() / 1024 << " KiB, "
+		<< (check.str() == reference ? "exact" : "not exact") << std::endl;
+}
+
+int main() {
+	const int numState = 64;
+	const int numAction = 8;
+	const int numHidden = 4096;
+	const int numReplaySamples = 400;
+
+	std::mt19937 generator(1234);
+
+	deep::FERL ferl;
+
+	ferl.createRandom(numState, numAction, numHidden, 0.1f, generator);
+
+	std::uniform_real_distribution<float> stateDist(0.0f, 1.0f);
+
+	std::vector<float> state(numState);
+	std::vector<float> action;
+
+	// Fill the replay buffer
+	for (int s = 0; s < numReplaySamples; s++) {
+		for (int i = 0; i < numState; i++)
+			state[i] = stateDist(generator);
+
+		ferl.step(state, action, stateDist(generator), 0.5f, 0.99f, 0.98f, 0.1f, 1, 1, 0.05f, 0.01f, 0.05f, numReplaySamples, 0, 0.001f, generator);
+	}
+
+	std::cout << numHidden << " hidden, " << ferl.getNumVisible() << " visible, " << ferl.getSamples().size() << " replay samples" << std::endl;
+
+	std::ostringstream reference(std::ios::binary);
+
+	ferl.saveToFile(reference, true, deep::FERL::_binary);
+
+	benchmarkFormat(ferl, deep::FERL::_text, "ferlBenchmark.txt", reference.str());
+	benchmarkFormat(ferl, deep::FERL::_binary, "ferlBenchmark.bin", reference.str());
+
+	return 0;
+}
+
+#endif
\ No newline at end of file
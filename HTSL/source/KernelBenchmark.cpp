@@ -0,0 +1,116 @@
+#include <Settings.h>
+
+#if SUBPROGRAM_EXECUTE == KERNEL_BENCHMARK
+
+#include <sdr/Kernels.h>
+
+#include <chrono>
+#include <random>
+#include <vector>
+#include <cmath>
+#include <iostream>
+
+int main() {
+	// Receptive windows of radius 8 into a 256 wide layer, as in RSDR with _implicit storage
+	const int width = 256;
+	const int radius = 8;
+	const int dim = radius * 2 + 1;
+	const int numWindows = 4096;
+	const int repeats = 200;
+
+	std::mt19937 generator(1234);
+
+	std::uniform_real_distribution<float> dist(0.0f, 1.0f);
+
+	std::vector<float> inputs(width * width);
+	std::vector<float> weights(numWindows * dim * dim);
+
+	for (size_t i = 0; i < inputs.size(); i++)
+		inputs[i] = dist(generator);
+
+	for (size_t i = 0; i < weights.size(); i++)
+		weights[i] = dist(generator) * 0.01f;
+
+	std::vector<int> offsets(numWindows);
+
+	std::uniform_int_distribution<int> offsetDist(0, width - dim);
+
+	for (int w = 0; w < numWindows; w++)
+		offsets[w] = offsetDist(generator) + offsetDist(generator) * width;
+
+	std::vector<float> referenceResults;
+
+	sdr::Kernels::InstructionSet supported = sdr::Kernels::getSupportedInstructionSet();
+
+	for (int set = sdr::Kernels::_scalar; set <= supported; set++) {
+		sdr::Kernels::setInstructionSet(static_cast<sdr::Kernels::InstructionSet>(set));
+
+		std::vector<float> learnedWeights = weights;
+		std::vector<float> results(numWindows * 4);
+
+		// Floating point operations per window element: sum 1, centered dot 3, Oja update 4, weighted distance 4, masked sum 3
+		float flops[5] = { 1.0f, 3.0f, 4.0f, 4.0f, 3.0f };
+		float seconds[5] = { 0.0f, 0.0f, 0.0f, 0.0f, 0.0f };
+
+		for (int r = 0; r < repeats; r++) {
+			std::chrono::high_resolution_clock::time_point start = std::chrono::high_resolution_clock::now();
+
+			for (int w = 0; w < numWindows; w++)
+				results[w * 4] = sdr::Kernels::windowSum(&inputs[offsets[w]], width, dim, dim);
+
+			std::chrono::high_resolution_clock::time_point sumEnd = std::chrono::high_resolution_clock::now();
+
+			for (int w = 0; w < numWindows; w++)
+				results[w * 4 + 1] = sdr::Kernels::windowCenteredDot(&inputs[offsets[w]], width, &learnedWeights[w * dim * dim], dim, 0.5f, dim, dim);
+
+			std::chrono::high_resolution_clock::time_point dotEnd = std::chrono::high_resolution_clock::now();
+
+			for (int w = 0; w < numWindows; w++)
+				sdr::Kernels::windowOja(&learnedWeights[w * dim * dim], dim, &inputs[offsets[w]], width, 0.0001f, 0.5f, dim, dim);
+
+			std::chrono::high_resolution_clock::time_point ojaEnd = std::chrono::high_resolution_clock::now();
+
+			// The weights double as falloffs
+			for (int w = 0; w < numWindows; w++)
+				results[w * 4 + 2] = sdr::Kernels::windowWeightedDistance(&inputs[offsets[w]], width, &learnedWeights[w * dim * dim], dim, &weights[w * dim * dim], dim, 0.0f, dim, dim);
+
+			std::chrono::high_resolution_clock::time_point distanceEnd = std::chrono::high_resolution_clock::now();
+
+			// As in the inhibition of RecurrentSparseCoder2D, with the inputs as the activations of the neighbours
+			for (int w = 0; w < numWindows; w++)
+				results[w * 4 + 3] = sdr::Kernels::windowMaskedSum(&inputs[offsets[w]], width, &learnedWeights[w * dim * dim], dim, &weights[w * dim * dim], dim, 0.5f, dim, dim);
+
+			std::chrono::high_resolution_clock::time_point maskedEnd = std::chrono::high_resolution_clock::now();
+
+			seconds[0] += std::chrono::duration<float>(sumEnd - start).count();
+			seconds[1] += std::chrono::duration<float>(dotEnd - sumEnd).count();
+			seconds[2] += std::chrono::duration<float>(ojaEnd - dotEnd).count();
+			seconds[3] += std::chrono::duration<float>(distanceEnd - ojaEnd).count();
+			seconds[4] += std::chrono::duration<float>(maskedEnd - distanceEnd).count();
+		}
+
+		results.insert(results.end(), learnedWeights.begin(), learnedWeights.end());
+
+		if (set == sdr::Kernels::_scalar)
+			referenceResults = results;
+
+		float maxRelativeError = 0.0f;
+
+		for (size_t i = 0; i < results.size(); i++)
+			maxRelativeError = std::max(maxRelativeError, std::abs(results[i] - referenceResults[i]) / std::max(1e-6f, std::abs(referenceResults[i])));
+
+		const char* kernelNames[5] = { "windowSum", "windowCenteredDot", "windowOja", "windowWeightedDistance", "windowMaskedSum" };
+
+		std::cout << sdr::Kernels::getInstructionSetName(static_cast<sdr::Kernels::InstructionSet>(set)) << " (max relative error vs scalar " << maxRelativeError << ")" << std::endl;
+
+		for (int k = 0; k < 5; k++) {
+			float gflops = flops[k] * dim * dim * numWindows * repeats / seconds[k] * 1e-9f;
+
+			std::cout << "  " << kernelNames[k] << ": " << gflops << " GFLOP/s" << std::endl;
+		}
+	}
+
+	return 0;
+}
+
+#endif
\ No newline at end of file
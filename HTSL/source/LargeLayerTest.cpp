@@ -0,0 +1,200 @@
+#include <Settings.h>
+
+#if SUBPROGRAM_EXECUTE == LARGE_LAYER_TEST
+
+#include <sdr/RSDR.h>
+#include <sdr/IRSDR.h>
+#include <sdr/Kernels.h>
+#include <sc/RecurrentSparseCoder2D.h>
+
+#include <iostream>
+
+// Regression test for layers past the 16-bit index range. Builds 512x512 input layers, checks that the connections address the right pixels,
+// and that _arrays and _implicit storage step to the same states as the _nodes reference. Exits with 1 on the first failure
+const int visibleSize = 512;
+const int hiddenSize = 256;
+
+bool check(bool condition, const char* message) {
+	if (!condition)
+		std::cerr << "FAILED: " << message << std::endl;
+
+	return condition;
+}
+
+// Connections must cover the window around (centerX, centerY) clipped to the layer, in createRandom order (columns of dy within dx), skipping the center if excludeCenter
+template<class Connection>
+bool checkWindow(const std::vector<Connection> &connections, int centerX, int centerY, int radius, int width, int height, bool excludeCenter) {
+	size_t ci = 0;
+
+	for (int dx = -radius; dx <= radius; dx++)
+		for (int dy = -radius; dy <= radius; dy++) {
+			if (excludeCenter && dx == 0 && dy == 0)
+				continue;
+
+			int x = centerX + dx;
+			int y = centerY + dy;
+
+			if (x < 0 || x >= width || y < 0 || y >= height)
+				continue;
+
+			if (ci >= connections.size() || connections[ci]._index != x + y * width)
+				return false;
+
+			ci++;
+		}
+
+	return ci == connections.size();
+}
+
+bool testRSDR() {
+	const int receptiveRadius = 2;
+	const int inhibitionRadius = 1;
+	const int recurrentRadius = 1;
+	const int steps = 2;
+
+	sdr::RSDR rsdrs[3];
+
+	for (int s = 0; s < 3; s++) {
+		std::mt19937 generator(1234);
+
+		rsdrs[s].createRandom(visibleSize, visibleSize, hiddenSize, hiddenSize, receptiveRadius, inhibitionRadius, recurrentRadius, -0.01f, 0.01f, 0.01f, 0.05f, 0.1f, generator, static_cast<sdr::RSDR::Storage>(s));
+	}
+
+	sdr::RSDR &reference = rsdrs[sdr::RSDR::_nodes];
+
+	if (!check(rsdrs[sdr::RSDR::_arrays].getLongIndices(), "RSDR _arrays storage of a 512x512 layer does not use 32-bit indices"))
+		return false;
+
+	float hiddenToVisible = static_cast<float>(visibleSize) / static_cast<float>(hiddenSize);
+
+	for (int hi = 0; hi < reference.getNumHidden(); hi++) {
+		int hx = hi % hiddenSize;
+		int hy = hi / hiddenSize;
+
+		int centerX = std::round(hx * hiddenToVisible);
+		int centerY = std::round(hy * hiddenToVisible);
+
+		sdr::RSDR::HiddenNode &node = reference.getHiddenNode(hi);
+
+		if (!check(checkWindow(node._feedForwardConnections, centerX, centerY, receptiveRadius, visibleSize, visibleSize, false), "RSDR feed-forward connections address the wrong pixels")
+			|| !check(checkWindow(node._lateralConnections, hx, hy, inhibitionRadius, hiddenSize, hiddenSize, true), "RSDR lateral connections address the wrong nodes")
+			|| !check(checkWindow(node._recurrentConnections, hx, hy, recurrentRadius, hiddenSize, hiddenSize, true), "RSDR recurrent connections address the wrong nodes"))
+			return false;
+	}
+
+	// The compact storages do not keep connection lists. Projecting single hidden nodes back onto the input shows which pixels their weights address
+	const int probes[] = { 0, hiddenSize - 1, hiddenSize * (hiddenSize / 2) + hiddenSize / 2, reference.getNumHidden() - hiddenSize, reference.getNumHidden() - 1 };
+
+	for (size_t p = 0; p < sizeof(probes) / sizeof(probes[0]); p++) {
+		std::vector<float> states(reference.getNumHidden(), 0.0f);
+
+		states[probes[p]] = 1.0f;
+
+		std::vector<float> referenceRecon;
+
+		reference.reconstructFeedForward(states, referenceRecon);
+
+		for (int s = sdr::RSDR::_arrays; s <= sdr::RSDR::_implicit; s++) {
+			std::vector<float> recon;
+
+			rsdrs[s].reconstructFeedForward(states, recon);
+
+			if (!check(recon == referenceRecon, "RSDR compact storage weights address the wrong pixels"))
+				return false;
+		}
+	}
+
+	// The SIMD kernels add up in a different order than the _nodes loops
+	sdr::Kernels::setInstructionSet(sdr::Kernels::_scalar);
+
+	std::mt19937 generator(4321);
+
+	std::uniform_real_distribution<float> inputDist(0.0f, 1.0f);
+
+	std::vector<float> input(reference.getNumVisible());
+
+	for (int step = 0; step < steps; step++) {
+		for (int vi = 0; vi < reference.getNumVisible(); vi++)
+			input[vi] = inputDist(generator);
+
+		for (int s = 0; s < 3; s++) {
+			rsdrs[s].setVisibleStates(input.data(), input.size());
+
+			rsdrs[s].activate(17, 5, 0.1f);
+			rsdrs[s].learn(0.02f, 0.02f, 0.2f, 0.12f, 0.02f);
+			rsdrs[s].stepEnd();
+		}
+
+		for (int s = sdr::RSDR::_arrays; s <= sdr::RSDR::_implicit; s++)
+			for (int hi = 0; hi < reference.getNumHidden(); hi++)
+				if (!check(rsdrs[s].getHiddenState(hi) == reference.getHiddenState(hi), "RSDR compact storage states differ from the _nodes reference"))
+					return false;
+	}
+
+	sdr::Kernels::setInstructionSet(sdr::Kernels::getSupportedInstructionSet());
+
+	return true;
+}
+
+bool testIRSDR() {
+	const int receptiveRadius = 2;
+	const int recurrentRadius = 1;
+
+	std::mt19937 generator(1234);
+
+	sdr::IRSDR irsdr;
+
+	irsdr.createRandom(visibleSize, visibleSize, hiddenSize, hiddenSize, receptiveRadius, recurrentRadius, -0.01f, 0.01f, generator);
+
+	float hiddenToVisible = static_cast<float>(visibleSize) / static_cast<float>(hiddenSize);
+
+	for (int hi = 0; hi < irsdr.getNumHidden(); hi++) {
+		int hx = hi % hiddenSize;
+		int hy = hi / hiddenSize;
+
+		int centerX = std::round(hx * hiddenToVisible);
+		int centerY = std::round(hy * hiddenToVisible);
+
+		sdr::IRSDR::HiddenNode &node = irsdr.getHiddenNode(hi);
+
+		if (!check(checkWindow(node._feedForwardConnections, centerX, centerY, receptiveRadius, visibleSize, visibleSize, false), "IRSDR feed-forward connections address the wrong pixels")
+			|| !check(checkWindow(node._recurrentConnections, hx, hy, recurrentRadius, hiddenSize, hiddenSize, true), "IRSDR recurrent connections address the wrong nodes"))
+			return false;
+	}
+
+	return true;
+}
+
+bool testRecurrentSparseCoder2D() {
+	const int coderHiddenSize = 128;
+	const int receptiveRadius = 2;
+
+	std::mt19937 generator(1234);
+
+	sc::RecurrentSparseCoder2D coder;
+
+	coder.createRandom(visibleSize, visibleSize, coderHiddenSize, coderHiddenSize, receptiveRadius, 1, 1, generator);
+
+	float hiddenToVisible = static_cast<float>(visibleSize - 1) / static_cast<float>(coderHiddenSize - 1);
+
+	for (int hi = 0; hi < coder.getNumHidden(); hi++) {
+		int centerX = std::round((hi % coderHiddenSize) * hiddenToVisible);
+		int centerY = std::round((hi / coderHiddenSize) * hiddenToVisible);
+
+		if (!check(checkWindow(coder.getHiddenNode(hi)._visibleHiddenConnections, centerX, centerY, receptiveRadius, visibleSize, visibleSize, false), "RecurrentSparseCoder2D connections address the wrong pixels"))
+			return false;
+	}
+
+	return true;
+}
+
+int main() {
+	if (!testRSDR() || !testIRSDR() || !testRecurrentSparseCoder2D())
+		return 1;
+
+	std::cout << "Large layer test passed" << std::endl;
+
+	return 0;
+}
+
+#endif
\ No newline at end of file
@@ -40,7 +40,8 @@ int main() {
 	layerDescs[2]._width = 8;
 	layerDescs[2]._height = 8;
 
-	rsdr.createRandom(16, 16, layerDescs, -0.01f, 0.01f, 0.01f, 0.05f, 0.1f, generator);
+	// Array storage, so the rollout copy below shares the weights and only copies states
+	rsdr.createRandom(16, 16, layerDescs, -0.01f, 0.01f, 0.01f, 0.05f, 0.1f, generator, sdr::RSDR::_arrays);
 
 	int ticksPerSample = 3;
 
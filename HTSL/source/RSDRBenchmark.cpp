@@ -0,0 +1,121 @@
+#include <Settings.h>
+
+#if SUBPROGRAM_EXECUTE == RSDR_BENCHMARK
+
+#include <sdr/RSDR.h>
+
+#include <chrono>
+#include <iostream>
+
+// Runs activate/learn/stepEnd on random inputs, returns steps per second. Final hidden states are stored in states for comparison
+float benchmarkRSDR(sdr::RSDR::Storage storage, const std::shared_ptr<sdr::ThreadPool> &threadPool, bool eventDrivenInhibition, int visibleSize, int hiddenSize, int steps, std::vector<float> &states) {
+	std::mt19937 generator(1234);
+
+	sdr::RSDR rsdr;
+
+	rsdr.createRandom(visibleSize, visibleSize, hiddenSize, hiddenSize, 8, 3, 4, -0.001f, 0.001f, 0.01f, 0.05f, 0.1f, generator, storage);
+
+	rsdr.setThreadPool(threadPool);
+	rsdr.setEventDrivenInhibition(eventDrivenInhibition);
+
+	std::uniform_real_distribution<float> inputDist(0.0f, 1.0f);
+
+	std::vector<std::vector<float>> inputs(steps, std::vector<float>(rsdr.getNumVisible()));
+
+	for (int s = 0; s < steps; s++)
+		for (size_t i = 0; i < inputs[s].size(); i++)
+			inputs[s][i] = inputDist(generator);
+
+	std::chrono::high_resolution_clock::time_point start = std::chrono::high_resolution_clock::now();
+
+	for (int s = 0; s < steps; s++) {
+		for (size_t i = 0; i < inputs[s].size(); i++)
+			rsdr.setVisibleState(i, inputs[s][i]);
+
+		rsdr.activate(17, 5, 0.1f);
+		rsdr.learn(0.02f, 0.02f, 0.2f, 0.12f, 0.02f);
+		rsdr.stepEnd();
+	}
+
+	std::chrono::duration<float> elapsed = std::chrono::high_resolution_clock::now() - start;
+
+	states.resize(rsdr.getNumHidden());
+
+	for (int hi = 0; hi < rsdr.getNumHidden(); hi++)
+		states[hi] = rsdr.getHiddenState(hi);
+
+	return steps / elapsed.count();
+}
+
+int main() {
+	const int sizes[] = { 64, 128 };
+	const int steps = 20;
+
+	std::shared_ptr<sdr::ThreadPool> threadPool = std::make_shared<sdr::ThreadPool>();
+
+	std::cout << "Threads: " << threadPool->getNumThreads() << std::endl;
+
+	bool failed = false;
+
+	for (int si = 0; si < 2; si++) {
+		int size = sizes[si];
+
+		std::vector<float> referenceStates;
+
+		float referenceStepsPerSecond = benchmarkRSDR(sdr::RSDR::_nodes, nullptr, false, size, size, steps, referenceStates);
+
+		std::cout << size << "x" << size << " hidden, nodes: " << referenceStepsPerSecond << " steps/s" << std::endl;
+
+		const char* storageNames[] = { "nodes", "arrays", "implicit" };
+
+		// Serial states of each storage. Threading and event-driven inhibition must not change them
+		std::vector<float> storageStates[3];
+
+		storageStates[sdr::RSDR::_nodes] = referenceStates;
+
+		// Storage, threaded, event-driven inhibition
+		for (int config = 1; config < 12; config++) {
+			sdr::RSDR::Storage storage = static_cast<sdr::RSDR::Storage>(config / 4);
+			bool threaded = (config & 1) != 0;
+			bool eventDrivenInhibition = (config & 2) != 0;
+
+			std::vector<float> states;
+
+			float stepsPerSecond = benchmarkRSDR(storage, threaded ? threadPool : nullptr, eventDrivenInhibition, size, size, steps, states);
+
+			if (!threaded && !eventDrivenInhibition)
+				storageStates[storage] = states;
+
+			int numDiffering = 0;
+			int numDifferingSerial = 0;
+
+			for (size_t hi = 0; hi < states.size(); hi++) {
+				if (states[hi] != referenceStates[hi])
+					numDiffering++;
+
+				if (states[hi] != storageStates[storage][hi])
+					numDifferingSerial++;
+			}
+
+			std::cout << size << "x" << size << " hidden, " << storageNames[storage]
+				<< (threaded ? ", threaded" : "") << (eventDrivenInhibition ? ", event-driven" : "") << ": "
+				<< stepsPerSecond << " steps/s (" << stepsPerSecond / referenceStepsPerSecond << "x), ";
+
+			// _implicit sums each window row by row instead of column by column, so rounding may flip a few spikes
+			if (numDiffering == 0)
+				std::cout << "states match" << std::endl;
+			else
+				std::cout << numDiffering << " of " << states.size() << " states differ" << std::endl;
+
+			if (numDifferingSerial != 0 || (storage != sdr::RSDR::_implicit && numDiffering != 0)) {
+				std::cout << "FAILED: " << (numDifferingSerial != 0 ? "states differ from the serial run of the same storage" : "states differ from nodes storage") << std::endl;
+
+				failed = true;
+			}
+		}
+	}
+
+	return failed ? 1 : 0;
+}
+
+#endif
\ No newline at end of file
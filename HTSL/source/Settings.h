@@ -12,6 +12,15 @@
 #define BINH_TEST 9
 #define SOUND_LEARNING_2 10
 #define SPRITE_ANIMATION_PREDICTION_2 11
+#define RSDR_BENCHMARK 12
+#define KERNEL_BENCHMARK 13
+#define FERL_BENCHMARK 14
+#define LARGE_LAYER_TEST 15
+#define ALLOCATION_TEST 16
+#define CHECKPOINT_TEST 17
+#define DETERMINISM_TEST 18
 
-// Choose program
-#define SUBPROGRAM_EXECUTE SPARSE_CODING
\ No newline at end of file
+// Choose program. The CMake build defines it per demo executable
+#ifndef SUBPROGRAM_EXECUTE
+#define SUBPROGRAM_EXECUTE SPARSE_CODING
+#endif
\ No newline at end of file
@@ -32,6 +32,16 @@ int main() {
 
 	sparseCoder.createRandom(sampleWidth, sampleHeight, codeWidth, codeHeight, 12, -1, -0.1f, 0.1f, generator);
 
+	// Print the hidden reconstruction errors while P is held
+	sparseCoder.setLearnHook([](const sdr::IRSDR &sdr, const std::vector<float> &hiddenErrors) {
+		if (sf::Keyboard::isKeyPressed(sf::Keyboard::P)) {
+			for (int hi = 0; hi < hiddenErrors.size(); hi++)
+				std::cout << hiddenErrors[hi] << " ";
+
+			std::cout << std::endl;
+		}
+	});
+
 	// ------------------------------- Load Resources --------------------------------
 
 	sf::Image sampleImage;
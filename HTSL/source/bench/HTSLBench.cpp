@@ -0,0 +1,470 @@
+// Headless throughput benchmarks of every model in sdr, sc and deep, at small, medium and large sizes on synthetic inputs.
+// Each benchmark reports steps/s, ns/connection (time of one step divided by the number of connections the model has) and modelRSS, the resident memory the model added to the process
+
+#include <sdr/RSDR.h>
+#include <sdr/IRSDR.h>
+#include <sdr/PredictiveRSDR.h>
+#include <sdr/IPredictiveRSDR.h>
+#include <sc/HTSL.h>
+#include <sc/RecurrentSparseCoder2D.h>
+#include <deep/SDRRL.h>
+#include <deep/FERL.h>
+#include <deep/CSRL.h>
+
+#include <benchmark/benchmark.h>
+
+#include <chrono>
+#include <random>
+
+#ifdef _WIN32
+#define NOMINMAX
+#include <windows.h>
+#include <psapi.h>
+#elif defined(__APPLE__)
+#include <mach/mach.h>
+#else
+#include <cstdio>
+#include <unistd.h>
+#endif
+
+#ifdef __GLIBC__
+#include <malloc.h>
+#endif
+
+namespace {
+	// Synthetic inputs are drawn up front and cycled through, so drawing them is not timed
+	const int _numInputFrames = 16;
+
+	// Resident set size of the process now, not its peak, which would carry over from the largest model benchmarked before
+	double getCurrentRSS() {
+#ifdef _WIN32
+		PROCESS_MEMORY_COUNTERS counters;
+
+		GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters));
+
+		return static_cast<double>(counters.WorkingSetSize);
+#elif defined(__APPLE__)
+		mach_task_basic_info info;
+		mach_msg_type_number_t count = MACH_TASK_BASIC_INFO_COUNT;
+
+		if (task_info(mach_task_self(), MACH_TASK_BASIC_INFO, reinterpret_cast<task_info_t>(&info), &count) != KERN_SUCCESS)
+			return 0.0;
+
+		return static_cast<double>(info.resident_size);
+#else
+		std::FILE* pFile = std::fopen("/proc/self/statm", "r");
+
+		if (pFile == nullptr)
+			return 0.0;
+
+		long size = 0;
+		long resident = 0;
+
+		int numRead = std::fscanf(pFile, "%ld %ld", &size, &resident);
+
+		std::fclose(pFile);
+
+		return numRead == 2 ? static_cast<double>(resident) * sysconf(_SC_PAGESIZE) : 0.0;
+#endif
+	}
+
+	// Resident set size before a model is made. Free heap pages are handed back first, so that memory freed by earlier benchmarks and reused by the model still counts as the model's.
+	// Models of a few pages can still fit in fragments freed earlier that stay resident and read low. Run them alone with --benchmark_filter for their full size
+	double getBaselineRSS() {
+#ifdef __GLIBC__
+		malloc_trim(0);
+#endif
+
+		return getCurrentRSS();
+	}
+
+	std::vector<std::vector<float>> makeInputFrames(int size, std::mt19937 &generator) {
+		std::uniform_real_distribution<float> inputDist(0.0f, 1.0f);
+
+		std::vector<std::vector<float>> frames(_numInputFrames, std::vector<float>(size));
+
+		for (int f = 0; f < _numInputFrames; f++)
+			for (int i = 0; i < size; i++)
+				frames[f][i] = inputDist(generator);
+
+		return frames;
+	}
+
+	// Number of connections of windows with the given radius around every hidden node, with the window centers scaled onto the visible grid and clipped at its edges
+	long long countWindows(int hiddenWidth, int hiddenHeight, int visibleWidth, int visibleHeight, int radius) {
+		if (radius < 0)
+			return 0;
+
+		long long count = 0;
+
+		for (int hy = 0; hy < hiddenHeight; hy++) {
+			int centerY = static_cast<int>(hy * static_cast<float>(visibleHeight) / static_cast<float>(hiddenHeight) + 0.5f);
+
+			int sizeY = std::min(centerY + radius, visibleHeight - 1) - std::max(centerY - radius, 0) + 1;
+
+			for (int hx = 0; hx < hiddenWidth; hx++) {
+				int centerX = static_cast<int>(hx * static_cast<float>(visibleWidth) / static_cast<float>(hiddenWidth) + 0.5f);
+
+				int sizeX = std::min(centerX + radius, visibleWidth - 1) - std::max(centerX - radius, 0) + 1;
+
+				count += std::max(sizeX, 0) * std::max(sizeY, 0);
+			}
+		}
+
+		return count;
+	}
+
+	// Feed forward, lateral, action and Q connections
+	long long countConnections(const deep::SDRRL &sdrrl) {
+		return static_cast<long long>(sdrrl.getNumCells()) * (sdrrl.getNumStates() + sdrrl.getNumCells() + sdrrl.getNumActions() + 1);
+	}
+
+	// Times step once per benchmark iteration and sets the counters. baselineRSS is getBaselineRSS from before the model was made, after the input frames were drawn,
+	// so modelRSS covers the model with its workspaces and whatever it grows while stepping
+	template<typename Step>
+	void runSteps(benchmark::State &state, long long connections, double baselineRSS, Step step) {
+		std::chrono::high_resolution_clock::time_point start = std::chrono::high_resolution_clock::now();
+
+		for (auto _ : state)
+			step();
+
+		std::chrono::duration<double, std::nano> elapsed = std::chrono::high_resolution_clock::now() - start;
+
+		state.counters["steps/s"] = benchmark::Counter(static_cast<double>(state.iterations()), benchmark::Counter::kIsRate);
+		state.counters["ns/connection"] = elapsed.count() / (static_cast<double>(state.iterations()) * connections);
+		state.counters["connections"] = static_cast<double>(connections);
+		state.counters["modelRSS"] = benchmark::Counter(getCurrentRSS() - baselineRSS, benchmark::Counter::kDefaults, benchmark::Counter::OneK::kIs1024);
+	}
+}
+
+// Argument: visible and hidden width
+void benchRSDR(benchmark::State &state) {
+	int size = state.range(0);
+
+	std::mt19937 generator(1234);
+
+	std::vector<std::vector<float>> frames = makeInputFrames(size * size, generator);
+
+	double baselineRSS = getBaselineRSS();
+
+	sdr::RSDR rsdr;
+
+	rsdr.createRandom(size, size, size, size, 8, 3, 4, -0.001f, 0.001f, 0.01f, 0.05f, 0.1f, generator);
+
+	long long connections = countWindows(size, size, size, size, 8) + countWindows(size, size, size, size, 3) + countWindows(size, size, size, size, 4);
+
+	int frame = 0;
+
+	runSteps(state, connections, baselineRSS, [&]() {
+		const std::vector<float> &inputs = frames[frame++ % _numInputFrames];
+
+		rsdr.setVisibleStates(inputs.data(), inputs.size());
+
+		rsdr.activate(17, 5, 0.1f);
+		rsdr.learn(0.02f, 0.02f, 0.2f, 0.12f, 0.02f);
+		rsdr.stepEnd();
+	});
+}
+
+// Argument: visible and hidden width
+void benchIRSDR(benchmark::State &state) {
+	int size = state.range(0);
+
+	std::mt19937 generator(1234);
+
+	std::vector<std::vector<float>> frames = makeInputFrames(size * size, generator);
+
+	double baselineRSS = getBaselineRSS();
+
+	sdr::IRSDR irsdr;
+
+	irsdr.createRandom(size, size, size, size, 8, 6, -0.01f, 0.01f, generator);
+
+	long long connections = countWindows(size, size, size, size, 8) + countWindows(size, size, size, size, 6);
+
+	int frame = 0;
+
+	runSteps(state, connections, baselineRSS, [&]() {
+		const std::vector<float> &inputs = frames[frame++ % _numInputFrames];
+
+		irsdr.setVisibleStates(inputs.data(), inputs.size());
+
+		irsdr.activate(30, 0.05f, 0.4f, 0.01f, 0.01f, generator);
+		irsdr.learn(0.05f, 0.05f, 0.05f, 0.02f, 0.0001f);
+		irsdr.stepEnd();
+	});
+}
+
+// Argument: input and layer width, two layers
+void benchPredictiveRSDR(benchmark::State &state) {
+	int size = state.range(0);
+
+	std::mt19937 generator(1234);
+
+	std::vector<sdr::PredictiveRSDR::LayerDesc> layerDescs(2);
+
+	long long connections = 0;
+
+	for (size_t l = 0; l < layerDescs.size(); l++) {
+		sdr::PredictiveRSDR::LayerDesc &desc = layerDescs[l];
+
+		desc._width = size;
+		desc._height = size;
+
+		connections += countWindows(size, size, size, size, desc._receptiveRadius) + countWindows(size, size, size, size, desc._lateralRadius)
+			+ countWindows(size, size, size, size, desc._recurrentRadius) + countWindows(size, size, size, size, desc._predictiveRadius);
+
+		if (l + 1 < layerDescs.size())
+			connections += countWindows(size, size, size, size, desc._feedBackRadius);
+	}
+
+	std::vector<std::vector<float>> frames = makeInputFrames(size * size, generator);
+
+	double baselineRSS = getBaselineRSS();
+
+	sdr::PredictiveRSDR prsdr;
+
+	prsdr.createRandom(size, size, layerDescs, -0.001f, 0.001f, 0.01f, 0.05f, 0.1f, generator);
+
+	int frame = 0;
+
+	runSteps(state, connections, baselineRSS, [&]() {
+		const std::vector<float> &inputs = frames[frame++ % _numInputFrames];
+
+		prsdr.setInputs(inputs.data(), inputs.size());
+
+		prsdr.simStep();
+	});
+}
+
+// Argument: input and layer width, two layers
+void benchIPredictiveRSDR(benchmark::State &state) {
+	int size = state.range(0);
+
+	std::mt19937 generator(1234);
+
+	std::vector<sdr::IPredictiveRSDR::LayerDesc> layerDescs(2);
+
+	const int inputFeedBackRadius = 8;
+
+	long long connections = countWindows(size, size, size, size, inputFeedBackRadius);
+
+	for (size_t l = 0; l < layerDescs.size(); l++) {
+		sdr::IPredictiveRSDR::LayerDesc &desc = layerDescs[l];
+
+		desc._width = size;
+		desc._height = size;
+
+		connections += countWindows(size, size, size, size, desc._receptiveRadius) + countWindows(size, size, size, size, desc._recurrentRadius)
+			+ countWindows(size, size, size, size, desc._predictiveRadius);
+
+		if (l + 1 < layerDescs.size())
+			connections += countWindows(size, size, size, size, desc._feedBackRadius);
+	}
+
+	std::vector<std::vector<float>> frames = makeInputFrames(size * size, generator);
+
+	double baselineRSS = getBaselineRSS();
+
+	sdr::IPredictiveRSDR iprsdr;
+
+	iprsdr.createRandom(size, size, inputFeedBackRadius, layerDescs, -0.01f, 0.01f, 0.0f, generator);
+
+	int frame = 0;
+
+	runSteps(state, connections, baselineRSS, [&]() {
+		const std::vector<float> &inputs = frames[frame++ % _numInputFrames];
+
+		iprsdr.setInputs(inputs.data(), inputs.size());
+
+		iprsdr.simStep(generator);
+	});
+}
+
+// Argument: input and layer width, two layers
+void benchHTSL(benchmark::State &state) {
+	int size = state.range(0);
+
+	std::mt19937 generator(1234);
+
+	std::vector<sc::HTSL::LayerDesc> layerDescs(2);
+
+	long long connections = 0;
+
+	for (size_t l = 0; l < layerDescs.size(); l++) {
+		sc::HTSL::LayerDesc &desc = layerDescs[l];
+
+		desc._width = size;
+		desc._height = size;
+
+		connections += countWindows(size, size, size, size, desc._receptiveRadius) + countWindows(size, size, size, size, desc._inhibitionRadius)
+			+ countWindows(size, size, size, size, desc._recurrentRadius) + countWindows(size, size, size, size, desc._lateralRadius);
+
+		if (l + 1 < layerDescs.size())
+			connections += countWindows(size, size, size, size, desc._feedbackRadius);
+	}
+
+	std::vector<std::vector<float>> frames = makeInputFrames(size * size, generator);
+
+	double baselineRSS = getBaselineRSS();
+
+	sc::HTSL htsl;
+
+	htsl.createRandom(size, size, layerDescs, generator);
+
+	int frame = 0;
+
+	runSteps(state, connections, baselineRSS, [&]() {
+		const std::vector<float> &inputs = frames[frame++ % _numInputFrames];
+
+		htsl.setInputs(inputs.data(), inputs.size());
+
+		htsl.update();
+		htsl.learn();
+		htsl.stepEnd();
+	});
+}
+
+// Argument: visible and hidden width
+void benchRecurrentSparseCoder2D(benchmark::State &state) {
+	int size = state.range(0);
+
+	std::mt19937 generator(1234);
+
+	std::vector<std::vector<float>> frames = makeInputFrames(size * size, generator);
+
+	double baselineRSS = getBaselineRSS();
+
+	sc::RecurrentSparseCoder2D rsc;
+
+	rsc.createRandom(size, size, size, size, 6, 6, 6, generator);
+
+	long long connections = countWindows(size, size, size, size, 6) * 3;
+
+	int frame = 0;
+
+	runSteps(state, connections, baselineRSS, [&]() {
+		const std::vector<float> &inputs = frames[frame++ % _numInputFrames];
+
+		rsc.setVisibleInputs(inputs.data(), inputs.size());
+
+		rsc.activate();
+		rsc.reconstruct();
+		rsc.learn(0.01f, 0.01f, 0.05f, 0.01f, 0.01f, 0.01f, 0.1f, 0.0f);
+		rsc.stepEnd();
+	});
+}
+
+// Argument: number of cells, with a quarter as many states
+void benchSDRRL(benchmark::State &state) {
+	int numCells = state.range(0);
+
+	std::mt19937 generator(1234);
+
+	std::vector<std::vector<float>> frames = makeInputFrames(numCells / 4 + 1, generator);
+
+	double baselineRSS = getBaselineRSS();
+
+	deep::SDRRL sdrrl;
+
+	sdrrl.createRandom(numCells / 4, 4, numCells, -0.01f, 0.01f, 0.01f, 0.05f, 0.1f, generator);
+
+	int frame = 0;
+
+	runSteps(state, countConnections(sdrrl), baselineRSS, [&]() {
+		const std::vector<float> &inputs = frames[frame++ % _numInputFrames];
+
+		for (int i = 0; i < sdrrl.getNumStates(); i++)
+			sdrrl.setState(i, inputs[i]);
+
+		sdrrl.simStep(inputs.back(), 0.065f, 0.995f, 0.005f, 0.05f, 0.002f, 0.004f, 0.01f, 48, 0.05f, 0.988f, 0.05f, 0.01f, 0.01f, 4.0f, generator);
+	});
+}
+
+// Argument: number of hidden units
+void benchFERL(benchmark::State &state) {
+	int numHidden = state.range(0);
+
+	const int numState = 64;
+	const int numAction = 8;
+	const int numReplaySamples = 64;
+
+	std::mt19937 generator(1234);
+
+	std::vector<std::vector<float>> frames = makeInputFrames(numState + 1, generator);
+
+	double baselineRSS = getBaselineRSS();
+
+	deep::FERL ferl;
+
+	ferl.createRandom(numState, numAction, numHidden, 0.1f, generator);
+
+	std::vector<float> inputs(numState);
+	std::vector<float> action;
+
+	int frame = 0;
+
+	runSteps(state, static_cast<long long>(numHidden) * ferl.getNumVisible(), baselineRSS, [&]() {
+		const std::vector<float> &f = frames[frame++ % _numInputFrames];
+
+		inputs.assign(f.begin(), f.begin() + numState);
+
+		ferl.step(inputs, action, f.back(), 0.5f, 0.99f, 0.98f, 0.1f, 1, 1, 0.05f, 0.01f, 0.05f, numReplaySamples, 0, 0.001f, generator);
+	});
+}
+
+// Argument: width of the first layer, the second is half as wide
+void benchCSRL(benchmark::State &state) {
+	int size = state.range(0);
+
+	const int inputsPerState = 4;
+
+	std::mt19937 generator(1234);
+
+	std::vector<deep::CSRL::LayerDesc> layerDescs(2);
+
+	layerDescs[0]._width = size;
+	layerDescs[0]._height = size;
+	layerDescs[1]._width = size / 2;
+	layerDescs[1]._height = size / 2;
+
+	int numColumns = size * size;
+
+	std::vector<std::vector<float>> frames = makeInputFrames(numColumns * inputsPerState + 1, generator);
+
+	double baselineRSS = getBaselineRSS();
+
+	deep::CSRL csrl;
+
+	csrl.createRandom(inputsPerState, layerDescs, -0.01f, 0.01f, 0.01f, 0.05f, 0.1f, generator);
+
+	long long connections = 0;
+
+	for (size_t l = 0; l < csrl.getLayers().size(); l++)
+		for (size_t c = 0; c < csrl.getLayers()[l]._columns.size(); c++)
+			connections += countConnections(csrl.getLayers()[l]._columns[c]._sou);
+
+	int frame = 0;
+
+	runSteps(state, connections, baselineRSS, [&]() {
+		const std::vector<float> &inputs = frames[frame++ % _numInputFrames];
+
+		for (int c = 0; c < numColumns; c++)
+			for (int i = 0; i < inputsPerState; i++)
+				csrl.setState(c, i, inputs[c * inputsPerState + i]);
+
+		csrl.simStep(1, inputs.back(), generator);
+	});
+}
+
+BENCHMARK(benchRSDR)->Arg(16)->Arg(32)->Arg(64)->Unit(benchmark::kMillisecond);
+BENCHMARK(benchIRSDR)->Arg(16)->Arg(32)->Arg(64)->Unit(benchmark::kMillisecond);
+BENCHMARK(benchPredictiveRSDR)->Arg(16)->Arg(32)->Arg(64)->Unit(benchmark::kMillisecond);
+BENCHMARK(benchIPredictiveRSDR)->Arg(16)->Arg(32)->Arg(64)->Unit(benchmark::kMillisecond);
+BENCHMARK(benchHTSL)->Arg(16)->Arg(32)->Arg(64)->Unit(benchmark::kMillisecond);
+BENCHMARK(benchRecurrentSparseCoder2D)->Arg(16)->Arg(32)->Arg(64)->Unit(benchmark::kMillisecond);
+BENCHMARK(benchSDRRL)->Arg(64)->Arg(256)->Arg(1024)->Unit(benchmark::kMillisecond);
+BENCHMARK(benchFERL)->Arg(256)->Arg(1024)->Arg(4096)->Unit(benchmark::kMillisecond);
+BENCHMARK(benchCSRL)->Arg(4)->Arg(8)->Arg(16)->Unit(benchmark::kMillisecond);
+
+BENCHMARK_MAIN();
\ No newline at end of file
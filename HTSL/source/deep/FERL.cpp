@@ -1,5 +1,7 @@
 #include "FERL.h"
 
+#include "../sdr/Checkpoint.h"
+
 #include <algorithm>
 
 #include <iostream>
@@ -335,8 +337,14 @@ void FERL::updateOnError(float error) {
 		_visible[vi]._bias._weight += error * _visible[vi]._state;
 }
 
-void FERL::saveToFile(std::ostream &os, bool saveReplayInformation) {
-	os << _hidden.size() << " " << _visible.size() << " " << _numState << " " << _numAction << " " << _zInv << " " << _prevValue << std::endl;
+void FERL::saveToFile(std::ostream &os, bool saveReplayInformation, Format format) const {
+	if (format == _binary) {
+		saveBinary(os, saveReplayInformation);
+
+		return;
+	}
+
+	os << _hidden.size() << " " << _visible.size() << " " << _numState << " " << _numAction << " " << _zInv << " " << _prevValue << "\n";
 
 	// Save hidden nodes
 	for (int k = 0; k < _hidden.size(); k++) {
@@ -345,28 +353,31 @@ void FERL::saveToFile(std::ostream &os, bool saveReplayInformation) {
 		for (int vi = 0; vi < _visible.size(); vi++)
 			os << " " << _hidden[k]._connections[vi]._weight;
 
-		os << std::endl;
+		os << "\n";
 	}
 
 	// Save visible nodes
 	for (int vi = 0; vi < _visible.size(); vi++)
-		os << _visible[vi]._state << " " << _visible[vi]._bias._weight << std::endl;
+		os << _visible[vi]._state << " " << _visible[vi]._bias._weight << "\n";
 
 	if (saveReplayInformation) {
-		os << "t" << _replaySamples.size() << std::endl;
+		os << "t " << _replaySamples.size() << "\n";
 
-		for (std::list<ReplaySample>::iterator it = _replaySamples.begin(); it != _replaySamples.end(); it++) {
+		for (std::list<ReplaySample>::const_iterator it = _replaySamples.begin(); it != _replaySamples.end(); it++) {
 			for (int i = 0; i < it->_visible.size(); i++)
 				os << it->_visible[i] << " ";
 
-			os << it->_q << std::endl;
+			os << it->_q << "\n";
 		}
 	}
 	else
-		os << "f" << std::endl;
+		os << "f" << "\n";
 }
 
-void FERL::loadFromFile(std::istream &is, bool loadReplayInformation) {
+bool FERL::loadFromFile(std::istream &is, bool loadReplayInformation, Format format) {
+	if (format == _binary)
+		return loadBinary(is, loadReplayInformation);
+
 	int numHidden, numVisible;
 
 	is >> numHidden >> numVisible >> _numState >> _numAction >> _zInv >> _prevValue;
@@ -413,4 +424,151 @@ void FERL::loadFromFile(std::istream &is, bool loadReplayInformation) {
 		else
 			std::cerr << "Stream does not contain replay information, but the application tried to load it!" << std::endl;
 	}
+
+	return !is.fail();
+}
+
+void FERL::saveBinary(std::ostream &os, bool saveReplayInformation) const {
+	sdr::CheckpointWriter writer(os);
+
+	writer.beginObject("deep::FERL", 1);
+
+	int numHidden = _hidden.size();
+	int numAction = _actions.size();
+
+	writer.write(numHidden);
+	writer.write(numAction);
+	writer.write(_numState);
+	writer.write(_numAction);
+	writer.write(_zInv);
+	writer.write(_prevValue);
+
+	writer.writeArray(_visible);
+
+	writer.writeField(numHidden, [&](int k) { return _hidden[k]._bias; });
+	writer.writeField(numHidden, [&](int k) { return _hidden[k]._state; });
+	writer.writeLists(numHidden, [&](int k) -> const std::vector<Connection> & { return _hidden[k]._connections; });
+
+	writer.writeField(numAction, [&](int a) { return _actions[a]._bias; });
+	writer.writeField(numAction, [&](int a) { return _actions[a]._state; });
+	writer.writeLists(numAction, [&](int a) -> const std::vector<Connection> & { return _actions[a]._connections; });
+
+	writer.writeArray(_prevVisible);
+	writer.writeArray(_prevHidden);
+
+	writer.write(static_cast<int>(saveReplayInformation));
+
+	if (saveReplayInformation) {
+		std::vector<const ReplaySample*> samples;
+		samples.reserve(_replaySamples.size());
+
+		for (std::list<ReplaySample>::const_iterator it = _replaySamples.begin(); it != _replaySamples.end(); it++)
+			samples.push_back(&*it);
+
+		int numSamples = samples.size();
+
+		writer.write(numSamples);
+
+		writer.writeLists(numSamples, [&](int i) -> const std::vector<float> & { return samples[i]->_visible; });
+		writer.writeField(numSamples, [&](int i) { return samples[i]->_originalQ; });
+		writer.writeField(numSamples, [&](int i) { return samples[i]->_q; });
+	}
+}
+
+bool FERL::loadBinary(std::istream &is, bool loadReplayInformation) {
+	// Read into a fresh FERL, so a failed load leaves this one unchanged. The replay samples are only replaced if the stream has them, so they move along
+	FERL loaded;
+
+	loaded._replaySamples.swap(_replaySamples);
+
+	if (!loaded.loadBinaryMembers(is, loadReplayInformation)) {
+		_replaySamples.swap(loaded._replaySamples);
+
+		return false;
+	}
+
+	*this = std::move(loaded);
+
+	return true;
+}
+
+bool FERL::loadBinaryMembers(std::istream &is, bool loadReplayInformation) {
+	sdr::CheckpointReader reader;
+
+	int numHidden, numAction;
+
+	if (!reader.open(is) || !reader.beginObject("deep::FERL", 1) || !reader.read(numHidden) || !reader.read(numAction) || !reader.canHold(numHidden) || !reader.canHold(numAction))
+		return false;
+
+	reader.read(_numState);
+	reader.read(_numAction);
+	reader.read(_zInv);
+	reader.read(_prevValue);
+
+	reader.readArray(_visible);
+
+	_hidden.clear();
+	_hidden.resize(numHidden);
+
+	reader.readField(numHidden, [&](int k) -> Connection & { return _hidden[k]._bias; });
+	reader.readField(numHidden, [&](int k) -> float & { return _hidden[k]._state; });
+	reader.readLists(numHidden, [&](int k) -> std::vector<Connection> & { return _hidden[k]._connections; });
+
+	_actions.clear();
+	_actions.resize(numAction);
+
+	reader.readField(numAction, [&](int a) -> Connection & { return _actions[a]._bias; });
+	reader.readField(numAction, [&](int a) -> float & { return _actions[a]._state; });
+	reader.readLists(numAction, [&](int a) -> std::vector<Connection> & { return _actions[a]._connections; });
+
+	reader.readArray(_prevVisible);
+	reader.readArray(_prevHidden);
+
+	int hasReplayInformation;
+
+	if (!reader.read(hasReplayInformation) || !reader.good())
+		return false;
+
+	// The layers are dense, so every connection list must cover the whole layer below
+	int numVisible = _visible.size();
+
+	if (_numState < 0 || _numAction != numAction || _numState > numVisible - numAction
+		|| _prevVisible.size() != _visible.size() || _prevHidden.size() != _hidden.size())
+		return false;
+
+	for (int k = 0; k < numHidden; k++)
+		if (_hidden[k]._connections.size() != _visible.size())
+			return false;
+
+	for (int a = 0; a < numAction; a++)
+		if (_actions[a]._connections.size() != _hidden.size())
+			return false;
+
+	if (loadReplayInformation) {
+		if (hasReplayInformation) {
+			int numSamples;
+
+			if (!reader.read(numSamples) || !reader.canHold(numSamples))
+				return false;
+
+			std::vector<ReplaySample> samples(numSamples);
+
+			reader.readLists(numSamples, [&](int i) -> std::vector<float> & { return samples[i]._visible; });
+			reader.readField(numSamples, [&](int i) -> float & { return samples[i]._originalQ; });
+			reader.readField(numSamples, [&](int i) -> float & { return samples[i]._q; });
+
+			if (!reader.good())
+				return false;
+
+			for (int i = 0; i < numSamples; i++)
+				if (samples[i]._visible.size() != _visible.size())
+					return false;
+
+			_replaySamples.assign(samples.begin(), samples.end());
+		}
+		else
+			std::cerr << "Stream does not contain replay information, but the application tried to load it!" << std::endl;
+	}
+
+	return reader.good();
 }
\ No newline at end of file
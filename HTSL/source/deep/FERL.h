@@ -8,6 +8,12 @@
 namespace deep {
 	class FERL {
 	public:
+		// _text is readable, for debugging. _binary is a checkpoint (see sdr/Checkpoint.h) that stores the weight matrices and replay samples as contiguous blocks.
+		// It is exact, and also holds the action weights and previous states
+		enum Format {
+			_text, _binary
+		};
+
 		static float sigmoid(float x) {
 			return 1.0f / (1.0f + std::exp(-x));
 		}
@@ -59,6 +65,12 @@ namespace deep {
 
 		std::list<ReplaySample> _replaySamples;
 
+		void saveBinary(std::ostream &os, bool saveReplayInformation) const;
+		bool loadBinary(std::istream &is, bool loadReplayInformation);
+
+		// The body of loadBinary, run on a freshly constructed FERL
+		bool loadBinaryMembers(std::istream &is, bool loadReplayInformation);
+
 	public:
 		FERL();
 
@@ -81,8 +93,9 @@ namespace deep {
 
 		float freeEnergy() const;
 
-		void saveToFile(std::ostream &os, bool saveReplayInformation = false);
-		void loadFromFile(std::istream &is, bool loadReplayInformation = false);
+		// Streams must be opened in binary mode for the _binary format. loadFromFile returns false if the stream could not be read
+		void saveToFile(std::ostream &os, bool saveReplayInformation = false, Format format = _text) const;
+		bool loadFromFile(std::istream &is, bool loadReplayInformation = false, Format format = _text);
 
 		float value() const {
 			return -freeEnergy() * _zInv;
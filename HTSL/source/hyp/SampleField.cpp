@@ -22,6 +22,7 @@ misrepresented as being the original software.
 #include "SampleField.h"
 
 #include <iostream>
+#include <cmath>
 
 #include <assert.h>
 
@@ -1,5 +1,8 @@
 #include "HTSL.h"
 
+#include "../sdr/Checkpoint.h"
+#include "../sdr/Trace.h"
+
 #include <algorithm>
 
 #include <iostream>
@@ -14,12 +17,17 @@ void HTSL::createRandom(int inputWidth, int inputHeight, const std::vector<Layer
 
 	_layers.resize(layerDescs.size());
 
+	setThreadPool(_threadPool);
+	setIncremental(_incremental, _refreshInterval);
+
 	_predictedInput.clear();
 	_predictedInput.assign(inputWidth * inputHeight, 0.0f);
 
 	_predictedInputPrev.clear();
 	_predictedInputPrev.assign(inputWidth * inputHeight, 0.0f);
 
+	_swapPredictions = false;
+
 	int prevWidth = inputWidth;
 	int prevHeight = inputHeight;
 
@@ -30,6 +38,7 @@ void HTSL::createRandom(int inputWidth, int inputHeight, const std::vector<Layer
 			_layerDescs[l]._receptiveRadius, _layerDescs[l]._inhibitionRadius, _layerDescs[l]._recurrentRadius, generator);
 
 		_layers[l]._predictionNodes.resize(layerDescs[l]._width * layerDescs[l]._height);
+		_layers[l]._activationColumns.assign(_layers[l]._predictionNodes.size(), 0.0f);
 
 		int lateralSize = std::pow(_layerDescs[l]._lateralRadius * 2 + 1, 2);
 		int feedbackSize = std::pow(_layerDescs[l]._feedbackRadius * 2 + 1, 2);
@@ -120,15 +129,30 @@ void HTSL::createRandom(int inputWidth, int inputHeight, const std::vector<Layer
 	}
 }
 
+void HTSL::setThreadPool(const std::shared_ptr<sdr::ThreadPool> &threadPool) {
+	_threadPool = threadPool;
+
+	for (int l = 0; l < _layers.size(); l++)
+		_layers[l]._rsc.setThreadPool(threadPool);
+}
+
+void HTSL::setIncremental(bool incremental, int refreshInterval) {
+	_incremental = incremental;
+	_refreshInterval = refreshInterval;
+
+	for (int l = 0; l < _layers.size(); l++)
+		_layers[l]._rsc.setIncremental(incremental, refreshInterval);
+}
+
 void HTSL::update() {
+	HTSL_TRACE_SCOPE("HTSL::update", -1);
+
 	// Up (feature extraction)
 	for (int l = 0; l < _layers.size(); l++) {
-		if (l != 0) {
-			int prevLayerIndex = l - 1;
+		HTSL_TRACE_SCOPE("HTSL::activate", l);
 
-			for (int vi = 0; vi < _layers[prevLayerIndex]._rsc.getNumHidden(); vi++)
-				_layers[l]._rsc.setVisibleInput(vi, _layers[prevLayerIndex]._rsc.getHiddenState(vi));
-		}
+		if (l != 0)
+			_layers[l]._rsc.setVisibleInputsFromHidden(_layers[l - 1]._rsc);
 
 		_layers[l]._rsc.activate();
 		_layers[l]._rsc.reconstruct();
@@ -136,106 +160,104 @@ void HTSL::update() {
 
 	// Down (predictions)
 	for (int l = _layers.size() - 1; l >= 0; l--) {
-		if (l == _layers.size() - 1) {
-			// Activations
-			for (int ni = 0; ni < _layers[l]._predictionNodes.size(); ni++) {
-				PredictionNode &node = _layers[l]._predictionNodes[ni];
-
-				float sum = 0.0f;// node._bias;
+		HTSL_TRACE_SCOPE("HTSL::predict", l);
 
-				for (int ci = 0; ci < node._lateralConnections.size(); ci++)
-					sum += node._lateralConnections[ci]._falloff * node._lateralConnections[ci]._weight * _layers[l]._rsc.getHiddenState(node._lateralConnections[ci]._index);
+		const RecurrentSparseCoder2D &rsc = _layers[l]._rsc;
 
-				node._activation = sum;
-			}
-		}
-		else {
-			// Activations
-			for (int ni = 0; ni < _layers[l]._predictionNodes.size(); ni++) {
+		// Activations
+		rsc.forEachHiddenTile([this, l, &rsc](int begin, int end) {
+			for (int ni = begin; ni < end; ni++) {
 				PredictionNode &node = _layers[l]._predictionNodes[ni];
 
 				float sum = 0.0f;// node._bias;
 
 				for (int ci = 0; ci < node._lateralConnections.size(); ci++)
-					sum += node._lateralConnections[ci]._falloff * node._lateralConnections[ci]._weight * _layers[l]._rsc.getHiddenState(node._lateralConnections[ci]._index);
+					sum += node._lateralConnections[ci]._falloff * node._lateralConnections[ci]._weight * rsc.getHiddenState(node._lateralConnections[ci]._index);
 
+				// Only layers below the top have feedback connections
 				for (int ci = 0; ci < node._feedbackConnections.size(); ci++)
 					sum += node._feedbackConnections[ci]._falloff * node._feedbackConnections[ci]._weight * _layers[l + 1]._predictionNodes[node._feedbackConnections[ci]._index]._state;
 
 				node._activation = sum;
+
+				_layers[l]._activationColumns[(ni % rsc.getHiddenWidth()) * rsc.getHiddenHeight() + ni / rsc.getHiddenWidth()] = sum;
 			}
-		}
+		});
+
+		// Inhibition compares against the activations of the neighbours
+		rsc.forEachHiddenTile([this, l, &rsc](int begin, int end) {
+			for (int ni = begin; ni < end; ni++) {
+				PredictionNode &node = _layers[l]._predictionNodes[ni];
 
-		for (int ni = 0; ni < _layers[l]._predictionNodes.size(); ni++) {
-			const RecurrentSparseCoder2D &rsc = _layers[l]._rsc;
+				node._state = rsc.inhibitedState(ni, _layers[l]._activationColumns.data(), node._activation, 1.0f);
 
-			PredictionNode &node = _layers[l]._predictionNodes[ni];
+				// Also update hidden usage
+				node._hiddenUsage = (1.0f - _layerDescs[l]._hiddenUsageDecay) * node._hiddenUsage + _layerDescs[l]._hiddenUsageDecay * rsc.getHiddenState(ni);
+			}
+		});
+	}
 
-			float inhibition = 0.0f;
+	// Reconstruct input. Gathers over the feed-forward transpose of the first layer, so each input sums in the same order as a scatter over the nodes
+	HTSL_TRACE_SCOPE("HTSL::predict", -1);
 
-			for (int ci = 0; ci < rsc._hidden[ni]._hiddenHiddenConnections.size(); ci++)
-				inhibition += rsc._hidden[ni]._hiddenHiddenConnections[ci]._weight * rsc._hidden[ni]._hiddenHiddenConnections[ci]._falloff * (_layers[l]._predictionNodes[rsc._hidden[ni]._hiddenHiddenConnections[ci]._index]._activation > node._activation ? 1.0f : 0.0f);
-				
-			node._state = (1.0f - inhibition * sigmoid(rsc._hidden[ni]._bias)) > 0.0f ? 1.0f : 0.0f;
+	const RecurrentSparseCoder2D &first = _layers.front()._rsc;
 
-			// Also update hidden usage
-			node._hiddenUsage = (1.0f - _layerDescs[l]._hiddenUsageDecay) * node._hiddenUsage + _layerDescs[l]._hiddenUsageDecay * rsc.getHiddenState(ni);
-		}
+	if (_swapPredictions) {
+		std::swap(_predictedInput, _predictedInputPrev);
+
+		_swapPredictions = false;
 	}
 
-	// Reconstruct input
-	for (int vi = 0; vi < _predictedInput.size(); vi++)
-		_predictedInput[vi] = 0.0f;
+	first.forEachVisibleTile([this, &first](int begin, int end) {
+		for (int vi = begin; vi < end; vi++) {
+			float prediction = 0.0f;
+			float sum = 0.0f;
 
-	std::vector<float> sums(_predictedInput.size(), 0.0f);
+			for (int ti = first._visibleTransposeOffsets[vi]; ti < first._visibleTransposeOffsets[vi + 1]; ti++) {
+				int hi = first._visibleTransposeTargets[ti];
 
-	for (int hi = 0; hi < _layers.front()._predictionNodes.size(); hi++) {
-		for (int ci = 0; ci < _layers.front()._rsc._hidden[hi]._visibleHiddenConnections.size(); ci++) {
-			_predictedInput[_layers.front()._rsc._hidden[hi]._visibleHiddenConnections[ci]._index] += _layers.front()._rsc._hidden[hi]._visibleHiddenConnections[ci]._weight * _layers.front()._predictionNodes[hi]._state;
+				float state = _layers.front()._predictionNodes[hi]._state;
 
-			sums[_layers.front()._rsc._hidden[hi]._visibleHiddenConnections[ci]._index] += _layers.front()._predictionNodes[hi]._state;
-		}
-	}
+				prediction += first._visibleWeights[first._visibleTransposeSlots[ti]] * state;
+				sum += state;
+			}
 
-	for (int vi = 0; vi < _predictedInput.size(); vi++)
-		_predictedInput[vi] /= std::max(0.0001f, sums[vi]);
+			_predictedInput[vi] = prediction / std::max(0.0001f, sum);
+		}
+	});
 }
 
 void HTSL::learn() {
+	HTSL_TRACE_SCOPE("HTSL::learn", -1);
+
 	for (int l = 0; l < _layers.size(); l++)
-		for (int ni = 0; ni < _layers[l]._predictionNodes.size(); ni++)
-			_layers[l]._rsc.setAttention(ni, 0.0f);
+		_layers[l]._rsc.forEachHiddenTile([this, l](int begin, int end) {
+			for (int ni = begin; ni < end; ni++)
+				_layers[l]._rsc.setAttention(ni, 0.0f);
+		});
 
 	for (int l = 0; l < _layers.size(); l++) {
-		for (int ni = 0; ni < _layers[l]._predictionNodes.size(); ni++) {
-			PredictionNode &node = _layers[l]._predictionNodes[ni];
-			
-			node._error = _layers[l]._rsc.getHiddenState(ni) - node._statePrev;
+		_layers[l]._rsc.forEachHiddenTile([this, l](int begin, int end) {
+			for (int ni = begin; ni < end; ni++) {
+				PredictionNode &node = _layers[l]._predictionNodes[ni];
 
-			_layers[l]._rsc.setAttention(ni, node._error < 0.25f ? 1.0f : 0.0f);
+				node._error = _layers[l]._rsc.getHiddenState(ni) - node._statePrev;
 
-			// Propagate prediction error back one step
-			//for (int ci = 0; ci < node._lateralConnections.size(); ci++)
-			//	_layers[l]._rsc.setAttention(node._lateralConnections[ci]._index, _layers[l]._rsc.getAttention(node._lateralConnections[ci]._index) + node._error * node._lateralConnections[ci]._weight);
+				_layers[l]._rsc.setAttention(ni, node._error < 0.25f ? 1.0f : 0.0f);
 
-			//for (int ci = 0; ci < node._feedbackConnections.size(); ci++)
-			//	_layers[l + 1]._rsc.setAttention(node._feedbackConnections[ci]._index, _layers[l + 1]._rsc.getAttention(node._feedbackConnections[ci]._index) + node._error * node._feedbackConnections[ci]._weight);
-		}
+				// Propagate prediction error back one step
+				//for (int ci = 0; ci < node._lateralConnections.size(); ci++)
+				//	_layers[l]._rsc.setAttention(node._lateralConnections[ci]._index, _layers[l]._rsc.getAttention(node._lateralConnections[ci]._index) + node._error * node._lateralConnections[ci]._weight);
+
+				//for (int ci = 0; ci < node._feedbackConnections.size(); ci++)
+				//	_layers[l + 1]._rsc.setAttention(node._feedbackConnections[ci]._index, _layers[l + 1]._rsc.getAttention(node._feedbackConnections[ci]._index) + node._error * node._feedbackConnections[ci]._weight);
+			}
+		});
 	}
 
 	for (int l = 0; l < _layers.size(); l++) {
-		if (l == _layers.size() - 1) {
-			for (int ni = 0; ni < _layers[l]._predictionNodes.size(); ni++) {
-				PredictionNode &node = _layers[l]._predictionNodes[ni];
-
-				node._bias += _layerDescs[l]._nodeBiasAlpha * node._error;
-
-				for (int ci = 0; ci < node._lateralConnections.size(); ci++)
-					node._lateralConnections[ci]._weight += _layerDescs[l]._nodeAlphaLateral * node._error * _layers[l]._rsc.getHiddenStatePrev(node._lateralConnections[ci]._index);
-			}
-		}
-		else {
-			for (int ni = 0; ni < _layers[l]._predictionNodes.size(); ni++) {
+		_layers[l]._rsc.forEachHiddenTile([this, l](int begin, int end) {
+			for (int ni = begin; ni < end; ni++) {
 				PredictionNode &node = _layers[l]._predictionNodes[ni];
 
 				node._bias += _layerDescs[l]._nodeBiasAlpha * node._error;
@@ -243,26 +265,151 @@ void HTSL::learn() {
 				for (int ci = 0; ci < node._lateralConnections.size(); ci++)
 					node._lateralConnections[ci]._weight += _layerDescs[l]._nodeAlphaLateral * node._error * _layers[l]._rsc.getHiddenStatePrev(node._lateralConnections[ci]._index);
 
+				// Only layers below the top have feedback connections
 				for (int ci = 0; ci < node._feedbackConnections.size(); ci++)
 					node._feedbackConnections[ci]._weight += _layerDescs[l]._nodeAlphaFeedback * node._error * _layers[l + 1]._predictionNodes[node._feedbackConnections[ci]._index]._statePrev;
 			}
-		}
+		});
 	}
 
-	for (int l = 0; l < _layers.size(); l++)
+	for (int l = 0; l < _layers.size(); l++) {
+		HTSL_TRACE_SCOPE("HTSL::learn", l);
+
 		_layers[l]._rsc.learn(_layerDescs[l]._rscAlpha, _layerDescs[l]._rscBetaVisible, _layerDescs[l]._rscBetaHidden, _layerDescs[l]._rscDeltaVisible, _layerDescs[l]._rscDeltaHidden, _layerDescs[l]._rscGamma, _layerDescs[l]._sparsity, 0.0f);
+	}
 }
 
 void HTSL::stepEnd() {
 	for (int l = 0; l < _layers.size(); l++) {
+		HTSL_TRACE_SCOPE("HTSL::stepEnd", l);
+
 		_layers[l]._rsc.stepEnd();
 
-		for (int ni = 0; ni < _layers[l]._predictionNodes.size(); ni++) {
-			_layers[l]._predictionNodes[ni]._activationPrev = _layers[l]._predictionNodes[ni]._activation;
-			_layers[l]._predictionNodes[ni]._statePrev = _layers[l]._predictionNodes[ni]._state;
-			_layers[l]._predictionNodes[ni]._reconstructedPredictionPrev = _layers[l]._predictionNodes[ni]._reconstructedPrediction;
-		}
+		_layers[l]._rsc.forEachHiddenTile([this, l](int begin, int end) {
+			for (int ni = begin; ni < end; ni++) {
+				_layers[l]._predictionNodes[ni]._activationPrev = _layers[l]._predictionNodes[ni]._activation;
+				_layers[l]._predictionNodes[ni]._statePrev = _layers[l]._predictionNodes[ni]._state;
+				_layers[l]._predictionNodes[ni]._reconstructedPredictionPrev = _layers[l]._predictionNodes[ni]._reconstructedPrediction;
+			}
+		});
+	}
+
+	_swapPredictions = true;
+}
+
+bool HTSL::save(const std::string &fileName) const {
+	return sdr::Checkpoint::saveToFile(*this, fileName);
+}
+
+bool HTSL::load(const std::string &fileName) {
+	return sdr::Checkpoint::loadFromFile(*this, fileName);
+}
+
+void HTSL::save(sdr::CheckpointWriter &writer) const {
+	writer.beginObject("sc::HTSL", 1);
+
+	writer.write(_inputWidth);
+	writer.write(_inputHeight);
+
+	writer.writeArray(_layerDescs);
+	writer.writeArray(_predictedInput);
+	writer.writeArray(_swapPredictions ? _predictedInput : _predictedInputPrev);
+
+	for (int l = 0; l < _layers.size(); l++) {
+		const std::vector<PredictionNode> &nodes = _layers[l]._predictionNodes;
+
+		int numNodes = nodes.size();
+
+		_layers[l]._rsc.save(writer);
+
+		writer.writeLists(numNodes, [&](int i) -> const std::vector<PredictionConnection> & { return nodes[i]._feedbackConnections; });
+		writer.writeLists(numNodes, [&](int i) -> const std::vector<PredictionConnection> & { return nodes[i]._lateralConnections; });
+
+		writer.writeField(numNodes, [&](int i) { return nodes[i]._activation; });
+		writer.writeField(numNodes, [&](int i) { return nodes[i]._activationPrev; });
+		writer.writeField(numNodes, [&](int i) { return nodes[i]._state; });
+		writer.writeField(numNodes, [&](int i) { return nodes[i]._statePrev; });
+		writer.writeField(numNodes, [&](int i) { return nodes[i]._hiddenUsage; });
+		writer.writeField(numNodes, [&](int i) { return nodes[i]._reconstructedPrediction; });
+		writer.writeField(numNodes, [&](int i) { return nodes[i]._reconstructedPredictionPrev; });
+		writer.writeField(numNodes, [&](int i) { return nodes[i]._bias; });
+		writer.writeField(numNodes, [&](int i) { return nodes[i]._error; });
+	}
+}
+
+bool HTSL::load(sdr::CheckpointReader &reader) {
+	// Read into a fresh HTSL with this one's settings, so a failed load leaves this one unchanged
+	HTSL loaded;
+
+	loaded._threadPool = _threadPool;
+	loaded._incremental = _incremental;
+	loaded._refreshInterval = _refreshInterval;
+
+	if (!loaded.loadMembers(reader))
+		return false;
+
+	*this = std::move(loaded);
+
+	return true;
+}
+
+bool HTSL::loadMembers(sdr::CheckpointReader &reader) {
+	if (!reader.beginObject("sc::HTSL", 1) || !reader.read(_inputWidth) || !reader.read(_inputHeight)
+		|| !reader.readArray(_layerDescs) || !reader.readArray(_predictedInput) || !reader.readArray(_predictedInputPrev))
+		return false;
+
+	_swapPredictions = false;
+
+	_layers.clear();
+	_layers.resize(_layerDescs.size());
+
+	setThreadPool(_threadPool);
+	setIncremental(_incremental, _refreshInterval);
+
+	for (int l = 0; l < _layers.size(); l++) {
+		std::vector<PredictionNode> &nodes = _layers[l]._predictionNodes;
+
+		if (!_layers[l]._rsc.load(reader))
+			return false;
+
+		// Each layer must take the one below it (or the input) and have the size of its description
+		const RecurrentSparseCoder2D &rsc = _layers[l]._rsc;
+
+		if (rsc.getVisibleWidth() != (l == 0 ? _inputWidth : _layerDescs[l - 1]._width) || rsc.getVisibleHeight() != (l == 0 ? _inputHeight : _layerDescs[l - 1]._height)
+			|| rsc.getHiddenWidth() != _layerDescs[l]._width || rsc.getHiddenHeight() != _layerDescs[l]._height)
+			return false;
+
+		int numNodes = _layers[l]._rsc.getNumHidden();
+
+		nodes.resize(numNodes);
+
+		_layers[l]._activationColumns.assign(numNodes, 0.0f);
+
+		// Feedback indices are checked once the layer above is loaded
+		reader.readLists(numNodes, [&](int i) -> std::vector<PredictionConnection> & { return nodes[i]._feedbackConnections; });
+		reader.readConnectionLists(numNodes, numNodes, [&](int i) -> std::vector<PredictionConnection> & { return nodes[i]._lateralConnections; });
+
+		reader.readField(numNodes, [&](int i) -> float & { return nodes[i]._activation; });
+		reader.readField(numNodes, [&](int i) -> float & { return nodes[i]._activationPrev; });
+		reader.readField(numNodes, [&](int i) -> float & { return nodes[i]._state; });
+		reader.readField(numNodes, [&](int i) -> float & { return nodes[i]._statePrev; });
+		reader.readField(numNodes, [&](int i) -> float & { return nodes[i]._hiddenUsage; });
+		reader.readField(numNodes, [&](int i) -> float & { return nodes[i]._reconstructedPrediction; });
+		reader.readField(numNodes, [&](int i) -> float & { return nodes[i]._reconstructedPredictionPrev; });
+		reader.readField(numNodes, [&](int i) -> float & { return nodes[i]._bias; });
+		reader.readField(numNodes, [&](int i) -> float & { return nodes[i]._error; });
+
+		if (!reader.good())
+			return false;
+	}
+
+	for (size_t l = 0; l < _layers.size(); l++) {
+		int numNext = l + 1 < _layers.size() ? static_cast<int>(_layers[l + 1]._predictionNodes.size()) : 0;
+
+		for (size_t pi = 0; pi < _layers[l]._predictionNodes.size(); pi++)
+			if (!sdr::Checkpoint::hasValidIndices(_layers[l]._predictionNodes[pi]._feedbackConnections, numNext))
+				return false;
 	}
 
-	_predictedInputPrev = _predictedInput;
+	return !_layers.empty() && _predictedInput.size() == static_cast<size_t>(_inputWidth * _inputHeight) && _predictedInputPrev.size() == _predictedInput.size();
 }
\ No newline at end of file
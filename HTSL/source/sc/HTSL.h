@@ -57,7 +57,7 @@ namespace sc {
 			float _weight;
 			float _falloff;
 
-			unsigned short _index;
+			int _index;
 		};
 
 		struct PredictionNode {
@@ -79,7 +79,7 @@ namespace sc {
 			float _error;
 
 			PredictionNode()
-				: _activation(0.0f), _activationPrev(0.0f), _state(0.0f), _statePrev(0.0f), _bias(0.0f), _error(0.0f), _hiddenUsage(1.0f), _reconstructedPrediction(0.0f)
+				: _activation(0.0f), _activationPrev(0.0f), _state(0.0f), _statePrev(0.0f), _hiddenUsage(1.0f), _reconstructedPrediction(0.0f), _bias(0.0f), _error(0.0f)
 			{}
 		};
 
@@ -87,6 +87,9 @@ namespace sc {
 			RecurrentSparseCoder2D _rsc;
 
 			std::vector<PredictionNode> _predictionNodes;
+
+			// Column-major copy of the prediction activations, which inhibition reads through the windows of the sparse coder
+			std::vector<float> _activationColumns;
 		};
 
 		std::vector<LayerDesc> _layerDescs;
@@ -95,9 +98,24 @@ namespace sc {
 		std::vector<float> _predictedInput;
 		std::vector<float> _predictedInputPrev;
 
+		// Set by stepEnd. The next update keeps the predictions as the previous ones by swapping the buffers, instead of stepEnd copying them, so they stay readable until then
+		bool _swapPredictions;
+
 		int _inputWidth, _inputHeight;
 
+		std::shared_ptr<sdr::ThreadPool> _threadPool;
+
+		bool _incremental;
+		int _refreshInterval;
+
+		// The body of load, run on a freshly constructed object
+		bool loadMembers(sdr::CheckpointReader &reader);
+
 	public:
+		HTSL()
+			: _swapPredictions(false), _inputWidth(0), _inputHeight(0), _incremental(false), _refreshInterval(64)
+		{}
+
 		void createRandom(int inputWidth, int inputHeight, const std::vector<LayerDesc> &layerDescs, std::mt19937 &generator);
 
 		void setInput(int index, float value) {
@@ -108,10 +126,20 @@ namespace sc {
 			_layers.front()._rsc.setVisibleInput(x, y, value);
 		}
 
+		// Whole input frame at once
+		void setInputs(const float* pInputs, size_t count) {
+			_layers.front()._rsc.setVisibleInputs(pInputs, count);
+		}
+
 		float getPrediction(int index) const {
 			return _predictedInput[index];
 		}
 
+		// Copies all predictions, as many as there are inputs
+		void getPredictions(float* pPredictions) const {
+			std::copy(_predictedInput.begin(), _predictedInput.end(), pPredictions);
+		}
+
 		float getPrediction(int x, int y) const {
 			return _predictedInput[x + y * _inputWidth];
 		}
@@ -128,6 +156,32 @@ namespace sc {
 		void learn();
 		void stepEnd();
 
+		// Binary checkpoint of the layer descriptions, weights and states (see sdr/Checkpoint.h). load returns false if the file holds no HTSL, and then leaves this one unchanged
+		bool save(const std::string &fileName) const;
+		bool load(const std::string &fileName);
+
+		void save(sdr::CheckpointWriter &writer) const;
+		bool load(sdr::CheckpointReader &reader);
+
+		// Every layer's nodes are split into tiles of rows that run in parallel on the pool, in update, learn and stepEnd. Results are identical to the serial path. Pass nullptr to go back to serial.
+		// Do not step the HTSL from a task of the same pool (see ThreadPool)
+		void setThreadPool(const std::shared_ptr<sdr::ThreadPool> &threadPool);
+
+		const std::shared_ptr<sdr::ThreadPool> &getThreadPool() const {
+			return _threadPool;
+		}
+
+		// Incremental activation of the sparse coders of all layers (see RecurrentSparseCoder2D::setIncremental), for input streams that change little between steps
+		void setIncremental(bool incremental, int refreshInterval = 64);
+
+		bool getIncremental() const {
+			return _incremental;
+		}
+
+		int getRefreshInterval() const {
+			return _refreshInterval;
+		}
+
 		std::vector<LayerDesc> &getLayerDescs() {
 			return _layerDescs;
 		}
@@ -2,8 +2,6 @@
 
 #include <algorithm>
 
-#include <iostream>
-
 using namespace sc;
 
 void HTSLPVLV::createRandom(int inputWidth, int inputHeight, const std::vector<InputType> &inputTypes, const std::vector<HTSL::LayerDesc> &layerDescs, std::mt19937 &generator) {
@@ -153,7 +151,8 @@ void HTSLPVLV::update(float reward, std::mt19937 &generator) {
 			_actionNodes[ni]._output = std::min(1.0f, std::max(0.0f, std::min(1.0f, std::max(0.0f, _actionNodes[ni]._state)) + perturbationDist(generator)));
 	}
 
-	std::cout << reward << " " << _expectedReward << " " << _expectedSecondaryE << " " << _expectedSecondaryI << " " << error << " " << (pvFilter ? "F" : "N") << std::endl;
+	if (_valueHook)
+		_valueHook(reward, _expectedReward, _expectedSecondaryE, _expectedSecondaryI, error, pvFilter);
 
 	_expectedReward = expectedReward;
 	_expectedSecondaryE = expectedSecondaryE;
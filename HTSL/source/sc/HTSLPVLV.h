@@ -3,17 +3,21 @@
 #include "HTSL.h"
 
 #include <assert.h>
+#include <functional>
 
 namespace sc {
 	class HTSLPVLV {
 	public:
+		// Debug introspection, called every update with the reward, the expected primary and secondary rewards, the learning error, and whether the primary value filter was on
+		typedef std::function<void(float reward, float expectedReward, float expectedSecondaryE, float expectedSecondaryI, float error, bool pvFilter)> ValueHook;
+
 		enum InputType {
 			_state, _action, _pv, _lve, _lvi
 		};
 
 	private:
 		struct Node {
-			unsigned short _inputIndex;
+			int _inputIndex;
 
 			float _state;
 			float _output;
@@ -37,6 +41,8 @@ namespace sc {
 		float _expectedSecondaryE;
 		float _expectedSecondaryI;
 
+		ValueHook _valueHook;
+
 	public:
 		float _actionRandomizeChance;
 		float _actionPerturbationStdDev;
@@ -95,6 +101,11 @@ namespace sc {
 
 		void update(float reward, std::mt19937 &generator);
 
+		// An empty hook disables it
+		void setValueHook(const ValueHook &valueHook) {
+			_valueHook = valueHook;
+		}
+
 		HTSL &getHTSL() {
 			return _htsl;
 		}
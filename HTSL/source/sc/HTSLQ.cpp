@@ -2,8 +2,6 @@
 
 #include <algorithm>
 
-#include <iostream>
-
 using namespace sc;
 
 void HTSLQ::createRandom(int inputWidth, int inputHeight, int actionQRadius, const std::vector<InputType> &inputTypes, const std::vector<HTSL::LayerDesc> &layerDescs, std::mt19937 &generator) {
@@ -205,7 +203,8 @@ void HTSLQ::update(float reward, std::mt19937 &generator) {
 		}
 	}
 
-	std::cout << newQ << " " << maxQ << " " << exploratoryQ << " " << learnAction << " " << _actionNodes[0]._state << std::endl;
+	if (_valueHook)
+		_valueHook(tdError, newQ);
 
 	for (int ni = 0; ni < _actionNodes.size(); ni++) {
 		_actionNodes[ni]._state = maxQAction[ni];// _htsl.getPrediction(_actionNodes[ni]._inputIndex);
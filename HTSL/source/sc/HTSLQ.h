@@ -3,10 +3,14 @@
 #include "HTSL.h"
 
 #include <assert.h>
+#include <functional>
 
 namespace sc {
 	class HTSLQ {
 	public:
+		// Debug introspection, called every update with the TD error and the new Q value
+		typedef std::function<void(float tdError, float q)> ValueHook;
+
 		enum InputType {
 			_state, _action, _q
 		};
@@ -19,7 +23,7 @@ namespace sc {
 			float _averageOutput;
 			float _targetWeight;
 			float _prevWeight;
-			unsigned short _index;
+			int _index;
 
 			Connection()
 				: _trace(0.0f), _lastOutput(0.0f), _averageOutput(0.0f), _targetWeight(0.0f), _prevWeight(0.0f)
@@ -29,7 +33,7 @@ namespace sc {
 		struct Node {
 			std::vector<Connection> _firstHiddenConnections;
 
-			unsigned short _inputIndex;
+			int _inputIndex;
 
 			float _state;
 			float _output;
@@ -53,6 +57,8 @@ namespace sc {
 		float _prevNewQ;
 		float _prevTdError;
 
+		ValueHook _valueHook;
+
 	public:
 		float _actionRandomizeChance;
 		float _actionPerturbationStdDev;
@@ -104,6 +110,11 @@ namespace sc {
 
 		void update(float reward, std::mt19937 &generator);
 
+		// An empty hook disables it
+		void setValueHook(const ValueHook &valueHook) {
+			_valueHook = valueHook;
+		}
+
 		HTSL &getHTSL() {
 			return _htsl;
 		}
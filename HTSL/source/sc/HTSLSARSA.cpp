@@ -2,8 +2,6 @@
 
 #include <algorithm>
 
-#include <iostream>
-
 using namespace sc;
 
 void HTSLSARSA::createRandom(int inputWidth, int inputHeight, int actionQRadius, const std::vector<InputType> &inputTypes, const std::vector<HTSL::LayerDesc> &layerDescs, std::mt19937 &generator) {
@@ -167,7 +165,8 @@ void HTSLSARSA::update(float reward, std::mt19937 &generator) {
 		}
 	}
 
-	std::cout << newQ << " " << learnAction << " " << _actionNodes[0]._state << std::endl;
+	if (_valueHook)
+		_valueHook(tdError, newQ);
 
 	std::uniform_real_distribution<float> dist01(0.0f, 1.0f);
 	std::normal_distribution<float> perturbationDist(0.0f, _actionPerturbationStdDev);
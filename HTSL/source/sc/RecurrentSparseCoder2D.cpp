@@ -1,5 +1,8 @@
 #include "RecurrentSparseCoder2D.h"
 
+#include "../sdr/Checkpoint.h"
+#include "../sdr/Kernels.h"
+
 #include <algorithm>
 
 #include <assert.h>
@@ -8,6 +11,10 @@
 
 using namespace sc;
 
+static float falloff(int dx, int dy, int radius) {
+	return std::max(0.0f, 1.0f - std::sqrt(static_cast<float>(dx * dx + dy * dy)) / static_cast<float>(radius + 1));
+}
+
 void RecurrentSparseCoder2D::createRandom(int visibleWidth, int visibleHeight, int hiddenWidth, int hiddenHeight, int receptiveRadius, int inhibitionRadius, int recurrentRadius, std::mt19937 &generator) {
 	std::uniform_real_distribution<float> weightDist(0.0f, 1.0f);
 
@@ -59,7 +66,7 @@ void RecurrentSparseCoder2D::createRandom(int visibleWidth, int visibleHeight, i
 
 					c._weight = weightDist(generator) * 2.0f - 1.0f;
 					c._index = vi;
-					c._falloff = std::max(0.0f, 1.0f - std::sqrt(static_cast<float>(dx * dx + dy * dy)) / static_cast<float>(receptiveRadius + 1));
+					c._falloff = falloff(dx, dy, receptiveRadius);
 
 					dist2 += c._weight * c._weight;
 
@@ -94,7 +101,7 @@ void RecurrentSparseCoder2D::createRandom(int visibleWidth, int visibleHeight, i
 
 					c._weight = weightDist(generator);
 					c._index = hio;
-					c._falloff = std::max(0.0f, 1.0f - std::sqrt(static_cast<float>(dx * dx + dy * dy)) / static_cast<float>(inhibitionRadius + 1));
+					c._falloff = falloff(dx, dy, inhibitionRadius);
 
 					dist2 += c._weight * c._weight;
 
@@ -127,7 +134,7 @@ void RecurrentSparseCoder2D::createRandom(int visibleWidth, int visibleHeight, i
 
 						c._weight = weightDist(generator);
 						c._index = hio;
-						c._falloff = std::max(0.0f, 1.0f - std::sqrt(static_cast<float>(dx * dx + dy * dy)) / static_cast<float>(recurrentRadius + 1));
+						c._falloff = falloff(dx, dy, recurrentRadius);
 
 						dist2 += c._weight * c._weight;
 
@@ -143,94 +150,502 @@ void RecurrentSparseCoder2D::createRandom(int visibleWidth, int visibleHeight, i
 				_hidden[hi]._hiddenPrevHiddenConnections[ci]._weight *= normFactor;
 		}
 	}
+
+	allocateBuffers();
+	buildTransposes();
+	buildWindows();
 }
 
-void RecurrentSparseCoder2D::activate(float excitation) {
-	// Activate
-	for (int hi = 0; hi < _hidden.size(); hi++) {
-		float sum = 0.0f;
+void RecurrentSparseCoder2D::allocateBuffers() {
+	int numVisible = _visible.size();
+	int numHidden = _hidden.size();
+
+	_inputColumns.assign(numVisible, 0.0f);
+	_statePrevColumns.assign(numHidden, 0.0f);
+	_activationColumns.assign(numHidden, 0.0f);
+
+	_visibleChanges.assign((_visibleWidth + 1) * (_visibleHeight + 1), 0);
+	_recurrentChanges.assign((_hiddenWidth + 1) * (_hiddenHeight + 1), 0);
+	_weightsChanged.assign(numHidden, false);
+
+	_changedVisible.clear();
+	_changedVisibleOld.clear();
+	_changedHidden.clear();
+	_changedHiddenOld.clear();
+
+	_changedVisible.reserve(numVisible);
+	_changedVisibleOld.reserve(numVisible);
+	_changedHidden.reserve(numHidden);
+	_changedHiddenOld.reserve(numHidden);
+
+	_visibleErrors.assign(numVisible, 0.0f);
+	_hiddenErrors.assign(numHidden, 0.0f);
+}
+
+void RecurrentSparseCoder2D::buildTransposes() {
+	int numVisible = _visible.size();
+	int numHidden = _hidden.size();
+
+	_visibleTransposeOffsets.assign(numVisible + 1, 0);
+	_recurrentTransposeOffsets.assign(numHidden + 1, 0);
 
+	for (int hi = 0; hi < numHidden; hi++) {
+		for (int ci = 0; ci < _hidden[hi]._visibleHiddenConnections.size(); ci++)
+			_visibleTransposeOffsets[_hidden[hi]._visibleHiddenConnections[ci]._index + 1]++;
+
+		for (int ci = 0; ci < _hidden[hi]._hiddenPrevHiddenConnections.size(); ci++)
+			_recurrentTransposeOffsets[_hidden[hi]._hiddenPrevHiddenConnections[ci]._index + 1]++;
+	}
+
+	for (int vi = 0; vi < numVisible; vi++)
+		_visibleTransposeOffsets[vi + 1] += _visibleTransposeOffsets[vi];
+
+	for (int hi = 0; hi < numHidden; hi++)
+		_recurrentTransposeOffsets[hi + 1] += _recurrentTransposeOffsets[hi];
+
+	_visibleTransposeTargets.resize(_visibleTransposeOffsets.back());
+	_visibleTransposeSlots.resize(_visibleTransposeOffsets.back());
+	_visibleTransposeFalloffs.resize(_visibleTransposeOffsets.back());
+	_recurrentTransposeTargets.resize(_recurrentTransposeOffsets.back());
+	_recurrentTransposeSlots.resize(_recurrentTransposeOffsets.back());
+	_recurrentTransposeFalloffs.resize(_recurrentTransposeOffsets.back());
+
+	std::vector<int> visibleFill(_visibleTransposeOffsets.begin(), _visibleTransposeOffsets.end() - 1);
+	std::vector<int> recurrentFill(_recurrentTransposeOffsets.begin(), _recurrentTransposeOffsets.end() - 1);
+
+	// The flat weights are the connection lists one after the other (see buildWindows)
+	int visibleWeightsOffset = 0;
+	int recurrentWeightsOffset = 0;
+
+	for (int hi = 0; hi < numHidden; hi++) {
 		for (int ci = 0; ci < _hidden[hi]._visibleHiddenConnections.size(); ci++) {
-			float delta = _visible[_hidden[hi]._visibleHiddenConnections[ci]._index]._input - _hidden[hi]._visibleHiddenConnections[ci]._weight;
+			int ti = visibleFill[_hidden[hi]._visibleHiddenConnections[ci]._index]++;
 
-			sum += _hidden[hi]._visibleHiddenConnections[ci]._falloff * delta * delta;
+			_visibleTransposeTargets[ti] = hi;
+			_visibleTransposeSlots[ti] = visibleWeightsOffset + ci;
+			_visibleTransposeFalloffs[ti] = _hidden[hi]._visibleHiddenConnections[ci]._falloff;
 		}
 
 		for (int ci = 0; ci < _hidden[hi]._hiddenPrevHiddenConnections.size(); ci++) {
-			float delta = _hidden[_hidden[hi]._hiddenPrevHiddenConnections[ci]._index]._statePrev - _hidden[hi]._hiddenPrevHiddenConnections[ci]._weight;
+			int ti = recurrentFill[_hidden[hi]._hiddenPrevHiddenConnections[ci]._index]++;
 
-			sum += _hidden[hi]._hiddenPrevHiddenConnections[ci]._falloff * delta * delta;
+			_recurrentTransposeTargets[ti] = hi;
+			_recurrentTransposeSlots[ti] = recurrentWeightsOffset + ci;
+			_recurrentTransposeFalloffs[ti] = _hidden[hi]._hiddenPrevHiddenConnections[ci]._falloff;
 		}
 
-		_hidden[hi]._activation = -sum;
+		visibleWeightsOffset += _hidden[hi]._visibleHiddenConnections.size();
+		recurrentWeightsOffset += _hidden[hi]._hiddenPrevHiddenConnections.size();
 	}
+}
 
-	// Inhibit
-	for (int hi = 0; hi < _hidden.size(); hi++) {
-		float inhibition = 0.0f;
+bool RecurrentSparseCoder2D::buildWindows() {
+	int numHidden = _hidden.size();
 
-		for (int ci = 0; ci < _hidden[hi]._hiddenHiddenConnections.size(); ci++)
-			inhibition += _hidden[hi]._hiddenHiddenConnections[ci]._weight * _hidden[hi]._hiddenHiddenConnections[ci]._falloff * (_hidden[_hidden[hi]._hiddenHiddenConnections[ci]._index]._activation > _hidden[hi]._activation ? 1.0f : 0.0f);
+	int receptiveDim = _receptiveRadius * 2 + 1;
+	int recurrentDim = _recurrentRadius * 2 + 1;
+	int inhibitionDim = _inhibitionRadius * 2 + 1;
 
-		_hidden[hi]._state = (excitation - inhibition * sigmoid(_hidden[hi]._bias)) > 0.0f ? 1.0f : 0.0f;
+	_receptiveFalloffs.resize(receptiveDim * receptiveDim);
+
+	for (int dx = -_receptiveRadius; dx <= _receptiveRadius; dx++)
+		for (int dy = -_receptiveRadius; dy <= _receptiveRadius; dy++)
+			_receptiveFalloffs[(dx + _receptiveRadius) * receptiveDim + dy + _receptiveRadius] = falloff(dx, dy, _receptiveRadius);
+
+	_recurrentFalloffs.resize(std::max(0, recurrentDim * recurrentDim));
+
+	for (int dx = -_recurrentRadius; dx <= _recurrentRadius; dx++)
+		for (int dy = -_recurrentRadius; dy <= _recurrentRadius; dy++)
+			_recurrentFalloffs[(dx + _recurrentRadius) * recurrentDim + dy + _recurrentRadius] = falloff(dx, dy, _recurrentRadius);
+
+	_inhibitionFalloffs.resize(inhibitionDim * inhibitionDim);
+
+	for (int dx = -_inhibitionRadius; dx <= _inhibitionRadius; dx++)
+		for (int dy = -_inhibitionRadius; dy <= _inhibitionRadius; dy++)
+			_inhibitionFalloffs[(dx + _inhibitionRadius) * inhibitionDim + dy + _inhibitionRadius] = falloff(dx, dy, _inhibitionRadius);
+
+	_visibleWindows.resize(numHidden);
+	_recurrentWindows.resize(numHidden);
+	_inhibitionWindows.resize(numHidden);
+	_visibleWeights.clear();
+	_recurrentWeights.clear();
+	_inhibitionWeights.clear();
+
+	// Same centers as in createRandom
+	float hiddenToVisibleWidth = static_cast<float>(_visibleWidth - 1) / static_cast<float>(_hiddenWidth - 1);
+	float hiddenToVisibleHeight = static_cast<float>(_visibleHeight - 1) / static_cast<float>(_hiddenHeight - 1);
+
+	for (int hi = 0; hi < numHidden; hi++) {
+		int hx = hi % _hiddenWidth;
+		int hy = hi / _hiddenWidth;
+
+		int centerX = std::round(hx * hiddenToVisibleWidth);
+		int centerY = std::round(hy * hiddenToVisibleHeight);
+
+		if (!buildWindow(_hidden[hi]._visibleHiddenConnections, _visibleWidth, centerX, centerY, _receptiveRadius, _receptiveFalloffs, _visibleWindows[hi], _visibleWeights)
+			|| !buildWindow(_hidden[hi]._hiddenPrevHiddenConnections, _hiddenWidth, hx, hy, _recurrentRadius, _recurrentFalloffs, _recurrentWindows[hi], _recurrentWeights)
+			|| !buildInhibitionWindow(_hidden[hi]._hiddenHiddenConnections, hx, hy, _inhibitionWindows[hi]))
+			return false;
 	}
+
+	_activateAll = true;
+
+	return true;
 }
 
-void RecurrentSparseCoder2D::reconstruct() {
-	std::vector<float> visibleSums(_visible.size(), 0.0f);
-	std::vector<float> hiddenSums(_hidden.size(), 0.0f);
+bool RecurrentSparseCoder2D::buildInhibitionWindow(const std::vector<HiddenConnection> &connections, int hx, int hy, Window &window) {
+	window._weightsOffset = _inhibitionWeights.size();
 
-	for (int vi = 0; vi < _visible.size(); vi++)
-		_visible[vi]._reconstruction = 0.0f;
+	// The clipped square around the node, as createRandom made it, minus the node itself
+	window._x = std::max(0, hx - _inhibitionRadius);
+	window._y = std::max(0, hy - _inhibitionRadius);
+	window._width = std::min(_hiddenWidth, hx + _inhibitionRadius + 1) - window._x;
+	window._height = std::min(_hiddenHeight, hy + _inhibitionRadius + 1) - window._y;
 
-	for (int hi = 0; hi < _hidden.size(); hi++)
-		_hidden[hi]._reconstruction = 0.0f;
+	if (static_cast<int>(connections.size()) + 1 != window._width * window._height)
+		return false;
 
-	for (int hi = 0; hi < _hidden.size(); hi++) {
-		for (int ci = 0; ci < _hidden[hi]._visibleHiddenConnections.size(); ci++) {
-			_visible[_hidden[hi]._visibleHiddenConnections[ci]._index]._reconstruction += _hidden[hi]._visibleHiddenConnections[ci]._weight * _hidden[hi]._state;
-			visibleSums[_hidden[hi]._visibleHiddenConnections[ci]._index] += _hidden[hi]._state;
+	int dim = _inhibitionRadius * 2 + 1;
+
+	window._falloffsOffset = (window._x - hx + _inhibitionRadius) * dim + window._y - hy + _inhibitionRadius;
+
+	int ci = 0;
+
+	for (int x = window._x; x < window._x + window._width; x++)
+		for (int y = window._y; y < window._y + window._height; y++) {
+			if (x == hx && y == hy) {
+				_inhibitionWeights.push_back(0.0f);
+
+				continue;
+			}
+
+			if (connections[ci]._index != x + y * _hiddenWidth || connections[ci]._weight < 0.0f || connections[ci]._falloff != _inhibitionFalloffs[(x - hx + _inhibitionRadius) * dim + y - hy + _inhibitionRadius])
+				return false;
+
+			_inhibitionWeights.push_back(connections[ci]._weight);
+
+			ci++;
 		}
 
-		for (int ci = 0; ci < _hidden[hi]._hiddenPrevHiddenConnections.size(); ci++) {
-			_hidden[_hidden[hi]._hiddenPrevHiddenConnections[ci]._index]._reconstruction += _hidden[hi]._hiddenPrevHiddenConnections[ci]._weight * _hidden[hi]._state;
-			hiddenSums[_hidden[hi]._hiddenPrevHiddenConnections[ci]._index] += _hidden[hi]._state;
+	return true;
+}
+
+bool RecurrentSparseCoder2D::buildWindow(const std::vector<VisibleConnection> &connections, int width, int centerX, int centerY, int radius, const std::vector<float> &falloffs, Window &window, std::vector<float> &weights) {
+	window._weightsOffset = weights.size();
+
+	if (connections.empty()) {
+		window._x = window._y = window._width = window._height = window._falloffsOffset = 0;
+
+		return true;
+	}
+
+	int numConnections = connections.size();
+
+	window._x = connections.front()._index % width;
+	window._y = connections.front()._index / width;
+
+	window._height = 1;
+
+	while (window._height < numConnections && connections[window._height]._index == connections.front()._index + window._height * width)
+		window._height++;
+
+	window._width = numConnections / window._height;
+
+	if (window._width * window._height != numConnections)
+		return false;
+
+	int dim = radius * 2 + 1;
+
+	window._falloffsOffset = (window._x - centerX + radius) * dim + window._y - centerY + radius;
+
+	for (int ci = 0; ci < numConnections; ci++) {
+		int x = window._x + ci / window._height;
+		int y = window._y + ci % window._height;
+
+		int dx = x - centerX;
+		int dy = y - centerY;
+
+		if (x >= width || connections[ci]._index != x + y * width || std::abs(dx) > radius || std::abs(dy) > radius || connections[ci]._falloff != falloffs[(dx + radius) * dim + dy + radius])
+			return false;
+
+		weights.push_back(connections[ci]._weight);
+	}
+
+	return true;
+}
+
+void RecurrentSparseCoder2D::activate(float excitation) {
+	gatherInputs();
+
+	if (_incremental && _stepsSinceRefresh >= _refreshInterval)
+		_activateAll = true;
+
+	// Scattering a change costs a few times more per connection than the full sums do, so too many changes are summed in full
+	if (_incremental && !_activateAll) {
+		int scattered = 0;
+
+		for (int i = 0; i < _changedVisible.size(); i++)
+			scattered += _visibleTransposeOffsets[_changedVisible[i] + 1] - _visibleTransposeOffsets[_changedVisible[i]];
+
+		for (int i = 0; i < _changedHidden.size(); i++)
+			scattered += _recurrentTransposeOffsets[_changedHidden[i] + 1] - _recurrentTransposeOffsets[_changedHidden[i]];
+
+		if (scattered * 8 > _visibleWeights.size() + _recurrentWeights.size())
+			_activateAll = true;
+	}
+
+	// Inhibition compares against the activations of the neighbours, so all activations are done first
+	if (_incremental && !_activateAll) {
+		activateIncremental();
+
+		_stepsSinceRefresh++;
+	}
+	else {
+		forEachHiddenTile([this](int begin, int end) {
+			activateRange(begin, end);
+		});
+
+		_stepsSinceRefresh = 0;
+	}
+
+	_activateAll = false;
+
+	for (int x = 0; x < _hiddenWidth; x++)
+		for (int y = 0; y < _hiddenHeight; y++)
+			_activationColumns[x * _hiddenHeight + y] = _hidden[x + y * _hiddenWidth]._activation;
+
+	forEachHiddenTile([this, excitation](int begin, int end) {
+		inhibitRange(begin, end, excitation);
+	});
+}
+
+void RecurrentSparseCoder2D::gatherInputs() {
+	_changedVisible.clear();
+	_changedVisibleOld.clear();
+	_changedHidden.clear();
+	_changedHiddenOld.clear();
+
+	// Column-major, and with _skipUnchanged the summed-area tables of what changed. The tables have a leading row and column of zeros
+	for (int x = 0; x < _visibleWidth; x++)
+		for (int y = 0; y < _visibleHeight; y++) {
+			float input = _visible[x + y * _visibleWidth]._input;
+			float &column = _inputColumns[x * _visibleHeight + y];
+
+			if (_skipUnchanged) {
+				int stride = _visibleHeight + 1;
+				int* pChanges = &_visibleChanges[(x + 1) * stride + y + 1];
+
+				*pChanges = (input != column ? 1 : 0) + pChanges[-1] + pChanges[-stride] - pChanges[-stride - 1];
+			}
+
+			if (_incremental && input != column) {
+				_changedVisible.push_back(x + y * _visibleWidth);
+				_changedVisibleOld.push_back(column);
+			}
+
+			column = input;
 		}
+
+	for (int x = 0; x < _hiddenWidth; x++)
+		for (int y = 0; y < _hiddenHeight; y++) {
+			float statePrev = _hidden[x + y * _hiddenWidth]._statePrev;
+			float &column = _statePrevColumns[x * _hiddenHeight + y];
+
+			if (_skipUnchanged) {
+				int stride = _hiddenHeight + 1;
+				int* pChanges = &_recurrentChanges[(x + 1) * stride + y + 1];
+
+				*pChanges = (statePrev != column ? 1 : 0) + pChanges[-1] + pChanges[-stride] - pChanges[-stride - 1];
+			}
+
+			if (_incremental && statePrev != column) {
+				_changedHidden.push_back(x + y * _hiddenWidth);
+				_changedHiddenOld.push_back(column);
+			}
+
+			column = statePrev;
+		}
+}
+
+// Number of changes in a window, from a column-major summed-area table of a layer with the given height
+static int countChanges(const std::vector<int> &changes, int height, int x, int y, int windowWidth, int windowHeight) {
+	int stride = height + 1;
+
+	return changes[(x + windowWidth) * stride + y + windowHeight] - changes[x * stride + y + windowHeight] - changes[(x + windowWidth) * stride + y] + changes[x * stride + y];
+}
+
+float RecurrentSparseCoder2D::distance(int hi) const {
+	const Window &visibleWindow = _visibleWindows[hi];
+	const Window &recurrentWindow = _recurrentWindows[hi];
+
+	// Window columns are the rows of the kernel
+	float sum = sdr::Kernels::windowWeightedDistance(_inputColumns.data() + visibleWindow._x * _visibleHeight + visibleWindow._y, _visibleHeight,
+		_visibleWeights.data() + visibleWindow._weightsOffset, visibleWindow._height, _receptiveFalloffs.data() + visibleWindow._falloffsOffset, _receptiveRadius * 2 + 1,
+		0.0f, visibleWindow._height, visibleWindow._width);
+
+	return sdr::Kernels::windowWeightedDistance(_statePrevColumns.data() + recurrentWindow._x * _hiddenHeight + recurrentWindow._y, _hiddenHeight,
+		_recurrentWeights.data() + recurrentWindow._weightsOffset, recurrentWindow._height, _recurrentFalloffs.data() + recurrentWindow._falloffsOffset, _recurrentRadius * 2 + 1,
+		sum, recurrentWindow._height, recurrentWindow._width);
+}
+
+void RecurrentSparseCoder2D::activateRange(int begin, int end) {
+	for (int hi = begin; hi < end; hi++) {
+		const Window &visibleWindow = _visibleWindows[hi];
+		const Window &recurrentWindow = _recurrentWindows[hi];
+
+		if (_skipUnchanged && !_activateAll && !_weightsChanged[hi]
+			&& countChanges(_visibleChanges, _visibleHeight, visibleWindow._x, visibleWindow._y, visibleWindow._width, visibleWindow._height) == 0
+			&& countChanges(_recurrentChanges, _hiddenHeight, recurrentWindow._x, recurrentWindow._y, recurrentWindow._width, recurrentWindow._height) == 0)
+			continue;
+
+		_hidden[hi]._activation = -distance(hi);
+
+		_weightsChanged[hi] = false;
 	}
+}
 
-	for (int vi = 0; vi < _visible.size(); vi++)
-		_visible[vi]._reconstruction /= std::max(0.0001f, visibleSums[vi]);
+void RecurrentSparseCoder2D::activateIncremental() {
+	// The changes are few, so they are scattered serially over the transposes, to the nodes that read them
+	for (int i = 0; i < _changedVisible.size(); i++) {
+		int vi = _changedVisible[i];
 
-	for (int hi = 0; hi < _hidden.size(); hi++)
-		_hidden[hi]._reconstruction /= std::max(0.0001f, hiddenSums[hi]);
+		// f (x - w)^2 - f (xOld - w)^2 = f (x - xOld) (x + xOld - 2 w)
+		float change = _visible[vi]._input - _changedVisibleOld[i];
+		float sum = _visible[vi]._input + _changedVisibleOld[i];
+
+		for (int ti = _visibleTransposeOffsets[vi]; ti < _visibleTransposeOffsets[vi + 1]; ti++) {
+			int hi = _visibleTransposeTargets[ti];
+
+			if (!_weightsChanged[hi])
+				_hidden[hi]._activation -= _visibleTransposeFalloffs[ti] * change * (sum - 2.0f * _visibleWeights[_visibleTransposeSlots[ti]]);
+		}
+	}
+
+	for (int i = 0; i < _changedHidden.size(); i++) {
+		int si = _changedHidden[i];
+
+		float change = _hidden[si]._statePrev - _changedHiddenOld[i];
+		float sum = _hidden[si]._statePrev + _changedHiddenOld[i];
+
+		for (int ti = _recurrentTransposeOffsets[si]; ti < _recurrentTransposeOffsets[si + 1]; ti++) {
+			int hi = _recurrentTransposeTargets[ti];
+
+			if (!_weightsChanged[hi])
+				_hidden[hi]._activation -= _recurrentTransposeFalloffs[ti] * change * (sum - 2.0f * _recurrentWeights[_recurrentTransposeSlots[ti]]);
+		}
+	}
+
+	// Nodes with new weights are summed in full
+	forEachHiddenTile([this](int begin, int end) {
+		for (int hi = begin; hi < end; hi++)
+			if (_weightsChanged[hi]) {
+				_hidden[hi]._activation = -distance(hi);
+
+				_weightsChanged[hi] = false;
+			}
+	});
 }
 
-void RecurrentSparseCoder2D::learn(float alpha, float betaVisible, float betaHidden, float deltaVisible, float deltaHidden, float gamma, float sparsity, float learnTolerance) {
-	std::vector<float> visibleErrors(_visible.size(), 0.0f);
-	std::vector<float> hiddenErrors(_hidden.size(), 0.0f);
+void RecurrentSparseCoder2D::inhibitRange(int begin, int end, float excitation) {
+	for (int hi = begin; hi < end; hi++)
+		_hidden[hi]._state = inhibitedState(hi, _activationColumns.data(), _hidden[hi]._activation, excitation);
+}
+
+float RecurrentSparseCoder2D::inhibitedState(int hi, const float* pActivationColumns, float activation, float excitation) const {
+	const Window &window = _inhibitionWindows[hi];
+
+	// The slot of the node itself has a 0 weight, and is not more active than the node anyway
+	float inhibition = sdr::Kernels::windowMaskedSum(pActivationColumns + window._x * _hiddenHeight + window._y, _hiddenHeight,
+		_inhibitionWeights.data() + window._weightsOffset, window._height, _inhibitionFalloffs.data() + window._falloffsOffset, _inhibitionRadius * 2 + 1,
+		activation, window._height, window._width);
+
+	return (excitation - inhibition * sigmoid(_hidden[hi]._bias)) > 0.0f ? 1.0f : 0.0f;
+}
 
+void RecurrentSparseCoder2D::reconstruct() {
+	forEachVisibleTile([this](int begin, int end) {
+		for (int vi = begin; vi < end; vi++) {
+			float recon = 0.0f;
+			float sum = 0.0f;
+
+			for (int ti = _visibleTransposeOffsets[vi]; ti < _visibleTransposeOffsets[vi + 1]; ti++) {
+				float state = _hidden[_visibleTransposeTargets[ti]]._state;
+
+				recon += _visibleWeights[_visibleTransposeSlots[ti]] * state;
+				sum += state;
+			}
+
+			_visible[vi]._reconstruction = recon / std::max(0.0001f, sum);
+		}
+	});
+
+	forEachHiddenTile([this](int begin, int end) {
+		for (int hi = begin; hi < end; hi++) {
+			float recon = 0.0f;
+			float sum = 0.0f;
+
+			for (int ti = _recurrentTransposeOffsets[hi]; ti < _recurrentTransposeOffsets[hi + 1]; ti++) {
+				float state = _hidden[_recurrentTransposeTargets[ti]]._state;
+
+				recon += _recurrentWeights[_recurrentTransposeSlots[ti]] * state;
+				sum += state;
+			}
+
+			_hidden[hi]._reconstruction = recon / std::max(0.0001f, sum);
+		}
+	});
+}
+
+void RecurrentSparseCoder2D::learn(float alpha, float betaVisible, float betaHidden, float deltaVisible, float deltaHidden, float gamma, float sparsity, float learnTolerance) {
 	for (int vi = 0; vi < _visible.size(); vi++)
-		visibleErrors[vi] = _visible[vi]._input - _visible[vi]._reconstruction;
+		_visibleErrors[vi] = _visible[vi]._input - _visible[vi]._reconstruction;
 
 	for (int vi = 0; vi < _hidden.size(); vi++)
-		hiddenErrors[vi] = _hidden[vi]._statePrev - _hidden[vi]._reconstruction;
+		_hiddenErrors[vi] = _hidden[vi]._statePrev - _hidden[vi]._reconstruction;
+
+	forEachHiddenTile([&](int begin, int end) {
+		learnRange(begin, end, alpha, betaVisible, betaHidden, gamma, sparsity);
+	});
+}
 
+void RecurrentSparseCoder2D::learnRange(int begin, int end, float alpha, float betaVisible, float betaHidden, float gamma, float sparsity) {
 	float sparsitySquared = sparsity * sparsity;
 
-	for (int hi = 0; hi < _hidden.size(); hi++) {
+	for (int hi = begin; hi < end; hi++) {
 		float learn = _hidden[hi]._state;
 
 		if (learn > 0.0f) {
-			for (int ci = 0; ci < _hidden[hi]._visibleHiddenConnections.size(); ci++)
-				_hidden[hi]._visibleHiddenConnections[ci]._weight += betaVisible * learn * visibleErrors[_hidden[hi]._visibleHiddenConnections[ci]._index];
+			float* pVisibleWeights = _visibleWeights.data() + _visibleWindows[hi]._weightsOffset;
+			float* pRecurrentWeights = _recurrentWeights.data() + _recurrentWindows[hi]._weightsOffset;
 
-			for (int ci = 0; ci < _hidden[hi]._hiddenPrevHiddenConnections.size(); ci++)
-				_hidden[hi]._hiddenPrevHiddenConnections[ci]._weight += betaHidden * learn * _hidden[hi]._attention * hiddenErrors[_hidden[hi]._hiddenPrevHiddenConnections[ci]._index];
+			for (int ci = 0; ci < _hidden[hi]._visibleHiddenConnections.size(); ci++) {
+				_hidden[hi]._visibleHiddenConnections[ci]._weight += betaVisible * learn * _visibleErrors[_hidden[hi]._visibleHiddenConnections[ci]._index];
+
+				pVisibleWeights[ci] = _hidden[hi]._visibleHiddenConnections[ci]._weight;
+			}
+
+			for (int ci = 0; ci < _hidden[hi]._hiddenPrevHiddenConnections.size(); ci++) {
+				_hidden[hi]._hiddenPrevHiddenConnections[ci]._weight += betaHidden * learn * _hidden[hi]._attention * _hiddenErrors[_hidden[hi]._hiddenPrevHiddenConnections[ci]._index];
+
+				pRecurrentWeights[ci] = _hidden[hi]._hiddenPrevHiddenConnections[ci]._weight;
+			}
+
+			_weightsChanged[hi] = true;
 		}
 
-		for (int ci = 0; ci < _hidden[hi]._hiddenHiddenConnections.size(); ci++)
+		// The flat weights skip the slot of the node itself
+		const Window &inhibitionWindow = _inhibitionWindows[hi];
+
+		float* pInhibitionWeights = _inhibitionWeights.data() + inhibitionWindow._weightsOffset;
+
+		int selfSlot = (hi % _hiddenWidth - inhibitionWindow._x) * inhibitionWindow._height + hi / _hiddenWidth - inhibitionWindow._y;
+
+		for (int ci = 0; ci < _hidden[hi]._hiddenHiddenConnections.size(); ci++) {
 			_hidden[hi]._hiddenHiddenConnections[ci]._weight = std::max(0.0f, _hidden[hi]._hiddenHiddenConnections[ci]._weight + alpha * (_hidden[hi]._state * (_hidden[_hidden[hi]._hiddenHiddenConnections[ci]._index]._activation < _hidden[hi]._activation ? 1.0f : 0.0f) - sparsitySquared)); //_hidden[_hidden[hi]._hiddenHiddenConnections[ci]._index]._state * 
 
+			pInhibitionWeights[ci < selfSlot ? ci : ci + 1] = _hidden[hi]._hiddenHiddenConnections[ci]._weight;
+		}
+
 		_hidden[hi]._bias += gamma * (_hidden[hi]._state - sparsity);
 	}
 }
@@ -265,10 +680,27 @@ void RecurrentSparseCoder2D::getVHWeights(int hx, int hy, std::vector<float> &re
 }
 
 void RecurrentSparseCoder2D::stepEnd() {
-	for (int hi = 0; hi < _hidden.size(); hi++) {
-		_hidden[hi]._statePrevPrev = _hidden[hi]._statePrev;
-		_hidden[hi]._statePrev = _hidden[hi]._state;
-	}
+	forEachHiddenTile([this](int begin, int end) {
+		for (int hi = begin; hi < end; hi++) {
+			_hidden[hi]._statePrevPrev = _hidden[hi]._statePrev;
+			_hidden[hi]._statePrev = _hidden[hi]._state;
+		}
+	});
+}
+
+void RecurrentSparseCoder2D::setVisibleInputs(const float* pInputs, size_t count) {
+	for (size_t vi = 0; vi < count; vi++)
+		_visible[vi]._input = pInputs[vi];
+}
+
+void RecurrentSparseCoder2D::setVisibleInputsFromHidden(const RecurrentSparseCoder2D &source) {
+	for (int vi = 0; vi < source._hidden.size(); vi++)
+		_visible[vi]._input = source._hidden[vi]._state;
+}
+
+void RecurrentSparseCoder2D::getHiddenStates(float* pStates) const {
+	for (int hi = 0; hi < _hidden.size(); hi++)
+		pStates[hi] = _hidden[hi]._state;
 }
 
 float RecurrentSparseCoder2D::getRepresentationError() const {
@@ -278,4 +710,105 @@ float RecurrentSparseCoder2D::getRepresentationError() const {
 		error += -_hidden[hi]._state * _hidden[hi]._activation;
 
 	return error;
+}
+
+bool RecurrentSparseCoder2D::save(const std::string &fileName) const {
+	return sdr::Checkpoint::saveToFile(*this, fileName);
+}
+
+bool RecurrentSparseCoder2D::load(const std::string &fileName) {
+	return sdr::Checkpoint::loadFromFile(*this, fileName);
+}
+
+void RecurrentSparseCoder2D::save(sdr::CheckpointWriter &writer) const {
+	writer.beginObject("sc::RecurrentSparseCoder2D", 1);
+
+	writer.write(_visibleWidth);
+	writer.write(_visibleHeight);
+	writer.write(_hiddenWidth);
+	writer.write(_hiddenHeight);
+	writer.write(_receptiveRadius);
+	writer.write(_inhibitionRadius);
+	writer.write(_recurrentRadius);
+
+	int numHidden = _hidden.size();
+
+	writer.writeArray(_visible);
+
+	writer.writeLists(numHidden, [&](int i) -> const std::vector<VisibleConnection> & { return _hidden[i]._visibleHiddenConnections; });
+	writer.writeLists(numHidden, [&](int i) -> const std::vector<VisibleConnection> & { return _hidden[i]._hiddenPrevHiddenConnections; });
+	writer.writeLists(numHidden, [&](int i) -> const std::vector<HiddenConnection> & { return _hidden[i]._hiddenHiddenConnections; });
+
+	writer.writeField(numHidden, [&](int i) { return _hidden[i]._bias; });
+	writer.writeField(numHidden, [&](int i) { return _hidden[i]._state; });
+	writer.writeField(numHidden, [&](int i) { return _hidden[i]._statePrev; });
+	writer.writeField(numHidden, [&](int i) { return _hidden[i]._statePrevPrev; });
+	writer.writeField(numHidden, [&](int i) { return _hidden[i]._error; });
+	writer.writeField(numHidden, [&](int i) { return _hidden[i]._activation; });
+	writer.writeField(numHidden, [&](int i) { return _hidden[i]._attention; });
+	writer.writeField(numHidden, [&](int i) { return _hidden[i]._reconstruction; });
+}
+
+bool RecurrentSparseCoder2D::load(sdr::CheckpointReader &reader) {
+	// Read into a fresh RecurrentSparseCoder2D with this one's settings, so a failed load leaves this one unchanged
+	RecurrentSparseCoder2D loaded;
+
+	loaded._threadPool = _threadPool;
+	loaded._skipUnchanged = _skipUnchanged;
+	loaded._incremental = _incremental;
+	loaded._refreshInterval = _refreshInterval;
+
+	if (!loaded.loadMembers(reader))
+		return false;
+
+	*this = std::move(loaded);
+
+	return true;
+}
+
+bool RecurrentSparseCoder2D::loadMembers(sdr::CheckpointReader &reader) {
+	if (!reader.beginObject("sc::RecurrentSparseCoder2D", 1))
+		return false;
+
+	reader.read(_visibleWidth);
+	reader.read(_visibleHeight);
+	reader.read(_hiddenWidth);
+	reader.read(_hiddenHeight);
+	reader.read(_receptiveRadius);
+	reader.read(_inhibitionRadius);
+	reader.read(_recurrentRadius);
+
+	// Everything read below is checked against these, so a malformed file fails instead of indexing out of bounds
+	if (!reader.good() || !sdr::Checkpoint::isValidArea(_visibleWidth, _visibleHeight) || !sdr::Checkpoint::isValidArea(_hiddenWidth, _hiddenHeight) || !reader.canHold(_hiddenWidth * _hiddenHeight)
+		|| !sdr::Checkpoint::isValidRadius(_receptiveRadius, 0) || !sdr::Checkpoint::isValidRadius(_inhibitionRadius, 0) || !sdr::Checkpoint::isValidRadius(_recurrentRadius, -1))
+		return false;
+
+	int numVisible = _visibleWidth * _visibleHeight;
+	int numHidden = _hiddenWidth * _hiddenHeight;
+
+	reader.readArray(_visible);
+
+	_hidden.clear();
+	_hidden.resize(numHidden);
+
+	reader.readConnectionLists(numHidden, numVisible, [&](int i) -> std::vector<VisibleConnection> & { return _hidden[i]._visibleHiddenConnections; });
+	reader.readConnectionLists(numHidden, numHidden, [&](int i) -> std::vector<VisibleConnection> & { return _hidden[i]._hiddenPrevHiddenConnections; });
+	reader.readConnectionLists(numHidden, numHidden, [&](int i) -> std::vector<HiddenConnection> & { return _hidden[i]._hiddenHiddenConnections; });
+
+	reader.readField(numHidden, [&](int i) -> float & { return _hidden[i]._bias; });
+	reader.readField(numHidden, [&](int i) -> float & { return _hidden[i]._state; });
+	reader.readField(numHidden, [&](int i) -> float & { return _hidden[i]._statePrev; });
+	reader.readField(numHidden, [&](int i) -> float & { return _hidden[i]._statePrevPrev; });
+	reader.readField(numHidden, [&](int i) -> float & { return _hidden[i]._error; });
+	reader.readField(numHidden, [&](int i) -> float & { return _hidden[i]._activation; });
+	reader.readField(numHidden, [&](int i) -> float & { return _hidden[i]._attention; });
+	reader.readField(numHidden, [&](int i) -> float & { return _hidden[i]._reconstruction; });
+
+	if (!reader.good() || _visible.size() != static_cast<size_t>(numVisible))
+		return false;
+
+	allocateBuffers();
+	buildTransposes();
+
+	return buildWindows();
 }
\ No newline at end of file
@@ -22,7 +22,18 @@ misrepresented as being the original software.
 #pragma once
 
 #include <vector>
+#include <string>
 #include <random>
+#include <algorithm>
+#include <memory>
+#include <functional>
+
+#include "../sdr/ThreadPool.h"
+
+namespace sdr {
+	class CheckpointWriter;
+	class CheckpointReader;
+}
 
 namespace sc {
 	class RecurrentSparseCoder2D {
@@ -32,7 +43,7 @@ namespace sc {
 		}
 
 		struct VisibleConnection {
-			unsigned short _index;
+			int _index;
 
 			float _weight;
 
@@ -43,7 +54,7 @@ namespace sc {
 		};
 
 		struct HiddenConnection {
-			unsigned short _index;
+			int _index;
 
 			float _weight;
 
@@ -93,7 +104,141 @@ namespace sc {
 		std::vector<VisibleNode> _visible;
 		std::vector<HiddenNode> _hidden;
 
+		// For every visible node (hidden node), the feed-forward (recurrent) connections that read it, in hidden node order: the hidden node, the connection's slot in the flat weights, and its falloff.
+		// Reconstructions gather over them instead of scattering, so every node sums in the same order as the serial scatter did. Incremental activation scatters changes over them
+		std::vector<int> _visibleTransposeOffsets;
+		std::vector<int> _visibleTransposeTargets;
+		std::vector<int> _visibleTransposeSlots;
+		std::vector<float> _visibleTransposeFalloffs;
+
+		std::vector<int> _recurrentTransposeOffsets;
+		std::vector<int> _recurrentTransposeTargets;
+		std::vector<int> _recurrentTransposeSlots;
+		std::vector<float> _recurrentTransposeFalloffs;
+
+		std::shared_ptr<sdr::ThreadPool> _threadPool;
+
+		// The feed-forward (recurrent) connections of a hidden node, as they are made by createRandom: width columns (dx) of height rows (dy) of the clipped square around the node.
+		// activate reads the windows from column-major copies of the inputs, in which the columns are contiguous, so the fused kernel adds up in connection order
+		struct Window {
+			int _x, _y;
+			int _width, _height;
+
+			// Start of the node's weights in the flat weights, and of its part of the falloff mask
+			int _weightsOffset;
+			int _falloffsOffset;
+		};
+
+		std::vector<Window> _visibleWindows;
+		std::vector<Window> _recurrentWindows;
+
+		// The lateral connections of a hidden node in the same layout, with a 0 weight in the slot of the node itself. Lateral weights and falloffs are never negative (learn clamps the weights),
+		// so the partial sums only grow. windowMaskedSum adds in connection order on every instruction set, so the full sum inhibits a node exactly when a partial sum would have
+		std::vector<Window> _inhibitionWindows;
+
+		// Weights in connection order, kept in sync by learn
+		std::vector<float> _visibleWeights;
+		std::vector<float> _recurrentWeights;
+		std::vector<float> _inhibitionWeights;
+
+		// Falloff of every (dx, dy) of the receptive (recurrent) square, column-major. Falloff only depends on the offset, so it is shared by all nodes
+		std::vector<float> _receptiveFalloffs;
+		std::vector<float> _recurrentFalloffs;
+		std::vector<float> _inhibitionFalloffs;
+
+		// Column-major copies of the inputs and the previous hidden states, made at the start of activate, and of the activations for inhibition
+		std::vector<float> _inputColumns;
+		std::vector<float> _statePrevColumns;
+		std::vector<float> _activationColumns;
+
+		// For skipping unchanged nodes. Summed-area tables (column-major) of the inputs and previous states that changed since the last activate, and the nodes learn changed the weights of
+		bool _skipUnchanged;
+		bool _activateAll;
+
+		std::vector<int> _visibleChanges;
+		std::vector<int> _recurrentChanges;
+		std::vector<char> _weightsChanged;
+
+		// For incremental activation. The inputs and previous states that changed since the last activate, with their old values
+		bool _incremental;
+		int _refreshInterval;
+		int _stepsSinceRefresh;
+
+		std::vector<int> _changedVisible;
+		std::vector<float> _changedVisibleOld;
+		std::vector<int> _changedHidden;
+		std::vector<float> _changedHiddenOld;
+
+		// Reconstruction errors for learn
+		std::vector<float> _visibleErrors;
+		std::vector<float> _hiddenErrors;
+
+		// Sizes the buffers above, so that stepping allocates nothing
+		void allocateBuffers();
+
+		void buildTransposes();
+
+		bool buildWindow(const std::vector<VisibleConnection> &connections, int width, int centerX, int centerY, int radius, const std::vector<float> &falloffs, Window &window, std::vector<float> &weights);
+		bool buildInhibitionWindow(const std::vector<HiddenConnection> &connections, int hx, int hy, Window &window);
+		void gatherInputs();
+
+		void activateRange(int begin, int end);
+		void activateIncremental();
+
+		// Weighted squared distance of a node's windows to its weights
+		float distance(int hi) const;
+		void inhibitRange(int begin, int end, float excitation);
+		void learnRange(int begin, int end, float alpha, float betaVisible, float betaHidden, float gamma, float sparsity);
+
+		// Call func(begin, end) on bands of whole rows of the hidden (visible) layer, in parallel if there is a thread pool
+		template<class Func>
+		void forEachHiddenTile(const Func &func) const {
+			forEachTile(_hiddenWidth, _hiddenHeight, func);
+		}
+
+		template<class Func>
+		void forEachVisibleTile(const Func &func) const {
+			forEachTile(_visibleWidth, _visibleHeight, func);
+		}
+
+		template<class Func>
+		void forEachTile(int width, int height, const Func &func) const {
+			if (_threadPool == nullptr || _threadPool->getNumThreads() == 1 || height < 2) {
+				func(0, width * height);
+
+				return;
+			}
+
+			struct Tiles {
+				int _width, _height;
+				int _numTiles;
+
+				const Func* _pFunc;
+			};
+
+			// Several tiles per thread for load balancing. The task only captures a reference, so wrapping it in a std::function does not allocate
+			Tiles tiles = { width, height, std::min(height, _threadPool->getNumThreads() * 4), &func };
+
+			_threadPool->run(tiles._numTiles, [&tiles](int t) {
+				int rowBegin = t * tiles._height / tiles._numTiles;
+				int rowEnd = (t + 1) * tiles._height / tiles._numTiles;
+
+				(*tiles._pFunc)(rowBegin * tiles._width, rowEnd * tiles._width);
+			});
+		}
+
+		// Binary state of a node from the lateral connections to the neighbours that are more active than it, read from column-major activations of the hidden layer
+		float inhibitedState(int hi, const float* pActivationColumns, float activation, float excitation) const;
+
+		// The body of load, run on a freshly constructed object
+		bool loadMembers(sdr::CheckpointReader &reader);
+
 	public:
+		RecurrentSparseCoder2D()
+			: _visibleWidth(0), _visibleHeight(0), _hiddenWidth(0), _hiddenHeight(0), _receptiveRadius(0), _inhibitionRadius(0), _recurrentRadius(-1), _skipUnchanged(false), _activateAll(true),
+			_incremental(false), _refreshInterval(64), _stepsSinceRefresh(0)
+		{}
+
 		void createRandom(int visibleWidth, int visibleHeight, int hiddenWidth, int hiddenHeight, int receptiveRadius, int inhibitionRadius, int recurrentRadius, std::mt19937 &generator);
 
 		void activate(float excitation = 1.0f);
@@ -103,6 +248,53 @@ namespace sc {
 
 		float getRepresentationError() const;
 
+		// Binary checkpoint of weights and states (see sdr/Checkpoint.h). load returns false if the file holds no RecurrentSparseCoder2D, and then leaves this one unchanged
+		bool save(const std::string &fileName) const;
+		bool load(const std::string &fileName);
+
+		void save(sdr::CheckpointWriter &writer) const;
+		bool load(sdr::CheckpointReader &reader);
+
+		// Tiles of rows are processed in parallel on the pool. Results are identical to the serial path. Pass nullptr to go back to serial.
+		// Do not step the coder from a task of the same pool (see ThreadPool)
+		void setThreadPool(const std::shared_ptr<sdr::ThreadPool> &threadPool) {
+			_threadPool = threadPool;
+		}
+
+		const std::shared_ptr<sdr::ThreadPool> &getThreadPool() const {
+			return _threadPool;
+		}
+
+		// activate keeps the activations of nodes whose inputs, previous states in reach and weights have not changed since the last activate. Results are identical
+		void setSkipUnchanged(bool skipUnchanged) {
+			_skipUnchanged = skipUnchanged;
+			_activateAll = true;
+		}
+
+		bool getSkipUnchanged() const {
+			return _skipUnchanged;
+		}
+
+		// activate adds the change of every connection whose input or previous state changed since the last activate to the activations, instead of summing all connections.
+		// Nodes whose weights learn changed are summed in full, and so are all nodes every refreshInterval steps, to bound the rounding drift, and when more than an eighth of the connections would change.
+		// Cost scales with the amount of change
+		void setIncremental(bool incremental, int refreshInterval = 64) {
+			_incremental = incremental;
+			_refreshInterval = refreshInterval;
+			_activateAll = true;
+		}
+
+		bool getIncremental() const {
+			return _incremental;
+		}
+
+		int getRefreshInterval() const {
+			return _refreshInterval;
+		}
+
+		// Copies the weights for activate again, after they were changed through getHiddenNode. False if the connections no longer have the layout of createRandom, or a lateral weight is negative
+		bool buildWindows();
+
 		void setVisibleInput(int index, float value) {
 			_visible[index]._input = value;
 		}
@@ -111,6 +303,15 @@ namespace sc {
 			_visible[x + y * _visibleWidth]._input = value;
 		}
 
+		// Whole frames at once
+		void setVisibleInputs(const float* pInputs, size_t count);
+
+		// Visible inputs from the hidden states of the layer below
+		void setVisibleInputsFromHidden(const RecurrentSparseCoder2D &source);
+
+		// getNumHidden() values
+		void getHiddenStates(float* pStates) const;
+
 		float getVisibleRecon(int index) const {
 			return _visible[index]._reconstruction;
 		}
@@ -167,6 +368,7 @@ namespace sc {
 			return _hidden[x + y * _hiddenWidth]._attention;
 		}
 
+		// Call buildWindows after changing weights through these
 		HiddenNode &getHiddenNode(int index) {
 			return _hidden[index];
 		}
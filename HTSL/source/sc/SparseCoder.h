@@ -32,7 +32,7 @@ namespace sc {
 		}
 
 		struct VisibleConnection {
-			unsigned short _index;
+			int _index;
 
 			double _weight;
 
@@ -41,7 +41,7 @@ namespace sc {
 		};
 
 		struct HiddenConnection {
-			unsigned short _index;
+			int _index;
 
 			double _weight;
 
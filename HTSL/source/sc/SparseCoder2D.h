@@ -33,7 +33,7 @@ namespace sc {
 		
 	private:
 		struct VisibleConnection {
-			unsigned short _index;
+			int _index;
 
 			float _weight;
 
@@ -0,0 +1,262 @@
+#include "Checkpoint.h"
+
+#include <algorithm>
+
+#ifdef _WIN32
+#define NOMINMAX
+#include <windows.h>
+#endif
+
+#if defined(__unix__) || defined(__APPLE__)
+#define CHECKPOINT_MMAP
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+using namespace sdr;
+
+const unsigned int Checkpoint::_formatVersion;
+const int Checkpoint::_blockAlignment;
+const int Checkpoint::_typeNameSize;
+
+namespace {
+	const char _magic[8] = { 'H', 'T', 'S', 'L', 'C', 'K', 'P', 'T' };
+}
+
+bool Checkpoint::isLittleEndian() {
+	const unsigned int one = 1;
+
+	return *reinterpret_cast<const unsigned char*>(&one) == 1;
+}
+
+void Checkpoint::swapWords(void* pData, size_t size, size_t wordSize) {
+	unsigned char* pBytes = static_cast<unsigned char*>(pData);
+
+	for (size_t i = 0; i + wordSize <= size; i += wordSize)
+		std::reverse(pBytes + i, pBytes + i + wordSize);
+}
+
+bool Checkpoint::replaceFile(const std::string &from, const std::string &to) {
+#ifdef _WIN32
+	bool replaced = MoveFileExA(from.c_str(), to.c_str(), MOVEFILE_REPLACE_EXISTING) != 0;
+#else
+	bool replaced = std::rename(from.c_str(), to.c_str()) == 0;
+#endif
+
+	if (!replaced)
+		std::remove(from.c_str());
+
+	return replaced;
+}
+
+CheckpointWriter::CheckpointWriter(std::ostream &os)
+	: _pOs(&os), _position(0)
+{
+	writeBytes(_magic, sizeof(_magic), 1);
+	write(Checkpoint::_formatVersion);
+	write(0u);
+}
+
+void CheckpointWriter::writeBytes(const void* pData, size_t size, size_t wordSize) {
+	if (size == 0)
+		return;
+
+	if (Checkpoint::isLittleEndian() || wordSize == 1)
+		_pOs->write(static_cast<const char*>(pData), size);
+	else {
+		std::vector<char> swapped(static_cast<const char*>(pData), static_cast<const char*>(pData) + size);
+
+		Checkpoint::swapWords(swapped.data(), size, wordSize);
+
+		_pOs->write(swapped.data(), size);
+	}
+
+	_position += size;
+}
+
+void CheckpointWriter::writeBlockHeader(size_t elementSize, size_t count) {
+	write(static_cast<unsigned int>(elementSize));
+	write(0u);
+	write(static_cast<unsigned long long>(count));
+
+	// Pad so the block data is aligned
+	char padding[Checkpoint::_blockAlignment] = {};
+
+	writeBytes(padding, (Checkpoint::_blockAlignment - _position % Checkpoint::_blockAlignment) % Checkpoint::_blockAlignment, 1);
+}
+
+void CheckpointWriter::beginObject(const char* typeName, int version) {
+	char name[Checkpoint::_typeNameSize] = {};
+
+	std::strncpy(name, typeName, Checkpoint::_typeNameSize - 1);
+
+	writeBytes(name, sizeof(name), 1);
+	write(version);
+}
+
+bool CheckpointReader::open(const std::string &fileName) {
+	close();
+
+#ifdef CHECKPOINT_MMAP
+	int fd = ::open(fileName.c_str(), O_RDONLY);
+
+	if (fd < 0)
+		return false;
+
+	struct stat fileStat;
+
+	if (fstat(fd, &fileStat) != 0 || fileStat.st_size == 0) {
+		::close(fd);
+
+		return false;
+	}
+
+#ifdef MAP_POPULATE
+	// Fault the whole file in at once instead of page by page while copying
+	int flags = MAP_PRIVATE | MAP_POPULATE;
+#else
+	int flags = MAP_PRIVATE;
+#endif
+
+	void* pMapping = mmap(nullptr, fileStat.st_size, PROT_READ, flags, fd, 0);
+
+	::close(fd);
+
+	if (pMapping == MAP_FAILED)
+		return false;
+
+	// Blocks are read front to back
+	madvise(pMapping, fileStat.st_size, MADV_SEQUENTIAL);
+
+	_pMapping = pMapping;
+	_mappingSize = fileStat.st_size;
+
+	return open(_pMapping, _mappingSize);
+#else
+	std::ifstream is(fileName, std::ios::binary | std::ios::ate);
+
+	if (!is.is_open())
+		return false;
+
+	_buffer.resize(static_cast<size_t>(is.tellg()));
+
+	is.seekg(0);
+	is.read(_buffer.data(), _buffer.size());
+
+	if (!is.good())
+		return false;
+
+	return open(_buffer.data(), _buffer.size());
+#endif
+}
+
+bool CheckpointReader::open(const void* pData, size_t size) {
+	_pData = static_cast<const char*>(pData);
+	_size = size;
+	_position = 0;
+	_good = true;
+
+	return readHeader();
+}
+
+bool CheckpointReader::open(std::istream &is) {
+	close();
+
+	const size_t chunkSize = 1 << 20;
+
+	size_t size = 0;
+
+	for (;;) {
+		_buffer.resize(size + chunkSize);
+
+		std::streamsize numRead = is.rdbuf()->sgetn(_buffer.data() + size, chunkSize);
+
+		size += static_cast<size_t>(numRead);
+
+		if (numRead < static_cast<std::streamsize>(chunkSize))
+			break;
+	}
+
+	_buffer.resize(size);
+
+	return open(_buffer.data(), _buffer.size());
+}
+
+void CheckpointReader::close() {
+#ifdef CHECKPOINT_MMAP
+	if (_pMapping != nullptr)
+		munmap(_pMapping, _mappingSize);
+#endif
+
+	_pMapping = nullptr;
+	_mappingSize = 0;
+
+	_buffer.clear();
+	_buffer.shrink_to_fit();
+
+	_pData = nullptr;
+	_size = 0;
+	_position = 0;
+	_good = false;
+}
+
+const char* CheckpointReader::readBytes(size_t size) {
+	if (!_good || size > _size - _position) {
+		_good = false;
+
+		return nullptr;
+	}
+
+	const char* pBytes = _pData + _position;
+
+	_position += size;
+
+	return pBytes;
+}
+
+bool CheckpointReader::readHeader() {
+	const char* pMagic = readBytes(sizeof(_magic));
+
+	unsigned int formatVersion, reserved;
+
+	if (pMagic == nullptr || std::memcmp(pMagic, _magic, sizeof(_magic)) != 0 || !read(formatVersion) || !read(reserved) || formatVersion != Checkpoint::_formatVersion)
+		return _good = false;
+
+	return true;
+}
+
+bool CheckpointReader::readBlockHeader(size_t elementSize, size_t &count) {
+	unsigned int storedElementSize, reserved;
+	unsigned long long storedCount;
+
+	if (!read(storedElementSize) || !read(reserved) || !read(storedCount) || storedElementSize != elementSize)
+		return _good = false;
+
+	// Skip the padding
+	if (readBytes((Checkpoint::_blockAlignment - _position % Checkpoint::_blockAlignment) % Checkpoint::_blockAlignment) == nullptr)
+		return false;
+
+	if (storedCount > (_size - _position) / elementSize)
+		return _good = false;
+
+	count = static_cast<size_t>(storedCount);
+
+	return true;
+}
+
+bool CheckpointReader::beginObject(const char* typeName, int version) {
+	char name[Checkpoint::_typeNameSize] = {};
+
+	std::strncpy(name, typeName, Checkpoint::_typeNameSize - 1);
+
+	const char* pStoredName = readBytes(sizeof(name));
+
+	int storedVersion;
+
+	if (pStoredName == nullptr || std::memcmp(pStoredName, name, sizeof(name)) != 0 || !read(storedVersion) || storedVersion != version)
+		return _good = false;
+
+	return true;
+}
\ No newline at end of file
@@ -0,0 +1,319 @@
+#pragma once
+
+#include <vector>
+#include <string>
+#include <fstream>
+#include <cstdio>
+#include <cstring>
+#include <limits>
+#include <type_traits>
+
+namespace sdr {
+	// Binary checkpoints of the sdr and sc networks. A file is a header (magic, format version) followed by objects, each starting with its type name and version.
+	// Objects hold scalars and array blocks. Everything is stored little-endian. Blocks start on 64 byte boundaries, so with the file memory-mapped loading a block is one copy.
+	// Stored types are arithmetic, enums, or structs made only of 32-bit fields
+	class Checkpoint {
+	public:
+		static const unsigned int _formatVersion = 1;
+		static const int _blockAlignment = 64;
+		static const int _typeNameSize = 24;
+
+		static bool isLittleEndian();
+
+		// Reverses the bytes of every wordSize byte word
+		static void swapWords(void* pData, size_t size, size_t wordSize);
+
+		// Whether loaded layer dimensions are non-negative with an area that fits in an int
+		static bool isValidArea(int width, int height) {
+			return width >= 0 && height >= 0 && (height == 0 || width <= std::numeric_limits<int>::max() / height);
+		}
+
+		// Whether a loaded window radius is at least minRadius, with a (2 radius + 1)^2 window that fits in an int
+		static bool isValidRadius(int radius, int minRadius) {
+			return radius >= minRadius && (2ll * radius + 1) * (2ll * radius + 1) <= std::numeric_limits<int>::max();
+		}
+
+		// Whether size is that of count dense (2 radius + 1)^2 weight blocks, or 0 for radius -1 (no window)
+		static bool isBlockSize(size_t size, int count, int radius) {
+			if (radius < 0)
+				return size == 0;
+
+			unsigned long long dim = 2ull * radius + 1;
+
+			return count == 0 ? size == 0 : size % count == 0 && size / count == dim * dim;
+		}
+
+		// Whether the _index of every connection addresses one of numTargets nodes
+		template<typename Connection>
+		static bool hasValidIndices(const std::vector<Connection> &connections, int numTargets) {
+			for (size_t ci = 0; ci < connections.size(); ci++)
+				if (connections[ci]._index < 0 || connections[ci]._index >= numTargets)
+					return false;
+
+			return true;
+		}
+
+		template<typename T>
+		static size_t getWordSize() {
+			static_assert(std::is_trivially_copyable<T>::value, "Only trivially copyable types can be stored");
+
+			return std::is_arithmetic<T>::value || std::is_enum<T>::value ? sizeof(T) : 4;
+		}
+
+		// Moves the file from over the file to, replacing it in one step (rename, or MoveFileEx on Windows). On failure from is removed
+		static bool replaceFile(const std::string &from, const std::string &to);
+
+		// Saves or loads any object with save(CheckpointWriter &) and load(CheckpointReader &) members. The loaders read into a fresh object, so a failed load leaves the object unchanged.
+		// saveToFile writes fileName + ".tmp" and renames it over fileName, so a failed save leaves the previous file intact
+		template<typename T>
+		static bool saveToFile(const T &object, const std::string &fileName);
+
+		template<typename T>
+		static bool loadFromFile(T &object, const std::string &fileName);
+	};
+
+	class CheckpointWriter {
+	private:
+		std::ostream* _pOs;
+
+		size_t _position;
+
+		void writeBytes(const void* pData, size_t size, size_t wordSize);
+		void writeBlockHeader(size_t elementSize, size_t count);
+
+	public:
+		// Writes the file header
+		CheckpointWriter(std::ostream &os);
+
+		void beginObject(const char* typeName, int version);
+
+		template<typename T>
+		void write(const T &value) {
+			writeBytes(&value, sizeof(T), Checkpoint::getWordSize<T>());
+		}
+
+		template<typename T>
+		void writeArray(const T* pValues, size_t count) {
+			size_t wordSize = Checkpoint::getWordSize<T>();
+
+			writeBlockHeader(sizeof(T), count);
+			writeBytes(pValues, sizeof(T) * count, wordSize);
+		}
+
+		template<typename T>
+		void writeArray(const std::vector<T> &values) {
+			writeArray(values.data(), values.size());
+		}
+
+		// One block with a member of count elements, get(i) returns the member of element i
+		template<typename Get>
+		void writeField(int count, Get get) {
+			typedef typename std::decay<decltype(get(0))>::type T;
+
+			std::vector<T> values(count);
+
+			for (int i = 0; i < count; i++)
+				values[i] = get(i);
+
+			writeArray(values);
+		}
+
+		// Variable length lists of count elements (such as connection lists of nodes), as a block of offsets and a block of the concatenated lists. get(i) returns the list of element i
+		template<typename Get>
+		void writeLists(int count, Get get) {
+			typedef typename std::decay<decltype(get(0))>::type::value_type T;
+
+			std::vector<int> offsets(count + 1, 0);
+
+			for (int i = 0; i < count; i++)
+				offsets[i + 1] = offsets[i] + get(i).size();
+
+			std::vector<T> values;
+			values.reserve(offsets.back());
+
+			for (int i = 0; i < count; i++)
+				values.insert(values.end(), get(i).begin(), get(i).end());
+
+			writeArray(offsets);
+			writeArray(values);
+		}
+
+		bool good() const {
+			return _pOs->good();
+		}
+	};
+
+	class CheckpointReader {
+	private:
+		const char* _pData;
+		size_t _size;
+		size_t _position;
+
+		bool _good;
+
+		// Set when opened from a file
+		void* _pMapping;
+		size_t _mappingSize;
+		std::vector<char> _buffer;
+
+		const char* readBytes(size_t size);
+		bool readBlockHeader(size_t elementSize, size_t &count);
+		bool readHeader();
+
+		CheckpointReader(const CheckpointReader &);
+		CheckpointReader &operator=(const CheckpointReader &);
+
+	public:
+		CheckpointReader()
+			: _pData(nullptr), _size(0), _position(0), _good(false), _pMapping(nullptr), _mappingSize(0)
+		{}
+
+		~CheckpointReader() {
+			close();
+		}
+
+		// Maps the file into memory and checks the header
+		bool open(const std::string &fileName);
+
+		// Reads from memory that must stay valid while reading
+		bool open(const void* pData, size_t size);
+
+		// Reads the rest of the stream into a buffer first
+		bool open(std::istream &is);
+
+		void close();
+
+		// Fails if the next object has a different type or version
+		bool beginObject(const char* typeName, int version);
+
+		template<typename T>
+		bool read(T &value) {
+			const char* pBytes = readBytes(sizeof(T));
+
+			if (pBytes == nullptr)
+				return false;
+
+			std::memcpy(&value, pBytes, sizeof(T));
+
+			if (!Checkpoint::isLittleEndian())
+				Checkpoint::swapWords(&value, sizeof(T), Checkpoint::getWordSize<T>());
+
+			return true;
+		}
+
+		template<typename T>
+		bool readArray(std::vector<T> &values) {
+			size_t count;
+
+			if (!readBlockHeader(sizeof(T), count))
+				return false;
+
+			const char* pBytes = readBytes(sizeof(T) * count);
+
+			if (pBytes == nullptr)
+				return false;
+
+			// Memory passed to open need not be aligned, so the block is copied as bytes
+			values.resize(count);
+
+			if (count != 0)
+				std::memcpy(values.data(), pBytes, sizeof(T) * count);
+
+			if (!Checkpoint::isLittleEndian())
+				Checkpoint::swapWords(values.data(), sizeof(T) * count, Checkpoint::getWordSize<T>());
+
+			return true;
+		}
+
+		// Counterpart of CheckpointWriter::writeField. get(i) returns a reference to the member of element i
+		template<typename Get>
+		bool readField(int count, Get get) {
+			typedef typename std::decay<decltype(get(0))>::type T;
+
+			std::vector<T> values;
+
+			if (!readArray(values) || count < 0 || values.size() != static_cast<size_t>(count))
+				return _good = false;
+
+			for (int i = 0; i < count; i++)
+				get(i) = values[i];
+
+			return true;
+		}
+
+		// Counterpart of CheckpointWriter::writeLists. get(i) returns a reference to the list of element i
+		template<typename Get>
+		bool readLists(int count, Get get) {
+			typedef typename std::decay<decltype(get(0))>::type::value_type T;
+
+			std::vector<int> offsets;
+			std::vector<T> values;
+
+			if (!readArray(offsets) || !readArray(values) || count < 0 || offsets.size() != static_cast<size_t>(count) + 1 || offsets.front() != 0 || static_cast<size_t>(offsets.back()) != values.size())
+				return _good = false;
+
+			for (int i = 0; i < count; i++) {
+				if (offsets[i + 1] < offsets[i] || offsets[i + 1] > offsets.back())
+					return _good = false;
+
+				get(i).assign(values.begin() + offsets[i], values.begin() + offsets[i + 1]);
+			}
+
+			return true;
+		}
+
+		// readLists for connection lists, which also fails unless the _index of every connection addresses one of numTargets nodes
+		template<typename Get>
+		bool readConnectionLists(int count, int numTargets, Get get) {
+			if (!readLists(count, get))
+				return false;
+
+			for (int i = 0; i < count; i++)
+				if (!Checkpoint::hasValidIndices(get(i), numTargets))
+					return _good = false;
+
+			return true;
+		}
+
+		// Whether the unread data is large enough for count elements of at least 4 bytes. Loaders check counts with this before allocating for them
+		bool canHold(int count) const {
+			return count >= 0 && static_cast<size_t>(count) <= (_size - _position) / 4;
+		}
+
+		bool good() const {
+			return _good;
+		}
+	};
+
+	template<typename T>
+	bool Checkpoint::saveToFile(const T &object, const std::string &fileName) {
+		std::string tempFileName = fileName + ".tmp";
+
+		std::ofstream os(tempFileName, std::ios::binary);
+
+		CheckpointWriter writer(os);
+
+		object.save(writer);
+
+		os.flush();
+
+		bool good = writer.good();
+
+		os.close();
+
+		if (!good || os.fail()) {
+			std::remove(tempFileName.c_str());
+
+			return false;
+		}
+
+		return replaceFile(tempFileName, fileName);
+	}
+
+	template<typename T>
+	bool Checkpoint::loadFromFile(T &object, const std::string &fileName) {
+		CheckpointReader reader;
+
+		return reader.open(fileName) && object.load(reader);
+	}
+}
\ No newline at end of file
@@ -1,7 +1,11 @@
 #include "IPredictiveRSDR.h"
 
-#include <SFML/Window.hpp>
-#include <iostream>
+#include "Checkpoint.h"
+#include "Trace.h"
+
+#include <algorithm>
+
+#include <assert.h>
 
 using namespace sdr;
 
@@ -16,8 +20,12 @@ void IPredictiveRSDR::createRandom(int inputWidth, int inputHeight, int inputFee
 	int heightPrev = inputHeight;
 
 	for (int l = 0; l < _layerDescs.size(); l++) {
+		assert(_layerDescs[l]._pipelineDelay >= 1);
+
 		_layers[l]._sdr.createRandom(widthPrev, heightPrev, _layerDescs[l]._width, _layerDescs[l]._height, _layerDescs[l]._receptiveRadius, _layerDescs[l]._recurrentRadius, initMinWeight, initMaxWeight, generator);
 
+		_layers[l]._sdr.setSolver(_layerDescs[l]._sdrSolver);
+
 		_layers[l]._predictionNodes.resize(_layerDescs[l]._width * _layerDescs[l]._height);
 
 		int feedBackSize = std::pow(_layerDescs[l]._feedBackRadius * 2 + 1, 2);
@@ -133,68 +141,96 @@ void IPredictiveRSDR::createRandom(int inputWidth, int inputHeight, int inputFee
 
 		p._feedBackConnections.shrink_to_fit();
 	}
+
+	allocateBuffers();
 }
 
-void IPredictiveRSDR::simStep(std::mt19937 &generator, bool learn) {
-	// Feature extraction
+void IPredictiveRSDR::allocateBuffers() {
+	_buffers.resize(_layers.size());
+
 	for (int l = 0; l < _layers.size(); l++) {
-		_layers[l]._sdr.activate(_layerDescs[l]._sdrIter, _layerDescs[l]._sdrStepSize, _layerDescs[l]._sdrLambda, _layerDescs[l]._sdrHiddenDecay, _layerDescs[l]._sdrNoise, generator);
+		LayerBuffers &buffers = _buffers[l];
 
-		// Set inputs for next layer if there is one
-		if (l < _layers.size() - 1) {
-			for (int i = 0; i < _layers[l]._sdr.getNumHidden(); i++)
-				_layers[l + 1]._sdr.setVisibleState(i, _layers[l]._sdr.getHiddenState(i));
-		}
+		int numHidden = _layers[l]._sdr.getNumHidden();
+		int numFeedBack = l < _layers.size() - 1 ? _layers[l + 1]._sdr.getNumHidden() : 0;
+
+		buffers._hiddenStateLine.assign(_layerDescs[l]._pipelineDelay + 1, std::vector<float>(numHidden, 0.0f));
+		buffers._predictionStateLine.assign(_layerDescs[l]._pipelineDelay + 1, std::vector<float>(numHidden, 0.0f));
+		buffers._feedBack.assign(numFeedBack, 0.0f);
+		buffers._feedBackPrev.assign(numFeedBack, 0.0f);
+		buffers._attentions.assign(numHidden, 0.0f);
+		buffers._writeSlot = 0;
 	}
 
-	// Prediction
-	std::vector<std::vector<float>> attentions(_layers.size());
+	_pipelineLive = false;
+}
 
-	for (int l = _layers.size() - 1; l >= 0; l--) {
-		attentions[l].resize(_layers[l]._predictionNodes.size());
+void IPredictiveRSDR::primePipeline() {
+	for (int l = 0; l < _layers.size(); l++) {
+		LayerBuffers &buffers = _buffers[l];
 
-		for (int pi = 0; pi < _layers[l]._predictionNodes.size(); pi++) {
-			PredictionNode &p = _layers[l]._predictionNodes[pi];
+		for (int s = 0; s < buffers._hiddenStateLine.size(); s++)
+			for (int i = 0; i < _layers[l]._sdr.getNumHidden(); i++) {
+				buffers._hiddenStateLine[s][i] = _layers[l]._sdr.getHiddenState(i);
+				buffers._predictionStateLine[s][i] = _layers[l]._predictionNodes[i]._state;
+			}
 
-			// Learn
-			if (learn) {
-				float predictionError = _layers[l]._sdr.getHiddenState(pi) - p._statePrev;
+		// The feedback consumed last step is the state of the layer above, as in the sequential mode
+		for (int i = 0; i < buffers._feedBackPrev.size(); i++)
+			buffers._feedBackPrev[i] = _layers[l + 1]._predictionNodes[i]._statePrev;
+	}
 
-				float surprise = predictionError * predictionError;
+	_pipelineLive = true;
+}
 
-				float attention = sigmoid(_layerDescs[l]._attentionFactor * (surprise - p._averageSurprise));
+void IPredictiveRSDR::setPipelined(bool pipelined, const std::shared_ptr<ThreadPool> &threadPool) {
+	_pipelined = pipelined;
+	_threadPool = threadPool;
+}
 
-				attentions[l][pi] = attention;
+void IPredictiveRSDR::predict(int l, const std::vector<float> &feedBack, const std::vector<float> &feedBackPrev, bool learn, std::vector<float> &attentions) {
+	for (int pi = 0; pi < _layers[l]._predictionNodes.size(); pi++) {
+		PredictionNode &p = _layers[l]._predictionNodes[pi];
 
-				p._averageSurprise = (1.0f - _layerDescs[l]._averageSurpriseDecay) * p._averageSurprise + _layerDescs[l]._averageSurpriseDecay * surprise;
+		// Learn
+		if (learn) {
+			float predictionError = _layers[l]._sdr.getHiddenState(pi) - p._statePrev;
 
-				if (l < _layers.size() - 1) {
-					for (int ci = 0; ci < p._feedBackConnections.size(); ci++)
-						p._feedBackConnections[ci]._weight += _layerDescs[l]._learnFeedBack * predictionError * _layers[l + 1]._predictionNodes[p._feedBackConnections[ci]._index]._statePrev;
-				}
+			float surprise = predictionError * predictionError;
 
-				// Predictive
-				for (int ci = 0; ci < p._predictiveConnections.size(); ci++)
-					p._predictiveConnections[ci]._weight += _layerDescs[l]._learnPrediction * predictionError * _layers[l]._sdr.getHiddenStatePrev(p._predictiveConnections[ci]._index);
-			}
+			float attention = sigmoid(_layerDescs[l]._attentionFactor * (surprise - p._averageSurprise));
 
-			float activation = 0.0f;
+			attentions[pi] = attention;
+
+			p._averageSurprise = (1.0f - _layerDescs[l]._averageSurpriseDecay) * p._averageSurprise + _layerDescs[l]._averageSurpriseDecay * surprise;
 
-			// Feed Back
 			if (l < _layers.size() - 1) {
 				for (int ci = 0; ci < p._feedBackConnections.size(); ci++)
-					activation += p._feedBackConnections[ci]._weight * _layers[l + 1]._predictionNodes[p._feedBackConnections[ci]._index]._state;
+					p._feedBackConnections[ci]._weight += _layerDescs[l]._learnFeedBack * predictionError * feedBackPrev[p._feedBackConnections[ci]._index];
 			}
 
 			// Predictive
 			for (int ci = 0; ci < p._predictiveConnections.size(); ci++)
-				activation += p._predictiveConnections[ci]._weight * _layers[l]._sdr.getHiddenState(p._predictiveConnections[ci]._index);
+				p._predictiveConnections[ci]._weight += _layerDescs[l]._learnPrediction * predictionError * _layers[l]._sdr.getHiddenStatePrev(p._predictiveConnections[ci]._index);
+		}
 
-			p._state = p._activation = activation;
+		float activation = 0.0f;
+
+		// Feed Back
+		if (l < _layers.size() - 1) {
+			for (int ci = 0; ci < p._feedBackConnections.size(); ci++)
+				activation += p._feedBackConnections[ci]._weight * feedBack[p._feedBackConnections[ci]._index];
 		}
+
+		// Predictive
+		for (int ci = 0; ci < p._predictiveConnections.size(); ci++)
+			activation += p._predictiveConnections[ci]._weight * _layers[l]._sdr.getHiddenState(p._predictiveConnections[ci]._index);
+
+		p._state = p._activation = activation;
 	}
+}
 
-	// Get first layer prediction
+void IPredictiveRSDR::predictInput(bool learn) {
 	for (int pi = 0; pi < _inputPredictionNodes.size(); pi++) {
 		PredictionNode &p = _inputPredictionNodes[pi];
 
@@ -214,20 +250,133 @@ void IPredictiveRSDR::simStep(std::mt19937 &generator, bool learn) {
 
 		p._state = p._activation = activation;
 	}
+}
 
-	for (int l = 0; l < _layers.size(); l++) {
-		if (learn)
-			_layers[l]._sdr.learn(_layerDescs[l]._learnFeedForward, _layerDescs[l]._learnRecurrent, _layerDescs[l]._sdrLearnBoost, _layerDescs[l]._sdrBoostSparsity, _layerDescs[l]._sdrWeightDecay); //attentions[l], 
+void IPredictiveRSDR::endLayer(int l, bool learn) {
+	if (learn) {
+		HTSL_TRACE_SCOPE("IPredictiveRSDR::learn", l);
 
-		_layers[l]._sdr.stepEnd();
+		_layers[l]._sdr.learn(_layerDescs[l]._learnFeedForward, _layerDescs[l]._learnRecurrent, _layerDescs[l]._sdrLearnBoost, _layerDescs[l]._sdrBoostSparsity, _layerDescs[l]._sdrWeightDecay); //attentions[l], 
+	}
 
-		for (int pi = 0; pi < _layers[l]._predictionNodes.size(); pi++) {
-			PredictionNode &p = _layers[l]._predictionNodes[pi];
+	HTSL_TRACE_SCOPE("IPredictiveRSDR::stepEnd", l);
 
-			p._statePrev = p._state;
-			p._activationPrev = p._activation;
+	_layers[l]._sdr.stepEnd();
+
+	for (int pi = 0; pi < _layers[l]._predictionNodes.size(); pi++) {
+		PredictionNode &p = _layers[l]._predictionNodes[pi];
+
+		p._statePrev = p._state;
+		p._activationPrev = p._activation;
+	}
+}
+
+void IPredictiveRSDR::stepLayerPipelined(int l, bool learn) {
+	LayerBuffers &buffers = _buffers[l];
+
+	{
+		HTSL_TRACE_SCOPE("IPredictiveRSDR::activate", l);
+
+		// Input from the layer below, _pipelineDelay steps of it ago
+		if (l > 0) {
+			const LayerBuffers &below = _buffers[l - 1];
+			const std::vector<float> &hiddenStates = below._hiddenStateLine[(below._writeSlot + 1) % below._hiddenStateLine.size()];
+
+			_layers[l]._sdr.setVisibleStates(hiddenStates.data(), hiddenStates.size());
+		}
+
+		_layers[l]._sdr.activate(_layerDescs[l]._sdrIter, _layerDescs[l]._sdrStepSize, _layerDescs[l]._sdrLambda, _layerDescs[l]._sdrHiddenDecay, _layerDescs[l]._sdrNoise, buffers._generator, _layerDescs[l]._sdrTolerance, _layerDescs[l]._sdrConvergence);
+
+		_layers[l]._sdr.getHiddenStates(buffers._hiddenStateLine[buffers._writeSlot].data());
+	}
+
+	{
+		HTSL_TRACE_SCOPE("IPredictiveRSDR::predict", l);
+
+		// Feedback from the layer above, _pipelineDelay steps of it ago
+		if (l < _layers.size() - 1) {
+			const LayerBuffers &above = _buffers[l + 1];
+			const std::vector<float> &predictionStates = above._predictionStateLine[(above._writeSlot + 1) % above._predictionStateLine.size()];
+
+			std::copy(predictionStates.begin(), predictionStates.end(), buffers._feedBack.begin());
+		}
+
+		predict(l, buffers._feedBack, buffers._feedBackPrev, learn, buffers._attentions);
+
+		std::vector<float> &predictionStates = buffers._predictionStateLine[buffers._writeSlot];
+
+		for (int pi = 0; pi < predictionStates.size(); pi++)
+			predictionStates[pi] = _layers[l]._predictionNodes[pi]._state;
+
+		if (l == 0)
+			predictInput(learn);
+	}
+
+	endLayer(l, learn);
+}
+
+void IPredictiveRSDR::simStep(std::mt19937 &generator, bool learn) {
+	HTSL_TRACE_SCOPE("IPredictiveRSDR::simStep", -1);
+
+	if (_pipelined) {
+		if (!_pipelineLive)
+			primePipeline();
+
+		// Layers run at once, so each draws its noise from its own generator
+		for (int l = 0; l < _layers.size(); l++)
+			_buffers[l]._generator.seed(generator());
+
+		if (_threadPool != nullptr)
+			_threadPool->run(_layers.size(), [this, learn](int l) { stepLayerPipelined(l, learn); });
+		else {
+			for (int l = 0; l < _layers.size(); l++)
+				stepLayerPipelined(l, learn);
+		}
+
+		// Move the outputs of this step one slot closer to the neighbouring layers
+		for (int l = 0; l < _layers.size(); l++) {
+			_buffers[l]._writeSlot = (_buffers[l]._writeSlot + 1) % _buffers[l]._hiddenStateLine.size();
+			_buffers[l]._feedBackPrev.swap(_buffers[l]._feedBack);
 		}
 	}
+	else {
+		_pipelineLive = false;
+
+		// Feature extraction
+		for (int l = 0; l < _layers.size(); l++) {
+			HTSL_TRACE_SCOPE("IPredictiveRSDR::activate", l);
+
+			_layers[l]._sdr.activate(_layerDescs[l]._sdrIter, _layerDescs[l]._sdrStepSize, _layerDescs[l]._sdrLambda, _layerDescs[l]._sdrHiddenDecay, _layerDescs[l]._sdrNoise, generator, _layerDescs[l]._sdrTolerance, _layerDescs[l]._sdrConvergence);
+
+			// Set inputs for next layer if there is one
+			if (l < _layers.size() - 1)
+				_layers[l + 1]._sdr.setVisibleStatesFromHidden(_layers[l]._sdr);
+		}
+
+		// Prediction, top down so the feedback is from this step
+		for (int l = _layers.size() - 1; l >= 0; l--) {
+			HTSL_TRACE_SCOPE("IPredictiveRSDR::predict", l);
+
+			LayerBuffers &buffers = _buffers[l];
+
+			for (int i = 0; i < buffers._feedBack.size(); i++) {
+				buffers._feedBack[i] = _layers[l + 1]._predictionNodes[i]._state;
+				buffers._feedBackPrev[i] = _layers[l + 1]._predictionNodes[i]._statePrev;
+			}
+
+			predict(l, buffers._feedBack, buffers._feedBackPrev, learn, buffers._attentions);
+		}
+
+		// Get first layer prediction
+		{
+			HTSL_TRACE_SCOPE("IPredictiveRSDR::predict", -1);
+
+			predictInput(learn);
+		}
+
+		for (int l = 0; l < _layers.size(); l++)
+			endLayer(l, learn);
+	}
 
 	for (int pi = 0; pi < _inputPredictionNodes.size(); pi++) {
 		PredictionNode &p = _inputPredictionNodes[pi];
@@ -235,9 +384,179 @@ void IPredictiveRSDR::simStep(std::mt19937 &generator, bool learn) {
 		p._statePrev = p._state;
 		p._activationPrev = p._activation;
 	}
+}
+
+namespace {
+	void savePredictionNodes(CheckpointWriter &writer, const std::vector<IPredictiveRSDR::PredictionNode> &nodes) {
+		int numNodes = nodes.size();
+
+		writer.write(numNodes);
+
+		writer.writeLists(numNodes, [&](int i) -> const std::vector<IPredictiveRSDR::Connection> & { return nodes[i]._feedBackConnections; });
+		writer.writeLists(numNodes, [&](int i) -> const std::vector<IPredictiveRSDR::Connection> & { return nodes[i]._predictiveConnections; });
+
+		writer.writeField(numNodes, [&](int i) { return nodes[i]._bias; });
+		writer.writeField(numNodes, [&](int i) { return nodes[i]._state; });
+		writer.writeField(numNodes, [&](int i) { return nodes[i]._statePrev; });
+		writer.writeField(numNodes, [&](int i) { return nodes[i]._activation; });
+		writer.writeField(numNodes, [&](int i) { return nodes[i]._activationPrev; });
+		writer.writeField(numNodes, [&](int i) { return nodes[i]._averageSurprise; });
+	}
+
+	// Predictive connections must address one of numPredictive nodes. Feed back indices depend on the layer above and are checked by the caller
+	bool loadPredictionNodes(CheckpointReader &reader, std::vector<IPredictiveRSDR::PredictionNode> &nodes, int numPredictive) {
+		int numNodes;
+
+		if (!reader.read(numNodes) || !reader.canHold(numNodes))
+			return false;
+
+		nodes.clear();
+		nodes.resize(numNodes);
+
+		reader.readLists(numNodes, [&](int i) -> std::vector<IPredictiveRSDR::Connection> & { return nodes[i]._feedBackConnections; });
+		reader.readConnectionLists(numNodes, numPredictive, [&](int i) -> std::vector<IPredictiveRSDR::Connection> & { return nodes[i]._predictiveConnections; });
+
+		reader.readField(numNodes, [&](int i) -> IPredictiveRSDR::Connection & { return nodes[i]._bias; });
+		reader.readField(numNodes, [&](int i) -> float & { return nodes[i]._state; });
+		reader.readField(numNodes, [&](int i) -> float & { return nodes[i]._statePrev; });
+		reader.readField(numNodes, [&](int i) -> float & { return nodes[i]._activation; });
+		reader.readField(numNodes, [&](int i) -> float & { return nodes[i]._activationPrev; });
+		reader.readField(numNodes, [&](int i) -> float & { return nodes[i]._averageSurprise; });
+
+		return reader.good();
+	}
+
+	// Reads a buffer that must keep the size it was allocated with
+	bool loadBuffer(CheckpointReader &reader, std::vector<float> &buffer) {
+		size_t size = buffer.size();
+
+		return reader.readArray(buffer) && buffer.size() == size;
+	}
+}
+
+bool IPredictiveRSDR::save(const std::string &fileName) const {
+	return Checkpoint::saveToFile(*this, fileName);
+}
+
+bool IPredictiveRSDR::load(const std::string &fileName) {
+	return Checkpoint::loadFromFile(*this, fileName);
+}
+
+void IPredictiveRSDR::save(CheckpointWriter &writer) const {
+	writer.beginObject("sdr::IPredictiveRSDR", 4);
+
+	writer.writeArray(_layerDescs);
+	writer.write(_learnInputFeedBack);
+
+	for (int l = 0; l < _layers.size(); l++) {
+		_layers[l]._sdr.save(writer);
+
+		savePredictionNodes(writer, _layers[l]._predictionNodes);
+	}
+
+	savePredictionNodes(writer, _inputPredictionNodes);
+
+	// Data in flight between the layers of the pipelined mode
+	writer.write(static_cast<unsigned char>(_pipelineLive));
+
+	for (int l = 0; l < _buffers.size(); l++) {
+		writer.write(_buffers[l]._writeSlot);
+
+		for (int s = 0; s < _buffers[l]._hiddenStateLine.size(); s++) {
+			writer.writeArray(_buffers[l]._hiddenStateLine[s]);
+			writer.writeArray(_buffers[l]._predictionStateLine[s]);
+		}
+
+		writer.writeArray(_buffers[l]._feedBackPrev);
+	}
+}
+
+bool IPredictiveRSDR::load(CheckpointReader &reader) {
+	// Read into a fresh IPredictiveRSDR with this one's settings, so a failed load leaves this one unchanged
+	IPredictiveRSDR loaded;
+
+	loaded._pipelined = _pipelined;
+	loaded._threadPool = _threadPool;
+
+	if (!loaded.loadMembers(reader))
+		return false;
+
+	// The learn hook is set on every layer, and the loaded layers are new
+	if (!_layers.empty())
+		loaded.setLearnHook(_layers.front()._sdr.getLearnHook());
+
+	*this = std::move(loaded);
+
+	return true;
+}
+
+bool IPredictiveRSDR::loadMembers(CheckpointReader &reader) {
+	if (!reader.beginObject("sdr::IPredictiveRSDR", 4) || !reader.readArray(_layerDescs) || !reader.read(_learnInputFeedBack))
+		return false;
+
+	// The delay lines are in the checkpoint, so their slots must fit in it
+	for (size_t l = 0; l < _layerDescs.size(); l++)
+		if (_layerDescs[l]._pipelineDelay < 1 || !reader.canHold(_layerDescs[l]._pipelineDelay))
+			return false;
+
+	_layers.clear();
+	_layers.resize(_layerDescs.size());
+
+	for (int l = 0; l < _layers.size(); l++) {
+		if (!_layers[l]._sdr.load(reader))
+			return false;
+
+		// Each layer must take the one below it and have the size of its description
+		const IRSDR &sdr = _layers[l]._sdr;
+
+		if (sdr.getHiddenWidth() != _layerDescs[l]._width || sdr.getHiddenHeight() != _layerDescs[l]._height
+			|| (l > 0 && (sdr.getVisibleWidth() != _layerDescs[l - 1]._width || sdr.getVisibleHeight() != _layerDescs[l - 1]._height)))
+			return false;
+
+		if (!loadPredictionNodes(reader, _layers[l]._predictionNodes, sdr.getNumHidden()) || _layers[l]._predictionNodes.size() != static_cast<size_t>(sdr.getNumHidden()))
+			return false;
+
+		_layers[l]._sdr.setSolver(_layerDescs[l]._sdrSolver);
+	}
+
+	// The input prediction nodes only have feed back connections
+	if (!loadPredictionNodes(reader, _inputPredictionNodes, 0) || _layers.empty() || _inputPredictionNodes.size() != static_cast<size_t>(_layers.front()._sdr.getNumVisible()))
+		return false;
+
+	for (size_t l = 0; l < _layers.size(); l++) {
+		int numFeedBack = l + 1 < _layers.size() ? _layers[l + 1]._sdr.getNumHidden() : 0;
+
+		for (size_t pi = 0; pi < _layers[l]._predictionNodes.size(); pi++)
+			if (!Checkpoint::hasValidIndices(_layers[l]._predictionNodes[pi]._feedBackConnections, numFeedBack))
+				return false;
+	}
+
+	for (size_t pi = 0; pi < _inputPredictionNodes.size(); pi++)
+		if (!Checkpoint::hasValidIndices(_inputPredictionNodes[pi]._feedBackConnections, _layers.front()._sdr.getNumHidden()))
+			return false;
+
+	allocateBuffers();
+
+	unsigned char pipelineLive;
+
+	if (!reader.read(pipelineLive) || pipelineLive > 1)
+		return false;
+
+	for (size_t l = 0; l < _layers.size(); l++) {
+		LayerBuffers &buffers = _buffers[l];
+
+		if (!reader.read(buffers._writeSlot) || buffers._writeSlot < 0 || buffers._writeSlot > _layerDescs[l]._pipelineDelay)
+			return false;
+
+		for (int s = 0; s <= _layerDescs[l]._pipelineDelay; s++)
+			if (!loadBuffer(reader, buffers._hiddenStateLine[s]) || !loadBuffer(reader, buffers._predictionStateLine[s]))
+				return false;
+
+		if (!loadBuffer(reader, buffers._feedBackPrev))
+			return false;
+	}
 
-	//for (int i = 0; i < _layers.front()._sdr.getNumHidden(); i++)
-	//	std::cout << _layers.front()._sdr.getHiddenState(i) << " ";
+	_pipelineLive = pipelineLive != 0;
 
-	//std::cout << std::endl;
+	return reader.good();
 }
\ No newline at end of file
@@ -1,12 +1,15 @@
 #pragma once
 
 #include "IRSDR.h"
+#include "ThreadPool.h"
+
+#include <memory>
 
 namespace sdr {
 	class IPredictiveRSDR {
 	public:
 		struct Connection {
-			unsigned short _index;
+			int _index;
 
 			float _weight;
 		};
@@ -21,6 +24,9 @@ namespace sdr {
 			float _learnFeedBack, _learnPrediction;
 
 			int _sdrIter;
+			float _sdrTolerance; // Stops the sparse coding before _sdrIter iterations once the state change drops below this, 0 always runs _sdrIter
+			IRSDR::Convergence _sdrConvergence;
+			IRSDR::Solver _sdrSolver;
 			float _sdrStepSize;
 			float _sdrLambda;
 			float _sdrHiddenDecay;
@@ -32,15 +38,18 @@ namespace sdr {
 			float _averageSurpriseDecay;
 			float _attentionFactor;
 
+			int _pipelineDelay; // Steps this layer's outputs take to reach the layers above and below it in pipelined mode, at least 1
+
 			LayerDesc()
 				: _width(16), _height(16),
 				_receptiveRadius(8), _recurrentRadius(6), _predictiveRadius(6), _feedBackRadius(8),
 				_learnFeedForward(0.05f), _learnRecurrent(0.05f),
 				_learnFeedBack(0.05f), _learnPrediction(0.05f),
-				_sdrIter(30), _sdrStepSize(0.05f), _sdrLambda(0.4f), _sdrHiddenDecay(0.01f), _sdrWeightDecay(0.0001f),
+				_sdrIter(30), _sdrTolerance(0.0f), _sdrConvergence(IRSDR::_meanDelta), _sdrSolver(IRSDR::_dense), _sdrStepSize(0.05f), _sdrLambda(0.4f), _sdrHiddenDecay(0.01f), _sdrWeightDecay(0.0001f),
 				_sdrBoostSparsity(0.02f), _sdrLearnBoost(0.05f), _sdrNoise(0.01f),
 				_averageSurpriseDecay(0.01f),
-				_attentionFactor(2.0f)
+				_attentionFactor(2.0f),
+				_pipelineDelay(1)
 			{}
 		};
 
@@ -59,7 +68,7 @@ namespace sdr {
 			float _averageSurprise; // Use to keep track of importance for prediction. If current error is greater than average, then attention is > 0.5 else < 0.5 (sigmoid)
 
 			PredictionNode()
-				: _state(0.0f), _statePrev(0.0f), _activation(0.0f), _activationPrev(0.0f), _averageSurprise(0.0f)
+				: _bias(), _state(0.0f), _statePrev(0.0f), _activation(0.0f), _activationPrev(0.0f), _averageSurprise(0.0f)
 			{}
 		};
 
@@ -74,23 +83,79 @@ namespace sdr {
 		}
 
 	private:
+		// Per-layer buffers of simStep. In pipelined mode layers exchange data only through these: a layer writes its outputs to slot _writeSlot of its delay lines,
+		// which have _pipelineDelay + 1 slots, and its neighbours read the slot after it, written _pipelineDelay steps earlier. The slots advance once every layer is done
+		struct LayerBuffers {
+			std::vector<std::vector<float>> _hiddenStateLine; // Input of the layer above
+			std::vector<std::vector<float>> _predictionStateLine; // Feedback of the layer below
+			std::vector<float> _feedBack, _feedBackPrev; // Prediction states of the layer above used in this and the previous step
+			std::vector<float> _attentions;
+
+			int _writeSlot;
+
+			std::mt19937 _generator;
+		};
+
 		std::vector<LayerDesc> _layerDescs;
 		std::vector<Layer> _layers;
 
 		std::vector<PredictionNode> _inputPredictionNodes;
 
+		std::vector<LayerBuffers> _buffers;
+
+		bool _pipelined;
+		bool _pipelineLive; // Whether the delay lines carry on from the current states. Not after createRandom or a sequential step
+
+		std::shared_ptr<ThreadPool> _threadPool;
+
+		void allocateBuffers();
+
+		// Fills every slot of the delay lines from the current states, so a pipelined run continues from them as if each layer had held them for its delay
+		void primePipeline();
+
+		void predict(int l, const std::vector<float> &feedBack, const std::vector<float> &feedBackPrev, bool learn, std::vector<float> &attentions);
+		void predictInput(bool learn);
+
+		// Learning and stepEnd of one layer
+		void endLayer(int l, bool learn);
+
+		void stepLayerPipelined(int l, bool learn);
+
+		// The body of load, run on a freshly constructed object
+		bool loadMembers(CheckpointReader &reader);
 
 	public:
 		float _learnInputFeedBack;
 
 		IPredictiveRSDR()
-			: _learnInputFeedBack(0.05f)
+			: _pipelined(false), _pipelineLive(false), _learnInputFeedBack(0.05f)
 		{}
 
 		void createRandom(int inputWidth, int inputHeight, int inputFeedBackRadius, const std::vector<LayerDesc> &layerDescs, float initMinWeight, float initMaxWeight, float initThreshold, std::mt19937 &generator);
 
 		void simStep(std::mt19937 &generator, bool learn = true);
 
+		// Pipelined mode: all layers step at once, layer l reading the hidden states of layer l - 1 and the predictions of layer l + 1 as they were LayerDesc::_pipelineDelay
+		// steps of the sending layer earlier. The delay of at least one step is what lets the layers run independently.
+		// Layers run as tasks of the thread pool, or in turn without one, with the same results. The learn hook is then called from the pool threads, and must not run() the same pool.
+		// The data in flight between layers is checkpointed. After createRandom or a sequential step the pipeline restarts from the current states
+		void setPipelined(bool pipelined, const std::shared_ptr<ThreadPool> &threadPool = nullptr);
+
+		bool getPipelined() const {
+			return _pipelined;
+		}
+
+		const std::shared_ptr<ThreadPool> &getThreadPool() const {
+			return _threadPool;
+		}
+
+		// Binary checkpoint of the layer descriptions, weights and states (see Checkpoint.h). load returns false if the file holds no IPredictiveRSDR, and then leaves this one unchanged
+		bool save(const std::string &fileName) const;
+		bool load(const std::string &fileName);
+
+		void save(CheckpointWriter &writer) const;
+		bool load(CheckpointReader &reader);
+
 		void setInput(int index, float value) {
 			_layers.front()._sdr.setVisibleState(index, value);
 		}
@@ -99,10 +164,21 @@ namespace sdr {
 			setInput(x + y * _layerDescs.front()._width, value);
 		}
 
+		// Whole input frame at once
+		void setInputs(const float* pInputs, size_t count) {
+			_layers.front()._sdr.setVisibleStates(pInputs, count);
+		}
+
 		float getPrediction(int index) const {
 			return _inputPredictionNodes[index]._state;
 		}
 
+		// Copies all predictions, as many as there are inputs
+		void getPredictions(float* pPredictions) const {
+			for (int pi = 0; pi < _inputPredictionNodes.size(); pi++)
+				pPredictions[pi] = _inputPredictionNodes[pi]._state;
+		}
+
 		float getPrediction(int x, int y) const {
 			return getPrediction(x + y * _layers.front()._sdr.getVisibleWidth());
 		}
@@ -114,5 +190,22 @@ namespace sdr {
 		const std::vector<Layer> &getLayers() const {
 			return _layers;
 		}
+
+		// Prediction nodes of the input, fed back from the first layer
+		const std::vector<PredictionNode> &getInputPredictionNodes() const {
+			return _inputPredictionNodes;
+		}
+
+		// Sets the debug hook of every layer's IRSDR
+		void setLearnHook(const IRSDR::LearnHook &learnHook) {
+			for (int l = 0; l < _layers.size(); l++)
+				_layers[l]._sdr.setLearnHook(learnHook);
+		}
+
+		// Resets the per-layer sparse coding iteration histograms (IRSDR::getIterationHistogram)
+		void clearIterationHistograms() {
+			for (int l = 0; l < _layers.size(); l++)
+				_layers[l]._sdr.clearIterationHistogram();
+		}
 	};
 }
\ No newline at end of file
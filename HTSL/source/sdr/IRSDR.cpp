@@ -1,19 +1,15 @@
 #include "IRSDR.h"
 
-#include <algorithm>
-
-#include <SFML/System.hpp>
-#include <SFML/Window.hpp>
+#include "Checkpoint.h"
 
 #include <algorithm>
+#include <limits>
 
 #include <assert.h>
 
-#include <iostream>
-
 using namespace sdr;
 
-void IRSDR::createRandom(int visibleWidth, int visibleHeight, int hiddenWidth, int hiddenHeight, int receptiveRadius, int recurrentRadius, float initMinWeight, float initMaxWeight, std::mt19937 &generator) {
+void IRSDR::createRandom(int visibleWidth, int visibleHeight, int hiddenWidth, int hiddenHeight, int receptiveRadius, int recurrentRadius, float initMinWeight, float initMaxWeight, std::mt19937 &generator, Storage storage) {
 	std::uniform_real_distribution<float> weightDist(initMinWeight, initMaxWeight);
 
 	_visibleWidth = visibleWidth;
@@ -24,6 +20,8 @@ void IRSDR::createRandom(int visibleWidth, int visibleHeight, int hiddenWidth, i
 	_receptiveRadius = receptiveRadius;
 	_recurrentRadius = recurrentRadius;
 
+	_storage = storage;
+
 	int numVisible = visibleWidth * visibleHeight;
 	int numHidden = hiddenWidth * hiddenHeight;
 	int receptiveSize = std::pow(receptiveRadius * 2 + 1, 2);
@@ -31,11 +29,26 @@ void IRSDR::createRandom(int visibleWidth, int visibleHeight, int hiddenWidth, i
 
 	_visible.resize(numVisible);
 
+	_hidden.clear();
 	_hidden.resize(numHidden);
 
 	float hiddenToVisibleWidth = static_cast<float>(visibleWidth) / static_cast<float>(hiddenWidth);
 	float hiddenToVisibleHeight = static_cast<float>(visibleHeight) / static_cast<float>(hiddenHeight);
 
+	int receptiveDim = receptiveRadius * 2 + 1;
+	int recurrentDim = recurrentRadius * 2 + 1;
+
+	// _implicit weights go straight into the blocks at their offset from the window center, no connection lists are built
+	_feedForwardWeights.clear();
+	_recurrentWeights.clear();
+
+	if (_storage == _implicit) {
+		_feedForwardWeights.assign(numHidden * receptiveSize, 0.0f);
+
+		if (recurrentRadius != -1)
+			_recurrentWeights.assign(numHidden * recurrentSize, 0.0f);
+	}
+
 	for (int hi = 0; hi < numHidden; hi++) {
 		int hx = hi % hiddenWidth;
 		int hy = hi / hiddenWidth;
@@ -44,7 +57,8 @@ void IRSDR::createRandom(int visibleWidth, int visibleHeight, int hiddenWidth, i
 		int centerY = std::round(hy * hiddenToVisibleHeight);
 
 		// Receptive
-		_hidden[hi]._feedForwardConnections.reserve(receptiveSize);
+		if (_storage == _nodes)
+			_hidden[hi]._feedForwardConnections.reserve(receptiveSize);
 
 		for (int dx = -receptiveRadius; dx <= receptiveRadius; dx++)
 			for (int dy = -receptiveRadius; dy <= receptiveRadius; dy++) {
@@ -54,12 +68,18 @@ void IRSDR::createRandom(int visibleWidth, int visibleHeight, int hiddenWidth, i
 				if (vx >= 0 && vx < visibleWidth && vy >= 0 && vy < visibleHeight) {
 					int vi = vx + vy * visibleWidth;
 
-					Connection c;
+					float weight = weightDist(generator);
+
+					if (_storage == _nodes) {
+						Connection c;
 
-					c._weight = weightDist(generator);
-					c._index = vi;
+						c._weight = weight;
+						c._index = vi;
 
-					_hidden[hi]._feedForwardConnections.push_back(c);
+						_hidden[hi]._feedForwardConnections.push_back(c);
+					}
+					else
+						_feedForwardWeights[hi * receptiveSize + (dx + receptiveRadius) + (dy + receptiveRadius) * receptiveDim] = weight;
 				}
 			}
 
@@ -67,7 +87,8 @@ void IRSDR::createRandom(int visibleWidth, int visibleHeight, int hiddenWidth, i
 
 		// Recurrent
 		if (recurrentRadius != -1) {
-			_hidden[hi]._recurrentConnections.reserve(recurrentSize);
+			if (_storage == _nodes)
+				_hidden[hi]._recurrentConnections.reserve(recurrentSize);
 
 			for (int dx = -recurrentRadius; dx <= recurrentRadius; dx++)
 				for (int dy = -recurrentRadius; dy <= recurrentRadius; dy++) {
@@ -80,39 +101,230 @@ void IRSDR::createRandom(int visibleWidth, int visibleHeight, int hiddenWidth, i
 					if (hox >= 0 && hox < hiddenWidth && hoy >= 0 && hoy < hiddenHeight) {
 						int hio = hox + hoy * hiddenWidth;
 
-						Connection c;
+						float weight = weightDist(generator);
+
+						if (_storage == _nodes) {
+							Connection c;
 
-						c._weight = weightDist(generator);
-						c._index = hio;
+							c._weight = weight;
+							c._index = hio;
 
-						_hidden[hi]._recurrentConnections.push_back(c);
+							_hidden[hi]._recurrentConnections.push_back(c);
+						}
+						else
+							_recurrentWeights[hi * recurrentSize + (dx + recurrentRadius) + (dy + recurrentRadius) * recurrentDim] = weight;
 					}
 				}
 
 			_hidden[hi]._recurrentConnections.shrink_to_fit();
 		}
 	}
+
+	allocateWorkspace();
+}
+
+void IRSDR::allocateWorkspace() {
+	_workspace._y.assign(_hidden.size(), 0.0f);
+	_workspace._t.assign(_hidden.size(), 0.0f);
+	_workspace._tPrev.assign(_hidden.size(), 0.0f);
+	_workspace._xPrev.assign(_hidden.size(), 0.0f);
+	_workspace._visibleErrors.assign(_visible.size(), 0.0f);
+	_workspace._hiddenErrors.assign(_hidden.size(), 0.0f);
+	_workspace._states.assign(_hidden.size(), 0.0f);
+	_workspace._reconHidden.assign(_hidden.size(), 0.0f);
+	_workspace._reconVisible.assign(_visible.size(), 0.0f);
+	_workspace._feedForwardNorms.assign(_hidden.size(), 0.0f);
+	_workspace._recurrentNorms.assign(_hidden.size(), 0.0f);
+	_workspace._sumBounds.assign(_hidden.size(), 0.0f);
+	_workspace._feedForwardDriftRefs.assign(_hidden.size(), 0.0f);
+	_workspace._recurrentDriftRefs.assign(_hidden.size(), 0.0f);
+
+	_workspace._driftTilesX = (_hiddenWidth + _driftTileSize - 1) / _driftTileSize;
+	_workspace._driftTilesY = (_hiddenHeight + _driftTileSize - 1) / _driftTileSize;
+
+	int numTiles = _workspace._driftTilesX * _workspace._driftTilesY;
+
+	_workspace._feedForwardDrifts.assign(numTiles, 0.0f);
+	_workspace._recurrentDrifts.assign(numTiles, 0.0f);
+	_workspace._feedForwardDriftDeltas.assign(numTiles, 0.0f);
+	_workspace._recurrentDriftDeltas.assign(numTiles, 0.0f);
+
+	// Receptive centers are rounded, so nodes further apart than (2r + 1) / (visible per hidden) have disjoint windows. One more for rounding of the ratio
+	_workspace._feedForwardReachX = _workspace._feedForwardReachY = 0;
+
+	if (_visibleWidth > 0 && _visibleHeight > 0) {
+		_workspace._feedForwardReachX = static_cast<int>((_receptiveRadius * 2 + 1) * static_cast<float>(_hiddenWidth) / static_cast<float>(_visibleWidth)) + 1;
+		_workspace._feedForwardReachY = static_cast<int>((_receptiveRadius * 2 + 1) * static_cast<float>(_hiddenHeight) / static_cast<float>(_visibleHeight)) + 1;
+	}
+
+	_workspace._recurrentReach = std::max(0, _recurrentRadius * 2);
+
+	_workspace._sumBoundsValid = false;
+}
+
+void IRSDR::getReceptiveCenter(int hi, int &centerX, int &centerY) const {
+	float hiddenToVisibleWidth = static_cast<float>(_visibleWidth) / static_cast<float>(_hiddenWidth);
+	float hiddenToVisibleHeight = static_cast<float>(_visibleHeight) / static_cast<float>(_hiddenHeight);
+
+	centerX = std::round((hi % _hiddenWidth) * hiddenToVisibleWidth);
+	centerY = std::round((hi / _hiddenWidth) * hiddenToVisibleHeight);
+}
+
+float IRSDR::getErrorSum(int hi, float &absSum) const {
+	int receptiveDim = _receptiveRadius * 2 + 1;
+	int recurrentDim = _recurrentRadius * 2 + 1;
+
+	float sum = 0.0f;
+
+	absSum = 0.0f;
+
+	if (_storage == _implicit) {
+		int centerX, centerY;
+
+		getReceptiveCenter(hi, centerX, centerY);
+
+		int dxMin, dxMax, dyMin, dyMax;
+
+		clipWindow(centerX, _receptiveRadius, _visibleWidth, dxMin, dxMax);
+		clipWindow(centerY, _receptiveRadius, _visibleHeight, dyMin, dyMax);
+
+		int rowLength = dxMax - dxMin + 1;
+
+		for (int dy = dyMin; dy <= dyMax; dy++) {
+			const float* pErrors = &_workspace._visibleErrors[centerX + dxMin + (centerY + dy) * _visibleWidth];
+			const float* pWeights = &_feedForwardWeights[hi * receptiveDim * receptiveDim + (dxMin + _receptiveRadius) + (dy + _receptiveRadius) * receptiveDim];
+
+			for (int i = 0; i < rowLength; i++) {
+				sum += pErrors[i] * pWeights[i];
+				absSum += std::abs(pErrors[i] * pWeights[i]);
+			}
+		}
+
+		if (_recurrentRadius > 0) {
+			int hx = hi % _hiddenWidth;
+			int hy = hi / _hiddenWidth;
+
+			clipWindow(hx, _recurrentRadius, _hiddenWidth, dxMin, dxMax);
+			clipWindow(hy, _recurrentRadius, _hiddenHeight, dyMin, dyMax);
+
+			rowLength = dxMax - dxMin + 1;
+
+			for (int dy = dyMin; dy <= dyMax; dy++) {
+				const float* pErrors = &_workspace._hiddenErrors[hx + dxMin + (hy + dy) * _hiddenWidth];
+				const float* pWeights = &_recurrentWeights[hi * recurrentDim * recurrentDim + (dxMin + _recurrentRadius) + (dy + _recurrentRadius) * recurrentDim];
+
+				for (int i = 0; i < rowLength; i++) {
+					sum += pErrors[i] * pWeights[i];
+					absSum += std::abs(pErrors[i] * pWeights[i]);
+				}
+			}
+		}
+	}
+	else {
+		for (int ci = 0; ci < _hidden[hi]._feedForwardConnections.size(); ci++) {
+			float term = _workspace._visibleErrors[_hidden[hi]._feedForwardConnections[ci]._index] * _hidden[hi]._feedForwardConnections[ci]._weight;
+
+			sum += term;
+			absSum += std::abs(term);
+		}
+
+		for (int ci = 0; ci < _hidden[hi]._recurrentConnections.size(); ci++) {
+			float term = _workspace._hiddenErrors[_hidden[hi]._recurrentConnections[ci]._index] * _hidden[hi]._recurrentConnections[ci]._weight;
+
+			sum += term;
+			absSum += std::abs(term);
+		}
+	}
+
+	return sum;
+}
+
+void IRSDR::computeWeightNorms() {
+	int receptiveSize = std::pow(_receptiveRadius * 2 + 1, 2);
+	int recurrentSize = std::pow(_recurrentRadius * 2 + 1, 2);
+
+	for (int hi = 0; hi < _hidden.size(); hi++) {
+		float feedForwardNorm2 = 0.0f;
+		float recurrentNorm2 = 0.0f;
+
+		if (_storage == _implicit) {
+			// Entries outside the layer are 0
+			for (int i = 0; i < receptiveSize; i++)
+				feedForwardNorm2 += _feedForwardWeights[hi * receptiveSize + i] * _feedForwardWeights[hi * receptiveSize + i];
+
+			if (_recurrentRadius > 0) {
+				for (int i = 0; i < recurrentSize; i++)
+					recurrentNorm2 += _recurrentWeights[hi * recurrentSize + i] * _recurrentWeights[hi * recurrentSize + i];
+			}
+		}
+		else {
+			for (int ci = 0; ci < _hidden[hi]._feedForwardConnections.size(); ci++)
+				feedForwardNorm2 += _hidden[hi]._feedForwardConnections[ci]._weight * _hidden[hi]._feedForwardConnections[ci]._weight;
+
+			for (int ci = 0; ci < _hidden[hi]._recurrentConnections.size(); ci++)
+				recurrentNorm2 += _hidden[hi]._recurrentConnections[ci]._weight * _hidden[hi]._recurrentConnections[ci]._weight;
+		}
+
+		_workspace._feedForwardNorms[hi] = std::sqrt(feedForwardNorm2);
+		_workspace._recurrentNorms[hi] = std::sqrt(recurrentNorm2);
+	}
 }
 
 void IRSDR::pL(const std::vector<float> &states, float stepSize, float lambda, float hiddenDecay) {
-	std::vector<float> visibleErrors(_visible.size(), 0.0f);
-	std::vector<float> hiddenErrors(_hidden.size(), 0.0f);
+	Workspace &w = _workspace;
 
 	for (int vi = 0; vi < _visible.size(); vi++)
-		visibleErrors[vi] = _visible[vi]._input - _visible[vi]._reconstruction;
+		w._visibleErrors[vi] = _visible[vi]._input - _visible[vi]._reconstruction;
 
 	for (int hi = 0; hi < _hidden.size(); hi++)
-		hiddenErrors[hi] = _hidden[hi]._statePrev - _hidden[hi]._reconstruction;
+		w._hiddenErrors[hi] = _hidden[hi]._statePrev - _hidden[hi]._reconstruction;
+
+	bool activeSet = _solver == _activeSet;
+
+	// Summing n products in float is off from the exact sum by at most about n * epsilon / 2 times the sum of |terms| (not |sum|, which can cancel).
+	// Every node has at most this many terms, plus headroom for the products' own rounding
+	int maxTerms = _storage == _implicit ? std::pow(_receptiveRadius * 2 + 1, 2) + (_recurrentRadius > 0 ? std::pow(_recurrentRadius * 2 + 1, 2) : 0) : 0;
+
+	if (_storage != _implicit) {
+		for (int hi = 0; hi < _hidden.size(); hi++)
+			maxTerms = std::max(maxTerms, static_cast<int>(_hidden[hi]._feedForwardConnections.size() + _hidden[hi]._recurrentConnections.size()));
+	}
+
+	float rounding = (maxTerms + 2) * std::numeric_limits<float>::epsilon();
 
 	// Activate - deltaH = alpha * (D * (x - Dh) - lambda * h / (sqrt(h^2 + e)))
 	for (int hi = 0; hi < _hidden.size(); hi++) {
-		float sum = 0.0f;
+		float statePrev = _hidden[hi]._state;
 
-		for (int ci = 0; ci < _hidden[hi]._feedForwardConnections.size(); ci++)
-			sum += visibleErrors[_hidden[hi]._feedForwardConnections[ci]._index] * _hidden[hi]._feedForwardConnections[ci]._weight;
+		int tile = activeSet ? getDriftTile(hi) : 0;
 
-		for (int ci = 0; ci < _hidden[hi]._recurrentConnections.size(); ci++)
-			sum += hiddenErrors[_hidden[hi]._recurrentConnections[ci]._index] * _hidden[hi]._recurrentConnections[ci]._weight;
+		if (activeSet && w._sumBoundsValid && states[hi] == 0.0f) {
+			// The sum can have moved by at most the weight norms times how far the errors in the windows moved since it was computed (Cauchy-Schwarz)
+			float bound = w._sumBounds[hi] + w._feedForwardNorms[hi] * (w._feedForwardDrifts[tile] - w._feedForwardDriftRefs[hi]) + w._recurrentNorms[hi] * (w._recurrentDrifts[tile] - w._recurrentDriftRefs[hi]);
+
+			// From 0 the state is stepSize * sum, which the shrinkage zeroes unless |sum| exceeds the boost. The stored bound already holds the rounding of the old sum
+			// and room for that of the new one; the factor covers the new sum's rounding on the drifted part, and the relative rounding of the norms, drifts and bound,
+			// which are sums of non-negative terms
+			if (bound * (1.0f + rounding) * 1.001f < _hidden[hi]._boost) {
+				_hidden[hi]._state = 0.0f;
+
+				addDrift(hi, std::abs(statePrev));
+
+				continue;
+			}
+		}
+
+		float absSum;
+
+		float sum = getErrorSum(hi, absSum);
+
+		if (activeSet) {
+			// The exact sum is within rounding * absSum of the computed one, and so is a later computed sum of the exact one, whose terms add up to at most
+			// absSum plus the drifted part
+			w._sumBounds[hi] = std::abs(sum) + 2.0f * rounding * absSum;
+			w._feedForwardDriftRefs[hi] = w._feedForwardDrifts[tile];
+			w._recurrentDriftRefs[hi] = w._recurrentDrifts[tile];
+		}
 
 		//-lambda * _hidden[hi]._state / std::sqrt(_hidden[hi]._state * _hidden[hi]._state + epsilon)
 		//_hidden[hi]._state += stepSize * (sum - lambda * _hidden[hi]._state / std::sqrt(_hidden[hi]._state * _hidden[hi]._state + epsilon)) - hiddenDecay * _hidden[hi]._state;
@@ -122,14 +334,82 @@ void IRSDR::pL(const std::vector<float> &states, float stepSize, float lambda, f
 		_hidden[hi]._state = std::max(std::abs(_hidden[hi]._state) - stepSize * _hidden[hi]._boost, 0.0f) * (_hidden[hi]._state > 0.0f ? 1.0f : -1.0f);
 	
 		_hidden[hi]._state = std::min(1.0f, std::max(-1.0f, _hidden[hi]._state));
+
+		// The shrinkage leaves -0 where it zeroes a negative state; skipped nodes are +0, so store +0 for both solvers to save the same bits
+		if (_hidden[hi]._state == 0.0f)
+			_hidden[hi]._state = 0.0f;
+
+		if (activeSet)
+			addDrift(hi, std::abs(_hidden[hi]._state - statePrev));
 	}
+
+	// The reconstruction the next iteration sees includes this iteration's changes
+	if (activeSet) {
+		for (int t = 0; t < w._feedForwardDrifts.size(); t++) {
+			w._feedForwardDrifts[t] += w._feedForwardDriftDeltas[t];
+			w._recurrentDrifts[t] += w._recurrentDriftDeltas[t];
+		}
+
+		std::fill(w._feedForwardDriftDeltas.begin(), w._feedForwardDriftDeltas.end(), 0.0f);
+		std::fill(w._recurrentDriftDeltas.begin(), w._recurrentDriftDeltas.end(), 0.0f);
+
+		w._sumBoundsValid = true;
+	}
+}
+
+void IRSDR::addDrift(int hi, float change) {
+	if (change == 0.0f)
+		return;
+
+	Workspace &w = _workspace;
+
+	int hx = hi % _hiddenWidth;
+	int hy = hi / _hiddenWidth;
+
+	float feedForwardDrift = w._feedForwardNorms[hi] * change;
+	float recurrentDrift = w._recurrentNorms[hi] * change;
+
+	// Every tile holding a node the change can reach
+	int txMin = std::max(0, hx - w._feedForwardReachX) / _driftTileSize;
+	int txMax = std::min(_hiddenWidth - 1, hx + w._feedForwardReachX) / _driftTileSize;
+	int tyMin = std::max(0, hy - w._feedForwardReachY) / _driftTileSize;
+	int tyMax = std::min(_hiddenHeight - 1, hy + w._feedForwardReachY) / _driftTileSize;
+
+	for (int ty = tyMin; ty <= tyMax; ty++)
+		for (int tx = txMin; tx <= txMax; tx++)
+			w._feedForwardDriftDeltas[tx + ty * w._driftTilesX] += feedForwardDrift;
+
+	if (recurrentDrift == 0.0f)
+		return;
+
+	txMin = std::max(0, hx - w._recurrentReach) / _driftTileSize;
+	txMax = std::min(_hiddenWidth - 1, hx + w._recurrentReach) / _driftTileSize;
+	tyMin = std::max(0, hy - w._recurrentReach) / _driftTileSize;
+	tyMax = std::min(_hiddenHeight - 1, hy + w._recurrentReach) / _driftTileSize;
+
+	for (int ty = tyMin; ty <= tyMax; ty++)
+		for (int tx = txMin; tx <= txMax; tx++)
+			w._recurrentDriftDeltas[tx + ty * w._driftTilesX] += recurrentDrift;
 }
 
-void IRSDR::activate(int iter, float stepSize, float lambda, float hiddenDecay, float noise, std::mt19937 &generator) {
-	std::vector<float> y(_hidden.size());
-	std::vector<float> t(_hidden.size());
-	std::vector<float> tPrev(_hidden.size(), 0.0f);
-	std::vector<float> xPrev(_hidden.size(), 0.0f);
+int IRSDR::activate(int iter, float stepSize, float lambda, float hiddenDecay, float noise, std::mt19937 &generator, float tolerance, Convergence convergence) {
+	std::vector<float> &y = _workspace._y;
+	std::vector<float> &t = _workspace._t;
+	std::vector<float> &tPrev = _workspace._tPrev;
+	std::vector<float> &xPrev = _workspace._xPrev;
+
+	std::fill(tPrev.begin(), tPrev.end(), 0.0f);
+	std::fill(xPrev.begin(), xPrev.end(), 0.0f);
+
+	if (_solver == _activeSet) {
+		computeWeightNorms();
+
+		// The errors change with the input, so every sum is computed in the first iteration
+		_workspace._sumBoundsValid = false;
+
+		std::fill(_workspace._feedForwardDrifts.begin(), _workspace._feedForwardDrifts.end(), 0.0f);
+		std::fill(_workspace._recurrentDrifts.begin(), _workspace._recurrentDrifts.end(), 0.0f);
+	}
 
 	std::normal_distribution<float> noiseDist(0.0f, noise);
 
@@ -149,6 +429,10 @@ void IRSDR::activate(int iter, float stepSize, float lambda, float hiddenDecay,
 		y[hi] = (_hidden[hi]._state += noiseDist(generator));
 	}
 
+	int iterations = 0;
+
+	_lastMaxDelta = _lastMeanDelta = 0.0f;
+
 	for (int i = 0; i < iter; i++) {
 		reconstruct();
 
@@ -160,10 +444,28 @@ void IRSDR::activate(int iter, float stepSize, float lambda, float hiddenDecay,
 		for (int hi = 0.0f; hi < y.size(); hi++)
 			y[hi] = _hidden[hi]._state + (tPrev[hi] - 1.0f) / t[hi] * (_hidden[hi]._state - xPrev[hi]);
 
-		tPrev = t;
+		tPrev.swap(t);
+
+		float maxDelta = 0.0f;
+		float sumDelta = 0.0f;
+
+		for (int hi = 0.0f; hi < xPrev.size(); hi++) {
+			float delta = std::abs(_hidden[hi]._state - xPrev[hi]);
+
+			maxDelta = std::max(maxDelta, delta);
+			sumDelta += delta;
 
-		for (int hi = 0.0f; hi < xPrev.size(); hi++)
 			xPrev[hi] = _hidden[hi]._state;
+		}
+
+		iterations = i + 1;
+
+		_lastMaxDelta = maxDelta;
+		_lastMeanDelta = sumDelta / std::max<int>(1, _hidden.size());
+
+		// The first iteration is measured against 0 rather than a previous code, so it never stops
+		if (tolerance > 0.0f && i > 0 && (convergence == _maxDelta ? _lastMaxDelta : _lastMeanDelta) < tolerance)
+			break;
 	}
 
 	reconstruct();
@@ -171,11 +473,36 @@ void IRSDR::activate(int iter, float stepSize, float lambda, float hiddenDecay,
 	pL(y, stepSize, lambda, hiddenDecay);
 
 	reconstruct();
+
+	if (_iterationHistogram.size() < iter + 1)
+		_iterationHistogram.resize(iter + 1, 0);
+
+	_iterationHistogram[iterations]++;
+
+	_lastIterations = iterations;
+
+	return iterations;
 }
 
 void IRSDR::reconstruct() {
-	std::vector<float> visibleDivs(_visible.size(), 0.0f);
-	std::vector<float> hiddenDivs(_hidden.size(), 0.0f);
+	if (_storage == _implicit) {
+		std::vector<float> &states = _workspace._states;
+		std::vector<float> &reconHidden = _workspace._reconHidden;
+		std::vector<float> &reconVisible = _workspace._reconVisible;
+
+		for (int hi = 0; hi < _hidden.size(); hi++)
+			states[hi] = _hidden[hi]._state;
+
+		reconstructImplicit(states, &reconHidden, reconVisible);
+
+		for (int vi = 0; vi < _visible.size(); vi++)
+			_visible[vi]._reconstruction = reconVisible[vi];
+
+		for (int hi = 0; hi < _hidden.size(); hi++)
+			_hidden[hi]._reconstruction = reconHidden[hi];
+
+		return;
+	}
 
 	for (int vi = 0; vi < _visible.size(); vi++)
 		_visible[vi]._reconstruction = 0.0f;
@@ -184,6 +511,10 @@ void IRSDR::reconstruct() {
 		_hidden[hi]._reconstruction = 0.0f;
 
 	for (int hi = 0; hi < _hidden.size(); hi++) {
+		// Most states are 0 after the shrinkage in pL, and add nothing
+		if (_hidden[hi]._state == 0.0f)
+			continue;
+
 		for (int ci = 0; ci < _hidden[hi]._feedForwardConnections.size(); ci++)
 			_visible[_hidden[hi]._feedForwardConnections[ci]._index]._reconstruction += _hidden[hi]._feedForwardConnections[ci]._weight * _hidden[hi]._state;
 
@@ -193,16 +524,22 @@ void IRSDR::reconstruct() {
 }
 
 void IRSDR::reconstruct(const std::vector<float> &states, std::vector<float> &reconHidden, std::vector<float> &reconVisible) {
-	std::vector<float> visibleDivs(_visible.size(), 0.0f);
-	std::vector<float> hiddenDivs(_hidden.size(), 0.0f);
-
 	reconVisible.clear();
 	reconVisible.assign(_visible.size(), 0.0f);
 
 	reconHidden.clear();
 	reconHidden.assign(_hidden.size(), 0.0f);
 
+	if (_storage == _implicit) {
+		reconstructImplicit(states, &reconHidden, reconVisible);
+
+		return;
+	}
+
 	for (int hi = 0; hi < _hidden.size(); hi++) {
+		if (states[hi] == 0.0f)
+			continue;
+
 		for (int ci = 0; ci < _hidden[hi]._feedForwardConnections.size(); ci++)
 			reconVisible[_hidden[hi]._feedForwardConnections[ci]._index] += _hidden[hi]._feedForwardConnections[ci]._weight * states[hi];
 
@@ -212,20 +549,85 @@ void IRSDR::reconstruct(const std::vector<float> &states, std::vector<float> &re
 }
 
 void IRSDR::reconstructFeedForward(const std::vector<float> &states, std::vector<float> &recon) {
-	std::vector<float> visibleDivs(_visible.size(), 0.0f);
-
 	recon.clear();
 	recon.assign(_visible.size(), 0.0f);
 
+	if (_storage == _implicit) {
+		reconstructImplicit(states, nullptr, recon);
+
+		return;
+	}
+
 	for (int hi = 0; hi < _hidden.size(); hi++) {
+		if (states[hi] == 0.0f)
+			continue;
+
 		for (int ci = 0; ci < _hidden[hi]._feedForwardConnections.size(); ci++)
 			recon[_hidden[hi]._feedForwardConnections[ci]._index] += _hidden[hi]._feedForwardConnections[ci]._weight * states[hi];
 	}
 }
 
+void IRSDR::reconstructImplicit(const std::vector<float> &states, std::vector<float>* pReconHidden, std::vector<float> &reconVisible) {
+	int receptiveDim = _receptiveRadius * 2 + 1;
+	int recurrentDim = _recurrentRadius * 2 + 1;
+
+	reconVisible.clear();
+	reconVisible.assign(_visible.size(), 0.0f);
+
+	if (pReconHidden != nullptr) {
+		pReconHidden->clear();
+		pReconHidden->assign(_hidden.size(), 0.0f);
+	}
+
+	for (int hi = 0; hi < _hidden.size(); hi++) {
+		float state = states[hi];
+
+		// Most states are 0 after the shrinkage in pL, and add nothing
+		if (state == 0.0f)
+			continue;
+
+		int centerX, centerY;
+
+		getReceptiveCenter(hi, centerX, centerY);
+
+		int dxMin, dxMax, dyMin, dyMax;
+
+		clipWindow(centerX, _receptiveRadius, _visibleWidth, dxMin, dxMax);
+		clipWindow(centerY, _receptiveRadius, _visibleHeight, dyMin, dyMax);
+
+		int rowLength = dxMax - dxMin + 1;
+
+		for (int dy = dyMin; dy <= dyMax; dy++) {
+			float* pRecon = &reconVisible[centerX + dxMin + (centerY + dy) * _visibleWidth];
+			const float* pWeights = &_feedForwardWeights[hi * receptiveDim * receptiveDim + (dxMin + _receptiveRadius) + (dy + _receptiveRadius) * receptiveDim];
+
+			for (int i = 0; i < rowLength; i++)
+				pRecon[i] += pWeights[i] * state;
+		}
+
+		if (pReconHidden != nullptr && _recurrentRadius > 0) {
+			int hx = hi % _hiddenWidth;
+			int hy = hi / _hiddenWidth;
+
+			clipWindow(hx, _recurrentRadius, _hiddenWidth, dxMin, dxMax);
+			clipWindow(hy, _recurrentRadius, _hiddenHeight, dyMin, dyMax);
+
+			rowLength = dxMax - dxMin + 1;
+
+			for (int dy = dyMin; dy <= dyMax; dy++) {
+				float* pRecon = &(*pReconHidden)[hx + dxMin + (hy + dy) * _hiddenWidth];
+				const float* pWeights = &_recurrentWeights[hi * recurrentDim * recurrentDim + (dxMin + _recurrentRadius) + (dy + _recurrentRadius) * recurrentDim];
+
+				for (int i = 0; i < rowLength; i++)
+					pRecon[i] += pWeights[i] * state;
+			}
+		}
+	}
+}
+
 void IRSDR::learn(float learnFeedForward, float learnRecurrent, float learnBoost, float boostSparsity, float weightDecay, float maxWeightDelta) {
-	std::vector<float> visibleErrors(_visible.size(), 0.0f);
-	std::vector<float> hiddenErrors(_hidden.size(), 0.0f);
+	std::vector<float> &visibleErrors = _workspace._visibleErrors;
+	std::vector<float> &hiddenErrors = _workspace._hiddenErrors;
 
 	for (int vi = 0; vi < _visible.size(); vi++)
 		visibleErrors[vi] = _visible[vi]._input - _visible[vi]._reconstruction;
@@ -233,9 +635,60 @@ void IRSDR::learn(float learnFeedForward, float learnRecurrent, float learnBoost
 	for (int hi = 0; hi < _hidden.size(); hi++)
 		hiddenErrors[hi] = _hidden[hi]._statePrev - _hidden[hi]._reconstruction;
 
+	int receptiveDim = _receptiveRadius * 2 + 1;
+	int recurrentDim = _recurrentRadius * 2 + 1;
+
 	for (int hi = 0; hi < _hidden.size(); hi++) {
 		float learn = _hidden[hi]._state;
 
+		if (_storage == _implicit) {
+			int centerX, centerY;
+
+			getReceptiveCenter(hi, centerX, centerY);
+
+			int dxMin, dxMax, dyMin, dyMax;
+
+			clipWindow(centerX, _receptiveRadius, _visibleWidth, dxMin, dxMax);
+			clipWindow(centerY, _receptiveRadius, _visibleHeight, dyMin, dyMax);
+
+			int rowLength = dxMax - dxMin + 1;
+
+			for (int dy = dyMin; dy <= dyMax; dy++) {
+				const float* pErrors = &visibleErrors[centerX + dxMin + (centerY + dy) * _visibleWidth];
+				float* pWeights = &_feedForwardWeights[hi * receptiveDim * receptiveDim + (dxMin + _receptiveRadius) + (dy + _receptiveRadius) * receptiveDim];
+
+				for (int i = 0; i < rowLength; i++) {
+					float delta = learnFeedForward * learn * pErrors[i] - weightDecay * pWeights[i];
+
+					pWeights[i] += std::min(maxWeightDelta, std::max(-maxWeightDelta, delta));
+				}
+			}
+
+			if (_recurrentRadius > 0) {
+				int hx = hi % _hiddenWidth;
+				int hy = hi / _hiddenWidth;
+
+				clipWindow(hx, _recurrentRadius, _hiddenWidth, dxMin, dxMax);
+				clipWindow(hy, _recurrentRadius, _hiddenHeight, dyMin, dyMax);
+
+				rowLength = dxMax - dxMin + 1;
+
+				for (int dy = dyMin; dy <= dyMax; dy++) {
+					const float* pErrors = &hiddenErrors[hx + dxMin + (hy + dy) * _hiddenWidth];
+					float* pWeights = &_recurrentWeights[hi * recurrentDim * recurrentDim + (dxMin + _recurrentRadius) + (dy + _recurrentRadius) * recurrentDim];
+
+					for (int i = 0; i < rowLength; i++) {
+						float delta = learnRecurrent * learn * pErrors[i] - weightDecay * pWeights[i];
+
+						pWeights[i] += std::min(maxWeightDelta, std::max(-maxWeightDelta, delta));
+					}
+				}
+
+				// A node is not connected to itself
+				_recurrentWeights[hi * recurrentDim * recurrentDim + _recurrentRadius + _recurrentRadius * recurrentDim] = 0.0f;
+			}
+		}
+
 		//if (_hidden[hi]._activation != 0.0f)
 		for (int ci = 0; ci < _hidden[hi]._feedForwardConnections.size(); ci++) {
 			float delta = learnFeedForward * learn * visibleErrors[_hidden[hi]._feedForwardConnections[ci]._index] - weightDecay * _hidden[hi]._feedForwardConnections[ci]._weight;
@@ -252,12 +705,8 @@ void IRSDR::learn(float learnFeedForward, float learnRecurrent, float learnBoost
 		_hidden[hi]._boost = std::max(0.0f, _hidden[hi]._boost + ((_hidden[hi]._state == 0.0f ? 0.0f : 1.0f) - boostSparsity) * learnBoost);
 	}
 
-	if (sf::Keyboard::isKeyPressed(sf::Keyboard::P)) {
-		for (int hi = 0; hi < _hidden.size(); hi++)
-			std::cout << hiddenErrors[hi] << " ";
-
-		std::cout << std::endl;
-	}
+	if (_learnHook)
+		_learnHook(*this, hiddenErrors);
 }
 
 /*void IRSDR::learn(const std::vector<float> &attentions, float learnFeedForward, float learnRecurrent) {
@@ -290,6 +739,27 @@ void IRSDR::learn(float learnFeedForward, float learnRecurrent, float learnBoost
 	}
 }*/
 
+float IRSDR::getVHWeight(int hi, int ci) const {
+	if (_storage == _nodes)
+		return _hidden[hi]._feedForwardConnections[ci]._weight;
+
+	int centerX, centerY;
+
+	getReceptiveCenter(hi, centerX, centerY);
+
+	int dxMin, dxMax, dyMin, dyMax;
+
+	clipWindow(centerX, _receptiveRadius, _visibleWidth, dxMin, dxMax);
+	clipWindow(centerY, _receptiveRadius, _visibleHeight, dyMin, dyMax);
+
+	int dx = dxMin + ci / (dyMax - dyMin + 1);
+	int dy = dyMin + ci % (dyMax - dyMin + 1);
+
+	int dim = _receptiveRadius * 2 + 1;
+
+	return _feedForwardWeights[hi * dim * dim + (dx + _receptiveRadius) + (dy + _receptiveRadius) * dim];
+}
+
 void IRSDR::getVHWeights(int hx, int hy, std::vector<float> &rectangle) const {
 	float hiddenToVisibleWidth = static_cast<float>(_visibleWidth) / static_cast<float>(_hiddenWidth);
 	float hiddenToVisibleHeight = static_cast<float>(_visibleHeight) / static_cast<float>(_hiddenHeight);
@@ -300,6 +770,13 @@ void IRSDR::getVHWeights(int hx, int hy, std::vector<float> &rectangle) const {
 
 	int hi = hx + hy * _hiddenWidth;
 
+	// The weight blocks already have this layout
+	if (_storage == _implicit) {
+		std::copy(_feedForwardWeights.begin() + hi * dim * dim, _feedForwardWeights.begin() + (hi + 1) * dim * dim, rectangle.begin());
+
+		return;
+	}
+
 	int centerX = std::round(hx * hiddenToVisibleWidth);
 	int centerY = std::round(hy * hiddenToVisibleHeight);
 
@@ -322,4 +799,134 @@ void IRSDR::getVHWeights(int hx, int hy, std::vector<float> &rectangle) const {
 void IRSDR::stepEnd() {
 	for (int hi = 0; hi < _hidden.size(); hi++)
 		_hidden[hi]._statePrev = _hidden[hi]._state;
+}
+
+void IRSDR::setVisibleStates(const float* pStates, size_t count) {
+	for (size_t vi = 0; vi < count; vi++)
+		_visible[vi]._input = pStates[vi];
+}
+
+void IRSDR::setVisibleStatesFromHidden(const IRSDR &source) {
+	for (int vi = 0; vi < source._hidden.size(); vi++)
+		_visible[vi]._input = source._hidden[vi]._state;
+}
+
+void IRSDR::getHiddenStates(float* pStates) const {
+	for (int hi = 0; hi < _hidden.size(); hi++)
+		pStates[hi] = _hidden[hi]._state;
+}
+
+bool IRSDR::save(const std::string &fileName) const {
+	return Checkpoint::saveToFile(*this, fileName);
+}
+
+bool IRSDR::load(const std::string &fileName) {
+	return Checkpoint::loadFromFile(*this, fileName);
+}
+
+void IRSDR::save(CheckpointWriter &writer) const {
+	writer.beginObject("sdr::IRSDR", 1);
+
+	writer.write(_visibleWidth);
+	writer.write(_visibleHeight);
+	writer.write(_hiddenWidth);
+	writer.write(_hiddenHeight);
+	writer.write(_receptiveRadius);
+	writer.write(_recurrentRadius);
+	writer.write(_storage);
+
+	int numHidden = _hidden.size();
+
+	writer.writeArray(_visible);
+
+	writer.writeLists(numHidden, [&](int i) -> const std::vector<Connection> & { return _hidden[i]._feedForwardConnections; });
+	writer.writeLists(numHidden, [&](int i) -> const std::vector<Connection> & { return _hidden[i]._recurrentConnections; });
+
+	writer.writeField(numHidden, [&](int i) { return _hidden[i]._state; });
+	writer.writeField(numHidden, [&](int i) { return _hidden[i]._statePrev; });
+	writer.writeField(numHidden, [&](int i) { return _hidden[i]._input; });
+	writer.writeField(numHidden, [&](int i) { return _hidden[i]._reconstruction; });
+	writer.writeField(numHidden, [&](int i) { return _hidden[i]._boost; });
+
+	writer.writeArray(_feedForwardWeights);
+	writer.writeArray(_recurrentWeights);
+}
+
+bool IRSDR::load(CheckpointReader &reader) {
+	// Read into a fresh IRSDR with this one's settings, so a failed load leaves this one unchanged
+	IRSDR loaded;
+
+	loaded._solver = _solver;
+	loaded._learnHook = _learnHook;
+	loaded._lastIterations = _lastIterations;
+	loaded._lastMaxDelta = _lastMaxDelta;
+	loaded._lastMeanDelta = _lastMeanDelta;
+	loaded._iterationHistogram = _iterationHistogram;
+
+	if (!loaded.loadMembers(reader))
+		return false;
+
+	*this = std::move(loaded);
+
+	return true;
+}
+
+bool IRSDR::loadMembers(CheckpointReader &reader) {
+	if (!reader.beginObject("sdr::IRSDR", 1))
+		return false;
+
+	reader.read(_visibleWidth);
+	reader.read(_visibleHeight);
+	reader.read(_hiddenWidth);
+	reader.read(_hiddenHeight);
+	reader.read(_receptiveRadius);
+	reader.read(_recurrentRadius);
+	// Read as an int, an out of range enum value is undefined
+	int storage;
+
+	reader.read(storage);
+
+	// Everything read below is checked against these, so a malformed file fails instead of indexing out of bounds
+	if (!reader.good() || !Checkpoint::isValidArea(_visibleWidth, _visibleHeight) || !Checkpoint::isValidArea(_hiddenWidth, _hiddenHeight) || !reader.canHold(_hiddenWidth * _hiddenHeight)
+		|| !Checkpoint::isValidRadius(_receptiveRadius, 0) || !Checkpoint::isValidRadius(_recurrentRadius, -1) || storage < _nodes || storage > _implicit)
+		return false;
+
+	_storage = static_cast<Storage>(storage);
+
+	int numVisible = _visibleWidth * _visibleHeight;
+	int numHidden = _hiddenWidth * _hiddenHeight;
+
+	reader.readArray(_visible);
+
+	_hidden.clear();
+	_hidden.resize(numHidden);
+
+	reader.readConnectionLists(numHidden, numVisible, [&](int i) -> std::vector<Connection> & { return _hidden[i]._feedForwardConnections; });
+	reader.readConnectionLists(numHidden, numHidden, [&](int i) -> std::vector<Connection> & { return _hidden[i]._recurrentConnections; });
+
+	reader.readField(numHidden, [&](int i) -> float & { return _hidden[i]._state; });
+	reader.readField(numHidden, [&](int i) -> float & { return _hidden[i]._statePrev; });
+	reader.readField(numHidden, [&](int i) -> float & { return _hidden[i]._input; });
+	reader.readField(numHidden, [&](int i) -> float & { return _hidden[i]._reconstruction; });
+	reader.readField(numHidden, [&](int i) -> float & { return _hidden[i]._boost; });
+
+	reader.readArray(_feedForwardWeights);
+	reader.readArray(_recurrentWeights);
+
+	// The blocks are only used, and the connection lists only filled, with _implicit and _nodes storage respectively
+	bool implicit = _storage == _implicit;
+
+	if (!reader.good() || _visible.size() != static_cast<size_t>(numVisible)
+		|| !Checkpoint::isBlockSize(_feedForwardWeights.size(), numHidden, implicit ? _receptiveRadius : -1)
+		|| !Checkpoint::isBlockSize(_recurrentWeights.size(), numHidden, implicit ? _recurrentRadius : -1))
+		return false;
+
+	if (implicit)
+		for (int hi = 0; hi < numHidden; hi++)
+			if (!_hidden[hi]._feedForwardConnections.empty() || !_hidden[hi]._recurrentConnections.empty())
+				return false;
+
+	allocateWorkspace();
+
+	return true;
 }
\ No newline at end of file
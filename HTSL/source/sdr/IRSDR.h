@@ -1,13 +1,39 @@
 #pragma once
 
 #include <vector>
+#include <string>
 #include <random>
+#include <algorithm>
+#include <functional>
 
 namespace sdr {
+	class CheckpointWriter;
+	class CheckpointReader;
+
 	class IRSDR {
 	public:
+		// _nodes: every node stores its connection list. _implicit: no indices are stored, every node has a dense (2r + 1)^2 weight block over its window
+		enum Storage {
+			_nodes, _implicit
+		};
+
+		// What activate compares to its tolerance. A few oscillating codes can keep the largest change up long after the rest settle
+		enum Convergence {
+			_maxDelta, _meanDelta
+		};
+
+		// _dense: every FISTA iteration updates every hidden node. _activeSet: nodes whose momentum point is 0 are skipped while a bound shows they stay 0 through the shrinkage,
+		// so an iteration costs about as much as the non-zero codes. The bound includes the float rounding of the sums,
+		// so a skipped node is one _dense would have left at 0 and results are identical
+		enum Solver {
+			_dense, _activeSet
+		};
+
+		// Debug introspection, called at the end of learn with the errors of the hidden reconstruction
+		typedef std::function<void(const IRSDR &sdr, const std::vector<float> &hiddenErrors)> LearnHook;
+
 		struct Connection {
-			unsigned short _index;
+			int _index;
 
 			float _weight;
 		};
@@ -44,19 +70,106 @@ namespace sdr {
 		int _receptiveRadius;
 		int _recurrentRadius;
 
+		Storage _storage;
+
 		std::vector<VisibleNode> _visible;
 		std::vector<HiddenNode> _hidden;
 
+		// _implicit storage. Row-major blocks of (2r + 1)^2 weights per hidden node. Entries outside the layer, and a node's own recurrent entry, stay 0
+		std::vector<float> _feedForwardWeights;
+		std::vector<float> _recurrentWeights;
+
+		// Scratch buffers of activate, reconstruct and learn, sized by createRandom and load so a step does not allocate
+		struct Workspace {
+			std::vector<float> _y;
+			std::vector<float> _t;
+			std::vector<float> _tPrev;
+			std::vector<float> _xPrev;
+			std::vector<float> _visibleErrors;
+			std::vector<float> _hiddenErrors;
+			std::vector<float> _states;
+			std::vector<float> _reconHidden;
+			std::vector<float> _reconVisible;
+
+			// _activeSet solver. L2 norms of the weights of every node, and a bound on the magnitude of every node's exact error sum when last computed
+			std::vector<float> _feedForwardNorms;
+			std::vector<float> _recurrentNorms;
+			std::vector<float> _sumBounds;
+
+			// Accumulated bounds on how far the visible and hidden errors seen by each tile of hidden nodes have moved, the part added by the running iteration,
+			// and the tile's bounds when each node's sum was computed. Only changes of nodes whose windows can overlap a tile's windows reach the tile
+			std::vector<float> _feedForwardDrifts;
+			std::vector<float> _recurrentDrifts;
+			std::vector<float> _feedForwardDriftDeltas;
+			std::vector<float> _recurrentDriftDeltas;
+			std::vector<float> _feedForwardDriftRefs;
+			std::vector<float> _recurrentDriftRefs;
+
+			int _driftTilesX, _driftTilesY;
+
+			// How many hidden nodes apart (x, y) two nodes can be and still have overlapping feed-forward (recurrent) windows
+			int _feedForwardReachX, _feedForwardReachY;
+			int _recurrentReach;
+
+			bool _sumBoundsValid;
+		};
+
+		static const int _driftTileSize = 4;
+
+		Workspace _workspace;
+
+		Solver _solver;
+
+		LearnHook _learnHook;
+
+		// Iterations used by the last activate, and how many activates used each number of iterations
+		int _lastIterations;
+		float _lastMaxDelta;
+		float _lastMeanDelta;
+		std::vector<int> _iterationHistogram;
+
+		void allocateWorkspace();
+
+		// Clips the window [center - radius, center + radius] to [0, size), as offsets from center
+		static void clipWindow(int center, int radius, int size, int &dMin, int &dMax) {
+			dMin = std::max(-radius, -center);
+			dMax = std::min(radius, size - 1 - center);
+		}
+
+		void getReceptiveCenter(int hi, int &centerX, int &centerY) const;
+
+		void reconstructImplicit(const std::vector<float> &states, std::vector<float>* pReconHidden, std::vector<float> &reconVisible);
+
+		// Sum of the weighted errors of a hidden node's connections, from the errors in the workspace, and the sum of their magnitudes
+		float getErrorSum(int hi, float &absSum) const;
+
+		void computeWeightNorms();
+
+		int getDriftTile(int hi) const {
+			return (hi % _hiddenWidth) / _driftTileSize + (hi / _hiddenWidth) / _driftTileSize * _workspace._driftTilesX;
+		}
+
+		// Adds the bound on how far a change of node hi moves the errors to the tiles it can reach
+		void addDrift(int hi, float change);
+
 		void pL(const std::vector<float> &states, float stepSize, float lambda, float hiddenDecay);
 
+		// The body of load, run on a freshly constructed object
+		bool loadMembers(CheckpointReader &reader);
+
 	public:
 		static float sigmoid(float x) {
 			return 1.0f / (1.0f + std::exp(-x));
 		}
 
-		void createRandom(int visibleWidth, int visibleHeight, int hiddenWidth, int hiddenHeight, int receptiveRadius, int recurrentRadius, float initMinWeight, float initMaxWeight, std::mt19937 &generator);
+		IRSDR()
+			: _visibleWidth(0), _visibleHeight(0), _hiddenWidth(0), _hiddenHeight(0), _receptiveRadius(0), _recurrentRadius(-1), _storage(_nodes), _solver(_dense), _lastIterations(0), _lastMaxDelta(0.0f), _lastMeanDelta(0.0f)
+		{}
+
+		void createRandom(int visibleWidth, int visibleHeight, int hiddenWidth, int hiddenHeight, int receptiveRadius, int recurrentRadius, float initMinWeight, float initMaxWeight, std::mt19937 &generator, Storage storage = _nodes);
 
-		void activate(int iter, float stepSize, float lambda, float hiddenDecay, float noise, std::mt19937 &generator);
+		// Runs at most iter FISTA iterations. With tolerance > 0, stops early once the largest or mean hidden state change of an iteration drops below tolerance. Returns the iterations used
+		int activate(int iter, float stepSize, float lambda, float hiddenDecay, float noise, std::mt19937 &generator, float tolerance = 0.0f, Convergence convergence = _meanDelta);
 		void reconstruct();
 		void reconstruct(const std::vector<float> &states, std::vector<float> &reconHidden, std::vector<float> &reconVisible);
 		void reconstructFeedForward(const std::vector<float> &states, std::vector<float> &recon);
@@ -64,6 +177,13 @@ namespace sdr {
 		//void learn(const std::vector<float> &attentions, float learnFeedForward, float learnRecurrent);
 		void stepEnd();
 
+		// Binary checkpoint of weights and states (see Checkpoint.h). load returns false if the file holds no IRSDR, and then leaves this one unchanged
+		bool save(const std::string &fileName) const;
+		bool load(const std::string &fileName);
+
+		void save(CheckpointWriter &writer) const;
+		bool load(CheckpointReader &reader);
+
 		void setVisibleState(int index, float value) {
 			_visible[index]._input = value;
 		}
@@ -72,6 +192,15 @@ namespace sdr {
 			_visible[x + y * _visibleWidth]._input = value;
 		}
 
+		// Whole frames at once
+		void setVisibleStates(const float* pStates, size_t count);
+
+		// Visible states from the hidden states of the layer below
+		void setVisibleStatesFromHidden(const IRSDR &source);
+
+		// getNumHidden() values
+		void getHiddenStates(float* pStates) const;
+
 		float getVisibleRecon(int index) const {
 			return _visible[index]._reconstruction;
 		}
@@ -104,6 +233,7 @@ namespace sdr {
 			return _hidden[x + y * _hiddenWidth]._statePrev;
 		}
 
+		// With _implicit storage the connection lists are empty
 		HiddenNode &getHiddenNode(int index) {
 			return _hidden[index];
 		}
@@ -140,12 +270,54 @@ namespace sdr {
 			return _receptiveRadius;
 		}
 
-		float getVHWeight(int hi, int ci) const {
-			return _hidden[hi]._feedForwardConnections[ci]._weight;
+		Storage getStorage() const {
+			return _storage;
+		}
+
+		// An empty hook disables it
+		void setLearnHook(const LearnHook &learnHook) {
+			_learnHook = learnHook;
+		}
+
+		const LearnHook &getLearnHook() const {
+			return _learnHook;
+		}
+
+		void setSolver(Solver solver) {
+			_solver = solver;
 		}
 
+		Solver getSolver() const {
+			return _solver;
+		}
+
+		int getLastIterations() const {
+			return _lastIterations;
+		}
+
+		// Largest and mean absolute hidden state change in the last iteration of the last activate
+		float getLastMaxDelta() const {
+			return _lastMaxDelta;
+		}
+
+		float getLastMeanDelta() const {
+			return _lastMeanDelta;
+		}
+
+		// Entry i counts the activates that used i iterations
+		const std::vector<int> &getIterationHistogram() const {
+			return _iterationHistogram;
+		}
+
+		void clearIterationHistogram() {
+			std::fill(_iterationHistogram.begin(), _iterationHistogram.end(), 0);
+		}
+
+		// ci counts the connections that lie inside the visible layer, column by column
+		float getVHWeight(int hi, int ci) const;
+
 		float getVHWeight(int hx, int hy, int ci) const {
-			return _hidden[hx + hy * _hiddenWidth]._feedForwardConnections[ci]._weight;
+			return getVHWeight(hx + hy * _hiddenWidth, ci);
 		}
 
 		void getVHWeights(int hx, int hy, std::vector<float> &rectangle) const;
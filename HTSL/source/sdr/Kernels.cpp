@@ -0,0 +1,601 @@
+#include "Kernels.h"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define KERNELS_X86
+#include <immintrin.h>
+#endif
+
+using namespace sdr;
+
+// Scalar
+
+static float windowSumScalar(const float* pX, int xStride, int rowLength, int numRows) {
+	float sum = 0.0f;
+
+	for (int r = 0; r < numRows; r++) {
+		const float* pRow = pX + r * xStride;
+
+		for (int i = 0; i < rowLength; i++)
+			sum += pRow[i];
+	}
+
+	return sum;
+}
+
+static float windowCenteredDotScalar(const float* pX, int xStride, const float* pW, int wStride, float center, int rowLength, int numRows) {
+	float sum = 0.0f;
+
+	for (int r = 0; r < numRows; r++) {
+		const float* pRow = pX + r * xStride;
+		const float* pRowWeights = pW + r * wStride;
+
+		for (int i = 0; i < rowLength; i++)
+			sum += (pRow[i] - center) * pRowWeights[i];
+	}
+
+	return sum;
+}
+
+static void windowOjaScalar(float* pW, int wStride, const float* pX, int xStride, float rate, float learn, int rowLength, int numRows) {
+	for (int r = 0; r < numRows; r++) {
+		const float* pRow = pX + r * xStride;
+		float* pRowWeights = pW + r * wStride;
+
+		for (int i = 0; i < rowLength; i++)
+			pRowWeights[i] += rate * (pRow[i] - learn * pRowWeights[i]);
+	}
+}
+
+static float windowWeightedDistanceScalar(const float* pX, int xStride, const float* pW, int wStride, const float* pF, int fStride, float sum, int rowLength, int numRows) {
+	for (int r = 0; r < numRows; r++) {
+		const float* pRow = pX + r * xStride;
+		const float* pRowWeights = pW + r * wStride;
+		const float* pRowFalloffs = pF + r * fStride;
+
+		for (int i = 0; i < rowLength; i++) {
+			float delta = pRow[i] - pRowWeights[i];
+
+			sum += pRowFalloffs[i] * delta * delta;
+		}
+	}
+
+	return sum;
+}
+
+static float windowMaskedSumScalar(const float* pX, int xStride, const float* pW, int wStride, const float* pF, int fStride, float threshold, int rowLength, int numRows) {
+	float sum = 0.0f;
+
+	for (int r = 0; r < numRows; r++) {
+		const float* pRow = pX + r * xStride;
+		const float* pRowWeights = pW + r * wStride;
+		const float* pRowFalloffs = pF + r * fStride;
+
+		for (int i = 0; i < rowLength; i++)
+			sum += pRowWeights[i] * pRowFalloffs[i] * (pRow[i] > threshold ? 1.0f : 0.0f);
+	}
+
+	return sum;
+}
+
+#ifdef KERNELS_X86
+
+// SSE4
+
+__attribute__((target("sse4.1")))
+static float horizontalSumSSE4(__m128 v) {
+	v = _mm_add_ps(v, _mm_movehl_ps(v, v));
+	v = _mm_add_ss(v, _mm_shuffle_ps(v, v, 0x55));
+
+	return _mm_cvtss_f32(v);
+}
+
+__attribute__((target("sse4.1")))
+static float windowSumSSE4(const float* pX, int xStride, int rowLength, int numRows) {
+	int vectorLength = rowLength & ~3;
+
+	__m128 sum = _mm_setzero_ps();
+	float tail = 0.0f;
+
+	for (int r = 0; r < numRows; r++) {
+		const float* pRow = pX + r * xStride;
+
+		int i = 0;
+
+		for (; i < vectorLength; i += 4)
+			sum = _mm_add_ps(sum, _mm_loadu_ps(pRow + i));
+
+		for (; i < rowLength; i++)
+			tail += pRow[i];
+	}
+
+	return horizontalSumSSE4(sum) + tail;
+}
+
+__attribute__((target("sse4.1")))
+static float windowCenteredDotSSE4(const float* pX, int xStride, const float* pW, int wStride, float center, int rowLength, int numRows) {
+	int vectorLength = rowLength & ~3;
+
+	__m128 centers = _mm_set1_ps(center);
+	__m128 sum = _mm_setzero_ps();
+	float tail = 0.0f;
+
+	for (int r = 0; r < numRows; r++) {
+		const float* pRow = pX + r * xStride;
+		const float* pRowWeights = pW + r * wStride;
+
+		int i = 0;
+
+		for (; i < vectorLength; i += 4)
+			sum = _mm_add_ps(sum, _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(pRow + i), centers), _mm_loadu_ps(pRowWeights + i)));
+
+		for (; i < rowLength; i++)
+			tail += (pRow[i] - center) * pRowWeights[i];
+	}
+
+	return horizontalSumSSE4(sum) + tail;
+}
+
+__attribute__((target("sse4.1")))
+static void windowOjaSSE4(float* pW, int wStride, const float* pX, int xStride, float rate, float learn, int rowLength, int numRows) {
+	int vectorLength = rowLength & ~3;
+
+	__m128 rates = _mm_set1_ps(rate);
+	__m128 learns = _mm_set1_ps(learn);
+
+	for (int r = 0; r < numRows; r++) {
+		const float* pRow = pX + r * xStride;
+		float* pRowWeights = pW + r * wStride;
+
+		int i = 0;
+
+		for (; i < vectorLength; i += 4) {
+			__m128 w = _mm_loadu_ps(pRowWeights + i);
+
+			_mm_storeu_ps(pRowWeights + i, _mm_add_ps(w, _mm_mul_ps(rates, _mm_sub_ps(_mm_loadu_ps(pRow + i), _mm_mul_ps(learns, w)))));
+		}
+
+		for (; i < rowLength; i++)
+			pRowWeights[i] += rate * (pRow[i] - learn * pRowWeights[i]);
+	}
+}
+
+__attribute__((target("sse4.1")))
+static float windowWeightedDistanceSSE4(const float* pX, int xStride, const float* pW, int wStride, const float* pF, int fStride, float sum, int rowLength, int numRows) {
+	int vectorLength = rowLength & ~3;
+
+	__m128 sums = _mm_setzero_ps();
+
+	for (int r = 0; r < numRows; r++) {
+		const float* pRow = pX + r * xStride;
+		const float* pRowWeights = pW + r * wStride;
+		const float* pRowFalloffs = pF + r * fStride;
+
+		int i = 0;
+
+		for (; i < vectorLength; i += 4) {
+			__m128 delta = _mm_sub_ps(_mm_loadu_ps(pRow + i), _mm_loadu_ps(pRowWeights + i));
+
+			sums = _mm_add_ps(sums, _mm_mul_ps(_mm_mul_ps(_mm_loadu_ps(pRowFalloffs + i), delta), delta));
+		}
+
+		for (; i < rowLength; i++) {
+			float delta = pRow[i] - pRowWeights[i];
+
+			sum += pRowFalloffs[i] * delta * delta;
+		}
+	}
+
+	return horizontalSumSSE4(sums) + sum;
+}
+
+__attribute__((target("sse4.1")))
+static float windowMaskedSumSSE4(const float* pX, int xStride, const float* pW, int wStride, const float* pF, int fStride, float threshold, int rowLength, int numRows) {
+	int vectorLength = rowLength & ~3;
+
+	__m128 thresholds = _mm_set1_ps(threshold);
+
+	alignas(16) float terms[4];
+
+	float sum = 0.0f;
+
+	for (int r = 0; r < numRows; r++) {
+		const float* pRow = pX + r * xStride;
+		const float* pRowWeights = pW + r * wStride;
+		const float* pRowFalloffs = pF + r * fStride;
+
+		int i = 0;
+
+		for (; i < vectorLength; i += 4) {
+			_mm_store_ps(terms, _mm_and_ps(_mm_cmpgt_ps(_mm_loadu_ps(pRow + i), thresholds), _mm_mul_ps(_mm_loadu_ps(pRowWeights + i), _mm_loadu_ps(pRowFalloffs + i))));
+
+			for (int t = 0; t < 4; t++)
+				sum += terms[t];
+		}
+
+		for (; i < rowLength; i++)
+			sum += pRowWeights[i] * pRowFalloffs[i] * (pRow[i] > threshold ? 1.0f : 0.0f);
+	}
+
+	return sum;
+}
+
+// AVX2
+
+__attribute__((target("avx2,fma")))
+static float horizontalSumAVX2(__m256 v) {
+	__m128 half = _mm_add_ps(_mm256_castps256_ps128(v), _mm256_extractf128_ps(v, 1));
+
+	half = _mm_add_ps(half, _mm_movehl_ps(half, half));
+	half = _mm_add_ss(half, _mm_shuffle_ps(half, half, 0x55));
+
+	return _mm_cvtss_f32(half);
+}
+
+__attribute__((target("avx2,fma")))
+static float windowSumAVX2(const float* pX, int xStride, int rowLength, int numRows) {
+	int vectorLength = rowLength & ~7;
+
+	__m256 sum = _mm256_setzero_ps();
+	float tail = 0.0f;
+
+	for (int r = 0; r < numRows; r++) {
+		const float* pRow = pX + r * xStride;
+
+		int i = 0;
+
+		for (; i < vectorLength; i += 8)
+			sum = _mm256_add_ps(sum, _mm256_loadu_ps(pRow + i));
+
+		for (; i < rowLength; i++)
+			tail += pRow[i];
+	}
+
+	return horizontalSumAVX2(sum) + tail;
+}
+
+__attribute__((target("avx2,fma")))
+static float windowCenteredDotAVX2(const float* pX, int xStride, const float* pW, int wStride, float center, int rowLength, int numRows) {
+	int vectorLength = rowLength & ~7;
+
+	__m256 centers = _mm256_set1_ps(center);
+	__m256 sum = _mm256_setzero_ps();
+	float tail = 0.0f;
+
+	for (int r = 0; r < numRows; r++) {
+		const float* pRow = pX + r * xStride;
+		const float* pRowWeights = pW + r * wStride;
+
+		int i = 0;
+
+		for (; i < vectorLength; i += 8)
+			sum = _mm256_fmadd_ps(_mm256_sub_ps(_mm256_loadu_ps(pRow + i), centers), _mm256_loadu_ps(pRowWeights + i), sum);
+
+		for (; i < rowLength; i++)
+			tail += (pRow[i] - center) * pRowWeights[i];
+	}
+
+	return horizontalSumAVX2(sum) + tail;
+}
+
+__attribute__((target("avx2,fma")))
+static void windowOjaAVX2(float* pW, int wStride, const float* pX, int xStride, float rate, float learn, int rowLength, int numRows) {
+	int vectorLength = rowLength & ~7;
+
+	__m256 rates = _mm256_set1_ps(rate);
+	__m256 learns = _mm256_set1_ps(learn);
+
+	for (int r = 0; r < numRows; r++) {
+		const float* pRow = pX + r * xStride;
+		float* pRowWeights = pW + r * wStride;
+
+		int i = 0;
+
+		for (; i < vectorLength; i += 8) {
+			__m256 w = _mm256_loadu_ps(pRowWeights + i);
+
+			_mm256_storeu_ps(pRowWeights + i, _mm256_fmadd_ps(rates, _mm256_fnmadd_ps(learns, w, _mm256_loadu_ps(pRow + i)), w));
+		}
+
+		for (; i < rowLength; i++)
+			pRowWeights[i] += rate * (pRow[i] - learn * pRowWeights[i]);
+	}
+}
+
+__attribute__((target("avx2,fma")))
+static float windowWeightedDistanceAVX2(const float* pX, int xStride, const float* pW, int wStride, const float* pF, int fStride, float sum, int rowLength, int numRows) {
+	int vectorLength = rowLength & ~7;
+
+	__m256 sums = _mm256_setzero_ps();
+
+	for (int r = 0; r < numRows; r++) {
+		const float* pRow = pX + r * xStride;
+		const float* pRowWeights = pW + r * wStride;
+		const float* pRowFalloffs = pF + r * fStride;
+
+		int i = 0;
+
+		for (; i < vectorLength; i += 8) {
+			__m256 delta = _mm256_sub_ps(_mm256_loadu_ps(pRow + i), _mm256_loadu_ps(pRowWeights + i));
+
+			sums = _mm256_fmadd_ps(_mm256_mul_ps(_mm256_loadu_ps(pRowFalloffs + i), delta), delta, sums);
+		}
+
+		for (; i < rowLength; i++) {
+			float delta = pRow[i] - pRowWeights[i];
+
+			sum += pRowFalloffs[i] * delta * delta;
+		}
+	}
+
+	return horizontalSumAVX2(sums) + sum;
+}
+
+__attribute__((target("avx2,fma")))
+static float windowMaskedSumAVX2(const float* pX, int xStride, const float* pW, int wStride, const float* pF, int fStride, float threshold, int rowLength, int numRows) {
+	int vectorLength = rowLength & ~7;
+
+	__m256 thresholds = _mm256_set1_ps(threshold);
+
+	alignas(32) float terms[8];
+
+	float sum = 0.0f;
+
+	for (int r = 0; r < numRows; r++) {
+		const float* pRow = pX + r * xStride;
+		const float* pRowWeights = pW + r * wStride;
+		const float* pRowFalloffs = pF + r * fStride;
+
+		int i = 0;
+
+		for (; i < vectorLength; i += 8) {
+			_mm256_store_ps(terms, _mm256_and_ps(_mm256_cmp_ps(_mm256_loadu_ps(pRow + i), thresholds, _CMP_GT_OQ), _mm256_mul_ps(_mm256_loadu_ps(pRowWeights + i), _mm256_loadu_ps(pRowFalloffs + i))));
+
+			for (int t = 0; t < 8; t++)
+				sum += terms[t];
+		}
+
+		for (; i < rowLength; i++)
+			sum += pRowWeights[i] * pRowFalloffs[i] * (pRow[i] > threshold ? 1.0f : 0.0f);
+	}
+
+	return sum;
+}
+
+// AVX-512, row tails of the reductions are handled with masked loads
+
+// Adds the 128-bit lanes in the same order as _mm512_reduce_add_ps, whose GCC version reads an uninitialized vector and warns under -Wall
+__attribute__((target("avx512f")))
+static float horizontalSumAVX512(__m512 v) {
+	__m128 lanes02 = _mm_add_ps(_mm512_maskz_extractf32x4_ps(0xf, v, 0), _mm512_maskz_extractf32x4_ps(0xf, v, 2));
+	__m128 lanes13 = _mm_add_ps(_mm512_maskz_extractf32x4_ps(0xf, v, 1), _mm512_maskz_extractf32x4_ps(0xf, v, 3));
+
+	return horizontalSumSSE4(_mm_add_ps(lanes13, lanes02));
+}
+
+__attribute__((target("avx512f")))
+static float windowSumAVX512(const float* pX, int xStride, int rowLength, int numRows) {
+	int vectorLength = rowLength & ~15;
+
+	__mmask16 tailMask = (1 << (rowLength - vectorLength)) - 1;
+
+	__m512 sum = _mm512_setzero_ps();
+
+	for (int r = 0; r < numRows; r++) {
+		const float* pRow = pX + r * xStride;
+
+		for (int i = 0; i < vectorLength; i += 16)
+			sum = _mm512_add_ps(sum, _mm512_loadu_ps(pRow + i));
+
+		sum = _mm512_add_ps(sum, _mm512_maskz_loadu_ps(tailMask, pRow + vectorLength));
+	}
+
+	return horizontalSumAVX512(sum);
+}
+
+__attribute__((target("avx512f")))
+static float windowCenteredDotAVX512(const float* pX, int xStride, const float* pW, int wStride, float center, int rowLength, int numRows) {
+	int vectorLength = rowLength & ~15;
+
+	__mmask16 tailMask = (1 << (rowLength - vectorLength)) - 1;
+
+	__m512 centers = _mm512_set1_ps(center);
+	__m512 sum = _mm512_setzero_ps();
+
+	for (int r = 0; r < numRows; r++) {
+		const float* pRow = pX + r * xStride;
+		const float* pRowWeights = pW + r * wStride;
+
+		for (int i = 0; i < vectorLength; i += 16)
+			sum = _mm512_fmadd_ps(_mm512_sub_ps(_mm512_loadu_ps(pRow + i), centers), _mm512_loadu_ps(pRowWeights + i), sum);
+
+		// Masked-off lanes load 0 weights, so they add nothing
+		sum = _mm512_fmadd_ps(_mm512_sub_ps(_mm512_maskz_loadu_ps(tailMask, pRow + vectorLength), centers), _mm512_maskz_loadu_ps(tailMask, pRowWeights + vectorLength), sum);
+	}
+
+	return horizontalSumAVX512(sum);
+}
+
+__attribute__((target("avx512f")))
+static void windowOjaAVX512(float* pW, int wStride, const float* pX, int xStride, float rate, float learn, int rowLength, int numRows) {
+	int vectorLength = rowLength & ~15;
+
+	__m512 rates = _mm512_set1_ps(rate);
+	__m512 learns = _mm512_set1_ps(learn);
+
+	for (int r = 0; r < numRows; r++) {
+		const float* pRow = pX + r * xStride;
+		float* pRowWeights = pW + r * wStride;
+
+		for (int i = 0; i < vectorLength; i += 16) {
+			__m512 w = _mm512_loadu_ps(pRowWeights + i);
+
+			_mm512_storeu_ps(pRowWeights + i, _mm512_fmadd_ps(rates, _mm512_fnmadd_ps(learns, w, _mm512_loadu_ps(pRow + i)), w));
+		}
+
+		// A masked store would stall the load of the next row (store forwarding), so the tail is scalar
+		for (int i = vectorLength; i < rowLength; i++)
+			pRowWeights[i] += rate * (pRow[i] - learn * pRowWeights[i]);
+	}
+}
+
+__attribute__((target("avx512f")))
+static float windowWeightedDistanceAVX512(const float* pX, int xStride, const float* pW, int wStride, const float* pF, int fStride, float sum, int rowLength, int numRows) {
+	int vectorLength = rowLength & ~15;
+
+	__mmask16 tailMask = (1 << (rowLength - vectorLength)) - 1;
+
+	__m512 sums = _mm512_setzero_ps();
+
+	for (int r = 0; r < numRows; r++) {
+		const float* pRow = pX + r * xStride;
+		const float* pRowWeights = pW + r * wStride;
+		const float* pRowFalloffs = pF + r * fStride;
+
+		for (int i = 0; i < vectorLength; i += 16) {
+			__m512 delta = _mm512_sub_ps(_mm512_loadu_ps(pRow + i), _mm512_loadu_ps(pRowWeights + i));
+
+			sums = _mm512_fmadd_ps(_mm512_mul_ps(_mm512_loadu_ps(pRowFalloffs + i), delta), delta, sums);
+		}
+
+		// Masked-off lanes load 0 falloffs, so they add nothing
+		__m512 delta = _mm512_sub_ps(_mm512_maskz_loadu_ps(tailMask, pRow + vectorLength), _mm512_maskz_loadu_ps(tailMask, pRowWeights + vectorLength));
+
+		sums = _mm512_fmadd_ps(_mm512_mul_ps(_mm512_maskz_loadu_ps(tailMask, pRowFalloffs + vectorLength), delta), delta, sums);
+	}
+
+	return horizontalSumAVX512(sums) + sum;
+}
+
+__attribute__((target("avx512f")))
+static float windowMaskedSumAVX512(const float* pX, int xStride, const float* pW, int wStride, const float* pF, int fStride, float threshold, int rowLength, int numRows) {
+	int vectorLength = rowLength & ~15;
+
+	__mmask16 tailMask = (1 << (rowLength - vectorLength)) - 1;
+
+	__m512 thresholds = _mm512_set1_ps(threshold);
+
+	alignas(64) float terms[16];
+
+	float sum = 0.0f;
+
+	for (int r = 0; r < numRows; r++) {
+		const float* pRow = pX + r * xStride;
+		const float* pRowWeights = pW + r * wStride;
+		const float* pRowFalloffs = pF + r * fStride;
+
+		for (int i = 0; i < vectorLength; i += 16) {
+			__mmask16 greater = _mm512_cmp_ps_mask(_mm512_loadu_ps(pRow + i), thresholds, _CMP_GT_OQ);
+
+			_mm512_store_ps(terms, _mm512_maskz_mul_ps(greater, _mm512_loadu_ps(pRowWeights + i), _mm512_loadu_ps(pRowFalloffs + i)));
+
+			for (int t = 0; t < 16; t++)
+				sum += terms[t];
+		}
+
+		// Masked-off lanes are left out of the comparison mask, so their terms are 0 and not added
+		__mmask16 greater = _mm512_mask_cmp_ps_mask(tailMask, _mm512_maskz_loadu_ps(tailMask, pRow + vectorLength), thresholds, _CMP_GT_OQ);
+
+		_mm512_store_ps(terms, _mm512_maskz_mul_ps(greater, _mm512_maskz_loadu_ps(tailMask, pRowWeights + vectorLength), _mm512_maskz_loadu_ps(tailMask, pRowFalloffs + vectorLength)));
+
+		for (int t = 0; t < rowLength - vectorLength; t++)
+			sum += terms[t];
+	}
+
+	return sum;
+}
+
+#endif
+
+Kernels::WindowSumFunc Kernels::_pWindowSum = windowSumScalar;
+Kernels::WindowCenteredDotFunc Kernels::_pWindowCenteredDot = windowCenteredDotScalar;
+Kernels::WindowOjaFunc Kernels::_pWindowOja = windowOjaScalar;
+Kernels::WindowWeightedDistanceFunc Kernels::_pWindowWeightedDistance = windowWeightedDistanceScalar;
+Kernels::WindowMaskedSumFunc Kernels::_pWindowMaskedSum = windowMaskedSumScalar;
+
+Kernels::InstructionSet Kernels::_instructionSet = Kernels::initialize();
+
+Kernels::InstructionSet Kernels::initialize() {
+	setInstructionSet(getSupportedInstructionSet());
+
+	return _instructionSet;
+}
+
+Kernels::InstructionSet Kernels::getSupportedInstructionSet() {
+#ifdef KERNELS_X86
+	__builtin_cpu_init();
+
+	if (__builtin_cpu_supports("avx512f"))
+		return _avx512;
+
+	if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma"))
+		return _avx2;
+
+	if (__builtin_cpu_supports("sse4.1"))
+		return _sse4;
+#endif
+
+	return _scalar;
+}
+
+void Kernels::setInstructionSet(InstructionSet instructionSet) {
+	InstructionSet supported = getSupportedInstructionSet();
+
+	if (instructionSet > supported)
+		instructionSet = supported;
+
+	_instructionSet = instructionSet;
+
+	switch (instructionSet) {
+#ifdef KERNELS_X86
+	case _avx512:
+		_pWindowSum = windowSumAVX512;
+		_pWindowCenteredDot = windowCenteredDotAVX512;
+		_pWindowOja = windowOjaAVX512;
+		_pWindowWeightedDistance = windowWeightedDistanceAVX512;
+		_pWindowMaskedSum = windowMaskedSumAVX512;
+
+		break;
+
+	case _avx2:
+		_pWindowSum = windowSumAVX2;
+		_pWindowCenteredDot = windowCenteredDotAVX2;
+		_pWindowOja = windowOjaAVX2;
+		_pWindowWeightedDistance = windowWeightedDistanceAVX2;
+		_pWindowMaskedSum = windowMaskedSumAVX2;
+
+		break;
+
+	case _sse4:
+		_pWindowSum = windowSumSSE4;
+		_pWindowCenteredDot = windowCenteredDotSSE4;
+		_pWindowOja = windowOjaSSE4;
+		_pWindowWeightedDistance = windowWeightedDistanceSSE4;
+		_pWindowMaskedSum = windowMaskedSumSSE4;
+
+		break;
+#endif
+
+	default:
+		_pWindowSum = windowSumScalar;
+		_pWindowCenteredDot = windowCenteredDotScalar;
+		_pWindowOja = windowOjaScalar;
+		_pWindowWeightedDistance = windowWeightedDistanceScalar;
+		_pWindowMaskedSum = windowMaskedSumScalar;
+	}
+}
+
+const char* Kernels::getInstructionSetName(InstructionSet instructionSet) {
+	switch (instructionSet) {
+	case _sse4:
+		return "SSE4";
+
+	case _avx2:
+		return "AVX2";
+
+	case _avx512:
+		return "AVX-512";
+
+	default:
+		return "scalar";
+	}
+}
\ No newline at end of file
@@ -0,0 +1,67 @@
+#pragma once
+
+namespace sdr {
+	// Dense kernels over windows of numRows rows with rowLength values each, consecutive rows being stride values apart.
+	// The implementation is picked at startup from the instruction sets the CPU supports
+	class Kernels {
+	public:
+		enum InstructionSet {
+			_scalar, _sse4, _avx2, _avx512
+		};
+
+		typedef float(*WindowSumFunc)(const float* pX, int xStride, int rowLength, int numRows);
+		typedef float(*WindowCenteredDotFunc)(const float* pX, int xStride, const float* pW, int wStride, float center, int rowLength, int numRows);
+		typedef void(*WindowOjaFunc)(float* pW, int wStride, const float* pX, int xStride, float rate, float learn, int rowLength, int numRows);
+		typedef float(*WindowWeightedDistanceFunc)(const float* pX, int xStride, const float* pW, int wStride, const float* pF, int fStride, float sum, int rowLength, int numRows);
+		typedef float(*WindowMaskedSumFunc)(const float* pX, int xStride, const float* pW, int wStride, const float* pF, int fStride, float threshold, int rowLength, int numRows);
+
+	private:
+		static WindowSumFunc _pWindowSum;
+		static WindowCenteredDotFunc _pWindowCenteredDot;
+		static WindowOjaFunc _pWindowOja;
+		static WindowWeightedDistanceFunc _pWindowWeightedDistance;
+		static WindowMaskedSumFunc _pWindowMaskedSum;
+
+		static InstructionSet _instructionSet;
+
+		static InstructionSet initialize();
+
+	public:
+		// Sum of x
+		static float windowSum(const float* pX, int xStride, int rowLength, int numRows) {
+			return _pWindowSum(pX, xStride, rowLength, numRows);
+		}
+
+		// Sum of (x - center) * w
+		static float windowCenteredDot(const float* pX, int xStride, const float* pW, int wStride, float center, int rowLength, int numRows) {
+			return _pWindowCenteredDot(pX, xStride, pW, wStride, center, rowLength, numRows);
+		}
+
+		// w += rate * (x - learn * w)
+		static void windowOja(float* pW, int wStride, const float* pX, int xStride, float rate, float learn, int rowLength, int numRows) {
+			_pWindowOja(pW, wStride, pX, xStride, rate, learn, rowLength, numRows);
+		}
+
+		// sum + sum of f * (x - w)^2. The scalar version adds row by row in order
+		static float windowWeightedDistance(const float* pX, int xStride, const float* pW, int wStride, const float* pF, int fStride, float sum, int rowLength, int numRows) {
+			return _pWindowWeightedDistance(pX, xStride, pW, wStride, pF, fStride, sum, rowLength, numRows);
+		}
+
+		// Sum of w * f where x > threshold. The SIMD versions compare and multiply in vectors but add the terms one at a time, row by row in order,
+		// so every instruction set gives the scalar result and thresholds on the sum do not depend on the machine
+		static float windowMaskedSum(const float* pX, int xStride, const float* pW, int wStride, const float* pF, int fStride, float threshold, int rowLength, int numRows) {
+			return _pWindowMaskedSum(pX, xStride, pW, wStride, pF, fStride, threshold, rowLength, numRows);
+		}
+
+		static InstructionSet getSupportedInstructionSet();
+
+		// The SIMD kernels other than windowMaskedSum add up in a different order, so only _scalar gives the same results on every machine. Falls back to the best supported set
+		static void setInstructionSet(InstructionSet instructionSet);
+
+		static InstructionSet getInstructionSet() {
+			return _instructionSet;
+		}
+
+		static const char* getInstructionSetName(InstructionSet instructionSet);
+	};
+}
\ No newline at end of file
@@ -1,7 +1,7 @@
 #include "PRSDRRL.h"
 
-#include <SFML/Window.hpp>
-#include <iostream>
+#include "Checkpoint.h"
+#include "Trace.h"
 
 #include <algorithm>
 
@@ -154,17 +154,19 @@ void PRSDRRL::createRandom(int inputWidth, int inputHeight, int inputFeedBackRad
 }
 
 void PRSDRRL::simStep(float reward, std::mt19937 &generator, bool learn) {
+	HTSL_TRACE_SCOPE("PRSDRRL::simStep", -1);
+
 	// Feature extraction
 	for (int l = 0; l < _layers.size(); l++) {
+		HTSL_TRACE_SCOPE("PRSDRRL::chain", l);
+
 		//_layers[l]._sdr.activate(_layerDescs[l]._sparsity);
 
 		//_layers[l]._sdr.reconstruct();
 
 		// Set inputs for next layer if there is one
-		if (l < _layers.size() - 1) {
-			for (int i = 0; i < _layers[l]._sdr.getNumHidden(); i++)
-				_layers[l + 1]._sdr.setVisibleState(i, _layers[l]._sdr.getHiddenState(i));
-		}
+		if (l < _layers.size() - 1)
+			_layers[l + 1]._sdr.setVisibleStatesFromHidden(_layers[l]._sdr);
 	}
 
 	// Prediction
@@ -173,6 +175,8 @@ void PRSDRRL::simStep(float reward, std::mt19937 &generator, bool learn) {
 	std::normal_distribution<float> pertDist(0.0f, _exploratoryNoise);
 
 	for (int l = _layers.size() - 1; l >= 0; l--) {
+		HTSL_TRACE_SCOPE("PRSDRRL::predict", l);
+
 		attentions[l].resize(_layers[l]._predictionNodes.size());
 
 		std::vector<float> predictionActivations(_layers[l]._predictionNodes.size());
@@ -274,8 +278,13 @@ void PRSDRRL::simStep(float reward, std::mt19937 &generator, bool learn) {
 	}
 
 	for (int l = 0; l < _layers.size(); l++) {
-		if (learn)
+		if (learn) {
+			HTSL_TRACE_SCOPE("PRSDRRL::learn", l);
+
 			_layers[l]._sdr.learn(attentions[l], _layerDescs[l]._learnFeedForward, _layerDescs[l]._learnRecurrent, _layerDescs[l]._learnLateral, _layerDescs[l]._learnThreshold, _layerDescs[l]._sparsity);
+		}
+
+		HTSL_TRACE_SCOPE("PRSDRRL::stepEnd", l);
 
 		_layers[l]._sdr.stepEnd();
 
@@ -307,12 +316,15 @@ void PRSDRRL::simStep(float reward, std::mt19937 &generator, bool learn) {
 
 	float newQ = _prevValue + _qAlpha * tdError;
 
-	std::cout << tdError << " " << q << std::endl;
+	if (_valueHook)
+		_valueHook(tdError, q);
 
 	_prevValue = q;
 
 	// Update predictive connections again, this time for RL
 	for (int l = _layers.size() - 1; l >= 0; l--) {
+		HTSL_TRACE_SCOPE("PRSDRRL::learnRL", l);
+
 		for (int pi = 0; pi < _layers[l]._predictionNodes.size(); pi++) {
 			PredictionNode &p = _layers[l]._predictionNodes[pi];
 
@@ -345,4 +357,168 @@ void PRSDRRL::simStep(float reward, std::mt19937 &generator, bool learn) {
 
 	for (int i = 0; i < _qInputIndices.size(); i++)
 		_layers.front()._sdr.setVisibleState(_qInputIndices[i], newQ + _qInputOffsets[i]);
+}
+
+namespace {
+	void savePredictionNodes(CheckpointWriter &writer, const std::vector<PRSDRRL::PredictionNode> &nodes) {
+		int numNodes = nodes.size();
+
+		writer.write(numNodes);
+
+		writer.writeLists(numNodes, [&](int i) -> const std::vector<PRSDRRL::Connection> & { return nodes[i]._feedBackConnections; });
+		writer.writeLists(numNodes, [&](int i) -> const std::vector<PRSDRRL::Connection> & { return nodes[i]._predictiveConnections; });
+
+		writer.writeField(numNodes, [&](int i) { return nodes[i]._bias; });
+		writer.writeField(numNodes, [&](int i) { return nodes[i]._state; });
+		writer.writeField(numNodes, [&](int i) { return nodes[i]._statePrev; });
+		writer.writeField(numNodes, [&](int i) { return nodes[i]._stateExploratory; });
+		writer.writeField(numNodes, [&](int i) { return nodes[i]._stateExploratoryPrev; });
+		writer.writeField(numNodes, [&](int i) { return nodes[i]._activation; });
+		writer.writeField(numNodes, [&](int i) { return nodes[i]._activationPrev; });
+		writer.writeField(numNodes, [&](int i) { return nodes[i]._averageSurprise; });
+	}
+
+	// Predictive connections must address one of numPredictive nodes. Feed back indices depend on the layer above and are checked by the caller
+	bool loadPredictionNodes(CheckpointReader &reader, std::vector<PRSDRRL::PredictionNode> &nodes, int numPredictive) {
+		int numNodes;
+
+		if (!reader.read(numNodes) || !reader.canHold(numNodes))
+			return false;
+
+		nodes.clear();
+		nodes.resize(numNodes);
+
+		reader.readLists(numNodes, [&](int i) -> std::vector<PRSDRRL::Connection> & { return nodes[i]._feedBackConnections; });
+		reader.readConnectionLists(numNodes, numPredictive, [&](int i) -> std::vector<PRSDRRL::Connection> & { return nodes[i]._predictiveConnections; });
+
+		reader.readField(numNodes, [&](int i) -> PRSDRRL::Connection & { return nodes[i]._bias; });
+		reader.readField(numNodes, [&](int i) -> float & { return nodes[i]._state; });
+		reader.readField(numNodes, [&](int i) -> float & { return nodes[i]._statePrev; });
+		reader.readField(numNodes, [&](int i) -> float & { return nodes[i]._stateExploratory; });
+		reader.readField(numNodes, [&](int i) -> float & { return nodes[i]._stateExploratoryPrev; });
+		reader.readField(numNodes, [&](int i) -> float & { return nodes[i]._activation; });
+		reader.readField(numNodes, [&](int i) -> float & { return nodes[i]._activationPrev; });
+		reader.readField(numNodes, [&](int i) -> float & { return nodes[i]._averageSurprise; });
+
+		return reader.good();
+	}
+}
+
+bool PRSDRRL::save(const std::string &fileName) const {
+	return Checkpoint::saveToFile(*this, fileName);
+}
+
+bool PRSDRRL::load(const std::string &fileName) {
+	return Checkpoint::loadFromFile(*this, fileName);
+}
+
+void PRSDRRL::save(CheckpointWriter &writer) const {
+	writer.beginObject("sdr::PRSDRRL", 1);
+
+	writer.writeArray(_layerDescs);
+
+	for (int l = 0; l < _layers.size(); l++) {
+		_layers[l]._sdr.save(writer);
+
+		savePredictionNodes(writer, _layers[l]._predictionNodes);
+	}
+
+	savePredictionNodes(writer, _inputPredictionNodes);
+
+	writer.writeArray(_inputTypes);
+	writer.writeArray(_qInputIndices);
+	writer.writeArray(_qInputOffsets);
+	writer.writeArray(_actionInputIndices);
+
+	writer.write(_prevValue);
+
+	writer.write(_stateLeak);
+	writer.write(_exploratoryNoise);
+	writer.write(_gamma);
+	writer.write(_gammaLambda);
+	writer.write(_actionRandomizeChance);
+	writer.write(_qAlpha);
+	writer.write(_learnInputFeedBack);
+}
+
+bool PRSDRRL::load(CheckpointReader &reader) {
+	// Read into a fresh PRSDRRL with this one's settings, so a failed load leaves this one unchanged
+	PRSDRRL loaded;
+
+	loaded._valueHook = _valueHook;
+
+	if (!loaded.loadMembers(reader))
+		return false;
+
+	*this = std::move(loaded);
+
+	return true;
+}
+
+bool PRSDRRL::loadMembers(CheckpointReader &reader) {
+	if (!reader.beginObject("sdr::PRSDRRL", 1) || !reader.readArray(_layerDescs))
+		return false;
+
+	_layers.clear();
+	_layers.resize(_layerDescs.size());
+
+	// Prediction nodes are sized by the layer descriptions, since createRandom does not build the sdr layers
+	for (int l = 0; l < _layers.size(); l++) {
+		if (!_layers[l]._sdr.load(reader) || !Checkpoint::isValidArea(_layerDescs[l]._width, _layerDescs[l]._height))
+			return false;
+
+		int numNodes = _layerDescs[l]._width * _layerDescs[l]._height;
+
+		if (!loadPredictionNodes(reader, _layers[l]._predictionNodes, numNodes) || _layers[l]._predictionNodes.size() != static_cast<size_t>(numNodes))
+			return false;
+	}
+
+	// The input prediction nodes only have feed back connections
+	if (!loadPredictionNodes(reader, _inputPredictionNodes, 0) || _layers.empty())
+		return false;
+
+	for (size_t l = 0; l < _layers.size(); l++) {
+		int numFeedBack = l + 1 < _layers.size() ? static_cast<int>(_layers[l + 1]._predictionNodes.size()) : 0;
+
+		for (size_t pi = 0; pi < _layers[l]._predictionNodes.size(); pi++)
+			if (!Checkpoint::hasValidIndices(_layers[l]._predictionNodes[pi]._feedBackConnections, numFeedBack))
+				return false;
+	}
+
+	// Input feed back connections also address input nodes when updating traces
+	int numInputFeedBack = static_cast<int>(std::min(_layers.front()._predictionNodes.size(), _inputPredictionNodes.size()));
+
+	for (size_t pi = 0; pi < _inputPredictionNodes.size(); pi++)
+		if (!Checkpoint::hasValidIndices(_inputPredictionNodes[pi]._feedBackConnections, numInputFeedBack))
+			return false;
+
+	reader.readArray(_inputTypes);
+	reader.readArray(_qInputIndices);
+	reader.readArray(_qInputOffsets);
+	reader.readArray(_actionInputIndices);
+
+	reader.read(_prevValue);
+
+	reader.read(_stateLeak);
+	reader.read(_exploratoryNoise);
+	reader.read(_gamma);
+	reader.read(_gammaLambda);
+	reader.read(_actionRandomizeChance);
+	reader.read(_qAlpha);
+	reader.read(_learnInputFeedBack);
+
+	if (!reader.good() || _inputTypes.size() != _inputPredictionNodes.size() || _qInputOffsets.size() != _qInputIndices.size())
+		return false;
+
+	int numInputs = _inputTypes.size();
+
+	for (size_t i = 0; i < _qInputIndices.size(); i++)
+		if (_qInputIndices[i] < 0 || _qInputIndices[i] >= numInputs)
+			return false;
+
+	for (size_t i = 0; i < _actionInputIndices.size(); i++)
+		if (_actionInputIndices[i] < 0 || _actionInputIndices[i] >= numInputs)
+			return false;
+
+	return true;
 }
\ No newline at end of file
@@ -2,6 +2,8 @@
 
 #include "RSDR.h"
 
+#include <functional>
+
 namespace sdr {
 	class PRSDRRL {
 	public:
@@ -9,8 +11,11 @@ namespace sdr {
 			_state, _q, _action
 		};
 
+		// Debug introspection, called every simStep with the TD error and the Q value
+		typedef std::function<void(float tdError, float q)> ValueHook;
+
 		struct Connection {
-			unsigned short _index;
+			int _index;
 
 			float _weight;
 			float _trace;
@@ -101,6 +106,11 @@ namespace sdr {
 
 		float _prevValue;
 
+		ValueHook _valueHook;
+
+		// The body of load, run on a freshly constructed object
+		bool loadMembers(CheckpointReader &reader);
+
 	public:
 		float _stateLeak;
 		float _exploratoryNoise;
@@ -125,6 +135,18 @@ namespace sdr {
 
 		void simStep(float reward, std::mt19937 &generator, bool learn = true);
 
+		// An empty hook disables it
+		void setValueHook(const ValueHook &valueHook) {
+			_valueHook = valueHook;
+		}
+
+		// Binary checkpoint of the layer descriptions, weights, states and parameters (see Checkpoint.h). load returns false if the file holds no PRSDRRL, and then leaves this one unchanged
+		bool save(const std::string &fileName) const;
+		bool load(const std::string &fileName);
+
+		void save(CheckpointWriter &writer) const;
+		bool load(CheckpointReader &reader);
+
 		void setState(int index, float value) {
 			_layers.front()._sdr.setVisibleState(index, value * _stateLeak + (1.0f - _stateLeak) * getAction(index));
 		}
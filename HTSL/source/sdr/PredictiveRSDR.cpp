@@ -1,11 +1,13 @@
 #include "PredictiveRSDR.h"
 
-#include <SFML/Window.hpp>
-#include <iostream>
+#include "Checkpoint.h"
+#include "Trace.h"
+
+#include <algorithm>
 
 using namespace sdr;
 
-void PredictiveRSDR::createRandom(int inputWidth, int inputHeight, const std::vector<LayerDesc> &layerDescs, float initMinWeight, float initMaxWeight, float initThreshold, std::mt19937 &generator) {
+void PredictiveRSDR::createRandom(int inputWidth, int inputHeight, const std::vector<LayerDesc> &layerDescs, float initMinWeight, float initMaxWeight, float initMinInhibition, float initMaxInhibition, float initThreshold, std::mt19937 &generator, RSDR::Storage storage) {
 	std::uniform_real_distribution<float> weightDist(initMinWeight, initMaxWeight);
 	
 	_layerDescs = layerDescs;
@@ -19,10 +21,13 @@ void PredictiveRSDR::createRandom(int inputWidth, int inputHeight, const std::ve
 	int heightPrev = inputHeight;
 
 	for (int l = 0; l < _layerDescs.size(); l++) {
-		//_layers[l]._sdr.createRandom(widthPrev, heightPrev, _layerDescs[l]._width, _layerDescs[l]._height, _layerDescs[l]._receptiveRadius, _layerDescs[l]._lateralRadius, _layerDescs[l]._recurrentRadius, initMinWeight, initMaxWeight, initThreshold, generator);
+		_layers[l]._sdr.createRandom(widthPrev, heightPrev, _layerDescs[l]._width, _layerDescs[l]._height, _layerDescs[l]._receptiveRadius, _layerDescs[l]._lateralRadius, _layerDescs[l]._recurrentRadius, initMinWeight, initMaxWeight, initMinInhibition, initMaxInhibition, initThreshold, generator, storage);
 
+		_layers[l]._predictionNodes.clear();
 		_layers[l]._predictionNodes.resize(_layerDescs[l]._width * _layerDescs[l]._height);
 
+		_layers[l]._predictionWeights = std::make_shared<std::vector<PredictionWeights>>(_layers[l]._predictionNodes.size());
+
 		int feedBackSize = std::pow(_layerDescs[l]._feedBackRadius * 2 + 1, 2);
 		int predictiveSize = std::pow(_layerDescs[l]._predictiveRadius * 2 + 1, 2);
 
@@ -35,7 +40,7 @@ void PredictiveRSDR::createRandom(int inputWidth, int inputHeight, const std::ve
 		}
 
 		for (int pi = 0; pi < _layers[l]._predictionNodes.size(); pi++) {
-			PredictionNode &p = _layers[l]._predictionNodes[pi];
+			PredictionWeights &p = (*_layers[l]._predictionWeights)[pi];
 
 			p._bias._weight = weightDist(generator);
 
@@ -97,24 +102,35 @@ void PredictiveRSDR::createRandom(int inputWidth, int inputHeight, const std::ve
 	}
 }
 
+void PredictiveRSDR::makeWeightsUnique() {
+	for (int l = 0; l < _layers.size(); l++)
+		if (_layers[l]._predictionWeights.use_count() != 1)
+			_layers[l]._predictionWeights = std::make_shared<std::vector<PredictionWeights>>(*_layers[l]._predictionWeights);
+}
+
 void PredictiveRSDR::simStep(bool learn) {
+	HTSL_TRACE_SCOPE("PredictiveRSDR::simStep", -1);
+
+	if (learn)
+		makeWeightsUnique();
+
 	// Feature extraction
 	for (int l = 0; l < _layers.size(); l++) {
-		//_layers[l]._sdr.activate(_layerDescs[l]._sparsity);
+		HTSL_TRACE_SCOPE("PredictiveRSDR::activate", l);
 
-		//_layers[l]._sdr.reconstruct();
+		_layers[l]._sdr.activate(_layerDescs[l]._subIterSettle, _layerDescs[l]._subIterMeasure, _layerDescs[l]._leak);
 
 		// Set inputs for next layer if there is one
-		if (l < _layers.size() - 1) {
-			for (int i = 0; i < _layers[l]._sdr.getNumHidden(); i++)
-				_layers[l + 1]._sdr.setVisibleState(i, _layers[l]._sdr.getHiddenState(i));
-		}
+		if (l < _layers.size() - 1)
+			_layers[l + 1]._sdr.setVisibleStatesFromHidden(_layers[l]._sdr);
 	}
 
 	// Prediction
 	std::vector<std::vector<float>> attentions(_layers.size());
 
 	for (int l = _layers.size() - 1; l >= 0; l--) {
+		HTSL_TRACE_SCOPE("PredictiveRSDR::predict", l);
+
 		attentions[l].resize(_layers[l]._predictionNodes.size());
 
 		std::vector<float> predictionActivations(_layers[l]._predictionNodes.size());
@@ -122,6 +138,7 @@ void PredictiveRSDR::simStep(bool learn) {
 
 		for (int pi = 0; pi < _layers[l]._predictionNodes.size(); pi++) {
 			PredictionNode &p = _layers[l]._predictionNodes[pi];
+			PredictionWeights &w = (*_layers[l]._predictionWeights)[pi];
 
 			// Learn
 			if (learn) {
@@ -136,32 +153,32 @@ void PredictiveRSDR::simStep(bool learn) {
 				p._averageSurprise = (1.0f - _layerDescs[l]._averageSurpriseDecay) * p._averageSurprise + _layerDescs[l]._averageSurpriseDecay * surprise;
 
 				if (l < _layers.size() - 1) {
-					for (int ci = 0; ci < p._feedBackConnections.size(); ci++)
-						p._feedBackConnections[ci]._weight += _layerDescs[l]._learnFeedBack * predictionError * _layers[l + 1]._predictionNodes[p._feedBackConnections[ci]._index]._statePrev;
+					for (int ci = 0; ci < w._feedBackConnections.size(); ci++)
+						w._feedBackConnections[ci]._weight += _layerDescs[l]._learnFeedBack * predictionError * _layers[l + 1]._predictionNodes[w._feedBackConnections[ci]._index]._statePrev;
 				}
 
 				// Predictive
-				for (int ci = 0; ci < p._predictiveConnections.size(); ci++)
-					p._predictiveConnections[ci]._weight += _layerDescs[l]._learnPrediction * predictionError * _layers[l]._sdr.getHiddenStatePrev(p._predictiveConnections[ci]._index);
+				for (int ci = 0; ci < w._predictiveConnections.size(); ci++)
+					w._predictiveConnections[ci]._weight += _layerDescs[l]._learnPrediction * predictionError * _layers[l]._sdr.getHiddenStatePrev(w._predictiveConnections[ci]._index);
 			}
 
 			float activation = 0.0f;
 
 			// Feed Back
 			if (l < _layers.size() - 1) {
-				for (int ci = 0; ci < p._feedBackConnections.size(); ci++)
-					activation += p._feedBackConnections[ci]._weight * _layers[l + 1]._predictionNodes[p._feedBackConnections[ci]._index]._state;
+				for (int ci = 0; ci < w._feedBackConnections.size(); ci++)
+					activation += w._feedBackConnections[ci]._weight * _layers[l + 1]._predictionNodes[w._feedBackConnections[ci]._index]._state;
 			}
 
 			// Predictive
-			for (int ci = 0; ci < p._predictiveConnections.size(); ci++)
-				activation += p._predictiveConnections[ci]._weight * _layers[l]._sdr.getHiddenState(p._predictiveConnections[ci]._index);
+			for (int ci = 0; ci < w._predictiveConnections.size(); ci++)
+				activation += w._predictiveConnections[ci]._weight * _layers[l]._sdr.getHiddenState(w._predictiveConnections[ci]._index);
 
 			predictionActivations[pi] = p._activation = activation;
 		}
 
 		// Inhibit to find state
-		//_layers[l]._sdr.inhibit(_layerDescs[l]._sparsity, predictionActivations, predictionStates);
+		_layers[l]._sdr.inhibit(_layerDescs[l]._subIterSettle, _layerDescs[l]._subIterMeasure, _layerDescs[l]._leak, predictionActivations, predictionStates);
 
 		for (int pi = 0; pi < _layers[l]._predictionNodes.size(); pi++) {
 			PredictionNode &p = _layers[l]._predictionNodes[pi];
@@ -171,8 +188,13 @@ void PredictiveRSDR::simStep(bool learn) {
 	}
 
 	for (int l = 0; l < _layers.size(); l++) {
-		if (learn)
+		if (learn) {
+			HTSL_TRACE_SCOPE("PredictiveRSDR::learn", l);
+
 			_layers[l]._sdr.learn(attentions[l], _layerDescs[l]._learnFeedForward, _layerDescs[l]._learnRecurrent, _layerDescs[l]._learnLateral, _layerDescs[l]._learnThreshold, _layerDescs[l]._sparsity);
+		}
+
+		HTSL_TRACE_SCOPE("PredictiveRSDR::stepEnd", l);
 
 		_layers[l]._sdr.stepEnd();
 
@@ -185,10 +207,183 @@ void PredictiveRSDR::simStep(bool learn) {
 	}
 
 	// Get first layer reconstruction for prediction
+	HTSL_TRACE_SCOPE("PredictiveRSDR::predict", -1);
+
 	std::vector<float> firstLayerPrediction(_layers.front()._predictionNodes.size());
 
 	for (int pi = 0; pi < _layers.front()._predictionNodes.size(); pi++)
 		firstLayerPrediction[pi] = _layers.front()._predictionNodes[pi]._state;
 
-	//_layers.front()._sdr.reconstructFeedForward(firstLayerPrediction, _prediction);
+	_layers.front()._sdr.reconstructFeedForward(firstLayerPrediction, _prediction);
+}
+
+void PredictiveRSDR::createBatch(int numStreams, Batch &batch) const {
+	batch._layerStates.resize(_layers.size());
+	batch._predictionStates.resize(_layers.size());
+
+	for (int l = 0; l < _layers.size(); l++) {
+		batch._layerStates[l].resize(numStreams);
+		batch._predictionStates[l].resize(numStreams);
+
+		for (int b = 0; b < numStreams; b++) {
+			_layers[l]._sdr.initStream(batch._layerStates[l][b]);
+
+			batch._predictionStates[l][b].clear();
+			batch._predictionStates[l][b].assign(_layers[l]._predictionNodes.size(), 0.0f);
+		}
+	}
+
+	batch._predictions.clear();
+	batch._predictions.assign(numStreams, std::vector<float>(_prediction.size(), 0.0f));
+}
+
+void PredictiveRSDR::simStep(Batch &batch) {
+	HTSL_TRACE_SCOPE("PredictiveRSDR::simStep", -1);
+
+	int numStreams = batch.getNumStreams();
+
+	// Feature extraction
+	for (int l = 0; l < _layers.size(); l++) {
+		HTSL_TRACE_SCOPE("PredictiveRSDR::activate", l);
+
+		_layers[l]._sdr.activate(batch._layerStates[l], _layerDescs[l]._subIterSettle, _layerDescs[l]._subIterMeasure, _layerDescs[l]._leak);
+
+		// Set inputs for next layer if there is one
+		if (l < _layers.size() - 1) {
+			for (int b = 0; b < numStreams; b++)
+				std::copy(batch._layerStates[l][b]._states.begin(), batch._layerStates[l][b]._states.end(), batch._layerStates[l + 1][b]._visibleInputs.begin());
+		}
+	}
+
+	// Prediction
+	for (int l = _layers.size() - 1; l >= 0; l--) {
+		HTSL_TRACE_SCOPE("PredictiveRSDR::predict", l);
+
+		std::vector<std::vector<float>> predictionActivations(numStreams, std::vector<float>(_layers[l]._predictionNodes.size()));
+
+		// Connection lists are walked once per node for all streams
+		for (int pi = 0; pi < _layers[l]._predictionNodes.size(); pi++) {
+			const PredictionWeights &p = (*_layers[l]._predictionWeights)[pi];
+
+			for (int b = 0; b < numStreams; b++) {
+				float activation = 0.0f;
+
+				// Feed Back
+				if (l < _layers.size() - 1) {
+					const std::vector<float> &nextStates = batch._predictionStates[l + 1][b];
+
+					for (int ci = 0; ci < p._feedBackConnections.size(); ci++)
+						activation += p._feedBackConnections[ci]._weight * nextStates[p._feedBackConnections[ci]._index];
+				}
+
+				// Predictive
+				const std::vector<float> &hiddenStates = batch._layerStates[l][b]._states;
+
+				for (int ci = 0; ci < p._predictiveConnections.size(); ci++)
+					activation += p._predictiveConnections[ci]._weight * hiddenStates[p._predictiveConnections[ci]._index];
+
+				predictionActivations[b][pi] = activation;
+			}
+		}
+
+		// Inhibit to find state
+		_layers[l]._sdr.inhibit(batch._layerStates[l], _layerDescs[l]._subIterSettle, _layerDescs[l]._subIterMeasure, _layerDescs[l]._leak, predictionActivations, batch._predictionStates[l]);
+	}
+
+	for (int l = 0; l < _layers.size(); l++) {
+		HTSL_TRACE_SCOPE("PredictiveRSDR::stepEnd", l);
+
+		_layers[l]._sdr.stepEnd(batch._layerStates[l]);
+	}
+
+	// Get first layer reconstruction for prediction
+	HTSL_TRACE_SCOPE("PredictiveRSDR::predict", -1);
+
+	for (int b = 0; b < numStreams; b++)
+		_layers.front()._sdr.reconstructFeedForward(batch._predictionStates.front()[b], batch._predictions[b]);
+}
+
+bool PredictiveRSDR::save(const std::string &fileName) const {
+	return Checkpoint::saveToFile(*this, fileName);
+}
+
+bool PredictiveRSDR::load(const std::string &fileName) {
+	return Checkpoint::loadFromFile(*this, fileName);
+}
+
+void PredictiveRSDR::save(CheckpointWriter &writer) const {
+	writer.beginObject("sdr::PredictiveRSDR", 1);
+
+	writer.writeArray(_layerDescs);
+	writer.writeArray(_prediction);
+
+	for (int l = 0; l < _layers.size(); l++) {
+		const std::vector<PredictionWeights> &weights = *_layers[l]._predictionWeights;
+
+		_layers[l]._sdr.save(writer);
+
+		writer.writeLists(weights.size(), [&](int i) -> const std::vector<Connection> & { return weights[i]._feedBackConnections; });
+		writer.writeLists(weights.size(), [&](int i) -> const std::vector<Connection> & { return weights[i]._predictiveConnections; });
+		writer.writeField(weights.size(), [&](int i) { return weights[i]._bias; });
+
+		writer.writeArray(_layers[l]._predictionNodes);
+	}
+}
+
+bool PredictiveRSDR::load(CheckpointReader &reader) {
+	// Read into a fresh PredictiveRSDR, so a failed load leaves this one unchanged
+	PredictiveRSDR loaded;
+
+	if (!loaded.loadMembers(reader))
+		return false;
+
+	*this = std::move(loaded);
+
+	return true;
+}
+
+bool PredictiveRSDR::loadMembers(CheckpointReader &reader) {
+	if (!reader.beginObject("sdr::PredictiveRSDR", 1) || !reader.readArray(_layerDescs) || !reader.readArray(_prediction))
+		return false;
+
+	_layers.clear();
+	_layers.resize(_layerDescs.size());
+
+	for (int l = 0; l < _layers.size(); l++) {
+		if (!_layers[l]._sdr.load(reader))
+			return false;
+
+		// Each layer must take the one below it and have the size of its description
+		const RSDR &sdr = _layers[l]._sdr;
+
+		if (sdr.getHiddenWidth() != _layerDescs[l]._width || sdr.getHiddenHeight() != _layerDescs[l]._height
+			|| (l > 0 && (sdr.getVisibleWidth() != _layerDescs[l - 1]._width || sdr.getVisibleHeight() != _layerDescs[l - 1]._height)))
+			return false;
+
+		int numPrediction = _layers[l]._sdr.getNumHidden();
+
+		_layers[l]._predictionWeights = std::make_shared<std::vector<PredictionWeights>>(numPrediction);
+
+		std::vector<PredictionWeights> &weights = *_layers[l]._predictionWeights;
+
+		// Feed back indices are checked once the layer above is loaded
+		reader.readLists(numPrediction, [&](int i) -> std::vector<Connection> & { return weights[i]._feedBackConnections; });
+		reader.readConnectionLists(numPrediction, numPrediction, [&](int i) -> std::vector<Connection> & { return weights[i]._predictiveConnections; });
+		reader.readField(numPrediction, [&](int i) -> Connection & { return weights[i]._bias; });
+
+		reader.readArray(_layers[l]._predictionNodes);
+
+		if (!reader.good() || _layers[l]._predictionNodes.size() != numPrediction)
+			return false;
+	}
+
+	for (size_t l = 0; l < _layers.size(); l++) {
+		int numNext = l + 1 < _layers.size() ? static_cast<int>(_layers[l + 1]._predictionNodes.size()) : 0;
+
+		for (size_t pi = 0; pi < _layers[l]._predictionWeights->size(); pi++)
+			if (!Checkpoint::hasValidIndices((*_layers[l]._predictionWeights)[pi]._feedBackConnections, numNext))
+				return false;
+	}
+
+	return !_layers.empty() && _prediction.size() == _layers.front()._sdr.getNumVisible();
 }
\ No newline at end of file
@@ -6,7 +6,7 @@ namespace sdr {
 	class PredictiveRSDR {
 	public:
 		struct Connection {
-			unsigned short _index;
+			int _index;
 
 			float _weight;
 		};
@@ -41,12 +41,15 @@ namespace sdr {
 			{}
 		};
 
-		struct PredictionNode {
+		// Learned connections of a prediction node
+		struct PredictionWeights {
 			std::vector<Connection> _feedBackConnections;
 			std::vector<Connection> _predictiveConnections;
 
 			Connection _bias;
+		};
 
+		struct PredictionNode {
 			float _state;
 			float _statePrev;
 
@@ -63,9 +66,33 @@ namespace sdr {
 		struct Layer {
 			RSDR _sdr;
 
+			// Shared by copies of the network like the RSDR weights, cloned before learning if shared
+			std::shared_ptr<std::vector<PredictionWeights>> _predictionWeights;
+
 			std::vector<PredictionNode> _predictionNodes;
 		};
 
+		// State of several independent streams for batched inference, indexed [layer][stream]. Created by createBatch
+		struct Batch {
+			std::vector<std::vector<RSDR::ArrayState>> _layerStates;
+			std::vector<std::vector<std::vector<float>>> _predictionStates;
+
+			// Indexed [stream]
+			std::vector<std::vector<float>> _predictions;
+
+			int getNumStreams() const {
+				return _predictions.size();
+			}
+
+			void setInput(int stream, int index, float value) {
+				_layerStates.front()[stream]._visibleInputs[index] = value;
+			}
+
+			float getPrediction(int stream, int index) const {
+				return _predictions[stream][index];
+			}
+		};
+
 		static float sigmoid(float x) {
 			return 1.0f / (1.0f + std::exp(-x));
 		}
@@ -76,11 +103,33 @@ namespace sdr {
 
 		std::vector<float> _prediction;
 
+		// Clones the prediction weights that other copies still share
+		void makeWeightsUnique();
+
+		// The body of load, run on a freshly constructed object
+		bool loadMembers(CheckpointReader &reader);
+
 	public:
-		void createRandom(int inputWidth, int inputHeight, const std::vector<LayerDesc> &layerDescs, float initMinWeight, float initMaxWeight, float initThreshold, std::mt19937 &generator);
+		// Builds the RSDR of every layer with the weight, inhibition and threshold ranges and the storage given here (see RSDR::createRandom), and the prediction nodes on top.
+		// simStep activates and inhibits those RSDRs and predicts the input by reconstructing it from the first layer's prediction states.
+		// With _arrays or _implicit storage a copy shares all weights with the original and only copies the node states, so rollouts can fork the network every step.
+		// Whichever copy learns first gets its own weights. Copies that share weights must not learn concurrently from different threads
+		void createRandom(int inputWidth, int inputHeight, const std::vector<LayerDesc> &layerDescs, float initMinWeight, float initMaxWeight, float initMinInhibition, float initMaxInhibition, float initThreshold, std::mt19937 &generator, RSDR::Storage storage = RSDR::_nodes);
 
 		void simStep(bool learn = true);
 
+		// Batched inference (no learning) on streams that share this network's weights. Needs _arrays or _implicit storage.
+		// Each stream gives the same predictions as a copy of the network stepped with simStep(false)
+		void createBatch(int numStreams, Batch &batch) const;
+		void simStep(Batch &batch);
+
+		// Binary checkpoint of the layer descriptions, weights and states (see Checkpoint.h). load returns false if the file holds no PredictiveRSDR, and then leaves this one unchanged
+		bool save(const std::string &fileName) const;
+		bool load(const std::string &fileName);
+
+		void save(CheckpointWriter &writer) const;
+		bool load(CheckpointReader &reader);
+
 		void setInput(int index, float value) {
 			_layers.front()._sdr.setVisibleState(index, value);
 		}
@@ -89,10 +138,20 @@ namespace sdr {
 			setInput(x + y * _layers.front()._sdr.getVisibleWidth(), value);
 		}
 
+		// Whole input frame at once
+		void setInputs(const float* pInputs, size_t count) {
+			_layers.front()._sdr.setVisibleStates(pInputs, count);
+		}
+
 		float getPrediction(int index) const {
 			return _prediction[index];
 		}
 
+		// Copies all predictions, as many as there are inputs
+		void getPredictions(float* pPredictions) const {
+			std::copy(_prediction.begin(), _prediction.end(), pPredictions);
+		}
+
 		float getPrediction(int x, int y) const {
 			return getPrediction(x + y * _layers.front()._sdr.getVisibleWidth());
 		}
@@ -1,13 +1,13 @@
 #include "QPRSDR.h"
 
-#include <iostream>
+#include "Checkpoint.h"
 
 using namespace sdr;
 
-void QPRSDR::createRandom(int inputWidth, int inputHeight, const std::vector<int> &actionIndices, const std::vector<PredictiveRSDR::LayerDesc> &layerDescs, float initMinWeight, float initMaxWeight, float initThreshold, std::mt19937 &generator) {
+void QPRSDR::createRandom(int inputWidth, int inputHeight, const std::vector<int> &actionIndices, const std::vector<PredictiveRSDR::LayerDesc> &layerDescs, float initMinWeight, float initMaxWeight, float initMinInhibition, float initMaxInhibition, float initThreshold, std::mt19937 &generator) {
 	std::uniform_real_distribution<float> weightDist(initMinWeight, initMaxWeight);
 	
-	_prsdr.createRandom(inputWidth, inputHeight, layerDescs, initMinWeight, initMaxWeight, initThreshold, generator);
+	_prsdr.createRandom(inputWidth, inputHeight, layerDescs, initMinWeight, initMaxWeight, initMinInhibition, initMaxInhibition, initThreshold, generator);
 
 	_actionNodeIndices.resize(inputWidth * inputHeight);
 
@@ -144,8 +144,6 @@ void QPRSDR::simStep(float reward, std::mt19937 &generator, bool learn) {
 			}
 		}
 
-		std::cout << q << std::endl;
-
 		// Backpropagate positive Q error
 		for (int l = _qFunctionLayers.size() - 1; l >= 0; l--) {
 			// Last layer
@@ -244,7 +242,8 @@ void QPRSDR::simStep(float reward, std::mt19937 &generator, bool learn) {
 	float qAlphaTdError = _qAlpha * tdError;
 	float actionAlphaTdError = _actionAlpha * tdError;
 
-	//std::cout << q << std::endl;
+	if (_valueHook)
+		_valueHook(tdError, q);
 
 	_prevValue = q;
 
@@ -325,4 +324,143 @@ void QPRSDR::simStep(float reward, std::mt19937 &generator, bool learn) {
 			}
 		}
 	}
+}
+
+bool QPRSDR::save(const std::string &fileName) const {
+	return Checkpoint::saveToFile(*this, fileName);
+}
+
+bool QPRSDR::load(const std::string &fileName) {
+	return Checkpoint::loadFromFile(*this, fileName);
+}
+
+void QPRSDR::save(CheckpointWriter &writer) const {
+	writer.beginObject("sdr::QPRSDR", 1);
+
+	_prsdr.save(writer);
+
+	writer.write(static_cast<int>(_qFunctionLayers.size()));
+
+	for (int l = 0; l < _qFunctionLayers.size(); l++) {
+		const std::vector<QFunctionNode> &nodes = _qFunctionLayers[l]._qFunctionNodes;
+
+		int numNodes = nodes.size();
+
+		writer.write(numNodes);
+
+		writer.writeLists(numNodes, [&](int i) -> const std::vector<Connection> & { return nodes[i]._feedForwardConnections; });
+
+		writer.writeField(numNodes, [&](int i) { return nodes[i]._bias; });
+		writer.writeField(numNodes, [&](int i) { return nodes[i]._state; });
+		writer.writeField(numNodes, [&](int i) { return nodes[i]._error; });
+
+		writer.writeArray(_qFunctionLayers[l]._qConnections);
+	}
+
+	writer.writeArray(_actionNodes);
+	writer.writeArray(_actionNodeIndices);
+
+	writer.write(_prevValue);
+
+	writer.write(_qAlpha);
+	writer.write(_actionAlpha);
+	writer.write(_actionDeriveIterations);
+	writer.write(_actionDeriveAlpha);
+	writer.write(_reluLeak);
+	writer.write(_explorationBreak);
+	writer.write(_explorationStdDev);
+	writer.write(_gamma);
+	writer.write(_gammaLambda);
+}
+
+bool QPRSDR::load(CheckpointReader &reader) {
+	// Read into a fresh QPRSDR with this one's settings, so a failed load leaves this one unchanged
+	QPRSDR loaded;
+
+	loaded._valueHook = _valueHook;
+
+	if (!loaded.loadMembers(reader))
+		return false;
+
+	*this = std::move(loaded);
+
+	return true;
+}
+
+bool QPRSDR::loadMembers(CheckpointReader &reader) {
+	int numLayers;
+
+	if (!reader.beginObject("sdr::QPRSDR", 1) || !_prsdr.load(reader) || !reader.read(numLayers) || numLayers < 0 || static_cast<size_t>(numLayers) > _prsdr.getLayers().size())
+		return false;
+
+	_qFunctionLayers.clear();
+	_qFunctionLayers.resize(numLayers);
+
+	for (int l = 0; l < numLayers; l++) {
+		std::vector<QFunctionNode> &nodes = _qFunctionLayers[l]._qFunctionNodes;
+
+		int numNodes;
+
+		// Q nodes are gated by the prediction nodes of their layer
+		if (!reader.read(numNodes) || numNodes < 0 || static_cast<size_t>(numNodes) != _prsdr.getLayers()[l]._predictionNodes.size())
+			return false;
+
+		nodes.resize(numNodes);
+
+		// The first layer addresses inputs, checked once _actionNodeIndices is loaded
+		reader.readConnectionLists(numNodes, l == 0 ? std::numeric_limits<int>::max() : _qFunctionLayers[l - 1]._qFunctionNodes.size(), [&](int i) -> std::vector<Connection> & { return nodes[i]._feedForwardConnections; });
+
+		reader.readField(numNodes, [&](int i) -> Connection & { return nodes[i]._bias; });
+		reader.readField(numNodes, [&](int i) -> float & { return nodes[i]._state; });
+		reader.readField(numNodes, [&](int i) -> float & { return nodes[i]._error; });
+
+		reader.readArray(_qFunctionLayers[l]._qConnections);
+
+		if (!reader.good() || _qFunctionLayers[l]._qConnections.size() != nodes.size())
+			return false;
+	}
+
+	reader.readArray(_actionNodes);
+	reader.readArray(_actionNodeIndices);
+
+	reader.read(_prevValue);
+
+	reader.read(_qAlpha);
+	reader.read(_actionAlpha);
+	reader.read(_actionDeriveIterations);
+	reader.read(_actionDeriveAlpha);
+	reader.read(_reluLeak);
+	reader.read(_explorationBreak);
+	reader.read(_explorationStdDev);
+	reader.read(_gamma);
+	reader.read(_gammaLambda);
+
+	int numInputs = _prsdr.getLayers().front()._sdr.getNumVisible();
+	int numActions = _actionNodes.size();
+
+	if (!reader.good() || _actionNodeIndices.size() != static_cast<size_t>(numInputs))
+		return false;
+
+	for (int i = 0; i < numActions; i++)
+		if (_actionNodes[i]._inputIndex < 0 || _actionNodes[i]._inputIndex >= numInputs)
+			return false;
+
+	for (int i = 0; i < numInputs; i++)
+		if (_actionNodeIndices[i] < -1 || _actionNodeIndices[i] >= numActions)
+			return false;
+
+	// Inputs without an action node (index -1) are never connected
+	if (numLayers > 0) {
+		const std::vector<QFunctionNode> &nodes = _qFunctionLayers.front()._qFunctionNodes;
+
+		for (size_t qi = 0; qi < nodes.size(); qi++)
+			for (size_t ci = 0; ci < nodes[qi]._feedForwardConnections.size(); ci++) {
+				int index = nodes[qi]._feedForwardConnections[ci]._index;
+
+				if (index >= numInputs || _actionNodeIndices[index] == -1)
+					return false;
+			}
+	}
+
+	return true;
 }
\ No newline at end of file
@@ -3,12 +3,16 @@
 #include "PredictiveRSDR.h"
 
 #include <algorithm>
+#include <functional>
 
 namespace sdr {
 	class QPRSDR {
 	public:
+		// Debug introspection, called every simStep with the TD error and the Q value
+		typedef std::function<void(float tdError, float q)> ValueHook;
+
 		struct Connection {
-			unsigned short _index;
+			int _index;
 
 			float _weight;
 			float _trace;
@@ -64,6 +68,11 @@ namespace sdr {
 
 		float _prevValue;
 
+		ValueHook _valueHook;
+
+		// The body of load, run on a freshly constructed object
+		bool loadMembers(CheckpointReader &reader);
+
 	public:
 		static float sigmoid(float x) {
 			return 1.0f / (1.0f + std::exp(-x));
@@ -101,10 +110,23 @@ namespace sdr {
 			_gammaLambda(0.98f)
 		{}
 
-		void createRandom(int inputWidth, int inputHeight, const std::vector<int> &actionIndices, const std::vector<PredictiveRSDR::LayerDesc> &layerDescs, float initMinWeight, float initMaxWeight, float initThreshold, std::mt19937 &generator);
+		// The weight, inhibition and threshold ranges go to PredictiveRSDR::createRandom, which builds the layers with _nodes storage
+		void createRandom(int inputWidth, int inputHeight, const std::vector<int> &actionIndices, const std::vector<PredictiveRSDR::LayerDesc> &layerDescs, float initMinWeight, float initMaxWeight, float initMinInhibition, float initMaxInhibition, float initThreshold, std::mt19937 &generator);
 
 		void simStep(float reward, std::mt19937 &generator, bool learn = true);
 
+		// An empty hook disables it
+		void setValueHook(const ValueHook &valueHook) {
+			_valueHook = valueHook;
+		}
+
+		// Binary checkpoint of the predictor, Q function weights, states and parameters (see Checkpoint.h). load returns false if the file holds no QPRSDR, and then leaves this one unchanged
+		bool save(const std::string &fileName) const;
+		bool load(const std::string &fileName);
+
+		void save(CheckpointWriter &writer) const;
+		bool load(CheckpointReader &reader);
+
 		void setState(int index, float state) {
 			_prsdr.setInput(index, state);
 		}
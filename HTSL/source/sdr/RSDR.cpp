@@ -1,6 +1,10 @@
 #include "RSDR.h"
 
+#include "Kernels.h"
+#include "Checkpoint.h"
+
 #include <algorithm>
+#include <limits>
 
 #include <assert.h>
 
@@ -8,7 +12,7 @@
 
 using namespace sdr;
 
-void RSDR::createRandom(int visibleWidth, int visibleHeight, int hiddenWidth, int hiddenHeight, int receptiveRadius, int inhibitionRadius, int recurrentRadius, float initMinWeight, float initMaxWeight, float initMinInhibition, float initMaxInhibition, float initThreshold, std::mt19937 &generator) {
+void RSDR::createRandom(int visibleWidth, int visibleHeight, int hiddenWidth, int hiddenHeight, int receptiveRadius, int inhibitionRadius, int recurrentRadius, float initMinWeight, float initMaxWeight, float initMinInhibition, float initMaxInhibition, float initThreshold, std::mt19937 &generator, Storage storage) {
 	std::uniform_real_distribution<float> weightDist(initMinWeight, initMaxWeight);
 	std::uniform_real_distribution<float> inhibitionDist(initMinInhibition, initMaxInhibition);
 
@@ -27,13 +31,66 @@ void RSDR::createRandom(int visibleWidth, int visibleHeight, int hiddenWidth, in
 	int inhibitionSize = std::pow(inhibitionRadius * 2 + 1, 2);
 	int recurrentSize = std::pow(recurrentRadius * 2 + 1, 2);
 
-	_visible.resize(numVisible);
+	_storage = storage;
+
+	// Fresh weights, so copies made before keep theirs
+	_sharedWeights = std::make_shared<SharedWeights>();
 
-	_hidden.resize(numHidden);
+	_longIndices = std::max(numVisible, numHidden) > std::numeric_limits<unsigned short>::max() + 1;
+
+	_visible.clear();
+	_hidden.clear();
+
+	if (_storage == _nodes) {
+		_visible.resize(numVisible);
+		_hidden.resize(numHidden);
+	}
+	else {
+		_visible.shrink_to_fit();
+		_hidden.shrink_to_fit();
+	}
 
 	float hiddenToVisibleWidth = static_cast<float>(visibleWidth) / static_cast<float>(hiddenWidth);
 	float hiddenToVisibleHeight = static_cast<float>(visibleHeight) / static_cast<float>(hiddenHeight);
 
+	int receptiveDim = receptiveRadius * 2 + 1;
+	int inhibitionDim = inhibitionRadius * 2 + 1;
+	int recurrentDim = recurrentRadius * 2 + 1;
+
+	// The compact storages are sized up front and filled directly from the window geometry, so no per-node connection lists are built for them
+	if (_storage == _arrays) {
+		_sharedWeights->_feedForwardPool._offsets.resize(numHidden + 1);
+		_sharedWeights->_lateralPool._offsets.resize(numHidden + 1);
+		_sharedWeights->_recurrentPool._offsets.resize(numHidden + 1);
+
+		_sharedWeights->_feedForwardPool._offsets[0] = _sharedWeights->_lateralPool._offsets[0] = _sharedWeights->_recurrentPool._offsets[0] = 0;
+
+		for (int hi = 0; hi < numHidden; hi++) {
+			int hx = hi % hiddenWidth;
+			int hy = hi / hiddenWidth;
+
+			int centerX = std::round(hx * hiddenToVisibleWidth);
+			int centerY = std::round(hy * hiddenToVisibleHeight);
+
+			// Lateral and recurrent windows exclude the node itself
+			_sharedWeights->_feedForwardPool._offsets[hi + 1] = _sharedWeights->_feedForwardPool._offsets[hi] + getWindowArea(centerX, centerY, receptiveRadius, visibleWidth, visibleHeight);
+			_sharedWeights->_lateralPool._offsets[hi + 1] = _sharedWeights->_lateralPool._offsets[hi] + getWindowArea(hx, hy, inhibitionRadius, hiddenWidth, hiddenHeight) - 1;
+			_sharedWeights->_recurrentPool._offsets[hi + 1] = _sharedWeights->_recurrentPool._offsets[hi] + (recurrentRadius != -1 ? getWindowArea(hx, hy, recurrentRadius, hiddenWidth, hiddenHeight) - 1 : 0);
+		}
+
+		reservePool(_sharedWeights->_feedForwardPool);
+		reservePool(_sharedWeights->_lateralPool);
+		reservePool(_sharedWeights->_recurrentPool);
+	}
+	else if (_storage == _implicit) {
+		_sharedWeights->_feedForwardWeights.assign(numHidden * receptiveSize, 0.0f);
+		_sharedWeights->_lateralWeights.assign(numHidden * inhibitionSize, 0.0f);
+
+		if (recurrentRadius != -1)
+			_sharedWeights->_recurrentWeights.assign(numHidden * recurrentSize, 0.0f);
+	}
+
+	// Connections are generated in the same order for every storage, so they all draw the same weights
 	for (int hi = 0; hi < numHidden; hi++) {
 		int hx = hi % hiddenWidth;
 		int hy = hi / hiddenWidth;
@@ -41,11 +98,17 @@ void RSDR::createRandom(int visibleWidth, int visibleHeight, int hiddenWidth, in
 		int centerX = std::round(hx * hiddenToVisibleWidth);
 		int centerY = std::round(hy * hiddenToVisibleHeight);
 
-		_hidden[hi]._threshold = initThreshold;
+		if (_storage == _nodes) {
+			_hidden[hi]._threshold = initThreshold;
 
-		// Receptive
-		_hidden[hi]._feedForwardConnections.reserve(receptiveSize);
+			_hidden[hi]._feedForwardConnections.reserve(receptiveSize);
+			_hidden[hi]._lateralConnections.reserve(inhibitionSize);
+
+			if (recurrentRadius != -1)
+				_hidden[hi]._recurrentConnections.reserve(recurrentSize);
+		}
 
+		// Receptive
 		for (int dx = -receptiveRadius; dx <= receptiveRadius; dx++)
 			for (int dy = -receptiveRadius; dy <= receptiveRadius; dy++) {
 				int vx = centerX + dx;
@@ -54,20 +117,24 @@ void RSDR::createRandom(int visibleWidth, int visibleHeight, int hiddenWidth, in
 				if (vx >= 0 && vx < visibleWidth && vy >= 0 && vy < visibleHeight) {
 					int vi = vx + vy * visibleWidth;
 
-					ConnectionFeed c;
+					float weight = weightDist(generator);
+
+					if (_storage == _nodes) {
+						ConnectionFeed c;
+
+						c._weight = weight;
+						c._index = vi;
 
-					c._weight = weightDist(generator);
-					c._index = vi;
-					
-					_hidden[hi]._feedForwardConnections.push_back(c);
+						_hidden[hi]._feedForwardConnections.push_back(c);
+					}
+					else if (_storage == _arrays)
+						addPoolConnection(_sharedWeights->_feedForwardPool, vi, weight);
+					else
+						_sharedWeights->_feedForwardWeights[hi * receptiveSize + (dx + receptiveRadius) + (dy + receptiveRadius) * receptiveDim] = weight;
 				}
 			}
 
-		_hidden[hi]._feedForwardConnections.shrink_to_fit();
-
 		// Inhibition
-		_hidden[hi]._lateralConnections.reserve(inhibitionSize);
-
 		for (int dx = -inhibitionRadius; dx <= inhibitionRadius; dx++)
 			for (int dy = -inhibitionRadius; dy <= inhibitionRadius; dy++) {
 				if (dx == 0 && dy == 0)
@@ -79,21 +146,25 @@ void RSDR::createRandom(int visibleWidth, int visibleHeight, int hiddenWidth, in
 				if (hox >= 0 && hox < hiddenWidth && hoy >= 0 && hoy < hiddenHeight) {
 					int hio = hox + hoy * hiddenWidth;
 
-					ConnectionLateral c;
+					float weight = inhibitionDist(generator);
+
+					if (_storage == _nodes) {
+						ConnectionLateral c;
+
+						c._weight = weight;
+						c._index = hio;
 
-					c._weight = inhibitionDist(generator);
-					c._index = hio;
-		
-					_hidden[hi]._lateralConnections.push_back(c);
+						_hidden[hi]._lateralConnections.push_back(c);
+					}
+					else if (_storage == _arrays)
+						addPoolConnection(_sharedWeights->_lateralPool, hio, weight);
+					else
+						_sharedWeights->_lateralWeights[hi * inhibitionSize + (dx + inhibitionRadius) + (dy + inhibitionRadius) * inhibitionDim] = weight;
 				}
 			}
 
-		_hidden[hi]._lateralConnections.shrink_to_fit();
-
 		// Recurrent
 		if (recurrentRadius != -1) {
-			_hidden[hi]._recurrentConnections.reserve(recurrentSize);
-
 			for (int dx = -recurrentRadius; dx <= recurrentRadius; dx++)
 				for (int dy = -recurrentRadius; dy <= recurrentRadius; dy++) {
 					if (dx == 0 && dy == 0)
@@ -105,23 +176,261 @@ void RSDR::createRandom(int visibleWidth, int visibleHeight, int hiddenWidth, in
 					if (hox >= 0 && hox < hiddenWidth && hoy >= 0 && hoy < hiddenHeight) {
 						int hio = hox + hoy * hiddenWidth;
 
-						ConnectionFeed c;
+						float weight = weightDist(generator);
 
-						c._weight = weightDist(generator);
-						c._index = hio;
+						if (_storage == _nodes) {
+							ConnectionFeed c;
+
+							c._weight = weight;
+							c._index = hio;
 
-						_hidden[hi]._recurrentConnections.push_back(c);
+							_hidden[hi]._recurrentConnections.push_back(c);
+						}
+						else if (_storage == _arrays)
+							addPoolConnection(_sharedWeights->_recurrentPool, hio, weight);
+						else
+							_sharedWeights->_recurrentWeights[hi * recurrentSize + (dx + recurrentRadius) + (dy + recurrentRadius) * recurrentDim] = weight;
 					}
 				}
+		}
 
+		if (_storage == _nodes) {
+			_hidden[hi]._feedForwardConnections.shrink_to_fit();
+			_hidden[hi]._lateralConnections.shrink_to_fit();
 			_hidden[hi]._recurrentConnections.shrink_to_fit();
 		}
 	}
+
+	if (_storage != _nodes) {
+		_sharedWeights->_thresholds.clear();
+		_sharedWeights->_thresholds.assign(numHidden, initThreshold);
+
+		_arrayState._visibleInputs.clear();
+		_arrayState._visibleInputs.assign(numVisible, 0.0f);
+		_arrayState._visibleReconstructions.clear();
+		_arrayState._visibleReconstructions.assign(numVisible, 0.0f);
+
+		_arrayState._excitations.clear();
+		_arrayState._excitations.assign(numHidden, 0.0f);
+		_arrayState._spikes.clear();
+		_arrayState._spikes.assign(numHidden, 0.0f);
+		_arrayState._spikesPrev.clear();
+		_arrayState._spikesPrev.assign(numHidden, 0.0f);
+		_arrayState._states.clear();
+		_arrayState._states.assign(numHidden, 0.0f);
+		_arrayState._statesPrev.clear();
+		_arrayState._statesPrev.assign(numHidden, 0.0f);
+		_arrayState._activations.clear();
+		_arrayState._activations.assign(numHidden, 0.0f);
+		_arrayState._reconstructions.clear();
+		_arrayState._reconstructions.assign(numHidden, 0.0f);
+	}
+
+	if (_eventDrivenInhibition)
+		buildLateralTranspose();
 }
 
 void RSDR::activate(int subIterSettle, int subIterMeasure, float leak) {
 	// Activate
-	for (int hi = 0; hi < _hidden.size(); hi++) {
+	forEachTile([this](int begin, int end) {
+		excite(begin, end, &_arrayState, 1);
+	});
+
+	// Inhibit
+	settle(subIterSettle, subIterMeasure, leak, &_arrayState, 1, nullptr);
+}
+
+void RSDR::inhibit(int subIterSettle, int subIterMeasure, float leak, const std::vector<float> &activations, std::vector<float> &states) {
+	states.clear();
+	states.assign(getNumHidden(), 0.0f);
+
+	forEachTile([this, &activations](int begin, int end) {
+		if (_storage != _nodes) {
+			for (int hi = begin; hi < end; hi++) {
+				_arrayState._excitations[hi] = activations[hi];
+				_arrayState._spikesPrev[hi] = 0.0f;
+				_arrayState._activations[hi] = 0.0f;
+			}
+		}
+		else {
+			for (int hi = begin; hi < end; hi++) {
+				_hidden[hi]._excitation = activations[hi];
+				_hidden[hi]._spike = 0.0f;
+				_hidden[hi]._spikePrev = 0.0f;
+				_hidden[hi]._activation = 0.0f;
+			}
+		}
+	});
+
+	// Inhibit
+	settle(subIterSettle, subIterMeasure, leak, &_arrayState, 1, &states);
+}
+
+void RSDR::initStream(ArrayState &stream) const {
+	int numVisible = getNumVisible();
+	int numHidden = getNumHidden();
+
+	stream._visibleInputs.clear();
+	stream._visibleInputs.assign(numVisible, 0.0f);
+	stream._visibleReconstructions.clear();
+	stream._visibleReconstructions.assign(numVisible, 0.0f);
+
+	stream._excitations.clear();
+	stream._excitations.assign(numHidden, 0.0f);
+	stream._spikes.clear();
+	stream._spikes.assign(numHidden, 0.0f);
+	stream._spikesPrev.clear();
+	stream._spikesPrev.assign(numHidden, 0.0f);
+	stream._states.clear();
+	stream._states.assign(numHidden, 0.0f);
+	stream._statesPrev.clear();
+	stream._statesPrev.assign(numHidden, 0.0f);
+	stream._activations.clear();
+	stream._activations.assign(numHidden, 0.0f);
+	stream._reconstructions.clear();
+	stream._reconstructions.assign(numHidden, 0.0f);
+}
+
+void RSDR::activate(std::vector<ArrayState> &streams, int subIterSettle, int subIterMeasure, float leak) {
+	assert(_storage != _nodes);
+
+	if (streams.empty())
+		return;
+
+	// Activate
+	forEachTile([this, &streams](int begin, int end) {
+		excite(begin, end, streams.data(), streams.size());
+	});
+
+	// Inhibit
+	settle(subIterSettle, subIterMeasure, leak, streams.data(), streams.size(), nullptr);
+}
+
+void RSDR::inhibit(std::vector<ArrayState> &streams, int subIterSettle, int subIterMeasure, float leak, const std::vector<std::vector<float>> &activations, std::vector<std::vector<float>> &states) {
+	assert(_storage != _nodes);
+
+	states.resize(streams.size());
+
+	for (int b = 0; b < streams.size(); b++) {
+		states[b].clear();
+		states[b].assign(getNumHidden(), 0.0f);
+	}
+
+	if (streams.empty())
+		return;
+
+	forEachTile([&streams, &activations](int begin, int end) {
+		for (int b = 0; b < streams.size(); b++)
+			for (int hi = begin; hi < end; hi++) {
+				streams[b]._excitations[hi] = activations[b][hi];
+				streams[b]._spikesPrev[hi] = 0.0f;
+				streams[b]._activations[hi] = 0.0f;
+			}
+	});
+
+	// Inhibit
+	settle(subIterSettle, subIterMeasure, leak, streams.data(), streams.size(), states.data());
+}
+
+void RSDR::stepEnd(std::vector<ArrayState> &streams) {
+	for (int b = 0; b < streams.size(); b++)
+		std::copy(streams[b]._states.begin(), streams[b]._states.end(), streams[b]._statesPrev.begin());
+}
+
+void RSDR::reconstructFeedForward(const std::vector<float> &states, std::vector<float> &recon) const {
+	recon.clear();
+	recon.assign(getNumVisible(), 0.0f);
+
+	int receptiveDim = _receptiveRadius * 2 + 1;
+
+	for (int hi = 0; hi < getNumHidden(); hi++) {
+		if (states[hi] == 0.0f)
+			continue;
+
+		if (_storage == _implicit) {
+			int centerX, centerY;
+
+			getReceptiveCenter(hi, centerX, centerY);
+
+			int dxMin, dxMax, dyMin, dyMax;
+
+			clipWindow(centerX, _receptiveRadius, _visibleWidth, dxMin, dxMax);
+			clipWindow(centerY, _receptiveRadius, _visibleHeight, dyMin, dyMax);
+
+			for (int dy = dyMin; dy <= dyMax; dy++) {
+				float* pRecon = &recon[centerX + dxMin + (centerY + dy) * _visibleWidth];
+				const float* pWeights = &_sharedWeights->_feedForwardWeights[hi * receptiveDim * receptiveDim + (dxMin + _receptiveRadius) + (dy + _receptiveRadius) * receptiveDim];
+
+				for (int i = 0; i <= dxMax - dxMin; i++)
+					pRecon[i] += pWeights[i] * states[hi];
+			}
+		}
+		else if (_storage == _arrays) {
+			for (int ci = _sharedWeights->_feedForwardPool._offsets[hi]; ci < _sharedWeights->_feedForwardPool._offsets[hi + 1]; ci++)
+				recon[_sharedWeights->_feedForwardPool.getIndex(ci)] += _sharedWeights->_feedForwardPool._weights[ci] * states[hi];
+		}
+		else {
+			for (int ci = 0; ci < _hidden[hi]._feedForwardConnections.size(); ci++)
+				recon[_hidden[hi]._feedForwardConnections[ci]._index] += _hidden[hi]._feedForwardConnections[ci]._weight * states[hi];
+		}
+	}
+}
+
+void RSDR::learn(float learnFeedForward, float learnRecurrent, float learnLateral, float learnThreshold, float sparsity) {
+	if (_storage != _nodes)
+		makeWeightsUnique();
+
+	forEachTile([&](int begin, int end) {
+		learnRange(begin, end, nullptr, learnFeedForward, learnRecurrent, learnLateral, learnThreshold, sparsity);
+	});
+}
+
+void RSDR::learn(const std::vector<float> &attentions, float learnFeedForward, float learnRecurrent, float learnLateral, float learnThreshold, float sparsity) {
+	if (_storage != _nodes)
+		makeWeightsUnique();
+
+	forEachTile([&](int begin, int end) {
+		learnRange(begin, end, &attentions, learnFeedForward, learnRecurrent, learnLateral, learnThreshold, sparsity);
+	});
+}
+
+void RSDR::forEachTile(const std::function<void(int, int)> &func) {
+	int numHidden = getNumHidden();
+
+	if (_threadPool == nullptr || _threadPool->getNumThreads() == 1) {
+		func(0, numHidden);
+
+		return;
+	}
+
+	// Tiles are bands of whole hidden rows, several per thread for load balancing
+	int numTiles = std::min(_hiddenHeight, _threadPool->getNumThreads() * 4);
+
+	_threadPool->run(numTiles, [this, numTiles, &func](int t) {
+		int rowBegin = t * _hiddenHeight / numTiles;
+		int rowEnd = (t + 1) * _hiddenHeight / numTiles;
+
+		func(rowBegin * _hiddenWidth, rowEnd * _hiddenWidth);
+	});
+}
+
+void RSDR::excite(int begin, int end, ArrayState* pStreams, int numStreams) {
+	if (_storage == _implicit) {
+		exciteImplicit(begin, end, pStreams, numStreams);
+
+		return;
+	}
+
+	if (_storage == _arrays) {
+		if (_longIndices)
+			exciteArrays<unsigned int>(begin, end, pStreams, numStreams);
+		else
+			exciteArrays<unsigned short>(begin, end, pStreams, numStreams);
+
+		return;
+	}
+
+	for (int hi = begin; hi < end; hi++) {
 		float centerFF = 0.0f;
 		float centerR = 0.0f;
 
@@ -149,184 +458,309 @@ void RSDR::activate(int subIterSettle, int subIterMeasure, float leak) {
 		_hidden[hi]._activation = 0.0f;
 		_hidden[hi]._state = 0.0f;
 	}
+}
 
-	// Inhibit
+void RSDR::settle(int subIterSettle, int subIterMeasure, float leak, ArrayState* pStreams, int numStreams, std::vector<float>* pMeasured) {
 	float subIterMeasureInv = 1.0f / subIterMeasure;
 
-	for (int iter = 0; iter < subIterSettle; iter++) {
-		for (int hi = 0; hi < _hidden.size(); hi++) {
-			float inhibition = 0.0f;
+	// The spiking node list only tracks the member state, batched streams always gather
+	bool eventDriven = _eventDrivenInhibition && pStreams == &_arrayState;
 
-			for (int ci = 0; ci < _hidden[hi]._lateralConnections.size(); ci++)
-				inhibition += _hidden[hi]._lateralConnections[ci]._weight * _hidden[_hidden[hi]._lateralConnections[ci]._index]._spikePrev;
+	// No node has spiked yet
+	if (eventDriven)
+		_spikingNodes.clear();
 
-			float activation = (1.0f - leak) * _hidden[hi]._activation + _hidden[hi]._excitation - inhibition;
+	for (int iter = 0; iter < subIterSettle + subIterMeasure; iter++) {
+		bool measure = iter >= subIterSettle;
 
-			if (activation > _hidden[hi]._threshold) {
-				_hidden[hi]._spike = 1.0f;
+		if (eventDriven)
+			scatterInhibition();
 
-				activation = 0.0f;
-			}
-			else
-				_hidden[hi]._spike = 0.0f;
+		forEachTile([&](int begin, int end) {
+			inhibitStep(begin, end, leak, measure, subIterMeasureInv, eventDriven, pStreams, numStreams, pMeasured);
+		});
 
-			_hidden[hi]._activation = activation;
+		// Every node only reads the spikes of the previous sub-iteration, so they are only published once all tiles are done
+		if (_storage != _nodes) {
+			for (int b = 0; b < numStreams; b++)
+				pStreams[b]._spikesPrev.swap(pStreams[b]._spikes);
+		}
+		else {
+			forEachTile([this](int begin, int end) {
+				for (int hi = begin; hi < end; hi++)
+					_hidden[hi]._spikePrev = _hidden[hi]._spike;
+			});
 		}
 
-		for (int hi = 0; hi < _hidden.size(); hi++)
-			_hidden[hi]._spikePrev = _hidden[hi]._spike;
+		if (eventDriven)
+			findSpikingNodes();
 	}
+}
 
-	for (int iter = 0; iter < subIterMeasure; iter++) {
-		for (int hi = 0; hi < _hidden.size(); hi++) {
-			float inhibition = 0.0f;
+void RSDR::inhibitStep(int begin, int end, float leak, bool measure, float subIterMeasureInv, bool eventDriven, ArrayState* pStreams, int numStreams, std::vector<float>* pMeasured) {
+	if (_storage == _implicit) {
+		inhibitStepImplicit(begin, end, leak, measure, subIterMeasureInv, eventDriven, pStreams, numStreams, pMeasured);
+
+		return;
+	}
+
+	if (_storage == _arrays) {
+		if (_longIndices)
+			inhibitStepArrays<unsigned int>(begin, end, leak, measure, subIterMeasureInv, eventDriven, pStreams, numStreams, pMeasured);
+		else
+			inhibitStepArrays<unsigned short>(begin, end, leak, measure, subIterMeasureInv, eventDriven, pStreams, numStreams, pMeasured);
 
+		return;
+	}
+
+	for (int hi = begin; hi < end; hi++) {
+		float inhibition = 0.0f;
+
+		if (eventDriven)
+			inhibition = _inhibitions[hi];
+		else {
 			for (int ci = 0; ci < _hidden[hi]._lateralConnections.size(); ci++)
 				inhibition += _hidden[hi]._lateralConnections[ci]._weight * _hidden[_hidden[hi]._lateralConnections[ci]._index]._spikePrev;
+		}
 
-			float activation = (1.0f - leak) * _hidden[hi]._activation + _hidden[hi]._excitation - inhibition;
-
-			if (activation > _hidden[hi]._threshold) {
-				_hidden[hi]._spike = 1.0f;
+		float activation = (1.0f - leak) * _hidden[hi]._activation + _hidden[hi]._excitation - inhibition;
 
-				_hidden[hi]._state += subIterMeasureInv;
+		if (activation > _hidden[hi]._threshold) {
+			_hidden[hi]._spike = 1.0f;
 
-				activation = 0.0f;
+			if (measure) {
+				if (pMeasured == nullptr)
+					_hidden[hi]._state += subIterMeasureInv;
+				else
+					(*pMeasured)[hi] += subIterMeasureInv;
 			}
-			else
-				_hidden[hi]._spike = 0.0f;
 
-			_hidden[hi]._activation = activation;
+			activation = 0.0f;
 		}
+		else
+			_hidden[hi]._spike = 0.0f;
 
-		for (int hi = 0; hi < _hidden.size(); hi++)
-			_hidden[hi]._spikePrev = _hidden[hi]._spike;
+		_hidden[hi]._activation = activation;
 	}
 }
 
-void RSDR::inhibit(int subIterSettle, int subIterMeasure, float leak, const std::vector<float> &activations, std::vector<float> &states) {
-	states.clear();
-	states.assign(_hidden.size(), 0.0f);
+void RSDR::setEventDrivenInhibition(bool eventDrivenInhibition) {
+	_eventDrivenInhibition = eventDrivenInhibition;
 
-	for (int hi = 0; hi < _hidden.size(); hi++) {
-		_hidden[hi]._excitation = activations[hi];
-		_hidden[hi]._spike = 0.0f;
-		_hidden[hi]._spikePrev = 0.0f;
-		_hidden[hi]._activation = 0.0f;
+	makeWeightsUnique();
+
+	if (_eventDrivenInhibition)
+		buildLateralTranspose();
+	else {
+		_sharedWeights->_lateralTransposeOffsets.clear();
+		_sharedWeights->_lateralTransposeTargets.clear();
+		_sharedWeights->_lateralTransposeConnections.clear();
+		_spikingNodes.clear();
+		_inhibitions.clear();
 	}
+}
 
-	// Inhibit
-	float subIterMeasureInv = 1.0f / subIterMeasure;
+void RSDR::makeWeightsUnique() {
+	if (_sharedWeights.use_count() != 1)
+		_sharedWeights = std::make_shared<SharedWeights>(*_sharedWeights);
+}
 
-	for (int iter = 0; iter < subIterSettle; iter++) {
-		for (int hi = 0; hi < _hidden.size(); hi++) {
-			float inhibition = 0.0f;
+void RSDR::buildLateralTranspose() {
+	int numHidden = getNumHidden();
+
+	_sharedWeights->_lateralTransposeOffsets.clear();
+	_sharedWeights->_lateralTransposeTargets.clear();
+	_sharedWeights->_lateralTransposeConnections.clear();
 
+	_spikingNodes.clear();
+	_spikingNodes.reserve(numHidden);
+
+	_inhibitions.clear();
+	_inhibitions.assign(numHidden, 0.0f);
+
+	// With _implicit storage the targets of a node follow from its window, so there is nothing to store
+	if (_storage == _implicit)
+		return;
+
+	_sharedWeights->_lateralTransposeOffsets.assign(numHidden + 1, 0);
+
+	// Count the connections reading each node
+	for (int hi = 0; hi < numHidden; hi++) {
+		if (_storage == _arrays) {
+			for (int ci = _sharedWeights->_lateralPool._offsets[hi]; ci < _sharedWeights->_lateralPool._offsets[hi + 1]; ci++)
+				_sharedWeights->_lateralTransposeOffsets[_sharedWeights->_lateralPool.getIndex(ci) + 1]++;
+		}
+		else {
 			for (int ci = 0; ci < _hidden[hi]._lateralConnections.size(); ci++)
-				inhibition += _hidden[hi]._lateralConnections[ci]._weight * _hidden[_hidden[hi]._lateralConnections[ci]._index]._spikePrev;
+				_sharedWeights->_lateralTransposeOffsets[_hidden[hi]._lateralConnections[ci]._index + 1]++;
+		}
+	}
 
-			float activation = (1.0f - leak) * _hidden[hi]._activation + _hidden[hi]._excitation - inhibition;
+	for (int hi = 0; hi < numHidden; hi++)
+		_sharedWeights->_lateralTransposeOffsets[hi + 1] += _sharedWeights->_lateralTransposeOffsets[hi];
 
-			if (activation > _hidden[hi]._threshold) {
-				_hidden[hi]._spike = 1.0f;
+	_sharedWeights->_lateralTransposeTargets.resize(_sharedWeights->_lateralTransposeOffsets.back());
+	_sharedWeights->_lateralTransposeConnections.resize(_sharedWeights->_lateralTransposeOffsets.back());
 
-				activation = 0.0f;
-			}
-			else
-				_hidden[hi]._spike = 0.0f;
+	std::vector<int> fill(_sharedWeights->_lateralTransposeOffsets.begin(), _sharedWeights->_lateralTransposeOffsets.end() - 1);
 
-			_hidden[hi]._activation = activation;
+	for (int hi = 0; hi < numHidden; hi++) {
+		if (_storage == _arrays) {
+			for (int ci = _sharedWeights->_lateralPool._offsets[hi]; ci < _sharedWeights->_lateralPool._offsets[hi + 1]; ci++) {
+				int slot = fill[_sharedWeights->_lateralPool.getIndex(ci)]++;
+
+				_sharedWeights->_lateralTransposeTargets[slot] = hi;
+				_sharedWeights->_lateralTransposeConnections[slot] = ci;
+			}
 		}
+		else {
+			for (int ci = 0; ci < _hidden[hi]._lateralConnections.size(); ci++) {
+				int slot = fill[_hidden[hi]._lateralConnections[ci]._index]++;
 
-		for (int hi = 0; hi < _hidden.size(); hi++)
-			_hidden[hi]._spikePrev = _hidden[hi]._spike;
+				_sharedWeights->_lateralTransposeTargets[slot] = hi;
+				_sharedWeights->_lateralTransposeConnections[slot] = ci;
+			}
+		}
 	}
+}
 
-	for (int iter = 0; iter < subIterMeasure; iter++) {
-		for (int hi = 0; hi < _hidden.size(); hi++) {
-			float inhibition = 0.0f;
+void RSDR::scatterInhibition() {
+	std::fill(_inhibitions.begin(), _inhibitions.end(), 0.0f);
 
-			for (int ci = 0; ci < _hidden[hi]._lateralConnections.size(); ci++)
-				inhibition += _hidden[hi]._lateralConnections[ci]._weight * _hidden[_hidden[hi]._lateralConnections[ci]._index]._spikePrev;
+	// Spikes are 1, so each spiking node adds its connection weights
+	if (_storage == _implicit) {
+		int inhibitionDim = _inhibitionRadius * 2 + 1;
+		int inhibitionSize = inhibitionDim * inhibitionDim;
 
-			float activation = (1.0f - leak) * _hidden[hi]._activation + _hidden[hi]._excitation - inhibition;
+		for (int si = 0; si < _spikingNodes.size(); si++) {
+			int sx = _spikingNodes[si] % _hiddenWidth;
+			int sy = _spikingNodes[si] / _hiddenWidth;
 
-			if (activation > _hidden[hi]._threshold) {
-				_hidden[hi]._spike = 1.0f;
+			int dxMin, dxMax, dyMin, dyMax;
 
-				states[hi] += subIterMeasureInv;
+			clipWindow(sx, _inhibitionRadius, _hiddenWidth, dxMin, dxMax);
+			clipWindow(sy, _inhibitionRadius, _hiddenHeight, dyMin, dyMax);
 
-				activation = 0.0f;
-			}
-			else
-				_hidden[hi]._spike = 0.0f;
+			// The source sits at offset (-dx, -dy) in the window of target (sx + dx, sy + dy)
+			for (int dy = dyMin; dy <= dyMax; dy++)
+				for (int dx = dxMin; dx <= dxMax; dx++) {
+					if (dx == 0 && dy == 0)
+						continue;
+
+					int target = sx + dx + (sy + dy) * _hiddenWidth;
 
-			_hidden[hi]._activation = activation;
+					_inhibitions[target] += _sharedWeights->_lateralWeights[target * inhibitionSize + (_inhibitionRadius - dx) + (_inhibitionRadius - dy) * inhibitionDim];
+				}
 		}
 
-		for (int hi = 0; hi < _hidden.size(); hi++)
-			_hidden[hi]._spikePrev = _hidden[hi]._spike;
+		return;
+	}
+
+	for (int si = 0; si < _spikingNodes.size(); si++) {
+		int source = _spikingNodes[si];
+
+		for (int ti = _sharedWeights->_lateralTransposeOffsets[source]; ti < _sharedWeights->_lateralTransposeOffsets[source + 1]; ti++) {
+			int target = _sharedWeights->_lateralTransposeTargets[ti];
+
+			if (_storage == _arrays)
+				_inhibitions[target] += _sharedWeights->_lateralPool._weights[_sharedWeights->_lateralTransposeConnections[ti]];
+			else
+				_inhibitions[target] += _hidden[target]._lateralConnections[_sharedWeights->_lateralTransposeConnections[ti]]._weight;
+		}
 	}
 }
 
-void RSDR::learn(float learnFeedForward, float learnRecurrent, float learnLateral, float learnThreshold, float sparsity) {
-	std::vector<float> visibleErrors(_visible.size(), 0.0f);
-	std::vector<float> hiddenErrors(_hidden.size(), 0.0f);
+void RSDR::findSpikingNodes() {
+	_spikingNodes.clear();
 
-	for (int vi = 0; vi < _visible.size(); vi++)
-		visibleErrors[vi] = _visible[vi]._input - _visible[vi]._reconstruction;
+	// Collect the spikes in the order the gather visits them, so every node adds up its inhibition in the same order.
+	// Lateral connections are created column by column (dx outer, dy inner), _implicit windows are walked row by row
+	if (_storage == _implicit) {
+		for (int hi = 0; hi < _hiddenWidth * _hiddenHeight; hi++)
+			if (_arrayState._spikesPrev[hi] > 0.0f)
+				_spikingNodes.push_back(hi);
 
-	for (int hi = 0; hi < _hidden.size(); hi++)
-		hiddenErrors[hi] = _hidden[hi]._statePrev - _hidden[hi]._reconstruction;
+		return;
+	}
+
+	for (int x = 0; x < _hiddenWidth; x++)
+		for (int y = 0; y < _hiddenHeight; y++) {
+			int hi = x + y * _hiddenWidth;
+
+			if ((_storage == _arrays ? _arrayState._spikesPrev[hi] : _hidden[hi]._spikePrev) > 0.0f)
+				_spikingNodes.push_back(hi);
+		}
+}
+
+void RSDR::learnRange(int begin, int end, const std::vector<float>* pAttentions, float learnFeedForward, float learnRecurrent, float learnLateral, float learnThreshold, float sparsity) {
+	if (_storage == _implicit) {
+		learnRangeImplicit(begin, end, pAttentions, learnFeedForward, learnRecurrent, learnLateral, learnThreshold, sparsity);
+
+		return;
+	}
+
+	if (_storage == _arrays) {
+		if (_longIndices)
+			learnRangeArrays<unsigned int>(begin, end, pAttentions, learnFeedForward, learnRecurrent, learnLateral, learnThreshold, sparsity);
+		else
+			learnRangeArrays<unsigned short>(begin, end, pAttentions, learnFeedForward, learnRecurrent, learnLateral, learnThreshold, sparsity);
+
+		return;
+	}
 
 	float sparsitySquared = sparsity * sparsity;
 
-	for (int hi = 0; hi < _hidden.size(); hi++) {
+	// An attention of 1 leaves every product unchanged, so both learn overloads share this
+	for (int hi = begin; hi < end; hi++) {
+		float attention = pAttentions == nullptr ? 1.0f : (*pAttentions)[hi];
+
 		float learn = _hidden[hi]._state;
 
 		if (learn > 0.0f) {
 			for (int ci = 0; ci < _hidden[hi]._feedForwardConnections.size(); ci++)
-				_hidden[hi]._feedForwardConnections[ci]._weight += learnFeedForward * learn * (_visible[_hidden[hi]._feedForwardConnections[ci]._index]._input - learn * _hidden[hi]._feedForwardConnections[ci]._weight);
+				_hidden[hi]._feedForwardConnections[ci]._weight += learnFeedForward * attention * learn * (_visible[_hidden[hi]._feedForwardConnections[ci]._index]._input - learn * _hidden[hi]._feedForwardConnections[ci]._weight);
 
 			for (int ci = 0; ci < _hidden[hi]._recurrentConnections.size(); ci++)
-				_hidden[hi]._recurrentConnections[ci]._weight += learnRecurrent * learn * (_hidden[_hidden[hi]._recurrentConnections[ci]._index]._statePrev - learn * _hidden[hi]._recurrentConnections[ci]._weight);
+				_hidden[hi]._recurrentConnections[ci]._weight += learnRecurrent * attention * learn * (_hidden[_hidden[hi]._recurrentConnections[ci]._index]._statePrev - learn * _hidden[hi]._recurrentConnections[ci]._weight);
 		}
 
 		for (int ci = 0; ci < _hidden[hi]._lateralConnections.size(); ci++)
-			_hidden[hi]._lateralConnections[ci]._weight = std::max(0.0f, _hidden[hi]._lateralConnections[ci]._weight + learnLateral * (_hidden[hi]._state * _hidden[_hidden[hi]._lateralConnections[ci]._index]._state - sparsitySquared)); //_hidden[_hidden[hi]._lateralConnections[ci]._index]._state * 
+			_hidden[hi]._lateralConnections[ci]._weight = std::max(0.0f, _hidden[hi]._lateralConnections[ci]._weight + learnLateral * attention * (_hidden[hi]._state * _hidden[_hidden[hi]._lateralConnections[ci]._index]._state - sparsitySquared));
 
-		_hidden[hi]._threshold += learnThreshold * (_hidden[hi]._state - sparsity);
+		_hidden[hi]._threshold += learnThreshold * attention * (_hidden[hi]._state - sparsity);
 	}
 }
 
-void RSDR::learn(const std::vector<float> &attentions, float learnFeedForward, float learnRecurrent, float learnLateral, float learnThreshold, float sparsity) {
-	std::vector<float> visibleErrors(_visible.size(), 0.0f);
-	std::vector<float> hiddenErrors(_hidden.size(), 0.0f);
+void RSDR::getReceptiveCenter(int hi, int &centerX, int &centerY) const {
+	float hiddenToVisibleWidth = static_cast<float>(_visibleWidth) / static_cast<float>(_hiddenWidth);
+	float hiddenToVisibleHeight = static_cast<float>(_visibleHeight) / static_cast<float>(_hiddenHeight);
 
-	for (int vi = 0; vi < _visible.size(); vi++)
-		visibleErrors[vi] = _visible[vi]._input - _visible[vi]._reconstruction;
+	centerX = std::round((hi % _hiddenWidth) * hiddenToVisibleWidth);
+	centerY = std::round((hi / _hiddenWidth) * hiddenToVisibleHeight);
+}
 
-	for (int hi = 0; hi < _hidden.size(); hi++)
-		hiddenErrors[hi] = _hidden[hi]._statePrev - _hidden[hi]._reconstruction;
+float RSDR::getVHWeight(int hi, int ci) const {
+	if (_storage == _arrays)
+		return _sharedWeights->_feedForwardPool._weights[_sharedWeights->_feedForwardPool._offsets[hi] + ci];
 
-	float sparsitySquared = sparsity * sparsity;
+	if (_storage == _nodes)
+		return _hidden[hi]._feedForwardConnections[ci]._weight;
 
-	for (int hi = 0; hi < _hidden.size(); hi++) {
-		float learn = _hidden[hi]._state;
+	int centerX, centerY;
 
-		if (learn > 0.0f) {
-			for (int ci = 0; ci < _hidden[hi]._feedForwardConnections.size(); ci++)
-				_hidden[hi]._feedForwardConnections[ci]._weight += learnFeedForward * attentions[hi] * learn * (_visible[_hidden[hi]._feedForwardConnections[ci]._index]._input - learn * _hidden[hi]._feedForwardConnections[ci]._weight);
+	getReceptiveCenter(hi, centerX, centerY);
 
-			for (int ci = 0; ci < _hidden[hi]._recurrentConnections.size(); ci++)
-				_hidden[hi]._recurrentConnections[ci]._weight += learnRecurrent * attentions[hi] * learn * (_hidden[_hidden[hi]._recurrentConnections[ci]._index]._statePrev - learn * _hidden[hi]._recurrentConnections[ci]._weight);
-		}
+	int dxMin, dxMax, dyMin, dyMax;
 
-		for (int ci = 0; ci < _hidden[hi]._lateralConnections.size(); ci++)
-			_hidden[hi]._lateralConnections[ci]._weight = std::max(0.0f, _hidden[hi]._lateralConnections[ci]._weight + learnLateral * attentions[hi] * (_hidden[hi]._state * _hidden[_hidden[hi]._lateralConnections[ci]._index]._state - sparsitySquared)); //_hidden[_hidden[hi]._lateralConnections[ci]._index]._state * 
+	clipWindow(centerX, _receptiveRadius, _visibleWidth, dxMin, dxMax);
+	clipWindow(centerY, _receptiveRadius, _visibleHeight, dyMin, dyMax);
 
-		_hidden[hi]._threshold += learnThreshold * attentions[hi] * (_hidden[hi]._state - sparsity);
-	}
+	int dx = dxMin + ci / (dyMax - dyMin + 1);
+	int dy = dyMin + ci % (dyMax - dyMin + 1);
+
+	int dim = _receptiveRadius * 2 + 1;
+
+	return _sharedWeights->_feedForwardWeights[hi * dim * dim + (dx + _receptiveRadius) + (dy + _receptiveRadius) * dim];
 }
 
 void RSDR::getVHWeights(int hx, int hy, std::vector<float> &rectangle) const {
@@ -339,11 +773,20 @@ void RSDR::getVHWeights(int hx, int hy, std::vector<float> &rectangle) const {
 
 	int hi = hx + hy * _hiddenWidth;
 
+	// The weight blocks already have this layout
+	if (_storage == _implicit) {
+		std::copy(_sharedWeights->_feedForwardWeights.begin() + hi * dim * dim, _sharedWeights->_feedForwardWeights.begin() + (hi + 1) * dim * dim, rectangle.begin());
+
+		return;
+	}
+
 	int centerX = std::round(hx * hiddenToVisibleWidth);
 	int centerY = std::round(hy * hiddenToVisibleHeight);
 
-	for (int ci = 0; ci < _hidden[hi]._feedForwardConnections.size(); ci++) {
-		int index = _hidden[hi]._feedForwardConnections[ci]._index;
+	int numConnections = _storage == _arrays ? _sharedWeights->_feedForwardPool._offsets[hi + 1] - _sharedWeights->_feedForwardPool._offsets[hi] : _hidden[hi]._feedForwardConnections.size();
+
+	for (int ci = 0; ci < numConnections; ci++) {
+		int index = _storage == _arrays ? _sharedWeights->_feedForwardPool.getIndex(_sharedWeights->_feedForwardPool._offsets[hi] + ci) : _hidden[hi]._feedForwardConnections[ci]._index;
 
 		int vx = index % _visibleWidth;
 		int vy = index / _visibleWidth;
@@ -354,11 +797,598 @@ void RSDR::getVHWeights(int hx, int hy, std::vector<float> &rectangle) const {
 		int rx = dx + _receptiveRadius;
 		int ry = dy + _receptiveRadius;
 
-		rectangle[rx + ry * dim] = _hidden[hi]._feedForwardConnections[ci]._weight;
+		rectangle[rx + ry * dim] = getVHWeight(hi, ci);
 	}
 }
 
 void RSDR::stepEnd() {
+	if (_storage != _nodes) {
+		std::copy(_arrayState._states.begin(), _arrayState._states.end(), _arrayState._statesPrev.begin());
+
+		return;
+	}
+
 	for (int hi = 0; hi < _hidden.size(); hi++)
 		_hidden[hi]._statePrev = _hidden[hi]._state;
+}
+
+void RSDR::setVisibleStates(const float* pStates, size_t count) {
+	if (_storage != _nodes) {
+		std::copy(pStates, pStates + count, _arrayState._visibleInputs.begin());
+
+		return;
+	}
+
+	for (size_t vi = 0; vi < count; vi++)
+		_visible[vi]._input = pStates[vi];
+}
+
+void RSDR::setVisibleStatesFromHidden(const RSDR &source) {
+	if (_storage != _nodes && source._storage != _nodes) {
+		std::copy(source._arrayState._states.begin(), source._arrayState._states.end(), _arrayState._visibleInputs.begin());
+
+		return;
+	}
+
+	for (int vi = 0; vi < source.getNumHidden(); vi++)
+		setVisibleState(vi, source.getHiddenState(vi));
+}
+
+void RSDR::getHiddenStates(float* pStates) const {
+	if (_storage != _nodes) {
+		std::copy(_arrayState._states.begin(), _arrayState._states.end(), pStates);
+
+		return;
+	}
+
+	for (int hi = 0; hi < _hidden.size(); hi++)
+		pStates[hi] = _hidden[hi]._state;
+}
+
+void RSDR::exciteImplicit(int begin, int end, ArrayState* pStreams, int numStreams) {
+	int receptiveDim = _receptiveRadius * 2 + 1;
+	int recurrentDim = _recurrentRadius * 2 + 1;
+
+	for (int hi = begin; hi < end; hi++) {
+		int centerX, centerY;
+
+		getReceptiveCenter(hi, centerX, centerY);
+
+		int dxMin, dxMax, dyMin, dyMax;
+
+		clipWindow(centerX, _receptiveRadius, _visibleWidth, dxMin, dxMax);
+		clipWindow(centerY, _receptiveRadius, _visibleHeight, dyMin, dyMax);
+
+		int rowLength = dxMax - dxMin + 1;
+		int numRows = dyMax - dyMin + 1;
+
+		const float* pWeights = &_sharedWeights->_feedForwardWeights[hi * receptiveDim * receptiveDim + (dxMin + _receptiveRadius) + (dyMin + _receptiveRadius) * receptiveDim];
+		int inputOffset = centerX + dxMin + (centerY + dyMin) * _visibleWidth;
+
+		// The weight block stays in cache for all streams
+		for (int b = 0; b < numStreams; b++) {
+			ArrayState &s = pStreams[b];
+
+			const float* pInputs = &s._visibleInputs[inputOffset];
+
+			float centerFF = Kernels::windowSum(pInputs, _visibleWidth, rowLength, numRows) / (rowLength * numRows);
+
+			s._excitations[hi] = Kernels::windowCenteredDot(pInputs, _visibleWidth, pWeights, receptiveDim, centerFF, rowLength, numRows);
+		}
+
+		// Recurrent, the node itself has weight 0 and is left out of the mean
+		if (_recurrentRadius > 0) {
+			int hx = hi % _hiddenWidth;
+			int hy = hi / _hiddenWidth;
+
+			clipWindow(hx, _recurrentRadius, _hiddenWidth, dxMin, dxMax);
+			clipWindow(hy, _recurrentRadius, _hiddenHeight, dyMin, dyMax);
+
+			rowLength = dxMax - dxMin + 1;
+			numRows = dyMax - dyMin + 1;
+
+			int count = rowLength * numRows - 1;
+
+			if (count > 0) {
+				pWeights = &_sharedWeights->_recurrentWeights[hi * recurrentDim * recurrentDim + (dxMin + _recurrentRadius) + (dyMin + _recurrentRadius) * recurrentDim];
+				inputOffset = hx + dxMin + (hy + dyMin) * _hiddenWidth;
+
+				for (int b = 0; b < numStreams; b++) {
+					ArrayState &s = pStreams[b];
+
+					const float* pInputs = &s._statesPrev[inputOffset];
+
+					float centerR = (Kernels::windowSum(pInputs, _hiddenWidth, rowLength, numRows) - s._statesPrev[hi]) / count;
+
+					s._excitations[hi] += Kernels::windowCenteredDot(pInputs, _hiddenWidth, pWeights, recurrentDim, centerR, rowLength, numRows);
+				}
+			}
+		}
+
+		for (int b = 0; b < numStreams; b++) {
+			ArrayState &s = pStreams[b];
+
+			s._spikesPrev[hi] = 0.0f;
+			s._activations[hi] = 0.0f;
+			s._states[hi] = 0.0f;
+		}
+	}
+}
+
+void RSDR::inhibitStepImplicit(int begin, int end, float leak, bool measure, float subIterMeasureInv, bool eventDriven, ArrayState* pStreams, int numStreams, std::vector<float>* pMeasured) {
+	int inhibitionDim = _inhibitionRadius * 2 + 1;
+
+	for (int hi = begin; hi < end; hi++) {
+		int hx = hi % _hiddenWidth;
+		int hy = hi / _hiddenWidth;
+
+		int dxMin, dxMax, dyMin, dyMax;
+
+		clipWindow(hx, _inhibitionRadius, _hiddenWidth, dxMin, dxMax);
+		clipWindow(hy, _inhibitionRadius, _hiddenHeight, dyMin, dyMax);
+
+		int rowLength = dxMax - dxMin + 1;
+
+		const float* pWeights = &_sharedWeights->_lateralWeights[hi * inhibitionDim * inhibitionDim + (dxMin + _inhibitionRadius) + (dyMin + _inhibitionRadius) * inhibitionDim];
+		int spikeOffset = hx + dxMin + (hy + dyMin) * _hiddenWidth;
+
+		for (int b = 0; b < numStreams; b++) {
+			ArrayState &s = pStreams[b];
+
+			float inhibition = 0.0f;
+
+			if (eventDriven)
+				inhibition = _inhibitions[hi];
+			else {
+				const float* pSpikes = &s._spikesPrev[spikeOffset];
+
+				for (int dy = dyMin; dy <= dyMax; dy++) {
+					const float* pRow = pSpikes + (dy - dyMin) * _hiddenWidth;
+					const float* pRowWeights = pWeights + (dy - dyMin) * inhibitionDim;
+
+					for (int i = 0; i < rowLength; i++)
+						inhibition += pRowWeights[i] * pRow[i];
+				}
+			}
+
+			float activation = (1.0f - leak) * s._activations[hi] + s._excitations[hi] - inhibition;
+
+			if (activation > _sharedWeights->_thresholds[hi]) {
+				s._spikes[hi] = 1.0f;
+
+				if (measure) {
+					if (pMeasured == nullptr)
+						s._states[hi] += subIterMeasureInv;
+					else
+						pMeasured[b][hi] += subIterMeasureInv;
+				}
+
+				activation = 0.0f;
+			}
+			else
+				s._spikes[hi] = 0.0f;
+
+			s._activations[hi] = activation;
+		}
+	}
+}
+
+void RSDR::learnRangeImplicit(int begin, int end, const std::vector<float>* pAttentions, float learnFeedForward, float learnRecurrent, float learnLateral, float learnThreshold, float sparsity) {
+	ArrayState &s = _arrayState;
+
+	int receptiveDim = _receptiveRadius * 2 + 1;
+	int inhibitionDim = _inhibitionRadius * 2 + 1;
+	int recurrentDim = _recurrentRadius * 2 + 1;
+
+	float sparsitySquared = sparsity * sparsity;
+
+	for (int hi = begin; hi < end; hi++) {
+		float attention = pAttentions == nullptr ? 1.0f : (*pAttentions)[hi];
+
+		float learn = s._states[hi];
+
+		int hx = hi % _hiddenWidth;
+		int hy = hi / _hiddenWidth;
+
+		int dxMin, dxMax, dyMin, dyMax;
+
+		if (learn > 0.0f) {
+			int centerX, centerY;
+
+			getReceptiveCenter(hi, centerX, centerY);
+
+			clipWindow(centerX, _receptiveRadius, _visibleWidth, dxMin, dxMax);
+			clipWindow(centerY, _receptiveRadius, _visibleHeight, dyMin, dyMax);
+
+			int rowLength = dxMax - dxMin + 1;
+
+			float rate = learnFeedForward * attention * learn;
+
+			float* pWeights = &_sharedWeights->_feedForwardWeights[hi * receptiveDim * receptiveDim + (dxMin + _receptiveRadius) + (dyMin + _receptiveRadius) * receptiveDim];
+			const float* pInputs = &s._visibleInputs[centerX + dxMin + (centerY + dyMin) * _visibleWidth];
+
+			Kernels::windowOja(pWeights, receptiveDim, pInputs, _visibleWidth, rate, learn, rowLength, dyMax - dyMin + 1);
+
+			if (_recurrentRadius > 0) {
+				clipWindow(hx, _recurrentRadius, _hiddenWidth, dxMin, dxMax);
+				clipWindow(hy, _recurrentRadius, _hiddenHeight, dyMin, dyMax);
+
+				rowLength = dxMax - dxMin + 1;
+
+				rate = learnRecurrent * attention * learn;
+
+				pWeights = &_sharedWeights->_recurrentWeights[hi * recurrentDim * recurrentDim + (dxMin + _recurrentRadius) + (dyMin + _recurrentRadius) * recurrentDim];
+				pInputs = &s._statesPrev[hx + dxMin + (hy + dyMin) * _hiddenWidth];
+
+				Kernels::windowOja(pWeights, recurrentDim, pInputs, _hiddenWidth, rate, learn, rowLength, dyMax - dyMin + 1);
+
+				// A node is not connected to itself
+				_sharedWeights->_recurrentWeights[hi * recurrentDim * recurrentDim + _recurrentRadius + _recurrentRadius * recurrentDim] = 0.0f;
+			}
+		}
+
+		clipWindow(hx, _inhibitionRadius, _hiddenWidth, dxMin, dxMax);
+		clipWindow(hy, _inhibitionRadius, _hiddenHeight, dyMin, dyMax);
+
+		int rowLength = dxMax - dxMin + 1;
+
+		float rate = learnLateral * attention;
+		float state = s._states[hi];
+
+		float* pWeights = &_sharedWeights->_lateralWeights[hi * inhibitionDim * inhibitionDim + (dxMin + _inhibitionRadius) + (dyMin + _inhibitionRadius) * inhibitionDim];
+		const float* pStates = &s._states[hx + dxMin + (hy + dyMin) * _hiddenWidth];
+
+		for (int dy = dyMin; dy <= dyMax; dy++) {
+			const float* pRow = pStates + (dy - dyMin) * _hiddenWidth;
+			float* pRowWeights = pWeights + (dy - dyMin) * inhibitionDim;
+
+			for (int i = 0; i < rowLength; i++)
+				pRowWeights[i] = std::max(0.0f, pRowWeights[i] + rate * (state * pRow[i] - sparsitySquared));
+		}
+
+		_sharedWeights->_lateralWeights[hi * inhibitionDim * inhibitionDim + _inhibitionRadius + _inhibitionRadius * inhibitionDim] = 0.0f;
+
+		_sharedWeights->_thresholds[hi] += learnThreshold * attention * (s._states[hi] - sparsity);
+	}
+}
+
+template<typename IndexType>
+void RSDR::exciteArrays(int begin, int end, ArrayState* pStreams, int numStreams) {
+	const IndexType* pFeedForwardIndices = _sharedWeights->_feedForwardPool.getIndices<IndexType>();
+	const IndexType* pRecurrentIndices = _sharedWeights->_recurrentPool.getIndices<IndexType>();
+
+	for (int hi = begin; hi < end; hi++) {
+		int feedForwardBegin = _sharedWeights->_feedForwardPool._offsets[hi];
+		int feedForwardEnd = _sharedWeights->_feedForwardPool._offsets[hi + 1];
+		int recurrentBegin = _sharedWeights->_recurrentPool._offsets[hi];
+		int recurrentEnd = _sharedWeights->_recurrentPool._offsets[hi + 1];
+
+		// The connection rows stay in cache for all streams
+		for (int b = 0; b < numStreams; b++) {
+			ArrayState &s = pStreams[b];
+
+			float centerFF = 0.0f;
+			float centerR = 0.0f;
+
+			for (int ci = feedForwardBegin; ci < feedForwardEnd; ci++)
+				centerFF += s._visibleInputs[pFeedForwardIndices[ci]];
+
+			for (int ci = recurrentBegin; ci < recurrentEnd; ci++)
+				centerR += s._statesPrev[pRecurrentIndices[ci]];
+
+			centerFF /= feedForwardEnd - feedForwardBegin;
+			centerR /= recurrentEnd - recurrentBegin;
+
+			float sum = 0.0f;
+
+			for (int ci = feedForwardBegin; ci < feedForwardEnd; ci++)
+				sum += (s._visibleInputs[pFeedForwardIndices[ci]] - centerFF) * _sharedWeights->_feedForwardPool._weights[ci];
+
+			for (int ci = recurrentBegin; ci < recurrentEnd; ci++)
+				sum += (s._statesPrev[pRecurrentIndices[ci]] - centerR) * _sharedWeights->_recurrentPool._weights[ci];
+
+			s._excitations[hi] = sum;
+
+			s._spikesPrev[hi] = 0.0f;
+			s._activations[hi] = 0.0f;
+			s._states[hi] = 0.0f;
+		}
+	}
+}
+
+template<typename IndexType>
+void RSDR::inhibitStepArrays(int begin, int end, float leak, bool measure, float subIterMeasureInv, bool eventDriven, ArrayState* pStreams, int numStreams, std::vector<float>* pMeasured) {
+	const IndexType* pLateralIndices = _sharedWeights->_lateralPool.getIndices<IndexType>();
+
+	for (int hi = begin; hi < end; hi++) {
+		for (int b = 0; b < numStreams; b++) {
+			ArrayState &s = pStreams[b];
+
+			float inhibition = 0.0f;
+
+			if (eventDriven)
+				inhibition = _inhibitions[hi];
+			else {
+				for (int ci = _sharedWeights->_lateralPool._offsets[hi]; ci < _sharedWeights->_lateralPool._offsets[hi + 1]; ci++)
+					inhibition += _sharedWeights->_lateralPool._weights[ci] * s._spikesPrev[pLateralIndices[ci]];
+			}
+
+			float activation = (1.0f - leak) * s._activations[hi] + s._excitations[hi] - inhibition;
+
+			if (activation > _sharedWeights->_thresholds[hi]) {
+				s._spikes[hi] = 1.0f;
+
+				if (measure) {
+					if (pMeasured == nullptr)
+						s._states[hi] += subIterMeasureInv;
+					else
+						pMeasured[b][hi] += subIterMeasureInv;
+				}
+
+				activation = 0.0f;
+			}
+			else
+				s._spikes[hi] = 0.0f;
+
+			s._activations[hi] = activation;
+		}
+	}
+}
+
+template<typename IndexType>
+void RSDR::learnRangeArrays(int begin, int end, const std::vector<float>* pAttentions, float learnFeedForward, float learnRecurrent, float learnLateral, float learnThreshold, float sparsity) {
+	ArrayState &s = _arrayState;
+
+	const IndexType* pFeedForwardIndices = _sharedWeights->_feedForwardPool.getIndices<IndexType>();
+	const IndexType* pLateralIndices = _sharedWeights->_lateralPool.getIndices<IndexType>();
+	const IndexType* pRecurrentIndices = _sharedWeights->_recurrentPool.getIndices<IndexType>();
+
+	float sparsitySquared = sparsity * sparsity;
+
+	for (int hi = begin; hi < end; hi++) {
+		float attention = pAttentions == nullptr ? 1.0f : (*pAttentions)[hi];
+
+		float learn = s._states[hi];
+
+		if (learn > 0.0f) {
+			for (int ci = _sharedWeights->_feedForwardPool._offsets[hi]; ci < _sharedWeights->_feedForwardPool._offsets[hi + 1]; ci++)
+				_sharedWeights->_feedForwardPool._weights[ci] += learnFeedForward * attention * learn * (s._visibleInputs[pFeedForwardIndices[ci]] - learn * _sharedWeights->_feedForwardPool._weights[ci]);
+
+			for (int ci = _sharedWeights->_recurrentPool._offsets[hi]; ci < _sharedWeights->_recurrentPool._offsets[hi + 1]; ci++)
+				_sharedWeights->_recurrentPool._weights[ci] += learnRecurrent * attention * learn * (s._statesPrev[pRecurrentIndices[ci]] - learn * _sharedWeights->_recurrentPool._weights[ci]);
+		}
+
+		for (int ci = _sharedWeights->_lateralPool._offsets[hi]; ci < _sharedWeights->_lateralPool._offsets[hi + 1]; ci++)
+			_sharedWeights->_lateralPool._weights[ci] = std::max(0.0f, _sharedWeights->_lateralPool._weights[ci] + learnLateral * attention * (s._states[hi] * s._states[pLateralIndices[ci]] - sparsitySquared));
+
+		_sharedWeights->_thresholds[hi] += learnThreshold * attention * (s._states[hi] - sparsity);
+	}
+}
+
+namespace {
+	void savePool(CheckpointWriter &writer, const RSDR::ConnectionPool &pool) {
+		writer.writeArray(pool._offsets);
+		writer.writeArray(pool._weights);
+		writer.writeArray(pool._shortIndices);
+		writer.writeArray(pool._longIndices);
+	}
+
+	// Fails unless the pool has a row for each of numHidden nodes, and every index of the width chosen by longIndices addresses one of numTargets nodes.
+	// Pools that are not used (numHidden -1) must be empty
+	bool loadPool(CheckpointReader &reader, RSDR::ConnectionPool &pool, int numHidden, int numTargets, bool longIndices) {
+		reader.readArray(pool._offsets);
+		reader.readArray(pool._weights);
+		reader.readArray(pool._shortIndices);
+		reader.readArray(pool._longIndices);
+
+		if (numHidden < 0)
+			return reader.good() && pool._offsets.empty() && pool._weights.empty() && pool._shortIndices.empty() && pool._longIndices.empty();
+
+		if (!reader.good() || pool._offsets.size() != static_cast<size_t>(numHidden) + 1 || pool._offsets.front() != 0 || static_cast<size_t>(pool._offsets.back()) != pool._weights.size())
+			return false;
+
+		for (int hi = 0; hi < numHidden; hi++)
+			if (pool._offsets[hi + 1] < pool._offsets[hi])
+				return false;
+
+		if ((longIndices ? pool._longIndices.size() : pool._shortIndices.size()) != pool._weights.size() || !(longIndices ? pool._shortIndices.empty() : pool._longIndices.empty()))
+			return false;
+
+		for (size_t ci = 0; ci < pool._weights.size(); ci++)
+			if ((longIndices ? pool._longIndices[ci] : pool._shortIndices[ci]) >= static_cast<unsigned int>(numTargets))
+				return false;
+
+		return true;
+	}
+
+	void saveArrayState(CheckpointWriter &writer, const RSDR::ArrayState &state) {
+		writer.writeArray(state._visibleInputs);
+		writer.writeArray(state._visibleReconstructions);
+		writer.writeArray(state._excitations);
+		writer.writeArray(state._spikes);
+		writer.writeArray(state._spikesPrev);
+		writer.writeArray(state._states);
+		writer.writeArray(state._statesPrev);
+		writer.writeArray(state._activations);
+		writer.writeArray(state._reconstructions);
+	}
+
+	// Fails unless the state has numVisible visible and numHidden hidden values of every quantity
+	bool loadArrayState(CheckpointReader &reader, RSDR::ArrayState &state, int numVisible, int numHidden) {
+		reader.readArray(state._visibleInputs);
+		reader.readArray(state._visibleReconstructions);
+		reader.readArray(state._excitations);
+		reader.readArray(state._spikes);
+		reader.readArray(state._spikesPrev);
+		reader.readArray(state._states);
+		reader.readArray(state._statesPrev);
+		reader.readArray(state._activations);
+		reader.readArray(state._reconstructions);
+
+		size_t visibleSize = numVisible;
+		size_t hiddenSize = numHidden;
+
+		return reader.good() && state._visibleInputs.size() == visibleSize && state._visibleReconstructions.size() == visibleSize
+			&& state._excitations.size() == hiddenSize && state._spikes.size() == hiddenSize && state._spikesPrev.size() == hiddenSize
+			&& state._states.size() == hiddenSize && state._statesPrev.size() == hiddenSize && state._activations.size() == hiddenSize && state._reconstructions.size() == hiddenSize;
+	}
+}
+
+bool RSDR::save(const std::string &fileName) const {
+	return Checkpoint::saveToFile(*this, fileName);
+}
+
+bool RSDR::load(const std::string &fileName) {
+	return Checkpoint::loadFromFile(*this, fileName);
+}
+
+void RSDR::save(CheckpointWriter &writer) const {
+	writer.beginObject("sdr::RSDR", 1);
+
+	writer.write(_visibleWidth);
+	writer.write(_visibleHeight);
+	writer.write(_hiddenWidth);
+	writer.write(_hiddenHeight);
+	writer.write(_receptiveRadius);
+	writer.write(_inhibitionRadius);
+	writer.write(_recurrentRadius);
+	writer.write(_storage);
+	writer.write(_longIndices);
+	writer.write(_eventDrivenInhibition);
+
+	if (_storage == _nodes) {
+		int numHidden = getNumHidden();
+
+		writer.writeArray(_visible);
+
+		writer.writeLists(numHidden, [&](int i) -> const std::vector<ConnectionFeed> & { return _hidden[i]._feedForwardConnections; });
+		writer.writeLists(numHidden, [&](int i) -> const std::vector<ConnectionLateral> & { return _hidden[i]._lateralConnections; });
+		writer.writeLists(numHidden, [&](int i) -> const std::vector<ConnectionFeed> & { return _hidden[i]._recurrentConnections; });
+
+		writer.writeField(numHidden, [&](int i) { return _hidden[i]._threshold; });
+		writer.writeField(numHidden, [&](int i) { return _hidden[i]._excitation; });
+		writer.writeField(numHidden, [&](int i) { return _hidden[i]._spike; });
+		writer.writeField(numHidden, [&](int i) { return _hidden[i]._spikePrev; });
+		writer.writeField(numHidden, [&](int i) { return _hidden[i]._state; });
+		writer.writeField(numHidden, [&](int i) { return _hidden[i]._statePrev; });
+		writer.writeField(numHidden, [&](int i) { return _hidden[i]._activation; });
+		writer.writeField(numHidden, [&](int i) { return _hidden[i]._reconstruction; });
+	}
+	else {
+		// The lateral transpose is rebuilt on load
+		savePool(writer, _sharedWeights->_feedForwardPool);
+		savePool(writer, _sharedWeights->_lateralPool);
+		savePool(writer, _sharedWeights->_recurrentPool);
+
+		writer.writeArray(_sharedWeights->_feedForwardWeights);
+		writer.writeArray(_sharedWeights->_lateralWeights);
+		writer.writeArray(_sharedWeights->_recurrentWeights);
+		writer.writeArray(_sharedWeights->_thresholds);
+
+		saveArrayState(writer, _arrayState);
+	}
+}
+
+bool RSDR::load(CheckpointReader &reader) {
+	// Read into a fresh RSDR with this one's settings, so a failed load leaves this one unchanged
+	RSDR loaded;
+
+	loaded._threadPool = _threadPool;
+
+	if (!loaded.loadMembers(reader))
+		return false;
+
+	*this = std::move(loaded);
+
+	return true;
+}
+
+bool RSDR::loadMembers(CheckpointReader &reader) {
+	if (!reader.beginObject("sdr::RSDR", 1))
+		return false;
+
+	reader.read(_visibleWidth);
+	reader.read(_visibleHeight);
+	reader.read(_hiddenWidth);
+	reader.read(_hiddenHeight);
+	reader.read(_receptiveRadius);
+	reader.read(_inhibitionRadius);
+	reader.read(_recurrentRadius);
+
+	// Read as integers, an out of range enum value or a bool byte other than 0 or 1 is undefined
+	static_assert(sizeof(bool) == 1, "Checkpoints store bools as one byte");
+
+	int storage;
+	unsigned char longIndices;
+	unsigned char eventDrivenInhibition;
+
+	reader.read(storage);
+	reader.read(longIndices);
+	reader.read(eventDrivenInhibition);
+
+	// Everything read below is checked against these, so a malformed file fails instead of indexing out of bounds
+	if (!reader.good() || !Checkpoint::isValidArea(_visibleWidth, _visibleHeight) || !Checkpoint::isValidArea(_hiddenWidth, _hiddenHeight) || !reader.canHold(_hiddenWidth * _hiddenHeight)
+		|| !Checkpoint::isValidRadius(_receptiveRadius, 0) || !Checkpoint::isValidRadius(_inhibitionRadius, 0) || !Checkpoint::isValidRadius(_recurrentRadius, -1) || storage < _nodes || storage > _implicit || longIndices > 1 || eventDrivenInhibition > 1)
+		return false;
+
+	_storage = static_cast<Storage>(storage);
+	_longIndices = longIndices != 0;
+	_eventDrivenInhibition = eventDrivenInhibition != 0;
+
+	int numVisible = getNumVisible();
+	int numHidden = getNumHidden();
+
+	if (_storage == _nodes) {
+		reader.readArray(_visible);
+
+		_hidden.resize(numHidden);
+
+		reader.readConnectionLists(numHidden, numVisible, [&](int i) -> std::vector<ConnectionFeed> & { return _hidden[i]._feedForwardConnections; });
+		reader.readConnectionLists(numHidden, numHidden, [&](int i) -> std::vector<ConnectionLateral> & { return _hidden[i]._lateralConnections; });
+		reader.readConnectionLists(numHidden, numHidden, [&](int i) -> std::vector<ConnectionFeed> & { return _hidden[i]._recurrentConnections; });
+
+		reader.readField(numHidden, [&](int i) -> float & { return _hidden[i]._threshold; });
+		reader.readField(numHidden, [&](int i) -> float & { return _hidden[i]._excitation; });
+		reader.readField(numHidden, [&](int i) -> float & { return _hidden[i]._spike; });
+		reader.readField(numHidden, [&](int i) -> float & { return _hidden[i]._spikePrev; });
+		reader.readField(numHidden, [&](int i) -> float & { return _hidden[i]._state; });
+		reader.readField(numHidden, [&](int i) -> float & { return _hidden[i]._statePrev; });
+		reader.readField(numHidden, [&](int i) -> float & { return _hidden[i]._activation; });
+		reader.readField(numHidden, [&](int i) -> float & { return _hidden[i]._reconstruction; });
+
+		if (!reader.good() || _visible.size() != static_cast<size_t>(numVisible))
+			return false;
+	}
+	else {
+		// Only the pools or the blocks of the storage mode are used, the other ones must be empty
+		bool arrays = _storage == _arrays;
+
+		if (!loadPool(reader, _sharedWeights->_feedForwardPool, arrays ? numHidden : -1, numVisible, _longIndices)
+			|| !loadPool(reader, _sharedWeights->_lateralPool, arrays ? numHidden : -1, numHidden, _longIndices)
+			|| !loadPool(reader, _sharedWeights->_recurrentPool, arrays ? numHidden : -1, numHidden, _longIndices))
+			return false;
+
+		reader.readArray(_sharedWeights->_feedForwardWeights);
+		reader.readArray(_sharedWeights->_lateralWeights);
+		reader.readArray(_sharedWeights->_recurrentWeights);
+		reader.readArray(_sharedWeights->_thresholds);
+
+		if (!reader.good() || _sharedWeights->_thresholds.size() != static_cast<size_t>(numHidden)
+			|| !Checkpoint::isBlockSize(_sharedWeights->_feedForwardWeights.size(), numHidden, arrays ? -1 : _receptiveRadius)
+			|| !Checkpoint::isBlockSize(_sharedWeights->_lateralWeights.size(), numHidden, arrays ? -1 : _inhibitionRadius)
+			|| !Checkpoint::isBlockSize(_sharedWeights->_recurrentWeights.size(), numHidden, arrays ? -1 : _recurrentRadius))
+			return false;
+
+		if (!loadArrayState(reader, _arrayState, numVisible, numHidden))
+			return false;
+	}
+
+	if (_eventDrivenInhibition)
+		buildLateralTranspose();
+	else {
+		_spikingNodes.clear();
+		_inhibitions.clear();
+	}
+
+	return true;
 }
\ No newline at end of file
@@ -1,19 +1,33 @@
 #pragma once
 
+#include "ThreadPool.h"
+
 #include <vector>
+#include <string>
 #include <random>
+#include <memory>
+#include <algorithm>
 
 namespace sdr {
+	class CheckpointWriter;
+	class CheckpointReader;
+
 	class RSDR {
 	public:
+		// _nodes: one struct per node with its connection list. _arrays: contiguous arrays with index pools.
+		// _implicit: like _arrays, but no indices are stored. Every node has a dense (2r + 1)^2 weight block over its window, and the kernels walk the window directly
+		enum Storage {
+			_nodes, _arrays, _implicit
+		};
+
 		struct ConnectionFeed {
-			unsigned short _index;
+			int _index;
 
 			float _weight;
 		};
 
 		struct ConnectionLateral {
-			unsigned short _index;
+			int _index;
 
 			float _weight;
 		};
@@ -50,6 +64,37 @@ namespace sdr {
 			{}
 		};
 
+		// All connections of one kind, for all hidden nodes (compressed sparse rows). Connections of hidden node hi are [_offsets[hi], _offsets[hi + 1])
+		struct ConnectionPool {
+			std::vector<int> _offsets;
+			std::vector<float> _weights;
+
+			// Only one of these is filled: 16-bit indices when all layers fit in them (smaller cache footprint), 32-bit otherwise
+			std::vector<unsigned short> _shortIndices;
+			std::vector<unsigned int> _longIndices;
+
+			template<typename IndexType>
+			const IndexType* getIndices() const;
+
+			int getIndex(int ci) const {
+				return _longIndices.empty() ? _shortIndices[ci] : _longIndices[ci];
+			}
+		};
+
+		// Node states for _arrays and _implicit storage, one contiguous array per quantity
+		struct ArrayState {
+			std::vector<float> _visibleInputs;
+			std::vector<float> _visibleReconstructions;
+
+			std::vector<float> _excitations;
+			std::vector<float> _spikes;
+			std::vector<float> _spikesPrev;
+			std::vector<float> _states;
+			std::vector<float> _statesPrev;
+			std::vector<float> _activations;
+			std::vector<float> _reconstructions;
+		};
+
 	private:
 		int _visibleWidth, _visibleHeight;
 		int _hiddenWidth, _hiddenHeight;
@@ -57,15 +102,128 @@ namespace sdr {
 		int _inhibitionRadius;
 		int _recurrentRadius;
 
+		Storage _storage;
+
+		// _nodes storage
 		std::vector<VisibleNode> _visible;
 		std::vector<HiddenNode> _hidden;
 
+		// Learned weights of _arrays and _implicit storage. Copies of the RSDR share them, so forking a network only copies the node states.
+		// Learning and other writes clone them first if they are shared
+		struct SharedWeights {
+			// _arrays storage
+			ConnectionPool _feedForwardPool;
+			ConnectionPool _lateralPool;
+			ConnectionPool _recurrentPool;
+
+			// _implicit storage. Row-major blocks of (2r + 1)^2 weights per hidden node. Entries outside the layer, and a node's own entry in the lateral and recurrent blocks, stay 0
+			std::vector<float> _feedForwardWeights;
+			std::vector<float> _lateralWeights;
+			std::vector<float> _recurrentWeights;
+
+			// _arrays and _implicit storage
+			std::vector<float> _thresholds;
+
+			// For event-driven inhibition. For every node, the (target node, connection) pairs of the lateral connections that read its spike
+			std::vector<int> _lateralTransposeOffsets;
+			std::vector<int> _lateralTransposeTargets;
+			std::vector<int> _lateralTransposeConnections;
+		};
+
+		// Whether the pools use 32-bit indices, chosen in createRandom from the layer sizes
+		bool _longIndices;
+
+		std::shared_ptr<SharedWeights> _sharedWeights;
+
+		ArrayState _arrayState;
+
+		std::shared_ptr<ThreadPool> _threadPool;
+
+		bool _eventDrivenInhibition;
+
+		std::vector<int> _spikingNodes;
+		std::vector<float> _inhibitions;
+
+		// Clones the weights if another copy still shares them
+		void makeWeightsUnique();
+
+		void buildLateralTranspose();
+		void scatterInhibition();
+		void findSpikingNodes();
+
+		// Calls func(begin, end) on ranges of hidden nodes, in parallel if there is a thread pool
+		void forEachTile(const std::function<void(int, int)> &func);
+
+		// Kernels run on numStreams states at once (the member state for single stream stepping). pMeasured receives the measured states per stream instead of _states if not nullptr
+		void excite(int begin, int end, ArrayState* pStreams, int numStreams);
+		void settle(int subIterSettle, int subIterMeasure, float leak, ArrayState* pStreams, int numStreams, std::vector<float>* pMeasured);
+		void inhibitStep(int begin, int end, float leak, bool measure, float subIterMeasureInv, bool eventDriven, ArrayState* pStreams, int numStreams, std::vector<float>* pMeasured);
+		void learnRange(int begin, int end, const std::vector<float>* pAttentions, float learnFeedForward, float learnRecurrent, float learnLateral, float learnThreshold, float sparsity);
+
+		// Clips the window [center - radius, center + radius] to [0, size), as offsets from center
+		static void clipWindow(int center, int radius, int size, int &dMin, int &dMax) {
+			dMin = std::max(-radius, -center);
+			dMax = std::min(radius, size - 1 - center);
+		}
+
+		// Number of nodes of the window around (centerX, centerY) that lie inside a width x height layer
+		static int getWindowArea(int centerX, int centerY, int radius, int width, int height) {
+			int dxMin, dxMax, dyMin, dyMax;
+
+			clipWindow(centerX, radius, width, dxMin, dxMax);
+			clipWindow(centerY, radius, height, dyMin, dyMax);
+
+			return std::max(0, dxMax - dxMin + 1) * std::max(0, dyMax - dyMin + 1);
+		}
+
+		// Reserves the indices and weights of a pool whose offsets are set, for createRandom
+		void reservePool(ConnectionPool &pool) const {
+			if (_longIndices)
+				pool._longIndices.reserve(pool._offsets.back());
+			else
+				pool._shortIndices.reserve(pool._offsets.back());
+
+			pool._weights.reserve(pool._offsets.back());
+		}
+
+		// Appends a connection to a pool, for createRandom
+		void addPoolConnection(ConnectionPool &pool, int index, float weight) const {
+			if (_longIndices)
+				pool._longIndices.push_back(index);
+			else
+				pool._shortIndices.push_back(index);
+
+			pool._weights.push_back(weight);
+		}
+
+		void getReceptiveCenter(int hi, int &centerX, int &centerY) const;
+
+		void exciteImplicit(int begin, int end, ArrayState* pStreams, int numStreams);
+		void inhibitStepImplicit(int begin, int end, float leak, bool measure, float subIterMeasureInv, bool eventDriven, ArrayState* pStreams, int numStreams, std::vector<float>* pMeasured);
+		void learnRangeImplicit(int begin, int end, const std::vector<float>* pAttentions, float learnFeedForward, float learnRecurrent, float learnLateral, float learnThreshold, float sparsity);
+
+		template<typename IndexType>
+		void exciteArrays(int begin, int end, ArrayState* pStreams, int numStreams);
+
+		template<typename IndexType>
+		void inhibitStepArrays(int begin, int end, float leak, bool measure, float subIterMeasureInv, bool eventDriven, ArrayState* pStreams, int numStreams, std::vector<float>* pMeasured);
+
+		template<typename IndexType>
+		void learnRangeArrays(int begin, int end, const std::vector<float>* pAttentions, float learnFeedForward, float learnRecurrent, float learnLateral, float learnThreshold, float sparsity);
+
+		// The body of load, run on a freshly constructed object
+		bool loadMembers(CheckpointReader &reader);
+
 	public:
 		static float sigmoid(float x) {
 			return 1.0f / (1.0f + std::exp(-x));
 		}
 
-		void createRandom(int visibleWidth, int visibleHeight, int hiddenWidth, int hiddenHeight, int receptiveRadius, int inhibitionRadius, int recurrentRadius, float initMinWeight, float initMaxWeight, float initMinInhibition, float initMaxInhibition, float initThreshold, std::mt19937 &generator);
+		RSDR()
+			: _visibleWidth(0), _visibleHeight(0), _hiddenWidth(0), _hiddenHeight(0), _receptiveRadius(0), _inhibitionRadius(0), _recurrentRadius(-1), _storage(_nodes), _longIndices(false), _sharedWeights(std::make_shared<SharedWeights>()), _eventDrivenInhibition(false)
+		{}
+
+		void createRandom(int visibleWidth, int visibleHeight, int hiddenWidth, int hiddenHeight, int receptiveRadius, int inhibitionRadius, int recurrentRadius, float initMinWeight, float initMaxWeight, float initMinInhibition, float initMaxInhibition, float initThreshold, std::mt19937 &generator, Storage storage = _nodes);
 
 		void activate(int subIterSettle, int subIterMeasure, float leak);
 		void inhibit(int subIterSettle, int subIterMeasure, float leak, const std::vector<float> &activations, std::vector<float> &states);
@@ -73,54 +231,108 @@ namespace sdr {
 		void learn(const std::vector<float> &attentions, float learnFeedForward, float learnRecurrent, float learnLateral, float learnThreshold, float sparsity);
 		void stepEnd();
 
+		// Copying an RSDR with _arrays or _implicit storage shares the weights with the copy (see SharedWeights), so a forked rollout costs O(nodes).
+		// With _nodes storage the copy is deep. Copies that share weights may step on different threads, but must not learn concurrently: the check for other owners is not synchronised with them
+
+		// Batched inference for independent streams that share the weights, with _arrays or _implicit storage. Each stream is an ArrayState set up by initStream.
+		// Every weight row is loaded once for all streams. Results per stream are identical to single stream stepping
+		void initStream(ArrayState &stream) const;
+		void activate(std::vector<ArrayState> &streams, int subIterSettle, int subIterMeasure, float leak);
+		void inhibit(std::vector<ArrayState> &streams, int subIterSettle, int subIterMeasure, float leak, const std::vector<std::vector<float>> &activations, std::vector<std::vector<float>> &states);
+		void stepEnd(std::vector<ArrayState> &streams);
+
+		// Projects hidden states back onto the visible layer through the feed-forward weights
+		void reconstructFeedForward(const std::vector<float> &states, std::vector<float> &recon) const;
+
+		// Binary checkpoint of weights and states (see Checkpoint.h). The thread pool is not stored. load returns false if the file holds no RSDR, and then leaves this one unchanged
+		bool save(const std::string &fileName) const;
+		bool load(const std::string &fileName);
+
+		void save(CheckpointWriter &writer) const;
+		bool load(CheckpointReader &reader);
+
+		// Tiles of hidden rows are processed in parallel on the pool. Results are identical to the serial path. Pass nullptr to go back to serial.
+		// Do not step the RSDR from a task of the same pool (see ThreadPool)
+		void setThreadPool(const std::shared_ptr<ThreadPool> &threadPool) {
+			_threadPool = threadPool;
+		}
+
+		const std::shared_ptr<ThreadPool> &getThreadPool() const {
+			return _threadPool;
+		}
+
+		// Instead of every node summing over all its lateral connections, only the nodes that spiked in the previous sub-iteration scatter their inhibition. Results are identical
+		void setEventDrivenInhibition(bool eventDrivenInhibition);
+
+		bool getEventDrivenInhibition() const {
+			return _eventDrivenInhibition;
+		}
+
+		bool getLongIndices() const {
+			return _longIndices;
+		}
+
 		void setVisibleState(int index, float value) {
-			_visible[index]._input = value;
+			if (_storage != _nodes)
+				_arrayState._visibleInputs[index] = value;
+			else
+				_visible[index]._input = value;
 		}
 
 		void setVisibleState(int x, int y, float value) {
-			_visible[x + y * _visibleWidth]._input = value;
+			setVisibleState(x + y * _visibleWidth, value);
 		}
 
+		// Whole frames at once. With _arrays and _implicit storage these are plain copies
+		void setVisibleStates(const float* pStates, size_t count);
+
+		// Visible states from the hidden states of the layer below
+		void setVisibleStatesFromHidden(const RSDR &source);
+
+		// getNumHidden() values
+		void getHiddenStates(float* pStates) const;
+
 		float getVisibleRecon(int index) const {
-			return _visible[index]._reconstruction;
+			return _storage != _nodes ? _arrayState._visibleReconstructions[index] : _visible[index]._reconstruction;
 		}
 
 		float getVisibleRecon(int x, int y) const {
-			return _visible[x + y * _visibleWidth]._reconstruction;
+			return getVisibleRecon(x + y * _visibleWidth);
 		}
 
 		float getVisibleState(int index) const {
-			return _visible[index]._input;
+			return _storage != _nodes ? _arrayState._visibleInputs[index] : _visible[index]._input;
 		}
 
 		float getVisibleState(int x, int y) const {
-			return _visible[x + y * _visibleWidth]._input;
+			return getVisibleState(x + y * _visibleWidth);
 		}
 
 		float getHiddenState(int index) const {
-			return _hidden[index]._state;
+			return _storage != _nodes ? _arrayState._states[index] : _hidden[index]._state;
 		}
 
 		float getHiddenState(int x, int y) const {
-			return _hidden[x + y * _hiddenWidth]._state;
+			return getHiddenState(x + y * _hiddenWidth);
 		}
 
 		float getHiddenActivation(int index) const {
-			return _hidden[index]._activation;
+			return _storage != _nodes ? _arrayState._activations[index] : _hidden[index]._activation;
 		}
 
 		float getHiddenActivation(int x, int y) const {
-			return _hidden[x + y * _hiddenWidth]._activation;
+			return getHiddenActivation(x + y * _hiddenWidth);
 		}
 
 		float getHiddenStatePrev(int index) const {
-			return _hidden[index]._statePrev;
+			return _storage != _nodes ? _arrayState._statesPrev[index] : _hidden[index]._statePrev;
 		}
 
 		float getHiddenStatePrev(int x, int y) const {
-			return _hidden[x + y * _hiddenWidth]._statePrev;
+			return getHiddenStatePrev(x + y * _hiddenWidth);
 		}
 
+		// Only available with _nodes storage
 		HiddenNode &getHiddenNode(int index) {
 			return _hidden[index];
 		}
@@ -129,12 +341,21 @@ namespace sdr {
 			return _hidden[x + y * _hiddenWidth];
 		}
 
+		// Only available with _arrays and _implicit storage
+		const ArrayState &getArrayState() const {
+			return _arrayState;
+		}
+
+		Storage getStorage() const {
+			return _storage;
+		}
+
 		int getNumVisible() const {
-			return _visible.size();
+			return _visibleWidth * _visibleHeight;
 		}
 
 		int getNumHidden() const {
-			return _hidden.size();
+			return _hiddenWidth * _hiddenHeight;
 		}
 
 		int getVisibleWidth() const {
@@ -161,16 +382,25 @@ namespace sdr {
 			return _inhibitionRadius;
 		}
 
-		float getVHWeight(int hi, int ci) const {
-			return _hidden[hi]._feedForwardConnections[ci]._weight;
-		}
+		// ci counts the connections that lie inside the visible layer, column by column
+		float getVHWeight(int hi, int ci) const;
 
 		float getVHWeight(int hx, int hy, int ci) const {
-			return _hidden[hx + hy * _hiddenWidth]._feedForwardConnections[ci]._weight;
+			return getVHWeight(hx + hy * _hiddenWidth, ci);
 		}
 
 		void getVHWeights(int hx, int hy, std::vector<float> &rectangle) const;
 
 		friend class HTSL;
 	};
+
+	template<>
+	inline const unsigned short* RSDR::ConnectionPool::getIndices<unsigned short>() const {
+		return _shortIndices.data();
+	}
+
+	template<>
+	inline const unsigned int* RSDR::ConnectionPool::getIndices<unsigned int>() const {
+		return _longIndices.data();
+	}
 }
\ No newline at end of file
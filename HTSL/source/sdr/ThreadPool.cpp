@@ -0,0 +1,105 @@
+#include "ThreadPool.h"
+
+#include <assert.h>
+
+using namespace sdr;
+
+namespace {
+	// The pool whose task the current thread is running, to catch nested run() calls
+	thread_local const ThreadPool* pRunningPool = nullptr;
+}
+
+ThreadPool::ThreadPool(int numThreads)
+	: _pTask(nullptr), _numTasks(0), _nextTask(0), _numWorkersActive(0), _generation(0), _stop(false)
+{
+	for (int t = 1; t < numThreads; t++)
+		_workers.push_back(std::thread(&ThreadPool::workerLoop, this));
+}
+
+ThreadPool::~ThreadPool() {
+	{
+		std::lock_guard<std::mutex> lock(_mutex);
+
+		_stop = true;
+	}
+
+	_workAvailable.notify_all();
+
+	for (size_t t = 0; t < _workers.size(); t++)
+		_workers[t].join();
+}
+
+void ThreadPool::run(int numTasks, const std::function<void(int)> &task) {
+	assert(pRunningPool != this && "ThreadPool::run called from one of its own tasks");
+
+	if (_workers.empty() || numTasks <= 1) {
+		for (int t = 0; t < numTasks; t++)
+			runTask(t, task);
+
+		return;
+	}
+
+	// The task and counters below belong to one run() at a time
+	std::lock_guard<std::mutex> runLock(_runMutex);
+
+	{
+		std::lock_guard<std::mutex> lock(_mutex);
+
+		_pTask = &task;
+		_numTasks = numTasks;
+		_nextTask = 0;
+		_numWorkersActive = static_cast<int>(_workers.size());
+		_generation++;
+	}
+
+	_workAvailable.notify_all();
+
+	runTasks();
+
+	std::unique_lock<std::mutex> lock(_mutex);
+
+	_workDone.wait(lock, [this] { return _numWorkersActive == 0; });
+
+	_pTask = nullptr;
+}
+
+void ThreadPool::workerLoop() {
+	unsigned long generation = 0;
+
+	for (;;) {
+		{
+			std::unique_lock<std::mutex> lock(_mutex);
+
+			_workAvailable.wait(lock, [this, generation] { return _stop || _generation != generation; });
+
+			if (_stop)
+				return;
+
+			generation = _generation;
+		}
+
+		runTasks();
+
+		{
+			std::lock_guard<std::mutex> lock(_mutex);
+
+			if (--_numWorkersActive == 0)
+				_workDone.notify_one();
+		}
+	}
+}
+
+void ThreadPool::runTasks() {
+	for (int t = _nextTask++; t < _numTasks; t = _nextTask++)
+		runTask(t, *_pTask);
+}
+
+void ThreadPool::runTask(int t, const std::function<void(int)> &task) {
+	const ThreadPool* pOuterPool = pRunningPool;
+
+	pRunningPool = this;
+
+	task(t);
+
+	pRunningPool = pOuterPool;
+}
\ No newline at end of file
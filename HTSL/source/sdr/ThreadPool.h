@@ -0,0 +1,46 @@
+#pragma once
+
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <functional>
+
+namespace sdr {
+	// Persistent worker threads. run() hands out task indices to the workers and the calling thread, and returns once all tasks are done, so every call is also a barrier.
+	// Tasks must not call run() on the pool that runs them, that would deadlock. Debug builds assert against it.
+	// Several threads may share a pool, their run() calls take turns
+	class ThreadPool {
+	private:
+		std::vector<std::thread> _workers;
+
+		std::mutex _runMutex; // Held by the run() call that owns the workers
+		std::mutex _mutex;
+		std::condition_variable _workAvailable;
+		std::condition_variable _workDone;
+
+		const std::function<void(int)>* _pTask;
+		int _numTasks;
+		std::atomic<int> _nextTask;
+
+		int _numWorkersActive;
+		unsigned long _generation;
+		bool _stop;
+
+		void workerLoop();
+		void runTasks();
+		void runTask(int t, const std::function<void(int)> &task);
+
+	public:
+		// Total number of threads, including the calling thread
+		ThreadPool(int numThreads = std::thread::hardware_concurrency());
+		~ThreadPool();
+
+		void run(int numTasks, const std::function<void(int)> &task);
+
+		int getNumThreads() const {
+			return static_cast<int>(_workers.size()) + 1;
+		}
+	};
+}
\ No newline at end of file
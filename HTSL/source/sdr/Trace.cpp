@@ -0,0 +1,149 @@
+#include "Trace.h"
+
+#include <map>
+#include <algorithm>
+#include <mutex>
+#include <thread>
+#include <fstream>
+#include <iomanip>
+#include <cstring>
+
+using namespace sdr;
+
+const size_t Trace::_maxEvents;
+
+namespace {
+	struct Event {
+		const char* _name;
+		int _layer;
+
+		std::chrono::steady_clock::time_point _begin, _end;
+
+		std::thread::id _thread;
+	};
+
+	struct PhaseKey {
+		const char* _name;
+		int _layer;
+
+		bool operator<(const PhaseKey &other) const {
+			int order = std::strcmp(_name, other._name);
+
+			return order < 0 || (order == 0 && _layer < other._layer);
+		}
+	};
+
+	struct PhaseTotal {
+		long long _calls;
+		std::chrono::steady_clock::duration _total;
+
+		PhaseTotal()
+			: _calls(0), _total(0)
+		{}
+	};
+
+	std::mutex _mutex;
+	std::vector<Event> _events;
+	std::map<PhaseKey, PhaseTotal> _totals;
+}
+
+void Trace::record(const char* name, int layer, std::chrono::steady_clock::time_point begin, std::chrono::steady_clock::time_point end) {
+	std::lock_guard<std::mutex> lock(_mutex);
+
+	PhaseKey key = { name, layer };
+
+	PhaseTotal &total = _totals[key];
+
+	total._calls++;
+	total._total += end - begin;
+
+	// All at once, so that recording does not allocate as the trace grows
+	if (_events.capacity() < _maxEvents)
+		_events.reserve(_maxEvents);
+
+	if (_events.size() < _maxEvents) {
+		Event event = { name, layer, begin, end, std::this_thread::get_id() };
+
+		_events.push_back(event);
+	}
+}
+
+void Trace::clear() {
+	std::lock_guard<std::mutex> lock(_mutex);
+
+	_events.clear();
+	_totals.clear();
+}
+
+std::vector<Trace::PhaseStats> Trace::getPhaseStats() {
+	std::lock_guard<std::mutex> lock(_mutex);
+
+	std::vector<PhaseStats> stats;
+
+	for (std::map<PhaseKey, PhaseTotal>::const_iterator it = _totals.begin(); it != _totals.end(); it++) {
+		PhaseStats phase;
+
+		phase._name = it->first._name;
+		phase._layer = it->first._layer;
+		phase._calls = it->second._calls;
+		phase._totalMilliseconds = std::chrono::duration<double, std::milli>(it->second._total).count();
+
+		stats.push_back(phase);
+	}
+
+	return stats;
+}
+
+void Trace::writeChromeTrace(std::ostream &os) {
+	std::lock_guard<std::mutex> lock(_mutex);
+
+	// Complete ("X") events with times in microseconds from the first event, and threads numbered in order of appearance
+	std::chrono::steady_clock::time_point start = _events.empty() ? std::chrono::steady_clock::time_point() : _events.front()._begin;
+
+	for (size_t e = 1; e < _events.size(); e++)
+		start = std::min(start, _events[e]._begin);
+
+	std::map<std::thread::id, int> threads;
+
+	// Fixed nanosecond resolution. The default 6 significant digits lose microseconds once a trace runs longer than a second
+	std::ios::fmtflags flags = os.flags();
+	std::streamsize precision = os.precision();
+
+	os << std::fixed << std::setprecision(3);
+
+	os << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[";
+
+	for (size_t e = 0; e < _events.size(); e++) {
+		const Event &event = _events[e];
+
+		std::map<std::thread::id, int>::const_iterator it = threads.find(event._thread);
+
+		int thread;
+
+		if (it == threads.end()) {
+			thread = threads.size();
+
+			threads[event._thread] = thread;
+		}
+		else
+			thread = it->second;
+
+		os << (e == 0 ? "\n" : ",\n") << "{\"name\":\"" << event._name << "\",\"cat\":\"htsl\",\"ph\":\"X\",\"pid\":0,\"tid\":" << thread
+			<< ",\"ts\":" << std::chrono::duration<double, std::micro>(event._begin - start).count()
+			<< ",\"dur\":" << std::chrono::duration<double, std::micro>(event._end - event._begin).count()
+			<< ",\"args\":{\"layer\":" << event._layer << "}}";
+	}
+
+	os << "\n]}\n";
+
+	os.flags(flags);
+	os.precision(precision);
+}
+
+bool Trace::saveChromeTrace(const std::string &fileName) {
+	std::ofstream os(fileName);
+
+	writeChromeTrace(os);
+
+	return os.good();
+}
\ No newline at end of file
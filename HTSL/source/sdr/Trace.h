@@ -0,0 +1,61 @@
+#pragma once
+
+#include <vector>
+#include <string>
+#include <ostream>
+#include <chrono>
+
+namespace sdr {
+	// Wall time and call counts of the phases of simulation steps (activate, predict, learn, stepEnd), per layer. Exports Chrome trace JSON for chrome://tracing or ui.perfetto.dev.
+	// Phases are only recorded when HTSL_TRACE is defined (CMake option HTSL_TRACE), otherwise HTSL_TRACE_SCOPE expands to nothing
+	class Trace {
+	public:
+		// Total of one phase of one layer. Layer -1 is the whole step or work outside the layers
+		struct PhaseStats {
+			std::string _name;
+			int _layer;
+			long long _calls;
+			double _totalMilliseconds;
+		};
+
+		// Events past this are still added to the stats, but not kept for the trace
+		static const size_t _maxEvents = 1 << 20;
+
+		// Thread safe. name must be a string literal. Only the first record (the event buffer) and the first of each phase and layer allocate, so warmed-up steps record without allocating
+		static void record(const char* name, int layer, std::chrono::steady_clock::time_point begin, std::chrono::steady_clock::time_point end);
+
+		static void clear();
+
+		// Sorted by name, then layer
+		static std::vector<PhaseStats> getPhaseStats();
+
+		static void writeChromeTrace(std::ostream &os);
+		static bool saveChromeTrace(const std::string &fileName);
+	};
+
+	// Records the time from construction to destruction
+	class TraceScope {
+	private:
+		const char* _name;
+		int _layer;
+
+		std::chrono::steady_clock::time_point _begin;
+
+	public:
+		TraceScope(const char* name, int layer)
+			: _name(name), _layer(layer), _begin(std::chrono::steady_clock::now())
+		{}
+
+		~TraceScope() {
+			Trace::record(_name, _layer, _begin, std::chrono::steady_clock::now());
+		}
+	};
+}
+
+#ifdef HTSL_TRACE
+#define HTSL_TRACE_CONCAT_INNER(a, b) a##b
+#define HTSL_TRACE_CONCAT(a, b) HTSL_TRACE_CONCAT_INNER(a, b)
+#define HTSL_TRACE_SCOPE(name, layer) sdr::TraceScope HTSL_TRACE_CONCAT(traceScope, __LINE__)(name, layer)
+#else
+#define HTSL_TRACE_SCOPE(name, layer)
+#endif
\ No newline at end of file